@@ -25,6 +25,7 @@
 #include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
 #include <sstream>
+#include <vector>
 
 class GcInfoAllocator;
 class GcInfoEncoder;
@@ -118,6 +119,9 @@ public:
   uint32_t PSPSymOffset;
   bool HasFunclets;
 
+  // Size of the outgoing argument and scratch area, in bytes.
+  uint32_t OutgoingAreaSize;
+
 private:
   // Record a Stack Allocation in the FuncInfo, with appropriate
   // Flags based on Type of allocation.
@@ -130,6 +134,44 @@ private:
   void markNonGcAlloca(const llvm::AllocaInst *Alloca, AllocaFlags Flags);
 };
 
+/// \brief Method-level facts encoded in the GcInfo header.
+
+struct GcInfoHeader {
+  bool HasFunclets;
+  uint32_t PSPSymOffset;
+  bool IsFPBased;
+  bool IsVarArg;
+  uint32_t CodeLength;
+  uint32_t OutgoingAreaSize;
+};
+
+/// \brief A stack slot defined in the GcInfo.
+struct GcSlotRecord {
+  int32_t Offset; ///< SP-relative offset of the slot.
+  uint32_t Flags; ///< GcSlotFlags of the slot.
+};
+
+/// \brief A change in the liveness of a tracked slot.
+struct GcSlotStateRecord {
+  uint32_t CodeOffset; ///< Offset of the call where the state changes.
+  uint32_t SlotID;     ///< The slot, as numbered by the encoder.
+  uint32_t State;      ///< GcSlotState of the slot from here on.
+};
+
+/// \brief Everything that was passed to the GcInfoEncoder for a method.
+///
+/// The emitted GcInfo depends on nothing else, so this is enough to emit
+/// it again without the method's IR, stackmaps or code.
+
+struct GcInfoRecord {
+  GcInfoHeader Header;
+  bool ReportsPointers = false; ///< False if only the header was encoded.
+  std::vector<GcSlotRecord> Slots; ///< Slot definitions, in slot ID order.
+  std::vector<GcSlotStateRecord> SlotStates;
+  std::vector<uint32_t> CallSites;    ///< Offsets of the calls.
+  std::vector<uint8_t> CallSiteSizes; ///< Sizes of the calls.
+};
+
 /// \brief Per Module / Jit Invocation GcInfo
 // GcFuncInfo Map for all functions in a Module.
 
@@ -173,18 +215,35 @@ public:
   /// \param StackMapData A pointer to the .llvm_stackmaps section
   ///        loaded in memory
   /// \param Allocator The allocator to be used by GcInfo encoder
+  /// \param HotCode The method's code, used to find the size of the call
+  ///        instructions at safepoints; nullptr if there are no safepoints
   GcInfoEmitter(LLILCJitContext *JitCtx, uint8_t *StackMapData,
-                GcInfoAllocator *Allocator);
+                GcInfoAllocator *Allocator, const uint8_t *HotCode = nullptr);
 
   /// Emit GC Info to the EE using GcInfoEncoder.
   void emitGCInfo();
 
+  /// Emit GC Info again from a record of an earlier encoding.
+  /// \param Record The record, as returned by getEmittedRecord.
+  void emitGCInfo(const GcInfoRecord &Record);
+
+  /// \brief Get the record of the GC Info emitted by emitGCInfo().
+  ///
+  /// \param Record [out] Everything encoded in the emitted GC Info.
+  /// \returns false unless exactly one function's GC Info was emitted.
+  bool getEmittedRecord(GcInfoRecord &Record);
+
   /// Destructor -- delete allocated memory
   ~GcInfoEmitter();
 
 private:
   void emitGCInfo(const GcFuncInfo *GcFuncInfo);
   void encodeHeader(const GcFuncInfo *GcFuncInfo);
+  void encodeHeader(const GcInfoHeader &Header);
+  void getHeader(const GcFuncInfo *GcFuncInfo, GcInfoHeader &Header);
+  uint32_t getCodeLength();
+  void computeCallSiteSizes();
+  uint8_t getCallSiteSize(uint32_t ReturnOffset);
   void encodeTrackedPointers(const GcFuncInfo *GcFuncInfo);
   void encodeUntrackedPointers(const GcFuncInfo *GcFuncInfo);
   void encodeGcAggregate(const llvm::AllocaInst *Alloca,
@@ -201,11 +260,17 @@ private:
   GcSlotId getTrackedSlot(int32_t Offset);
   GcSlotId getUntrackedSlot(int32_t Offset, bool IsPinned = false,
                             bool IsObjectRef = false);
+  void setSlotState(uint32_t CodeOffset, GcSlotId SlotID, GcSlotState State);
 
   const LLILCJitContext *JitContext;
   const uint8_t *LLVMStackMapData;
+  const uint8_t *HotCode;
   GcInfoEncoder Encoder;
 
+  // Offset just past each call instruction in the code to the size of the
+  // call, as decoded from the code.
+  llvm::DenseMap<uint32_t, uint8_t> CallSiteSizeMap;
+
   // Offset to SlotID Map
   // Currently, the base pointer for all slots is the current function's SP.
   // If this changes, we need to change SlotMap
@@ -225,6 +290,11 @@ private:
   GcSlotId FirstTrackedSlot;
   size_t NumTrackedSlots;
 
+  // Everything passed to the Encoder, and the number of functions whose
+  // GC Info was emitted.
+  GcInfoRecord Emitted;
+  uint32_t NumEmitted;
+
 #if !defined(NDEBUG)
   bool EmitLogs;
   std::ostringstream SlotStream;
@@ -217,23 +217,20 @@ public:
   virtual void Free(void *p) = 0;
 };
 
+class ReaderArena;
+
+// Allocates from an arena when given one, so that the encoder's many small
+// allocations are freed all at once with the arena; otherwise from the heap.
 class GcInfoAllocator : public IAllocator {
   static int ZeroLengthAlloc;
+  ReaderArena *Arena;
 
 public:
-  void *Alloc(size_t sz) {
-    if (sz == 0) {
-      return (void *)(&ZeroLengthAlloc);
-    }
+  GcInfoAllocator(ReaderArena *Arena = nullptr) : Arena(Arena) {}
 
-    return ::operator new(sz);
-  }
+  void *Alloc(size_t sz);
 
-  virtual void Free(void *p) {
-    if (p != (void *)(&ZeroLengthAlloc)) {
-      ::operator delete(p);
-    }
-  }
+  virtual void Free(void *p);
 };
 
 //*****************************************************************************
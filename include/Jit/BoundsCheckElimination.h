@@ -0,0 +1,38 @@
+//===---- include/Jit/BoundsCheckElimination.h ------------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Declaration of the array bounds check elimination pass.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef BOUNDS_CHECK_ELIMINATION_H
+#define BOUNDS_CHECK_ELIMINATION_H
+
+namespace llvm {
+class FunctionPass;
+}
+
+/// \brief Get the name of the metadata on the compares of bounds checks.
+///
+/// The reader puts this on the `icmp uge Index, Length` of each bounds check
+/// it emits, so that the pass can tell bounds checks from other compares.
+inline const char *getBoundsCheckMDName() { return "llilc.boundscheck"; }
+
+/// \brief Create a pass that removes array bounds checks.
+///
+/// Checks that scalar evolution proves always pass are removed outright.
+/// Then each innermost loop with checks of an index that steps by one
+/// against a loop-invariant length is versioned: a single test in front of
+/// the loop checks the index range the loop covers, and selects either the
+/// loop with those checks removed or a copy of the loop that keeps them.
+llvm::FunctionPass *createBoundsCheckEliminationPass();
+
+#endif // BOUNDS_CHECK_ELIMINATION_H
@@ -0,0 +1,181 @@
+//===---- include/Jit/CodeCache.h -------------------------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Declaration of the persistent cache of jitted code.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef CODE_CACHE_H
+#define CODE_CACHE_H
+
+#include "GcInfo.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+struct LLILCJitContext;
+
+/// \brief A relocation against jitted code, recorded in a form that can be
+/// replayed against a different code allocation.
+struct CodeCacheRelocation {
+  /// The places a relocation can refer to.
+  enum BlockKind : uint8_t {
+    HotCode = 0,      ///< Offset into the hot code block.
+    ReadOnlyData = 1, ///< Offset into the read-only data block.
+    JitHelper = 2     ///< A jit helper, identified by its CorInfoHelpFunc.
+  };
+
+  uint8_t FixupBlock;      ///< Block holding the fixup (never JitHelper).
+  uint8_t TargetBlock;     ///< Block the relocation refers to.
+  uint8_t IsIndirect;      ///< For helpers, true if the target is the
+                           ///< helper's indirection cell.
+  uint8_t Reserved;        ///< Padding, always zero.
+  uint32_t RelocationType; ///< EE relocation type.
+  uint32_t FixupOffset;    ///< Offset of the fixup within \p FixupBlock.
+  uint32_t Target;         ///< Offset within \p TargetBlock, or helper id.
+  int64_t Addend;          ///< Value added to the target address.
+};
+
+/// \brief Everything the EE was told about a jitted method, in a form that
+/// does not depend on the process that jitted it.
+struct CodeCacheEntry {
+  uint32_t CodeAlign = 0;   ///< Alignment of the hot code block.
+  uint32_t RODataAlign = 0; ///< Alignment of the read-only data block.
+  std::vector<uint8_t> HotCode;      ///< Hot code, with stale fixups.
+  std::vector<uint8_t> ReadOnlyData; ///< Read-only data, with stale fixups.
+  std::vector<uint8_t> Xdata;        ///< Unwind data, or empty if none.
+  std::vector<CodeCacheRelocation> Relocations; ///< Fixups to replay.
+  GcInfoRecord GcRecord;                        ///< Source of the GcInfo.
+  bool HasGcInfo = false; ///< True if GcRecord has been recorded.
+
+  /// \name Debug information
+  /// Native offsets are relative to the start of the hot code block.
+  //@{
+  std::vector<ICorDebugInfo::OffsetMapping> Boundaries;
+  std::vector<ICorDebugInfo::NativeVarInfo> Vars;
+  //@}
+
+  /// True if the debug info offsets were reported as addresses, rather
+  /// than as offsets from the start of the code.
+  bool HasAbsoluteDebugOffsets = false;
+
+  /// False if something was reported to the EE that cannot be replayed.
+  bool IsReplayable = true;
+};
+
+/// \brief The key of a cacheable jit request.
+struct CodeCacheKey {
+  std::string Key;  ///< Everything the method's code is derived from.
+  std::string Path; ///< The cache file for \p Key.
+};
+
+/// \brief Persistent, content-addressed cache of jitted code.
+///
+/// When the AltJitCodeCache config value names a directory, the final
+/// outputs of a jit request -- code, read-only data, relocations, unwind and
+/// EH data, GC info and debug info -- are saved in a file named by a hash of
+/// everything the code was derived from. A later process that jits the same
+/// method installs the saved outputs instead of reading the MSIL and running
+/// LLVM.
+///
+/// Cached code must be valid in any process that computes the same key, so
+/// only methods whose code depends on nothing but the key are cached. The
+/// key covers the IL and signature of the method, the JIT/EE interface
+/// version, the EE layout info, the jit flags and options, and the identity
+/// of the jit binary itself. The code of a method is cacheable only if it
+/// resolves no metadata tokens, has no value types or generics in its
+/// signature, and refers to nothing outside itself but jit helpers; helper
+/// addresses are bound again when a cached entry is installed.
+class LLILCCodeCache {
+public:
+  /// Get the process-wide code cache.
+  static LLILCCodeCache &get();
+
+  /// \brief Compute the cache key for a jit request.
+  ///
+  /// \param JitContext  Context record for the method's jit request.
+  /// \param Directory   The directory holding the cache files.
+  /// \param Key [out]   The key, if the request is eligible for caching.
+  /// \returns true if the request is eligible for caching.
+  bool computeKey(LLILCJitContext &JitContext, llvm::StringRef Directory,
+                  CodeCacheKey &Key);
+
+  /// \brief Try to satisfy a jit request from the cache.
+  ///
+  /// \param JitContext            Context record for the method's jit request.
+  /// \param Key                   The key computed for the request.
+  /// \param NativeEntry [out]     Address of the installed code.
+  /// \param NativeSizeOfCode [out] Length of the installed code.
+  /// \returns true if the code was installed from the cache.
+  bool install(LLILCJitContext &JitContext, const CodeCacheKey &Key,
+               BYTE **NativeEntry, ULONG *NativeSizeOfCode);
+
+  /// \brief Save the outputs of a completed jit request.
+  ///
+  /// \param JitContext Context record for the method's jit request.
+  /// \param Key        The key computed for the request.
+  /// \param Entry      The outputs recorded while jitting the method.
+  void store(LLILCJitContext &JitContext, const CodeCacheKey &Key,
+             const CodeCacheEntry &Entry);
+
+  /// Note a request whose code turned out not to be cacheable.
+  void noteUncacheable() { ++NumUncacheable; }
+
+  /// Print the cache counters to \p OS.
+  void printStatistics(llvm::raw_ostream &OS);
+
+private:
+  LLILCCodeCache();
+
+  /// \brief Decode a cache file.
+  /// \returns false if the file is malformed or was written for another key.
+  bool readEntry(llvm::StringRef Buffer, const std::string &Key,
+                 CodeCacheEntry &Entry);
+
+  /// \brief Check that \p Entry can be installed in this process.
+  ///
+  /// Nothing may be reported to the EE once installation starts unless it
+  /// is certain to finish, so everything that can fail is checked here.
+  ///
+  /// \param JitContext         Context record for the method's jit request.
+  /// \param Entry              The entry to check.
+  /// \param HelperTargets [out] The current address of each helper that
+  ///                           \p Entry refers to, by relocation index.
+  /// \returns true if the entry can be installed.
+  bool validateEntry(LLILCJitContext &JitContext, const CodeCacheEntry &Entry,
+                     std::vector<uint8_t *> &HelperTargets);
+
+  /// \brief Check that the GcInfoEncoder accepts a recorded encoding.
+  /// \returns true if \p Record can be emitted again.
+  bool validateGcRecord(const GcInfoRecord &Record);
+
+  /// Install the outputs in \p Entry as the code for the current method.
+  void installEntry(LLILCJitContext &JitContext, const CodeCacheEntry &Entry,
+                    const std::vector<uint8_t *> &HelperTargets,
+                    BYTE **NativeEntry, ULONG *NativeSizeOfCode);
+
+private:
+  /// Identity of the jit binary, so a rebuilt jit never sees stale code.
+  std::string JitIdentity;
+
+  /// \name Counters
+  //@{
+  std::atomic<uint32_t> NumHits;        ///< Requests installed from cache.
+  std::atomic<uint32_t> NumMisses;      ///< Eligible requests not found.
+  std::atomic<uint32_t> NumRejected;    ///< Entries found but unusable.
+  std::atomic<uint32_t> NumUncacheable; ///< Requests that cannot be cached.
+  std::atomic<uint32_t> NumStored;      ///< Entries written.
+  //@}
+};
+
+#endif // CODE_CACHE_H
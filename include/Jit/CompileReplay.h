@@ -0,0 +1,133 @@
+//===---- include/Jit/CompileReplay.h ---------------------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Declaration of the compile replay records and of the entry point
+/// that replays them.
+///
+/// When COMPlus_AltJitReplayRecord names a file, the jit appends to it a
+/// record of each method it reads: the IR the reader produced, as bitcode,
+/// and the flags and options the rest of the compile depends on. The jit's
+/// replayMethod export compiles such a record again without the EE, from
+/// the optimizer through code emission, which is what the replay driver in
+/// tools/Driver uses to benchmark the jit.
+///
+/// This header is shared with the driver, so apart from the recorder it
+/// only declares plain data that does not depend on the jit's headers.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef COMPILE_REPLAY_H
+#define COMPILE_REPLAY_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+struct LLILCJitContext;
+
+/// The first bytes of a replay file, followed by LLILCReplayVersion.
+static const char LLILCReplayMagic[8] = {'L', 'L', 'I', 'L',
+                                         'C', 'R', 'P', 'L'};
+
+/// Version of the replay file format. Records are in the byte order and
+/// layout of the host that wrote them.
+static const uint32_t LLILCReplayVersion = 1;
+
+/// Options of the recorded jit request that the replay depends on.
+enum LLILCReplayOption : uint8_t {
+  ReplayEnableOptimization = 1 << 0,   ///< Options::EnableOptimization.
+  ReplayUseConservativeGC = 1 << 1,    ///< Options::UseConservativeGC.
+  ReplayDoInsertStatepoints = 1 << 2,  ///< Options::DoInsertStatepoints.
+  ReplayDoDebugInfo = 1 << 3,          ///< Options::DoDebugInfo.
+  ReplayContainsUnmanagedCall = 1 << 4 ///< The reader saw an unmanaged call.
+};
+
+/// \brief The fixed part of a replay record.
+///
+/// It is followed by \p MethodNameSize bytes of method name and then
+/// \p BitcodeSize bytes of bitcode; \p RecordSize covers all three, so a
+/// reader can skip records without looking into them.
+struct LLILCReplayRecordHeader {
+  uint32_t RecordSize;     ///< Bytes of the record, this header included.
+  uint32_t Flags;          ///< CorJitFlags of the jit request.
+  uint32_t ILSize;         ///< Size of the method's MSIL in bytes.
+  uint32_t MethodNameSize; ///< Bytes of method name, without a terminator.
+  uint32_t BitcodeSize;    ///< Bytes of bitcode.
+  uint8_t OptLevel;        ///< The request's ::OptLevel.
+  uint8_t Options;         ///< LLILCReplayOption bits.
+  uint16_t Reserved;       ///< Zero.
+};
+
+/// Most phases a replay result can describe.
+static const unsigned LLILCReplayMaxPhases = 32;
+
+/// \brief The outcome of replaying one record.
+///
+/// The result names the phases itself, so that a driver can report on a jit
+/// built from another revision, which is the point of a regression
+/// benchmark.
+struct LLILCReplayResult {
+  uint32_t ObjectSize; ///< Bytes of the object file emitted, or 0 if the
+                       ///< record could not be compiled.
+  uint32_t NumPhases;  ///< Number of phases described below.
+  const char *PhaseNames[LLILCReplayMaxPhases]; ///< Name of each phase.
+  uint64_t PhaseMicroseconds[LLILCReplayMaxPhases]; ///< Time of each phase.
+};
+
+/// \brief Compile a replay record again.
+///
+/// Exported by the jit. getJit must have been called first; after that,
+/// records may be replayed concurrently on any number of threads, each
+/// using the thread's jit state as a jit request would.
+///
+/// \param Record     The record, starting with its LLILCReplayRecordHeader.
+/// \param RecordSize Bytes available at \p Record.
+/// \param Result     Where to put the outcome.
+/// \returns 1 if the record was compiled, 0 otherwise.
+typedef int (*LLILCReplayMethodFn)(const void *Record, size_t RecordSize,
+                                   LLILCReplayResult *Result);
+
+/// \brief Process-wide sink for replay records.
+///
+/// Records are appended, so the methods of several runs can be collected in
+/// one file; the file header is only written to a new file.
+class LLILCReplayRecorder {
+public:
+  /// Get the process-wide recorder.
+  static LLILCReplayRecorder &get();
+
+  /// \brief Open the file on first use.
+  ///
+  /// Later calls are ignored, so the file of the first jit request that
+  /// enables recording is used for the rest of the process.
+  ///
+  /// \param Path File to append records to.
+  /// \returns true if records can be written.
+  bool open(llvm::StringRef Path);
+
+  /// \brief Append a record of the method the reader has just read.
+  ///
+  /// \param Context               Context of the jit request.
+  /// \param ContainsUnmanagedCall True if the method calls unmanaged code.
+  void record(LLILCJitContext &Context, bool ContainsUnmanagedCall);
+
+private:
+  LLILCReplayRecorder() = default;
+
+  std::mutex Lock;                              ///< Serializes output.
+  bool IsOpen = false;                          ///< True once open succeeds.
+  bool IsOpenAttempted = false;                 ///< True once open is called.
+  std::unique_ptr<llvm::raw_fd_ostream> Output; ///< Where records go.
+};
+
+#endif // COMPILE_REPLAY_H
@@ -0,0 +1,201 @@
+//===---- include/Jit/CompileTelemetry.h ------------------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Declaration of the per-method compile time telemetry.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef COMPILE_TELEMETRY_H
+#define COMPILE_TELEMETRY_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// \brief The phases of a jit request that compile time is charged to.
+///
+/// Phases do not overlap: while a nested phase runs, the enclosing phase's
+/// clock is stopped. So the phase times of a method add up to its total.
+enum class CompilePhase : uint8_t {
+  Other,          ///< Anything not covered by another phase.
+  ReaderPrePass,  ///< GenIR set up of the function, before flow graph build.
+  FlowGraph,      ///< EH region tree and flow graph construction.
+  MSILToIR,       ///< The rest of the reader's translation of MSIL to IR.
+  FinallyCloning, ///< Copying finally bodies for their non-exception paths.
+  Verify,         ///< verifyModule on the reader's output.
+  Optimize,       ///< The mid-level IR optimization pipeline.
+  Statepoints,    ///< Safepoint placement and statepoint rewriting.
+  CodeEmission,   ///< Code generation and MC emission in LLILCCompiler.
+  Link,           ///< Loading the object with RuntimeDyld.
+  DebugInfo,      ///< Extracting and reporting debug info from the object.
+  GcInfo,         ///< GcInfoEmitter::emitGCInfo.
+  Count           ///< Number of phases; not a phase.
+};
+
+/// \brief A remark from the vectorizers about one loop or block.
+struct VectorizationRemark {
+  const char *Kind;    ///< "vectorized", "missed" or "analysis".
+  uint32_t ILOffset;   ///< IL offset the remark is for, or 0 if unknown.
+  std::string Message; ///< The vectorizer's message.
+};
+
+/// \brief Compile time telemetry for one jit request.
+struct CompileTelemetry {
+  typedef std::chrono::steady_clock Clock;
+
+  /// Start the clock, charging time to CompilePhase::Other.
+  CompileTelemetry();
+
+  /// \brief Switch the phase that elapsed time is charged to.
+  ///
+  /// \param Phase The phase to charge time to from now on.
+  /// \returns The phase that time was charged to until now.
+  CompilePhase enterPhase(CompilePhase Phase);
+
+  /// Stop the clock. Time can no longer be charged afterwards.
+  void finish();
+
+  /// Get the time charged to \p Phase, in microseconds.
+  uint64_t getPhaseMicroseconds(CompilePhase Phase) const {
+    return PhaseMicroseconds[static_cast<unsigned>(Phase)];
+  }
+
+  /// Get the sum of the phase times, in microseconds.
+  uint64_t getTotalMicroseconds() const;
+
+  /// Get the name of \p Phase, as used in the column names of the records.
+  static const char *getPhaseName(CompilePhase Phase);
+
+  std::string MethodName;           ///< Name of the method (for diagnostics).
+  const char *Outcome = "";         ///< How the request ended.
+  const char *OptLevel = "";        ///< Opt level the method was compiled at.
+  uint32_t ILSize = 0;              ///< Size of the method's MSIL in bytes.
+  uint32_t NativeSize = 0;          ///< Size of the reported code in bytes.
+  uint32_t BasicBlockCount = 0;     ///< Basic blocks in the reader's IR.
+  uint32_t VectorizedLoopCount = 0; ///< Loops the loop vectorizer changed.
+  uint32_t FinallyCopyCount = 0;    ///< Finally bodies copied for an exit.
+  uint32_t FinallyCopySize = 0;     ///< Instructions in those copies.
+  uint64_t ContextFootprint = 0;    ///< Estimated bytes held by the
+                                    ///< thread's LLVMContext after reading.
+  uint32_t StatepointCount = 0;     ///< Statepoints in the lowered IR.
+  uint32_t StatepointLiveCount = 0; ///< GC pointers live at statepoints,
+                                    ///< summed over the statepoints.
+  uint32_t MaxStatepointLiveCount = 0; ///< Most GC pointers live at one
+                                       ///< statepoint.
+  uint32_t ReservedSize = 0; ///< Bytes of code and data memory the EE
+                             ///< gave the method.
+  uint32_t UnusedSize = 0;   ///< Bytes of that memory holding neither
+                             ///< code nor data.
+  /// The vectorizers' remarks, in the order they were made.
+  std::vector<VectorizationRemark> VectorizationRemarks;
+
+private:
+  /// Charge time elapsed since the last switch to the current phase.
+  void chargeCurrentPhase();
+
+  CompilePhase CurrentPhase;    ///< Phase time is charged to.
+  Clock::time_point PhaseStart; ///< When \p CurrentPhase was entered.
+  bool IsFinished;              ///< True once the clock is stopped.
+  /// Time charged to each phase so far, in microseconds.
+  uint64_t PhaseMicroseconds[static_cast<unsigned>(CompilePhase::Count)];
+};
+
+/// \brief Charge the time during the lifetime of this object to a phase.
+///
+/// Does nothing if there is no telemetry record, so it is cheap to leave
+/// in place when telemetry is disabled.
+class CompilePhaseTimer {
+public:
+  /// Start charging time to \p Phase.
+  /// \param Telemetry The record for the jit request, or nullptr.
+  /// \param Phase     The phase to charge time to.
+  CompilePhaseTimer(CompileTelemetry *Telemetry, CompilePhase Phase)
+      : Telemetry(Telemetry) {
+    if (Telemetry != nullptr) {
+      EnclosingPhase = Telemetry->enterPhase(Phase);
+    }
+  }
+
+  /// Go back to charging time to the enclosing phase.
+  ~CompilePhaseTimer() {
+    if (Telemetry != nullptr) {
+      Telemetry->enterPhase(EnclosingPhase);
+    }
+  }
+
+private:
+  CompileTelemetry *Telemetry;
+  CompilePhase EnclosingPhase = CompilePhase::Other;
+};
+
+/// \brief Process-wide sink for compile time telemetry.
+///
+/// When the AltJitTelemetry config value names a file (or "-" for stderr),
+/// a record is written there for every method LLILC compiles. Records are
+/// CSV with a header line, or JSON with one object per line if
+/// AltJitTelemetryFormat is "JSON". The sink also keeps a histogram of the
+/// time spent in each phase, which is appended to the output when the jit is
+/// unloaded.
+class LLILCTelemetry {
+public:
+  /// Get the process-wide telemetry sink.
+  static LLILCTelemetry &get();
+
+  /// \brief Open the output on first use.
+  ///
+  /// Later calls are ignored, so the output of the first jit request that
+  /// enables telemetry is used for the rest of the process.
+  ///
+  /// \param Path   File to write records to, or "-" for stderr.
+  /// \param IsJSON True to write JSON records, false to write CSV.
+  /// \returns true if records can be written.
+  bool open(llvm::StringRef Path, bool IsJSON);
+
+  /// Write \p Record and add it to the histogram.
+  void report(const CompileTelemetry &Record);
+
+  /// Write the histogram of phase times to \p OS.
+  void printHistogram(llvm::raw_ostream &OS);
+
+  ~LLILCTelemetry();
+
+private:
+  LLILCTelemetry();
+
+  void writeCSVHeader();
+  void writeCSV(const CompileTelemetry &Record);
+  void writeJSON(const CompileTelemetry &Record);
+
+private:
+  /// Bucket I of the histogram counts times below 2^I microseconds that
+  /// are not in a lower bucket; the last bucket is open-ended.
+  static const unsigned NumBuckets = 24;
+
+  /// Rows of the histogram: one per phase, plus one for the total.
+  static const unsigned NumRows =
+      static_cast<unsigned>(CompilePhase::Count) + 1;
+
+  std::mutex Lock;                              ///< Serializes output.
+  bool IsOpen = false;                          ///< True once open succeeds.
+  bool IsOpenAttempted = false;                 ///< True once open is called.
+  bool IsJSON = false;                          ///< Format of the records.
+  std::unique_ptr<llvm::raw_fd_ostream> Output; ///< Where records go.
+  std::atomic<uint32_t> Histogram[NumRows][NumBuckets]; ///< Phase times.
+  std::atomic<uint32_t> NumRecords;                     ///< Records seen.
+};
+
+#endif // COMPILE_TELEMETRY_H
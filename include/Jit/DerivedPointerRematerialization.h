@@ -0,0 +1,34 @@
+//===---- include/Jit/DerivedPointerRematerialization.h ---------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Declaration of the derived pointer rematerialization pass.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef DERIVED_POINTER_REMATERIALIZATION_H
+#define DERIVED_POINTER_REMATERIALIZATION_H
+
+namespace llvm {
+class FunctionPass;
+}
+
+/// \brief Create a pass that recomputes derived pointers where they are used.
+///
+/// Every GC pointer live across a safepoint is relocated there, so an
+/// interior pointer computed from an object before a call and used after it
+/// costs a relocation of its own, even though the object it points into is
+/// usually live and relocated too. This pass copies such address
+/// computations (GEPs and pointer casts of GC pointers) to just before their
+/// uses, so that only the base is live across the safepoints in between.
+/// It must run before statepoints are placed and rewritten.
+llvm::FunctionPass *createDerivedPointerRematerializationPass();
+
+#endif // DERIVED_POINTER_REMATERIALIZATION_H
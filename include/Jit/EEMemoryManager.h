@@ -17,6 +17,7 @@
 #define EE_MEMORYMANAGER_H
 
 #include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
+#include "llvm/ADT/SmallVector.h"
 
 struct LLILCJitContext;
 
@@ -34,7 +35,9 @@ public:
   /// \param C Jit context for the method being jitted.
   EEMemoryManager(LLILCJitContext *C)
       : Context(C), HotCodeBlock(nullptr), ColdCodeBlock(nullptr),
-        ReadOnlyDataBlock(nullptr), StackMapBlock(nullptr) {}
+        ReadOnlyDataBlock(nullptr), StackMapBlock(nullptr),
+        ReadOnlyDataUnallocated(nullptr), PlannedCodeSize(0),
+        CanPackReadOnlyData(false), ReadOnlyDataUsed(0) {}
 
   /// Destroy an \p EEMemoryManager
   ~EEMemoryManager() override;
@@ -106,11 +109,22 @@ public:
                               uintptr_t RWDataSize,
                               uint32_t RWDataAlign) override;
 
-  /// Inform the memory manager about the amount of memory required to hold
-  /// unwind codes for the function and funclets being loaded.
+  /// \brief Inform the memory manager about an object before it is loaded.
+  ///
+  /// Reserves the unwind space the object needs, and records the sizes and
+  /// alignments of its sections, so that \p reserveAllocationSpace can ask
+  /// the EE for just the bytes the object occupies rather than the padded
+  /// totals the dynamic loader computes.
   ///
   /// \param Obj - the Object being loaded
-  void reserveUnwindSpace(const object::ObjectFile &Obj);
+  void reserveObjectSpace(const object::ObjectFile &Obj);
+
+  /// Inform the memory manager about the amount of memory required to hold
+  /// the unwind codes described by an .xdata section.
+  ///
+  /// \param XdataPtr - the contents of the .xdata section
+  /// \param Size - the size of the .xdata section in bytes
+  void reserveUnwindSpace(const uint8_t *XdataPtr, size_t Size);
 
   /// \brief Override to enable the reserveAllocationSpace callback.
   ///
@@ -156,13 +170,55 @@ public:
 
   uint8_t *getHotCodeBlock() { return HotCodeBlock; }
 
+  /// \brief Get the ReadOnlyData section if allocated.
+  ///
+  /// Returns a pointer to the ReadOnlyData section
+  /// if it is already loaded into memory.
+
+  uint8_t *getReadOnlyDataBlock() { return ReadOnlyDataBlock; }
+
+  /// \brief Get the number of bytes reserved from the EE that hold neither
+  /// code nor data.
+  ///
+  /// Only meaningful once the object has been loaded.
+  uintptr_t getUnusedSize() const;
+
+  /// \brief Check whether a section is only read by the jit.
+  ///
+  /// Such sections (stackmaps and the unwind data the EE copies) are not
+  /// part of the EE's allocation; they live in jit memory until the jit
+  /// request is finished.
+  ///
+  /// \param SectionName    Name of the section
+  static bool isJitLocalSection(StringRef SectionName);
+
 private:
+  /// Number of distinct read-only data alignments (1 through 16 bytes).
+  static const unsigned NumAlignments = 5;
+
+  /// \brief Get the alignment bucket for a section alignment.
+  ///
+  /// An alignment of zero is treated as 16, as the dynamic loader does.
+  static unsigned getAlignmentIndex(unsigned Alignment);
+
   LLILCJitContext *Context;         ///< LLVM context for types, etc.
   uint8_t *HotCodeBlock;            ///< Memory to hold the hot method code.
   uint8_t *ColdCodeBlock;           ///< Memory to hold the cold method code.
   uint8_t *ReadOnlyDataBlock;       ///< Memory to hold the readonly data.
   uint8_t *StackMapBlock;           ///< Memory to hold the readonly StackMap
   uint8_t *ReadOnlyDataUnallocated; ///< Address of unallocated part of RO data.
+  uintptr_t PlannedCodeSize; ///< Exact code size, or 0 to use the loader's.
+  bool CanPackReadOnlyData;  ///< True if RO data is placed by alignment.
+  uintptr_t ReadOnlyDataUsed; ///< RO bytes handed to the loader so far.
+  /// Sizes of the jit-local sections, which the loader counts as RO data.
+  SmallVector<uint64_t, 4> LocalDataSizes;
+  /// Bytes of RO data of each alignment, each section rounded up to its
+  /// alignment.
+  uint64_t ReadOnlyDataBucketSize[NumAlignments] = {};
+  /// Offset in the RO data block of the next free byte of each alignment.
+  uint64_t ReadOnlyDataBucketNext[NumAlignments] = {};
+  /// Offset in the RO data block just past the bytes of each alignment.
+  uint64_t ReadOnlyDataBucketEnd[NumAlignments] = {};
 };
 } // namespace llvm
 
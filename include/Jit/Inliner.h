@@ -0,0 +1,134 @@
+//===---- include/Jit/Inliner.h ---------------------------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Declaration of the inliner for small managed callees.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef INLINER_H
+#define INLINER_H
+
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Metadata.h"
+
+struct LLILCJitContext;
+
+/// \brief Inliner for small managed callees.
+///
+/// While reading a method, the reader marks the direct calls whose targets
+/// might be inlined. Once the method is read, the inliner asks the EE about
+/// each marked call. If the EE approves and the callee's MSIL is within
+/// budget, the callee is read into a function of its own in the method's
+/// module, its own candidates are inlined into it, and it is then inlined
+/// into the caller. Every decision is reported back to the EE via
+/// reportInliningDecision.
+///
+/// Callees with exception handling, synchronized callees, callees that make
+/// unmanaged calls and callees with special frame slots (pinned locals, the
+/// security object, the GS cookie or a generics context that is kept alive)
+/// are not inlined, since the GC info and EH tables can only describe them
+/// for the method being jitted.
+class LLILCInliner {
+public:
+  /// Largest callee, in bytes of MSIL, that is inlined.
+  static const uint32_t MaxCalleeILSize = 32;
+
+  /// Deepest nest of inlined calls.
+  static const uint32_t MaxDepth = 3;
+
+  /// Largest total of inlined MSIL, in bytes, for one method.
+  static const uint32_t MaxTotalILSize = 512;
+
+  /// Get the name of the metadata the reader puts on candidate calls. The
+  /// operand is the handle of the method the call targets.
+  static const char *getCandidateMDName() { return "llilc.inline.candidate"; }
+
+  /// \brief Construct an inliner for the method being jitted.
+  ///
+  /// \param JitContext Context of the jit request; its module holds the
+  ///                   reader's IR for the method.
+  LLILCInliner(LLILCJitContext &JitContext);
+
+  /// \brief Check whether inlining is enabled for a jit request.
+  ///
+  /// Inlining is only done when optimizing, and not when prejitting, where
+  /// inlining across version bubbles would have to be checked.
+  static bool isEnabled(LLILCJitContext &JitContext);
+
+  /// \brief Mark a call as a candidate for inlining.
+  ///
+  /// This is called by the reader, so it is defined here rather than in the
+  /// jit library.
+  ///
+  /// \param Call   The call or invoke the reader emitted.
+  /// \param Method The method the call targets.
+  static void markCandidate(llvm::Instruction *Call,
+                            CORINFO_METHOD_HANDLE Method) {
+    llvm::LLVMContext &Context = Call->getContext();
+    llvm::Metadata *Handle =
+        llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(
+            llvm::Type::getInt64Ty(Context), (uint64_t)Method));
+    Call->setMetadata(Context.getMDKindID(getCandidateMDName()),
+                      llvm::MDNode::get(Context, Handle));
+  }
+
+  /// \brief Inline the candidates in the method being jitted.
+  ///
+  /// \returns The number of calls inlined.
+  uint32_t run();
+
+private:
+  /// Inline the candidate calls in \p Caller, which is nested \p Depth
+  /// inlines deep in the method being jitted.
+  void inlineCandidates(llvm::Function *Caller, uint32_t Depth);
+
+  /// \brief Try to inline one candidate call.
+  ///
+  /// \param Call   The candidate call.
+  /// \param Callee The method the call targets.
+  /// \param Depth  Inline depth of the callee.
+  /// \param Reason Set to the reason for the decision.
+  /// \returns The decision to report to the EE.
+  CorInfoInline tryInline(llvm::CallSite Call, CORINFO_METHOD_HANDLE Callee,
+                          uint32_t Depth, const char *&Reason);
+
+  /// \brief Read a callee into a function of its own.
+  ///
+  /// \param CalleeInfo The callee's method info.
+  /// \param Reason     Set to the reason if the callee cannot be inlined.
+  /// \returns The callee's function, or nullptr if it cannot be inlined.
+  llvm::Function *readCallee(CORINFO_METHOD_INFO *CalleeInfo,
+                             const char *&Reason);
+
+  /// Check whether the reader's function for a callee can be inlined.
+  /// \returns nullptr if it can be, otherwise the reason it cannot be.
+  const char *checkCallee(llvm::Function *Callee);
+
+  /// Remove the GC info and the definition of a callee's function.
+  void eraseCallee(llvm::Function *Callee);
+
+  /// Record the GC allocas of the inlined callees in the GC info of the
+  /// method being jitted.
+  void recordInlinedAllocas();
+
+  LLILCJitContext &JitContext; ///< Context of the method being jitted.
+  llvm::Function *Root;        ///< The method being jitted.
+  unsigned CandidateKind;      ///< Kind of the candidate metadata.
+  unsigned EscapeKind;         ///< Kind of the metadata marking allocas that
+                               ///< inlined callees frame-escaped.
+  uint32_t TotalILSize;        ///< Bytes of MSIL inlined so far.
+  uint32_t NumInlined;         ///< Calls inlined so far.
+};
+
+#endif // INLINER_H
@@ -17,20 +17,37 @@
 #define LLILC_JIT_H
 
 #include "Pal/LLILCPal.h"
+#include "Reader/arena.h"
+#include "Reader/classlayout.h"
 #include "Reader/options.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/RuntimeDyld.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/CodeGen.h"
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/ThreadLocal.h"
 #include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
 #include "llvm/ExecutionEngine/Orc/NullResolver.h"
 #include "llvm/Config/config.h"
+#include "llvm/Target/TargetMachine.h"
+#include <mutex>
+#include <vector>
 
 class ABIInfo;
+class ABISignatureCache;
 class GcInfo;
+struct CodeCacheEntry;
+struct LLILCTargetMachineEntry;
+struct CompileTelemetry;
+struct LLILCReplayResult;
 struct LLILCJitPerThreadState;
 namespace llvm {
+class DiagnosticInfo;
 class EEMemoryManager;
 } // namespace llvm
 
@@ -79,28 +96,48 @@ public:
   uint32_t Flags;                  ///< Flags controlling jit behavior.
   CORINFO_EE_INFO EEInfo;          ///< Information about internal EE data.
   std::string MethodName;          ///< Name of the method (for diagnostics).
+  const char *EEMethodName = nullptr; ///< Method name from the EE.
+  const char *EEClassName = nullptr;  ///< Class name from the EE.
   //@}
 
   /// \name LLVM information
   //@{
   llvm::LLVMContext *LLVMContext; ///< LLVM context for types and similar.
   llvm::Module *CurrentModule;    ///< Module holding LLVM IR.
-  llvm::TargetMachine *TM;        ///< Target characteristics
+  llvm::TargetMachine *TM;        ///< Target characteristics. Owned by the
+                                  ///< per-thread target machine cache.
+  /// The per-thread cache entry holding \p TM and \p TheABIInfo.
+  LLILCTargetMachineEntry *TMEntry = nullptr;
   bool HasLoadedBitCode;          ///< Flag for side-loaded LLVM IR.
   llvm::StringMap<uint64_t> NameToHandleMap; ///< Map from global object names
                                              ///< to the corresponding CLR
                                              ///< handles.
+  /// Names of the ReadyToRun indirection cells that calls go through. The
+  /// EE was told each call is call [rel32] so that its delay-load thunk can
+  /// be shared.
+  llvm::StringSet<> ReadyToRunCallCells;
+  /// True if the code refers to one of ReadyToRunCallCells other than by
+  /// call [rel32]; the method is then compiled again with atypical call
+  /// sites.
+  bool HasAtypicalCallSite = false;
+  /// True if the EE is told that calls through ReadyToRun cells may be in
+  /// any form, which keeps crossgen from sharing their delay-load thunks.
+  bool UseAtypicalCallSites = false;
   //@}
 
   /// \name ABI information
   //@{
-  ABIInfo *TheABIInfo; ///< Target ABI information.
+  ABIInfo *TheABIInfo; ///< Target ABI information. Owned by the
+                       ///< per-thread target machine cache.
   //@}
 
   /// \name Context management
   //@{
   LLILCJitContext *Next;         ///< Parent jit context, if any.
   LLILCJitPerThreadState *State; ///< Per thread state for the jit.
+  /// If this context reads a callee for the inliner, the context of the
+  /// method being jitted; otherwise nullptr.
+  LLILCJitContext *InlineRoot = nullptr;
   //@}
 
   /// \name Per invocation JIT Options
@@ -114,10 +151,62 @@ public:
   uintptr_t ColdCodeSize = 0;     ///< Size of cold code section in bytes.
   uintptr_t ReadOnlyDataSize = 0; ///< Size of readonly data ref'd from code.
   uintptr_t StackMapSize = 0;     ///< Size of readonly Stackmap section.
+  uint32_t CodeLength = 0; ///< Bytes of code in the method and its funclets,
+                           ///< without padding; 0 if not known.
   //@}
 
   /// \name GC Information
   ::GcInfo *GcInfo; ///< GcInfo for functions in CurrentModule
+
+  /// \name Persistent code cache
+  //@{
+  bool IsCacheable = true; ///< False once the code depends on EE state
+                           ///< that can differ from process to process.
+  /// Map from the descriptors of jit helpers embedded in the code to the
+  /// helpers they name.
+  std::map<uint64_t, CorInfoHelpFunc> HelperDescriptorMap;
+  /// If non-null, outputs reported to the EE are also recorded here.
+  CodeCacheEntry *CodeCacheRecord = nullptr;
+  //@}
+
+  /// Compile time telemetry for this request, or nullptr if not enabled.
+  CompileTelemetry *Telemetry = nullptr;
+
+  /// Backs the reader's procedure-lifetime memory; released at the end of
+  /// the jit request.
+  ReaderArena ProcArena;
+};
+
+/// \brief A \p TargetMachine cached for reuse across jit requests.
+///
+/// Creating a \p TargetMachine (and the \p DataLayout derived from it) is a
+/// fixed cost that is independent of the method being jitted, so each thread
+/// keeps the machines it has created and hands them out again to later jit
+/// requests with the same code generation parameters.
+struct LLILCTargetMachineEntry {
+  /// Construct an entry that takes ownership of \p TM.
+  /// \param TM           The target machine to cache.
+  /// \param CreationTime Wall time in seconds it took to create \p TM.
+  LLILCTargetMachineEntry(llvm::TargetMachine *TM, double CreationTime);
+
+  /// Destroy the entry, its target machine and its \p ABIInfo.
+  ~LLILCTargetMachineEntry();
+
+  std::unique_ptr<llvm::TargetMachine> TM; ///< The cached target machine.
+  llvm::DataLayout DataLayout;             ///< Data layout produced by \p TM.
+  ABIInfo *TheABIInfo; ///< Target ABI information using \p DataLayout.
+  double CreationTime; ///< Seconds spent creating \p TM; this is the time
+                       ///< saved by each subsequent reuse.
+
+  /// \brief The mid-level optimization pipelines for \p TM, by the opt
+  /// level they are for.
+  ///
+  /// Each is built by the first method that needs it and then run on the
+  /// module of every later method, so that the passes and their schedule
+  /// are set up once per thread rather than once per method. The passes
+  /// keep no state from one module to the next.
+  std::map<::OptLevel, std::unique_ptr<llvm::legacy::PassManager>>
+      Optimizers;
 };
 
 /// \brief This struct holds per-thread Jit state.
@@ -131,27 +220,86 @@ public:
 struct LLILCJitPerThreadState {
 public:
   /// Construct a new state.
-  LLILCJitPerThreadState()
-      : LLVMContext(), JitContext(nullptr), ClassTypeMap(),
-        ReverseClassTypeMap(), BoxedTypeMap(), ArrayTypeMap(), FieldIndexMap() {
-  }
+  LLILCJitPerThreadState();
+
+  /// Destroy the state; defined where \p ABISignatureCache is complete.
+  ~LLILCJitPerThreadState();
 
   /// Each thread maintains its own \p LLVMContext. This is where
   /// LLVM keeps definitions of types and similar constructs.
-  llvm::LLVMContext LLVMContext;
+  std::unique_ptr<llvm::LLVMContext> LLVMContext;
 
   /// Pointer to the current jit context.
   LLILCJitContext *JitContext;
 
+  /// \brief Get a buffer to emit an object file into.
+  ///
+  /// Buffers are recycled, so that once the thread has jitted a few methods
+  /// emitting an object file does not need to allocate. Nested jit requests
+  /// each get a buffer of their own.
+  std::unique_ptr<llvm::SmallVector<char, 0>> takeObjectBuffer();
+
+  /// \brief Give back a buffer from \p takeObjectBuffer for reuse.
+  ///
+  /// Unusually large buffers are freed rather than kept.
+  void returnObjectBuffer(std::unique_ptr<llvm::SmallVector<char, 0>> Buffer);
+
+  /// Object file buffers not in use by a jit request on this thread.
+  std::vector<std::unique_ptr<llvm::SmallVector<char, 0>>> FreeObjectBuffers;
+
+  /// \brief Get a target machine suitable for the given code generation
+  /// parameters, creating and caching one if necessary.
+  ///
+  /// \param OptLevel      Code generation optimization level.
+  /// \param CodeModel     Code model to generate code for.
+  /// \param IsNgen        True if compiling for ngen (CORJIT_FLG_PREJIT).
+  /// \param IsReadyToRun  True if compiling for ReadyToRun.
+  /// \param UseAVX2       True if the generated code may use AVX2.
+  /// \param IsReused [out] True if a previously created machine was returned.
+  /// \returns The cache entry holding the target machine, or nullptr if the
+  ///          target could not be found.
+  LLILCTargetMachineEntry *getTargetMachine(llvm::CodeGenOpt::Level OptLevel,
+                                            llvm::CodeModel::Model CodeModel,
+                                            bool IsNgen, bool IsReadyToRun,
+                                            bool UseAVX2, bool &IsReused);
+
+  /// \brief Map from code generation parameters to the target machines
+  /// created for them on this thread.
+  ///
+  /// The key is (OptLevel, CodeModel, IsNgen, IsReadyToRun, UseAVX2).
+  std::map<std::tuple<llvm::CodeGenOpt::Level, llvm::CodeModel::Model, bool,
+                      bool, bool>,
+           std::unique_ptr<LLILCTargetMachineEntry>>
+      TargetMachineMap;
+
   /// Map from class handles to the LLVM types that represent them.
-  std::map<CORINFO_CLASS_HANDLE, llvm::Type *> ClassTypeMap;
+  llvm::DenseMap<CORINFO_CLASS_HANDLE, llvm::Type *> ClassTypeMap;
 
   /// Map from LLVM types to the corresponding class handles.
-  std::map<llvm::Type *, CORINFO_CLASS_HANDLE> ReverseClassTypeMap;
+  llvm::DenseMap<llvm::Type *, CORINFO_CLASS_HANDLE> ReverseClassTypeMap;
 
   /// Map from class handles for value types to the LLVM types that represent
   /// their boxed versions.
-  std::map<CORINFO_CLASS_HANDLE, llvm::Type *> BoxedTypeMap;
+  llvm::DenseMap<CORINFO_CLASS_HANDLE, llvm::Type *> BoxedTypeMap;
+
+  /// Key of the \p ArrayTypeMap: the element handle, and the element type,
+  /// array rank and whether the array is a vector packed into an integer.
+  typedef std::pair<CORINFO_CLASS_HANDLE, uint64_t> ArrayTypeKey;
+
+  /// \brief Get the key of the \p ArrayTypeMap for an array.
+  ///
+  /// \param ElementType   Type of the array elements.
+  /// \param ElementHandle Class of the array elements, if any.
+  /// \param Rank          Rank of the array.
+  /// \param IsVector      True if the array is single-dimensional with a zero
+  ///                      lower bound.
+  static ArrayTypeKey getArrayTypeKey(CorInfoType ElementType,
+                                      CORINFO_CLASS_HANDLE ElementHandle,
+                                      uint32_t Rank, bool IsVector) {
+    uint64_t Key = ((uint64_t)Rank << 32) | ((uint64_t)ElementType << 1) |
+                   (IsVector ? 1 : 0);
+    return ArrayTypeKey(ElementHandle, Key);
+  }
 
   /// \brief Map from class handles for arrays to the LLVM types that represent
   /// them.
@@ -159,15 +307,91 @@ public:
   /// \note Arrays can't be looked up via the \p ClassTypeMap. Instead they
   /// are looked up via element type, element handle, array rank, and whether
   /// this array is a vector (single-dimensional array with zero lower bound).
-  std::map<std::tuple<CorInfoType, CORINFO_CLASS_HANDLE, uint32_t, bool>,
-           llvm::Type *>
-      ArrayTypeMap;
+  llvm::DenseMap<ArrayTypeKey, llvm::Type *> ArrayTypeMap;
 
   /// \brief Map from a field handle to the index of that field in the overall
   /// layout of the enclosing class.
   ///
   /// Used to build struct GEP instructions in LLVM IR for field accesses.
-  std::map<CORINFO_FIELD_HANDLE, uint32_t> FieldIndexMap;
+  llvm::DenseMap<CORINFO_FIELD_HANDLE, uint32_t> FieldIndexMap;
+
+  /// \brief ABI classifications of the signatures read on this thread.
+  ///
+  /// Created on first use by the reader. The classifications refer to types
+  /// in the \p LLVMContext, so they are discarded when it is recycled.
+  std::unique_ptr<ABISignatureCache> ABISignatures;
+
+  /// \name LLVMContext memory
+  ///
+  /// Nothing the \p LLVMContext creates is ever freed before the context is,
+  /// so the memory it holds grows with every method jitted on the thread.
+  /// The state keeps an estimate of that memory, and once it is over the
+  /// limit the context is replaced by a fresh one at the start of the
+  /// thread's next top-level jit request. When the EE clears the jit's
+  /// caches, the contexts of threads that are not jitting are replaced
+  /// right away, and those of the others at their next top-level request.
+  //@{
+
+  /// \brief Held by the thread while it runs a jit request.
+  ///
+  /// Other threads only replace the \p LLVMContext while holding this, so
+  /// that they never replace it under a running request.
+  std::recursive_mutex Lock;
+
+  /// \brief Get the estimated bytes held by the \p LLVMContext and the maps
+  /// into it.
+  uint64_t getContextFootprint() const;
+
+  /// \brief Add the constants and metadata of a method read in the
+  /// \p LLVMContext to its estimated footprint.
+  ///
+  /// \param M     The module holding the method and its inlined callees.
+  /// \param Limit Kilobytes the context may hold, or 0 for no limit.
+  void addMethodFootprint(const llvm::Module &M, unsigned Limit);
+
+  /// \brief Check whether the \p LLVMContext should be replaced.
+  bool isContextRecycleDue() const;
+
+  /// \brief Replace the \p LLVMContext with a fresh one, and clear the maps
+  /// into it. No jit request may be running on the thread.
+  void recycleContext();
+
+  /// Estimated bytes of the constants and metadata the methods read in the
+  /// \p LLVMContext left in it.
+  uint64_t MethodFootprint = 0;
+
+  /// Bytes of this thread's footprint included in the process-wide total.
+  uint64_t ReportedFootprint = 0;
+
+  /// Number of times the EE had cleared the jit's caches when the
+  /// \p LLVMContext was created.
+  uint32_t ContextGeneration = 0;
+
+  /// True once the footprint is over the limit.
+  bool IsContextOverLimit = false;
+  //@}
+};
+
+/// \brief An object file buffer borrowed from the per-thread pool for the
+/// duration of a jit request.
+class PooledObjectBuffer {
+public:
+  /// Borrow a buffer from the pool of \p State.
+  PooledObjectBuffer(LLILCJitPerThreadState *State)
+      : State(State), Buffer(State->takeObjectBuffer()) {}
+
+  /// Give the buffer back to the pool.
+  ~PooledObjectBuffer() { State->returnObjectBuffer(std::move(Buffer)); }
+
+  /// Get the buffer.
+  llvm::SmallVectorImpl<char> &get() { return *Buffer; }
+
+private:
+  PooledObjectBuffer(const PooledObjectBuffer &) = delete;
+  PooledObjectBuffer &operator=(const PooledObjectBuffer &) = delete;
+
+  LLILCJitPerThreadState *State;
+  std::unique_ptr<llvm::SmallVector<char, 0>> Buffer;
 };
 
 /// \brief Stub \p SymbolResolver that tells dynamic linker not to apply
@@ -232,11 +456,16 @@ public:
                                        UINT Flags, BYTE **NativeEntry,
                                        ULONG *NativeSizeOfCode) override;
 
-  /// Clear any caches kept by the jit.
+  /// \brief Clear any caches kept by the jit.
+  ///
+  /// The caches are per thread. Threads that are not jitting have their
+  /// \p LLVMContext and type maps replaced here; threads running a jit
+  /// request replace theirs at the start of their next top-level request.
   void clearCache() override;
 
   /// Check if cache cleanup is required.
-  /// \returns \p true if the jit is caching information.
+  /// \returns \p true if any thread's \p LLVMContext holds types, constants
+  /// or metadata of methods jitted before.
   BOOL isCacheCleanupRequired() override;
 
   /// \brief Get the Jit's version identifier.
@@ -267,10 +496,69 @@ public:
   ///        instances this is.
   static void signalHandler(void *Cookie);
 
-  /// Return SIMD generic vector length if LLILC is primary JIT.
+  /// Return SIMD generic vector length if LLILC is primary JIT, or 0 during
+  /// a jit request where LLILC is the alternative JIT.
   unsigned getMaxIntrinsicSIMDVectorLength(DWORD CpuCompileFlags) override;
 
+  /// \brief Compile a method from a replay record.
+  ///
+  /// Runs the part of a jit request that follows the reader, on the IR the
+  /// record holds: optimization, GC and ReadyToRun lowering, and code
+  /// emission into an object file, which is then discarded. Nothing is
+  /// asked of or reported to the EE, so the object is not loaded, and no
+  /// debug or GC info is reported for it.
+  ///
+  /// \param Record     The record, starting with its header.
+  /// \param RecordSize Bytes available at \p Record.
+  /// \param Result     Where to put the object size and phase times.
+  /// \returns \p true if the record was compiled.
+  bool replayMethod(const void *Record, size_t RecordSize,
+                    LLILCReplayResult *Result);
+
 private:
+  /// \brief Make one attempt at jitting a method.
+  ///
+  /// \param JitInfo                Interface the jit can use for callbacks.
+  /// \param MethodInfo             Data structure describing the method to jit.
+  /// \param Flags                  CorJitFlags controlling jit behavior.
+  /// \param NativeEntry [out]      Address of the jitted code.
+  /// \param NativeSizeOfCode [out] Length of the jitted code.
+  /// \param UseAtypicalCallSites   True if the EE is to be told that calls
+  ///                               through ReadyToRun cells are atypical.
+  /// \param HasAtypicalCallSite [out] True if the code was discarded because
+  ///                                  it reached a ReadyToRun call cell
+  ///                                  other than by call [rel32].
+  ///
+  /// \returns Code indicating success or failure of the jit request.
+  CorJitResult compileMethod(ICorJitInfo *JitInfo,
+                             CORINFO_METHOD_INFO *MethodInfo, UINT Flags,
+                             BYTE **NativeEntry, ULONG *NativeSizeOfCode,
+                             bool UseAtypicalCallSites,
+                             bool &HasAtypicalCallSite);
+
+  /// \brief Get the jit state of the calling thread for a jit request.
+  ///
+  /// Creates the state on the thread's first request, and replaces its
+  /// \p LLVMContext if that is due and no request is using it.
+  ///
+  /// \param StateLock [out] Holds the state's \p Lock; keep it for the
+  ///                        duration of the request.
+  /// \returns The state of the calling thread.
+  LLILCJitPerThreadState *
+  getPerThreadState(std::unique_lock<std::recursive_mutex> &StateLock);
+
+  /// \brief Get the target machine to generate a method's code with.
+  ///
+  /// The code generation parameters follow from the flags and options of
+  /// the jit request.
+  ///
+  /// \param Context        Context record for the method's jit request.
+  /// \param IsReused [out] True if a previously created machine was returned.
+  /// \returns The cache entry holding the target machine, or nullptr if the
+  ///          target could not be found.
+  static LLILCTargetMachineEntry *getTargetMachine(LLILCJitContext &Context,
+                                                   bool &IsReused);
+
   /// Convert a method into LLVM IR.
   /// \param JitContext Context record for the method's jit request.
   /// \param ContainsUnmanagedCall [out] Indicates whether the method read
@@ -278,6 +566,39 @@ private:
   /// \returns \p true if the conversion was successful.
   bool readMethod(LLILCJitContext *JitContext, bool &ContainsUnmanagedCall);
 
+  /// \brief Run the mid-level IR optimization pipeline on a method.
+  ///
+  /// The pipeline is selected by the \p OptLevel of the jit request: no
+  /// passes for DEBUG_CODE and TIER0_CODE, a cheap cleanup pipeline for
+  /// BLENDED_CODE and SMALL_CODE, and the full scalar pipeline followed by
+  /// loop and SLP vectorization for FAST_CODE. This must run before
+  /// safepoint placement and statepoint rewriting, since those passes
+  /// expect to see the final shape of the IR.
+  ///
+  /// \param JitContext Context record for the method's jit request.
+  void optimizeMethod(LLILCJitContext *JitContext);
+
+  /// \brief Lower the optimized IR of a method for GC and ReadyToRun.
+  ///
+  /// Places safepoints and rewrites calls as statepoints when the GC is
+  /// precise or the method calls unmanaged code, and puts calls through
+  /// ReadyToRun indirection cells in the form crossgen expects. Also picks
+  /// the instruction selector for the method.
+  ///
+  /// \param JitContext            Context record for the method's jit request.
+  /// \param ContainsUnmanagedCall True if the method calls unmanaged code.
+  void lowerMethod(LLILCJitContext *JitContext, bool ContainsUnmanagedCall);
+
+  /// \brief Handle a diagnostic from the optimizer.
+  ///
+  /// Records the vectorizers' remarks in the telemetry of the jit request
+  /// and gives any other diagnostic LLVM's default handling.
+  ///
+  /// \param Diagnostic     The diagnostic.
+  /// \param HandlerContext The LLILCJitContext of the jit request.
+  static void handleOptimizerDiagnostic(const llvm::DiagnosticInfo &Diagnostic,
+                                        void *HandlerContext);
+
 public:
   /// A pointer to the singleton jit instance.
   static LLILCJit *TheJit;
@@ -288,6 +609,13 @@ public:
 private:
   /// Thread local storage for the jit's per-thread state.
   llvm::sys::ThreadLocal<LLILCJitPerThreadState> State;
+
+  /// The states of all threads that have jitted, so that \p clearCache can
+  /// reach the ones of threads that are not jitting.
+  std::vector<LLILCJitPerThreadState *> AllStates;
+
+  /// Serializes access to \p AllStates.
+  std::mutex AllStatesLock;
 };
 
 #endif // LLILC_JIT_H
@@ -0,0 +1,171 @@
+//===---- include/Jit/ObjectStackAllocation.h -------------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Declaration of the stack allocation of objects that do not escape
+/// the method being jitted.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef OBJECT_STACK_ALLOCATION_H
+#define OBJECT_STACK_ALLOCATION_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Metadata.h"
+#include <memory>
+
+struct LLILCJitContext;
+
+namespace llvm {
+class AllocaInst;
+class DataLayout;
+class Function;
+}
+
+/// \brief Stack allocation of objects that do not escape the method.
+///
+/// The reader marks the allocation helper calls of small fixed-size objects
+/// without finalizers. Once the method is read and its callees inlined, each
+/// marked allocation that runs at most once per call of the method is
+/// checked for escapes: the object may be loaded from, stored into, compared
+/// and copied, and its reference may be kept in stack slots the method only
+/// accesses directly, but if the reference is passed to a call, stored to
+/// any other memory, merged with other values or returned, the object
+/// escapes.
+///
+/// An object that does not escape is given a frame slot with room for the
+/// object header, and is initialized there as the allocation helper would
+/// have. If the object has GC references, the slot is recorded as a GC
+/// aggregate, so that the references are reported for as long as the
+/// method runs. The references to the slot itself point outside of the
+/// heap, so they must only be reported as interior pointers, which the GC
+/// ignores outside of the heap: the GC info reports the values live at
+/// safepoints as interior pointers, and a reference stored to a slot that
+/// it reports as holding object references makes the object escape. Write
+/// barriers on stores into the object become plain stores.
+///
+/// Methods with exception handling are not changed, since their handlers
+/// may access any frame-escaped slot.
+class ObjectStackAllocator {
+public:
+  /// Largest object, in bytes, that is allocated on the stack.
+  static const uint32_t MaxObjectSize = 128;
+
+  /// Largest total of stack allocated objects, in bytes, for one method.
+  static const uint32_t MaxTotalSize = 512;
+
+  /// Get the name of the metadata the reader puts on candidate allocations.
+  /// The operand is the size of the object the EE reported.
+  static const char *getCandidateMDName() {
+    return "llilc.allocation.stackable";
+  }
+
+  /// \brief Construct a stack allocator for the method being jitted.
+  ///
+  /// \param JitContext Context of the jit request; its module holds the
+  ///                   reader's IR for the method.
+  ObjectStackAllocator(LLILCJitContext &JitContext);
+
+  /// \brief Check whether stack allocation is enabled for a jit request.
+  ///
+  /// Objects are only allocated on the stack when optimizing.
+  static bool isEnabled(LLILCJitContext &JitContext);
+
+  /// \brief Mark an allocation as a candidate for stack allocation.
+  ///
+  /// This is called by the reader, so it is defined here rather than in the
+  /// jit library.
+  ///
+  /// \param Allocation The allocation helper call or invoke the reader
+  ///                   emitted; its only argument is the class handle.
+  /// \param Size       Size of the object's class, as the EE reports it.
+  static void markCandidate(llvm::Instruction *Allocation, uint32_t Size) {
+    llvm::LLVMContext &Context = Allocation->getContext();
+    llvm::Metadata *SizeMD = llvm::ConstantAsMetadata::get(
+        llvm::ConstantInt::get(llvm::Type::getInt32Ty(Context), Size));
+    Allocation->setMetadata(Context.getMDKindID(getCandidateMDName()),
+                            llvm::MDNode::get(Context, SizeMD));
+  }
+
+  /// \brief Allocate the candidates that do not escape on the stack.
+  ///
+  /// \returns The number of objects allocated on the stack.
+  uint32_t run();
+
+private:
+  /// \brief The accesses of a stack slot the method only accesses directly.
+  ///
+  /// A slot is an alloca whose every use is a load, a store or a memset at
+  /// a constant offset, possibly through bitcasts and constant GEPs.
+  struct SlotAccess {
+    llvm::Instruction *Access; ///< The load, store or memset.
+    uint64_t Offset;           ///< Byte offset of the access in the slot.
+    uint64_t Size;             ///< Bytes accessed.
+  };
+  typedef llvm::SmallVector<SlotAccess, 8> SlotAccessList;
+
+  /// \brief Check whether the object a candidate allocates escapes.
+  ///
+  /// \param Allocation The candidate allocation.
+  /// \param Barriers   Set to the write barriers on stores into the object.
+  /// \returns True if the object escapes.
+  bool isEscaping(llvm::Instruction *Allocation,
+                  llvm::SmallVectorImpl<llvm::Instruction *> &Barriers);
+
+  /// \brief Find the stack slot a store of the object's reference is to.
+  ///
+  /// \param Address The address stored to.
+  /// \param Base    Set to the alloca of the slot.
+  /// \param Offset  Set to the byte offset of the store in the alloca.
+  /// \returns The accesses of the alloca, or nullptr if the store is not to
+  ///          a slot that the method only accesses directly.
+  const SlotAccessList *getSlot(llvm::Value *Address, llvm::AllocaInst *&Base,
+                                uint64_t &Offset);
+
+  /// \brief Check whether the GC treats any reference in a stack slot as an
+  /// interior pointer, if it looks at the slot at all.
+  ///
+  /// \param Slot The alloca of the slot.
+  /// \returns False if the GC reports the slot's references as object
+  ///          references, which must point into the heap.
+  bool isInteriorSlot(llvm::AllocaInst *Slot);
+
+  /// Collect the accesses of an alloca.
+  /// \returns False if the alloca is used in any other way.
+  bool collectSlotAccesses(llvm::AllocaInst *Alloca, SlotAccessList &Accesses);
+
+  /// Allocate the object of a candidate on the stack, turning the write
+  /// barriers on stores into it into plain stores.
+  void moveToStack(llvm::Instruction *Allocation,
+                   llvm::ArrayRef<llvm::Instruction *> Barriers);
+
+  /// Record the stack slots of objects with GC references in the GC info
+  /// of the method being jitted.
+  void recordGcSlots();
+
+  LLILCJitContext &JitContext; ///< Context of the method being jitted.
+  llvm::Function *Root;        ///< The method being jitted.
+  const llvm::DataLayout *DL;  ///< Data layout of the module.
+  unsigned CandidateKind;      ///< Kind of the candidate metadata.
+  unsigned WriteBarrierKind;   ///< Kind of the write barrier metadata.
+  uint32_t TotalSize;          ///< Bytes allocated on the stack so far.
+
+  /// Accesses of the allocas checked so far; nullptr for allocas that are
+  /// used in other ways.
+  llvm::DenseMap<llvm::AllocaInst *, std::unique_ptr<SlotAccessList>> Slots;
+
+  /// Stack slots of objects with GC references.
+  llvm::SmallVector<llvm::AllocaInst *, 4> GcSlots;
+};
+
+#endif // OBJECT_STACK_ALLOCATION_H
@@ -0,0 +1,35 @@
+//===---- include/Jit/ReadyToRunCallSiteLowering.h --------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Declaration of the ReadyToRun call site lowering pass.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef READY_TO_RUN_CALL_SITE_LOWERING_H
+#define READY_TO_RUN_CALL_SITE_LOWERING_H
+
+namespace llvm {
+class FunctionPass;
+}
+
+/// \brief Create a pass that puts calls through ReadyToRun indirection cells
+/// in the form crossgen's shared delay-load thunks expect.
+///
+/// A shared thunk finds the cell to fix up by decoding the call instruction
+/// that reached it, which must be call [rel32]. Instruction selection folds
+/// the load of the cell into the call only if the load is used by that call
+/// alone and comes right before it; the optimizer is free to hoist and share
+/// such loads. This pass gives each call its own load of the cell just before
+/// it. It must run after statepoints are rewritten, since a statepoint is the
+/// call that the load has to precede.
+llvm::FunctionPass *createReadyToRunCallSiteLoweringPass();
+
+#endif // READY_TO_RUN_CALL_SITE_LOWERING_H
@@ -0,0 +1,41 @@
+//===---- include/Jit/RuntimeLookupOptimization.h ---------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Declaration of the generic dictionary lookup optimization pass.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef RUNTIME_LOOKUP_OPTIMIZATION_H
+#define RUNTIME_LOOKUP_OPTIMIZATION_H
+
+namespace llvm {
+class FunctionPass;
+}
+
+/// \brief Get the name of the metadata on runtime lookup helper calls.
+///
+/// The reader puts this on each call to a CORINFO_HELP_RUNTIMEHANDLE_*
+/// helper, whose arguments are the generic context and the signature of the
+/// handle looked up. When the lookup first checks a dictionary slot, the
+/// call is made only if the slot is null, and its result is merged with the
+/// slot's value by a phi.
+inline const char *getRuntimeLookupMDName() { return "llilc.runtimelookup"; }
+
+/// \brief Create a pass that removes and hoists repeated runtime lookups.
+///
+/// A lookup of the same signature from the same generic context always
+/// finds the same handle, so a lookup dominated by an identical one is
+/// replaced with the earlier result. A lookup that runs on every iteration
+/// of a loop and whose inputs are loop-invariant is made once in front of
+/// the loop, calling the helper there only if the dictionary slot is null.
+llvm::FunctionPass *createRuntimeLookupOptimizationPass();
+
+#endif // RUNTIME_LOOKUP_OPTIMIZATION_H
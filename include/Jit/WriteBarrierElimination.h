@@ -0,0 +1,47 @@
+//===---- include/Jit/WriteBarrierElimination.h -----------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Declaration of the write barrier elimination pass.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef WRITE_BARRIER_ELIMINATION_H
+#define WRITE_BARRIER_ELIMINATION_H
+
+namespace llvm {
+class FunctionPass;
+}
+
+/// \brief Get the name of the metadata on write barrier helper calls.
+///
+/// The reader puts this on each call to the reference write barrier helpers,
+/// whose arguments are the address stored to and the reference stored.
+inline const char *getWriteBarrierMDName() { return "llilc.writebarrier"; }
+
+/// \brief Get the name of the metadata on small object allocations.
+///
+/// The reader puts this on the allocation helper calls of fixed-size objects
+/// small enough to be allocated in generation 0 rather than in the large
+/// object heap.
+inline const char *getSmallAllocationMDName() {
+  return "llilc.allocation.small";
+}
+
+/// \brief Create a pass that removes unneeded write barriers.
+///
+/// A write barrier is not needed when the reference stored is null, or when
+/// the object stored to was allocated by a small object allocation with no
+/// safepoint since; no GC can have promoted it out of generation 0, so the
+/// store cannot create a reference from an older generation. Such barrier
+/// calls are replaced with plain stores.
+llvm::FunctionPass *createWriteBarrierEliminationPass();
+
+#endif // WRITE_BARRIER_ELIMINATION_H
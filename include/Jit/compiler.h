@@ -17,12 +17,14 @@
 #ifndef COMPILER_H
 #define COMPILER_H
 
+#include "CompileTelemetry.h"
 #include "GcInfo.h"
 #include "LLILCJit.h"
-#include "llvm/ExecutionEngine/ObjectMemoryBuffer.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/MC/MCContext.h"
 #include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Target/TargetMachine.h"
 
 namespace llvm {
@@ -30,15 +32,36 @@ namespace orc {
 
 /// \brief Default compile functor: Takes a single IR module and returns an
 ///        ObjectFile.
+///
+/// The object file is emitted into a buffer supplied by the caller, rather
+/// than into a fresh one, so that the buffer's memory can be reused from one
+/// method to the next. The returned ObjectFile refers to that buffer, which
+/// must outlive it and must not be reused until the object set is removed
+/// from the jit layers.
+///
+/// The code still goes through an object file rather than being emitted
+/// straight into the EE's memory: the EE only hands out memory once the
+/// sizes of the code and data are known, and the reporting of relocations,
+/// unwind info, debug info and GC info to the EE all read the object as
+/// RuntimeDyld loads it. Emitting directly would mean replacing all of
+/// those with an MC streamer of our own.
 class LLILCCompiler {
 public:
   /// \brief Construct a simple compile functor with the given target.
-  LLILCCompiler(TargetMachine &TM) : TM(TM) {}
+  ///
+  /// \param TM        The target to compile for.
+  /// \param ObjBuffer The buffer to emit the object file into.
+  /// \param Telemetry Where to charge the compile time, or nullptr.
+  LLILCCompiler(TargetMachine &TM, SmallVectorImpl<char> &ObjBuffer,
+                CompileTelemetry *Telemetry = nullptr)
+      : TM(TM), ObjBuffer(ObjBuffer), Telemetry(Telemetry) {}
 
   /// \brief Compile a Module to an ObjectFile.
   object::OwningBinary<object::ObjectFile> operator()(Module &M) const {
-    SmallVector<char, 0> ObjBufferSV;
-    raw_svector_ostream ObjStream(ObjBufferSV);
+    CompilePhaseTimer Timer(Telemetry, CompilePhase::CodeEmission);
+    // Clearing keeps the capacity from earlier methods.
+    ObjBuffer.clear();
+    raw_svector_ostream ObjStream(ObjBuffer);
 
     legacy::PassManager PM;
     MCContext *Ctx;
@@ -46,19 +69,23 @@ public:
       llvm_unreachable("Target does not support MC emission.");
     PM.add(new GcInfoRecorder());
     PM.run(M);
-    std::unique_ptr<MemoryBuffer> ObjBuffer(
-        new ObjectMemoryBuffer(std::move(ObjBufferSV)));
+    // Wrap the buffer without copying it.
+    std::unique_ptr<MemoryBuffer> ObjMemBuffer = MemoryBuffer::getMemBuffer(
+        StringRef(ObjBuffer.data(), ObjBuffer.size()), M.getModuleIdentifier(),
+        /*RequiresNullTerminator=*/false);
     ErrorOr<std::unique_ptr<object::ObjectFile>> Obj =
-        object::ObjectFile::createObjectFile(ObjBuffer->getMemBufferRef());
+        object::ObjectFile::createObjectFile(ObjMemBuffer->getMemBufferRef());
     // TODO: Actually report errors helpfully.
     typedef object::OwningBinary<object::ObjectFile> OwningObj;
     if (Obj)
-      return OwningObj(std::move(*Obj), std::move(ObjBuffer));
+      return OwningObj(std::move(*Obj), std::move(ObjMemBuffer));
     return OwningObj(nullptr, nullptr);
   }
 
 private:
   TargetMachine &TM;
+  SmallVectorImpl<char> &ObjBuffer;
+  CompileTelemetry *Telemetry;
 };
 } // namespace orc
 } // namespace llvm
@@ -38,11 +38,59 @@ public:
   /// Destruct Options object.
   ~JitOptions();
 
+  /// \brief Get the size of System.Numerics.Vector<T> on the target.
+  ///
+  /// The EE asks while laying out Vector<T>, which need not be during a jit
+  /// request, so this depends only on the flags that describe the CPU.
+  ///
+  /// \param CpuCompileFlags CorJitFlags describing the instruction sets.
+  /// \returns 32 if AVX2 can be used, else 16.
+  static unsigned querySIMDVectorLength(uint32_t CpuCompileFlags);
+
 private:
+  /// \brief The options that depend only on the CLR config.
+  ///
+  /// The CLR config does not change while the process runs, so it is read
+  /// once, by the first jit request, and the result is shared by all later
+  /// requests. Taking the snapshot also compiles the method sets, so that
+  /// they are never modified once jit requests can run concurrently.
+  struct ConfigOptions {
+    /// Read the CLR config and compile the method sets.
+    ConfigOptions(LLILCJitContext &JitContext);
+
+    ::DumpLevel DumpLevel;          ///< Dump level requested.
+    bool UseConservativeGC;         ///< True to use conservative GC.
+    bool DoInsertStatepoints;       ///< True to insert statepoints.
+    bool DoTailCallOpt;             ///< True to do tail call optimization.
+    bool DoInline;                  ///< True to inline small callees.
+    bool DoImplicitNullChecks;      ///< True to allow implicit null checks.
+    bool LogGcInfo;                 ///< True to log GcInfo translation.
+    bool ExecuteHandlers;           ///< True to squelch handler suppression.
+    bool DoSIMDIntrinsic;           ///< True if SIMD intrinsics are on.
+    bool IsTieredCompilation;       ///< True if tiered compilation is on.
+    unsigned ArenaSlabSize;         ///< Slab size of the reader's arenas.
+    unsigned ContextMemoryLimit;    ///< Recycling limit of LLVM contexts.
+    std::string CodeCacheDirectory; ///< Directory of the code cache.
+    std::string TelemetryPath;      ///< File telemetry is written to.
+    bool IsTelemetryJSON;           ///< True to write telemetry as JSON.
+    std::string ReplayRecordPath;   ///< File replay records go to.
+#if defined(NDEBUG)
+    bool IsAltJitAll;     ///< True if AltJit is "*".
+    bool IsAltJitNgenAll; ///< True if AltJitNgen is "*".
+#endif
+  };
+
+  /// \brief Get the snapshot of the CLR config.
+  ///
+  /// The snapshot is taken by the first call; \p JitContext is only used to
+  /// access the config then.
+  static const ConfigOptions &getConfigOptions(LLILCJitContext &JitContext);
+
   /// Set current JIT invocation as "AltJit".  This sets up
   /// the JIT to filter based on the AltJit flag contents.
   /// \returns true if runing as the alternate JIT
-  static bool queryIsAltJit(LLILCJitContext &JitContext);
+  static bool queryIsAltJit(LLILCJitContext &JitContext,
+                            const ConfigOptions &Config);
 
   /// \brief Compute dump level for the JIT
   ///
@@ -54,7 +102,20 @@ private:
   ///
   /// Opt Level based on CLR provided flags and environment.
   /// \returns Computed OptLevel
-  static ::OptLevel queryOptLevel(LLILCJitContext &JitContext);
+  static ::OptLevel queryOptLevel(LLILCJitContext &JitContext,
+                                  const ConfigOptions &Config);
+
+  /// \brief Check whether tiered compilation is enabled.
+  ///
+  /// \returns true if COMPlus_AltJitTieredCompilation is set in the
+  /// environment.
+  static bool queryIsTieredCompilation(LLILCJitContext &JitContext);
+
+  /// \brief Define set of methods that are known to be hot.
+  ///
+  /// With tiered compilation, these skip tier 0 and are fully optimized.
+  /// \returns true if current method is in that set.
+  static bool queryIsHotMethod(LLILCJitContext &JitContext);
 
   /// \brief Set UseConservativeGC based on environment variable.
   ///
@@ -72,6 +133,17 @@ private:
   /// \returns true if COMPLUS_TAILCALLOPT is set in the environment.
   static bool queryDoTailCallOpt(LLILCJitContext &JitContext);
 
+  /// \brief Set DoInline based on environment variable.
+  ///
+  /// \returns false if COMPlus_AltJitNoInline is set in the environment.
+  static bool queryDoInline(LLILCJitContext &JitContext);
+
+  /// \brief Set DoImplicitNullChecks based on environment variable.
+  ///
+  /// \returns false if COMPlus_AltJitExplicitNullChecks is set in the
+  /// environment.
+  static bool queryDoImplicitNullChecks(LLILCJitContext &JitContext);
+
   /// \brief Set LogGcInfo based on environment variable.
   ///
   /// \returns true if COMPLUS_JitGCInfoLogging is set in the environment.
@@ -107,8 +179,24 @@ private:
   /// \returns true if current method is in that set.
   static bool queryIsCodeRangeMethod(LLILCJitContext &JitContext);
 
-  static bool queryMethodSet(LLILCJitContext &JitContext, MethodSet &TheSet,
-                             const char16_t *Name);
+  /// \brief Compile a method set from a configuration variable.
+  ///
+  /// \param TheSet The method set to initialize.
+  /// \param Name   The name of the configuration variable.
+  static void initMethodSet(LLILCJitContext &JitContext, MethodSet &TheSet,
+                            const char16_t *Name);
+
+  /// \brief Check whether the method being jitted is in a method set.
+  ///
+  /// \param TheSet The method set, which must already be initialized.
+  /// \returns true if the method is in \p TheSet.
+  static bool queryMethodSet(LLILCJitContext &JitContext, MethodSet &TheSet);
+
+  /// \brief Check whether a configuration variable is exactly "*".
+  ///
+  /// \param Name The name of the configuration variable
+  /// \returns true if the configuration variable is "*".
+  static bool queryIsStar(LLILCJitContext &JitContext, const char16_t *Name);
 
   /// \brief Check for non-null non-empty configuration variable.
   ///
@@ -117,6 +205,44 @@ private:
   static bool queryNonNullNonEmpty(LLILCJitContext &JitContext,
                                    const char16_t *Name);
 
+  /// \brief Get the directory of the persistent code cache.
+  ///
+  /// \returns The value of COMPlus_AltJitCodeCache, or an empty string if
+  /// the code cache is not enabled.
+  static std::string queryCodeCacheDirectory(LLILCJitContext &JitContext);
+
+  /// \brief Get the slab size of the reader's memory arenas.
+  ///
+  /// \returns The value of COMPlus_AltJitArenaSlabSize in bytes, or 0 to use
+  /// the default size.
+  static unsigned queryArenaSlabSize(LLILCJitContext &JitContext);
+
+  /// \brief Get the memory a thread's LLVM context may hold before it is
+  /// recycled.
+  ///
+  /// \returns The value of COMPlus_AltJitContextMemoryLimit in kilobytes, 0
+  /// if contexts are only recycled when the EE clears the jit's caches, or
+  /// 65536 if it is not specified.
+  static unsigned queryContextMemoryLimit(LLILCJitContext &JitContext);
+
+  /// \brief Get the file to write compile time telemetry to.
+  ///
+  /// \returns The value of COMPlus_AltJitTelemetry, or an empty string if
+  /// telemetry is not enabled.
+  static std::string queryTelemetryPath(LLILCJitContext &JitContext);
+
+  /// \brief Check whether compile time telemetry should be written as JSON.
+  ///
+  /// \returns true if COMPlus_AltJitTelemetryFormat is JSON, false if the
+  /// telemetry should be written as CSV.
+  static bool queryIsTelemetryJSON(LLILCJitContext &JitContext);
+
+  /// \brief Get the file to append compile replay records to.
+  ///
+  /// \returns The value of COMPlus_AltJitReplayRecord, or an empty string if
+  /// methods are not to be recorded.
+  static std::string queryReplayRecordPath(LLILCJitContext &JitContext);
+
   /// \brief Set SIMD intrinsics using.
   ///
   /// \returns true if SIMD_INTRINSIC is set in the environment set.
@@ -130,6 +256,16 @@ public:
   bool IsMSILDumpMethod;  ///< True if dump of MSIL requested.
   bool IsLLVMDumpMethod;  ///< True if dump of LLVM requested.
   bool IsCodeRangeMethod; ///< True if desired to dump entry address and size.
+  std::string CodeCacheDirectory; ///< Directory of the persistent code
+                                  ///< cache, or empty if not enabled.
+  std::string TelemetryPath; ///< File compile time telemetry is written to,
+                             ///< or empty if not enabled.
+  bool IsTelemetryJSON;      ///< True to write telemetry as JSON, not CSV.
+  std::string ReplayRecordPath; ///< File replay records are appended to,
+                                ///< or empty if not enabled.
+  unsigned ContextMemoryLimit; ///< Kilobytes a thread's LLVM context may
+                               ///< hold before it is recycled, or 0 for no
+                               ///< limit.
 
 private:
   static MethodSet AltJitMethodSet;     ///< Singleton AltJit MethodSet.
@@ -139,6 +275,7 @@ private:
   static MethodSet MSILMethodSet;       ///< Methods to dump MSIL.
   static MethodSet LLVMMethodSet;       ///< Methods to dump LLVM IR.
   static MethodSet CodeRangeMethodSet;  ///< Methods to dump code range
+  static MethodSet HotMethodSet;        ///< Methods to compile at full opt.
 };
 
 #endif // JITOPTIONS_H
@@ -16,16 +16,17 @@
 #ifndef UTILITY_H
 #define UTILITY_H
 
-#include <list>
 #include <cassert>
 #include <memory>
 
 #include "cor.h"
 #include "utility.h"
 
-#include "llvm/Support/Atomic.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
 #include "llvm/Config/llvm-config.h"
+#include <vector>
 
 // The MethodID.NumArgs field may hold either of 2 values:
 //   Empty   => the input string was all-blank, or empty.
@@ -97,6 +98,10 @@ public:
   /// C can be a simple class name, or a namespace.classname.  For example,
   /// "Sort" or "System.Array:Sort".  (The dots in a namespace are ignored).
   ///
+  /// C and M may contain '*' wildcards, each matching any sequence of
+  /// characters.  For example, "System.Collections*:Add" or "Get*".  Either
+  /// may also be empty, in which case it matches anything.
+  ///
   /// M can be followed by the pattern (number) to specify its number of
   /// arguments.  For example, .ctor(0) or Adjust(2)
   ///
@@ -127,6 +132,12 @@ public:
 /// \brief MethodSet comprises a set of MethodID objects
 ///
 /// MethodSet specifies the methods to compile with the "alt" JIT.
+///
+/// The MethodIDs are compiled into a matcher when the set is initialized, so
+/// that testing a method does not depend on the number of patterns: patterns
+/// naming a method exactly are found by hashing the method name, and only the
+/// patterns whose method name is absent or has wildcards are tested one by
+/// one.
 
 class MethodSet {
 public:
@@ -135,7 +146,7 @@ public:
 
   bool isEmpty() {
     assert(this->isInitialized());
-    return (this->MethodIDList->size() == 0);
+    return !MatchesAll && ExactMethods.empty() && OtherPatterns.empty();
   }
 
   /// Test whether specified method is matched in current MethodSet.
@@ -147,23 +158,46 @@ public:
   bool contains(const char *MethodName, const char *ClassName,
                 PCCOR_SIGNATURE Sig);
 
-  /// Initialize a new MethodSet - once only.
+  /// \brief Initialize a new MethodSet - once only.
+  ///
+  /// This must be done before the set is shared between threads; the jit
+  /// initializes all of its sets while taking its snapshot of the CLR config.
   void init(std::unique_ptr<std::string> ConfigValue);
 
   /// Check whether current MethodSet has been initialized.
-  bool isInitialized() { return MethodIDList != nullptr; }
+  bool isInitialized() { return Initialized; }
 
   /// \brief Parse the string S into one or more MethodIDs, and insert
   /// them into current MethodSet.
   void insert(std::unique_ptr<std::string> S);
 
 private:
-  /// Internal initialized flag.  This should only be accessed via interlocked
-  /// exchange operations, since several methods may be JIT'ing concurrently.
-  uint32_t Initialized = 0;
+  /// A compiled MethodID. Empty names match anything.
+  struct Pattern {
+    std::string ClassName;  ///< Class name, possibly with wildcards.
+    std::string MethodName; ///< Method name, possibly with wildcards.
+    int NumArgs;            ///< Number of arguments, or AnyArgs.
+  };
+
+  /// Test whether \p Text matches \p Glob, where '*' in \p Glob matches
+  /// any sequence of characters.
+  static bool matchesGlob(llvm::StringRef Glob, llvm::StringRef Text);
+
+  /// Test whether a method's class name and argument count match \p P.
+  static bool matchesClassAndArgs(const Pattern &P, llvm::StringRef ClassName,
+                                  int NumArgs);
+
+  /// True once init has been called.
+  bool Initialized = false;
+
+  /// True if the set contains "*", and so every method.
+  bool MatchesAll = false;
+
+  /// Patterns whose method name has no wildcard, keyed by method name.
+  llvm::StringMap<std::vector<Pattern>> ExactMethods;
 
-  /// MethodSigList implementing the set.
-  std::list<MethodID> *MethodIDList = nullptr;
+  /// Patterns whose method name is absent or has wildcards.
+  std::vector<Pattern> OtherPatterns;
 };
 
 /// \brief Class implementing miscellaneous conversion functions.
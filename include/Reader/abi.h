@@ -16,6 +16,10 @@
 #ifndef _READER_ABI_H_
 #define _READER_ABI_H_
 
+namespace llvm {
+class Triple;
+}
+
 /// \brief Information about how a particular argument is passed to a function.
 ///
 /// This class encapsulates information such as whether a parameter is passed
@@ -118,6 +122,13 @@ public:
   /// Actual values should be created using \p getDirect and \p getIndirect.
   ABIArgInfo() {}
 
+  /// \brief Make a copy of this value, e.g. to reuse a cached signature.
+  ///
+  /// The index is not copied.
+  ///
+  /// \returns An \p ABIArgInfo value describing the same argument passing.
+  ABIArgInfo copy() const;
+
   /// \brief Get the \p Kind that describes how this argument is passed.
   ///
   /// \returns The \p Kind that describes how this argument is passed.
@@ -195,6 +206,17 @@ public:
   ///          should be deleted when it is no longer needed.
   static ABIInfo *get(llvm::Module &M);
 
+  /// \brief Gets an \p ABIInfo for the given target.
+  ///
+  /// \param TargetTriple  The target.
+  /// \param DL            The data layout of the target, which must outlive
+  ///                      the \p ABIInfo.
+  ///
+  /// \returns An \p ABIInfo instance. This instance belongs to the caller and
+  ///          should be deleted when it is no longer needed.
+  static ABIInfo *get(const llvm::Triple &TargetTriple,
+                      const llvm::DataLayout &DL);
+
   /// \brief Computes argument passing information for the target ABI.
   ///
   /// This function is used to determine how the parameters to and result of a
@@ -17,6 +17,43 @@
 #ifndef _READER_ABISIGNATURE_H_
 #define _READER_ABISIGNATURE_H_
 
+/// \brief A cache of the ABI classifications of signatures.
+///
+/// Classifying a signature may query the EE about each struct passed, so
+/// each thread keeps the classifications it has computed, keyed by the
+/// calling convention and the normalized result and argument types. The
+/// classifications refer to types in the thread's \p LLVMContext, so the
+/// cache is discarded along with the context.
+class ABISignatureCache {
+public:
+  /// \brief A classified signature.
+  struct Entry {
+    llvm::Type *FuncResultType;   ///< The return type of the function.
+    ABIArgInfo Result;            ///< How the result is passed.
+    std::vector<ABIArgInfo> Args; ///< How each argument is passed.
+  };
+
+  /// \brief Find the classification of a signature.
+  ///
+  /// \param Key  The signature's calling convention and types, as built by
+  ///             \p ABISignature.
+  /// \returns The cached classification, or nullptr if there is none.
+  const Entry *lookup(llvm::ArrayRef<uintptr_t> Key) const;
+
+  /// \brief Add the classification of a signature.
+  ///
+  /// \param Key             The signature's calling convention and types.
+  /// \param FuncResultType  The return type of the function.
+  /// \param Result          How the result is passed; copied.
+  /// \param Args            How each argument is passed; copied.
+  void insert(llvm::ArrayRef<uintptr_t> Key, llvm::Type *FuncResultType,
+              const ABIArgInfo &Result, llvm::ArrayRef<ABIArgInfo> Args);
+
+private:
+  /// Map from the bytes of the keys to the classifications.
+  llvm::StringMap<std::unique_ptr<Entry>> Entries;
+};
+
 /// \brief Encapsulates ABI-specific argument and result passing information for
 ///        a particular function signature.
 class ABISignature {
@@ -31,6 +68,9 @@ protected:
   /// \brief Fills in argument and result passing information for the given
   ///        function signature.
   ///
+  /// When the same signature was classified before on this thread, the
+  /// cached information is used.
+  ///
   /// \param Signature   The function signature.
   /// \param Reader      The \p GenIR instance that will be used to emit IR.
   /// \param TheABIInfo  The target \p ABIInfo.
@@ -0,0 +1,126 @@
+//===------------------ include/Reader/arena.h ------------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Declares the bump pointer arenas backing the reader's temporary
+/// and procedure-lifetime memory.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef _READER_ARENA_H_
+#define _READER_ARENA_H_
+
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/// \brief Process-wide statistics for one kind of arena.
+///
+/// Every arena of the kind folds its usage in here when it is released, so
+/// the statistics cover all the methods jitted so far on any thread.
+struct ReaderArenaStatistics {
+  /// Construct statistics with all counts zero.
+  /// \param Name Name of the kind of arena, for printing.
+  ReaderArenaStatistics(const char *Name);
+
+  /// Fold the usage of an arena being released into the statistics.
+  void noteRelease(size_t BytesAllocated, size_t BytesReserved);
+
+  /// Print the statistics to \p OS.
+  void print(llvm::raw_ostream &OS) const;
+
+  const char *Name;                          ///< Kind of arena.
+  std::atomic<uint64_t> NumReleases;         ///< Arenas released.
+  std::atomic<uint64_t> TotalBytesAllocated; ///< Sum over all arenas.
+  std::atomic<uint64_t> HighWaterAllocated;  ///< Most allocated by one arena.
+  std::atomic<uint64_t> HighWaterReserved;   ///< Most reserved by one arena.
+};
+
+/// Statistics for the arenas holding reader temporary memory.
+extern ReaderArenaStatistics TempArenaStatistics;
+
+/// Statistics for the arenas holding procedure-lifetime memory.
+extern ReaderArenaStatistics ProcArenaStatistics;
+
+/// \brief A bump pointer arena for memory that is all freed at once.
+///
+/// The reader gets its temporary and procedure-lifetime memory from
+/// arenas, which are released when the reader and the jit request finish.
+/// Memory is carved out of slabs obtained from the C heap, and handed out
+/// zeroed, since the reader relies on that. Objects in an arena must not be
+/// deleted; objects that own other memory must be destroyed explicitly
+/// before the arena is released.
+class ReaderArena {
+public:
+  /// Default size of a slab in bytes.
+  static const size_t DefaultSlabSize = 16 * 1024;
+
+  /// Alignment of every allocation; enough for any type the reader
+  /// allocates.
+  static const size_t Alignment = 16;
+
+  /// \brief Construct an empty arena.
+  ///
+  /// \param Statistics Statistics to fold the arena's usage into.
+  /// \param SlabSize   Size of the slabs the arena carves memory out of.
+  ReaderArena(ReaderArenaStatistics &Statistics,
+              size_t SlabSize = DefaultSlabSize);
+
+  /// Release all the memory of the arena.
+  ~ReaderArena() { release(); }
+
+  /// \brief Change the slab size for slabs allocated from now on.
+  ///
+  /// \param SlabSize The new slab size, or 0 for the default.
+  void setSlabSize(size_t SlabSize);
+
+  /// \brief Allocate zeroed memory from the arena.
+  ///
+  /// Allocations larger than a slab get a slab of their own.
+  ///
+  /// \param NumBytes Number of bytes to allocate.
+  /// \returns The memory, aligned to \p Alignment.
+  void *allocate(size_t NumBytes);
+
+  /// \brief Free all the memory of the arena.
+  ///
+  /// The arena can be used again afterwards.
+  void release();
+
+  /// Get the number of bytes handed out since the arena was last released.
+  size_t getBytesAllocated() const { return BytesAllocated; }
+
+  /// Get the number of bytes in slabs since the arena was last released.
+  size_t getBytesReserved() const { return BytesReserved; }
+
+private:
+  ReaderArena(const ReaderArena &) = delete;
+  ReaderArena &operator=(const ReaderArena &) = delete;
+
+  /// Header at the start of every slab.
+  struct Slab {
+    Slab *Next; ///< Previously allocated slab.
+  };
+
+  /// Allocate a slab with room for \p NumBytes after the header.
+  /// \returns Start of the usable memory in the slab.
+  char *allocateSlab(size_t NumBytes);
+
+  ReaderArenaStatistics &Statistics; ///< Where usage is reported.
+  size_t SlabSize;                   ///< Size of new slabs.
+  Slab *Slabs;                       ///< Most recently allocated slab.
+  char *Current;                     ///< Next free byte in current slab.
+  char *End;                         ///< End of current slab.
+  size_t BytesAllocated;             ///< Bytes handed out.
+  size_t BytesReserved;              ///< Bytes in slabs.
+};
+
+#endif // _READER_ARENA_H_
@@ -0,0 +1,125 @@
+//===---------------- include/Reader/classlayout.h --------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Declares the process-wide cache of the class layouts the EE
+/// reports, which the reader builds LLVM types from.
+///
+//===----------------------------------------------------------------------===//
+
+#ifndef _READER_CLASS_LAYOUT_H_
+#define _READER_CLASS_LAYOUT_H_
+
+#include "Pal/LLILCPal.h"
+#if !defined(_MSC_VER)
+#include "ntimage.h"
+#endif
+#include "cor.h"
+#include "corjit.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/RWMutex.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/// \brief DenseMapInfo for the EE's opaque handle types.
+///
+/// The handles point to structs that are never defined, so the DenseMapInfo
+/// for pointers, which depends on the alignment of the referent, cannot be
+/// used for them.
+template <typename HandleT> struct EEHandleDenseMapInfo {
+  static inline HandleT getEmptyKey() { return (HandleT)(uintptr_t)-1; }
+  static inline HandleT getTombstoneKey() { return (HandleT)(uintptr_t)-2; }
+  static unsigned getHashValue(HandleT Handle) {
+    uintptr_t Value = (uintptr_t)Handle;
+    return (unsigned)(Value >> 4) ^ (unsigned)(Value >> 9);
+  }
+  static bool isEqual(HandleT LHS, HandleT RHS) { return LHS == RHS; }
+};
+
+namespace llvm {
+template <>
+struct DenseMapInfo<CORINFO_CLASS_HANDLE>
+    : EEHandleDenseMapInfo<CORINFO_CLASS_HANDLE> {};
+template <>
+struct DenseMapInfo<CORINFO_FIELD_HANDLE>
+    : EEHandleDenseMapInfo<CORINFO_FIELD_HANDLE> {};
+} // namespace llvm
+
+/// \brief A field that a class adds to the layout of its parent.
+struct FieldLayout {
+  uint32_t Offset;                  ///< Byte offset of the field.
+  CORINFO_FIELD_HANDLE Handle;      ///< Handle of the field.
+  CorInfoType CorType;              ///< Type of the field.
+  CORINFO_CLASS_HANDLE ClassHandle; ///< Class of the field, if any.
+};
+
+/// \brief The facts about a class's layout that the EE reports.
+///
+/// These do not depend on the LLVMContext, so one copy can be shared by all
+/// the threads that build types for the class.
+struct ClassLayout {
+  /// Number of instance fields, including those of ancestor classes.
+  uint32_t NumInstanceFields;
+
+  /// Parent class of a reference class, or nullptr.
+  CORINFO_CLASS_HANDLE ParentClassHandle;
+
+  /// The fields the class adds to its parent, in increasing offset order.
+  /// This may miss some fields, e.g. for classes that derive from
+  /// System.__ComObject.
+  std::vector<FieldLayout> Fields;
+
+  /// Size of a value class; zero for reference classes.
+  uint32_t Size;
+};
+
+/// \brief A cache of class layouts that can be read concurrently.
+///
+/// Entries are never changed once added, so a layout found in the cache can
+/// be used without holding any lock. Callers share ownership of the layouts
+/// they look up, so a layout stays valid while it is in use even if the
+/// cache is cleared meanwhile.
+class ClassLayoutCache {
+public:
+  /// \brief Find the layout of a class.
+  ///
+  /// \param ClassHandle The class.
+  /// \returns The cached layout, or nullptr if there is none.
+  std::shared_ptr<const ClassLayout> lookup(CORINFO_CLASS_HANDLE ClassHandle);
+
+  /// \brief Add the layout of a class.
+  ///
+  /// If another thread added a layout for the class first, that one is kept
+  /// and \p Layout is discarded.
+  ///
+  /// \param ClassHandle The class.
+  /// \param Layout      Its layout, as read from the EE.
+  /// \returns The cached layout.
+  std::shared_ptr<const ClassLayout>
+  insert(CORINFO_CLASS_HANDLE ClassHandle, std::unique_ptr<ClassLayout> Layout);
+
+  /// \brief Remove all layouts.
+  ///
+  /// Layouts still in use are freed once their users let go of them.
+  void clear();
+
+private:
+  llvm::sys::SmartRWMutex<true> Lock; ///< Taken shared to read the map.
+  llvm::DenseMap<CORINFO_CLASS_HANDLE, std::shared_ptr<const ClassLayout>>
+      Layouts; ///< Map from class handles to layouts.
+};
+
+/// The cache of class layouts shared by all jit threads. It is keyed by
+/// class handle, and the EE may reuse the handles of classes it unloads, so
+/// it is cleared whenever the EE asks the jit to clear its caches.
+extern ClassLayoutCache SharedClassLayouts;
+
+#endif // _READER_CLASS_LAYOUT_H_
@@ -27,7 +27,9 @@ enum class OptLevel {
   DEBUG_CODE,   ///< No/Low optimization to preserve debug semantics.
   BLENDED_CODE, ///< Fast code that remains sensitive to code size.
   SMALL_CODE,   ///< Optimized for small size.
-  FAST_CODE     ///< Optimized for speed.
+  FAST_CODE,    ///< Optimized for speed.
+  TIER0_CODE    ///< Compiled as quickly as possible, for methods that are
+                ///< not expected to be hot.
 };
 
 /// \brief Enum for LLVM IR Dump Level
@@ -54,10 +56,17 @@ struct Options {
   bool UseConservativeGC;   ///< True if the environment is set to use CGC.
   bool DoInsertStatepoints; ///< True if the environment calls for statepoints.
   bool DoTailCallOpt;       ///< Tail call optimization.
+  bool DoInline;            ///< True to inline small callees' MSIL.
+  bool DoImplicitNullChecks; ///< True to let codegen fold null checks into
+                             ///< faulting accesses.
   bool LogGcInfo;           ///< Generate GCInfo Translation logs
   bool ExecuteHandlers;     ///< Squelch handler suppression.
   bool DoSIMDIntrinsic;     ///< True if SIMD intrinsic is on.
+  bool DoDebugInfo;         ///< True to report IL offset and local variable
+                            ///< info to the EE.
   unsigned PreferredIntrinsicSIMDVectorLength; ///< Prefer Intrinsic SIMD Vector
   /// Length in bytes.
+  unsigned ArenaSlabSize; ///< Slab size of the reader's memory arenas in
+                          ///< bytes, or 0 for the default.
 };
 #endif // OPTIONS_H
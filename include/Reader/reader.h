@@ -147,7 +147,6 @@ class ReaderBitVector;
 struct EHRegion;
 class VerifyWorkList;
 class VerificationState;
-class FlowGraphNodeOffsetList;
 class ReaderCallTargetData;
 
 /// \brief Exception information for the Jit's exception filter
@@ -268,7 +267,35 @@ enum ReaderSIMDIntrinsic {
   EQ,
   NEQ,
   GETCOUNTOP,
-  GETITEM
+  GETITEM,
+  DOT,
+  DISTANCE,
+  DISTANCESQ,
+  LENGTH,
+  LENGTHSQ,
+  CONDSELECT,
+  CONVERT,
+  NARROW,
+  WIDEN,
+  COPYTO
+};
+
+/// \brief Well-known BCL methods that the reader recognizes by name.
+///
+/// The EE only reports intrinsic IDs for methods implemented in the
+/// runtime. These methods are implemented in IL, but expanding them in the
+/// reader lets later optimizations see through them even when they are not
+/// inlined.
+enum ReaderNamedIntrinsic {
+  NI_Undefined,
+  NI_Math_Max,
+  NI_Math_Min,
+  NI_Array_GetLength,
+  NI_RuntimeHelpers_IsReferenceOrContainsReferences,
+  NI_Unsafe_Add,
+  NI_Unsafe_AreSame,
+  NI_Unsafe_AsPointer,
+  NI_Unsafe_SizeOf
 };
 
 /// Common base class for reader exceptions
@@ -1266,12 +1293,40 @@ struct VerificationBranchInfo {
   VerificationBranchInfo *Next; ///< Next branch to verify
 };
 
+/// \brief An MSIL instruction as decoded by \p ReaderBase::decodeMSIL.
+///
+/// The MSIL of a method is decoded once, into an array of these in offset
+/// order, which flow graph construction and the main reader loop then reuse.
+struct DecodedMSILInstr {
+  uint32_t Offset;             ///< MSIL offset of the instruction
+  uint32_t OperandOffset;      ///< MSIL offset of the instruction's operand
+  ReaderBaseNS::OPCODE Opcode; ///< Opcode of the instruction
+  uint16_t StackPop;           ///< Stack entries popped, when verifying
+  uint16_t StackPush;          ///< Stack entries pushed, when verifying
+};
+
 /// Translate a call opcode from the general MSIL opcode enumeration into
 /// the call-specific opcode enumeration.
 /// \param Opcode     MSIL opcode
 /// \returns          MSIL call opcode
 ReaderBaseNS::CallOpcode remapCallOpcode(ReaderBaseNS::OPCODE Opcode);
 
+/// Kinds of access an MSIL instruction can make to a local variable.
+enum class MSILLocalAccess {
+  None,        ///< The instruction does not access a local
+  Load,        ///< The instruction loads the local's value
+  Store,       ///< The instruction stores the local's whole value
+  AddressTaken ///< The instruction takes the local's address
+};
+
+/// Determine how an MSIL instruction accesses a local variable.
+/// \param Opcode          MSIL opcode
+/// \param Operand         Address of the instruction's operand
+/// \param LocalNum [out]  Number of the local accessed, if any
+/// \returns               How the instruction accesses the local
+MSILLocalAccess getMSILLocalAccess(ReaderBaseNS::OPCODE Opcode,
+                                   uint8_t *Operand, uint32_t *LocalNum);
+
 /// \brief Parameters needed for converting MSIL to client IR for
 /// a particular flow graph node.
 ///
@@ -1349,15 +1404,23 @@ private:
   // SEQUENCE POINT Info
   ReaderBitVector *CustomSequencePoints;
 
+  // Decoded MSIL. MSILInstrs holds the instructions of the method in offset
+  // order, followed by a sentinel whose offset is the size of the MSIL.
+  // MSILInstrIndex maps each MSIL offset to the index in MSILInstrs of the
+  // instruction starting there, or to NoMSILInstrIndex.
+  std::vector<DecodedMSILInstr> MSILInstrs;
+  uint32_t *MSILInstrIndex;
+  static const uint32_t NoMSILInstrIndex = UINT32_MAX;
+
   // Fg Info - unused after fg is built
 
-  // NodeOffsetListArray is an ordered array of FlowGraphNodeOffsetList*.
-  // Each entry is a pointer to a FlowGraphNodeOffsetList which will contain at
-  // most LABEL_LIST_ARRAY_STRIDE elements. The FlowGraphNodeOffsetLists
-  // are maintained in order, which helps later replacement of temp branch
-  // targets with real ones.
-  FlowGraphNodeOffsetList **NodeOffsetListArray;
-  uint32_t NodeOffsetListArraySize;
+  // BranchTargetNodes maps each MSIL offset to the temporary branch target
+  // node, if any, created for that offset. BranchTargetOffsets is the bitmap
+  // of offsets that have one, which are the starts of blocks; walking it in
+  // order lets the temporary targets be replaced with real ones in one sweep
+  // over the blocks.
+  FlowGraphNode **BranchTargetNodes;
+  ReaderBitVector *BranchTargetOffsets;
 
   VerificationBranchInfo *BranchesToVerify;
 
@@ -1427,8 +1490,6 @@ public:
 protected:
 private:
   // Global Verification Info
-  uint16_t *GvStackPop;
-  uint16_t *GvStackPush;
   GlobalVerifyData *GvWorklistHead;
   GlobalVerifyData *GvWorklistTail;
 
@@ -1590,6 +1651,41 @@ public:
   /// \returns true if simd intrinsic opt is enabled.
   virtual bool doSimdIntrinsicOpt() = 0;
 
+  /// \brief Check options as to whether to devirtualize calls.
+  ///
+  /// Derived class will provide an implementation that is correct for the
+  /// client.
+  ///
+  /// \returns true if virtual calls with known targets should be made direct.
+  virtual bool doDevirtualization() = 0;
+
+  /// \brief Check options as to whether to expand well-known BCL methods.
+  ///
+  /// Derived class will provide an implementation that is correct for the
+  /// client.
+  ///
+  /// \returns true if calls to the methods of ReaderNamedIntrinsic should be
+  /// expanded inline.
+  virtual bool doNamedIntrinsicExpansion() = 0;
+
+  /// \brief Check options as to whether to avoid boxes whose uses are known.
+  ///
+  /// Derived class will provide an implementation that is correct for the
+  /// client.
+  ///
+  /// \returns true if boxes should be folded into the instructions that
+  /// use them when possible.
+  virtual bool doBoxPeepholes() = 0;
+
+  /// \brief Check whether ReadyToRun call sites are to be reported atypical.
+  ///
+  /// Derived class will provide an implementation that is correct for the
+  /// client.
+  ///
+  /// \returns true if the EE should not expect calls through ReadyToRun
+  /// indirection cells to be in call [rel32] form.
+  virtual bool useAtypicalCallSites() = 0;
+
 private:
   /// \brief Determine if a call instruction is a candidate to be a tail call.
   ///
@@ -1632,6 +1728,25 @@ private:
   ///                       tail call.
   bool checkExplicitTailCall(uint32_t ILOffset, bool AllowPop);
 
+  /// \brief Try to read the instruction that uses a box without the box.
+  ///
+  /// The box a value class makes is never null and only ever holds that
+  /// class, so \p unbox.any of the same class, tests of the box for null,
+  /// and \p isinst of a class the value class casts to, followed by such a
+  /// test, need no box. A \p callvirt of a method without parameters on the
+  /// box is read as a constrained call on the address of a copy of the
+  /// value, which calls the value class's own implementation directly.
+  ///
+  /// \param ResolvedToken    Token of the box.
+  /// \param Arg              Value being boxed.
+  /// \param NextOffset [in]  Offset of the instruction after the box.
+  ///                        [out] Offset of the next instruction to read.
+  /// \param Result [out]     Value to push in place of the box, or nullptr
+  ///                         if there is none.
+  /// \returns                True if no box is needed.
+  bool tryBoxPeephole(CORINFO_RESOLVED_TOKEN *ResolvedToken, IRNode *Arg,
+                      uint32_t *NextOffset, IRNode *&Result);
+
   /// \brief Convert the MSIL for this flow graph node into the client IR.
   ///
   /// Orchestrates client processing the MSIL in this flow graph node,
@@ -1658,14 +1773,14 @@ protected:
   /// This method sees if there is an existing flow graph node that begins at
   /// the indicated target. If so, \p Node is set to this block. If not, a
   /// temporary block is allocated to use as a target, and an entry is added
-  /// to the \p NodeOffsetListArray so a subsequent pass can update the
+  /// to the \p BranchTargetNodes so a subsequent pass can update the
   /// temporary target blocks to real target blocks.
   ///
   /// \param Node [out]          Node to use as the branch target.
   /// \param TargetOffset        MSIL offset of the branch target.
-  /// \returns                   List node of target in offset list.
-  FlowGraphNodeOffsetList *fgAddNodeMSILOffset(FlowGraphNode **Node,
-                                               uint32_t TargetOffset);
+  /// \returns                   Node to use as the branch target.
+  FlowGraphNode *fgAddNodeMSILOffset(FlowGraphNode **Node,
+                                     uint32_t TargetOffset);
 
   /// Get the innermost fault or finally region enclosing the given \p Offset.
   ///
@@ -1682,6 +1797,28 @@ protected:
   ///          that includes \p Offset, if such a region exists; else nullptr.
   EHRegion *getInnerEnclosingRegion(EHRegion *OuterRegion, uint32_t Offset);
 
+  /// \brief Decode the MSIL of the method.
+  ///
+  /// Fills in \p MSILInstrs and \p MSILInstrIndex, reporting any malformed
+  /// instructions, so that later passes need not parse the MSIL again.
+  ///
+  /// \param ILInput       Pointer to the start of the MSIL bytecode stream.
+  /// \param ILInputSize   Length of the MSIL bytecode stream.
+  void decodeMSIL(uint8_t *ILInput, uint32_t ILInputSize);
+
+  /// \brief Get the decoded MSIL instruction at an offset.
+  ///
+  /// An offset that does not start an instruction of the decoded stream,
+  /// which only unverifiable MSIL can branch to, is parsed on the spot.
+  ///
+  /// \param Offset        Offset into the MSIL stream.
+  /// \param Opcode [out]  Opcode of the instruction.
+  /// \param Operand [out] Address of the instruction's operand.
+  /// \param ReportErrors  Whether to report errors when parsing on the spot.
+  /// \returns             Offset of the next instruction.
+  uint32_t getDecodedMSILInstr(uint32_t Offset, ReaderBaseNS::OPCODE *Opcode,
+                               uint8_t **Operand, bool ReportErrors = true);
+
   /// Process first entry to a region during 1st-pass flow-graph construction
   ///
   /// \param Region   \p EHRegion being entered
@@ -2261,6 +2398,21 @@ private:
 
   IRNode *rdrGetDirectCallTarget(ReaderCallTargetData *CallTargetData);
 
+  /// \brief Turn a virtual call into a direct call when its target is known.
+  ///
+  /// The target of a callvirt is the method the token resolved to when that
+  /// method is final, when its class is sealed, or when the receiver is known
+  /// to be an object of exactly that class. In those cases the call info is
+  /// replaced with that of a non-virtual call to the method, which the ensuing
+  /// call sequence must null-check explicitly.
+  ///
+  /// \param CallTargetData Info on the call; updated if it is devirtualized.
+  /// \param ThisPointer    The receiver of the call.
+  ///
+  /// \returns True iff the call was devirtualized.
+  bool rdrDevirtualizeCall(ReaderCallTargetData *CallTargetData,
+                           IRNode *ThisPointer);
+
   /// \brief Generate IR for getting the target of a direct call. "Direct call"
   /// can either be a true direct call if the runtime allows, or it can be an
   /// indirect call through the method descriptor.
@@ -2493,6 +2645,7 @@ public:
   CORINFO_CLASS_HANDLE getTypeForBox(CORINFO_CLASS_HANDLE Class);
   CorInfoHelpFunc getBoxHelper(CORINFO_CLASS_HANDLE);
   CorInfoHelpFunc getUnBoxHelper(CORINFO_CLASS_HANDLE);
+  bool canCast(CORINFO_CLASS_HANDLE Child, CORINFO_CLASS_HANDLE Parent);
   uint32_t getFieldOffset(CORINFO_FIELD_HANDLE);
 
   void *getStaticFieldAddress(CORINFO_FIELD_HANDLE Field, bool *IsIndirect);
@@ -2918,6 +3071,26 @@ public:
   /// \returns             true iff Result represents the sqrt
   virtual bool sqrt(IRNode *Argument, IRNode **Result) = 0;
 
+  /// Optionally generate inline code for System.Math.Round(double)
+  ///
+  /// \param Argument      input value to round
+  /// \param Result [out]  the value rounded to the nearest integer, ties to
+  ///                      even, iff reader decided to expand
+  /// \returns             true iff Result represents the rounded value
+  virtual bool round(IRNode *Argument, IRNode **Result) = 0;
+
+  /// Optionally generate inline code for System.Math.Min or Max
+  ///
+  /// \param IsMax         true for Max, false for Min
+  /// \param IsUnsigned    true if integer arguments are unsigned
+  /// \param Arg1          first argument
+  /// \param Arg2          second argument
+  /// \param Result [out]  the lesser or greater argument, iff reader decided
+  ///                      to expand
+  /// \returns             true iff Result represents the min or max
+  virtual bool minMax(bool IsMax, bool IsUnsigned, IRNode *Arg1, IRNode *Arg2,
+                      IRNode **Result) = 0;
+
   virtual bool interlockedIntrinsicBinOp(IRNode *Arg1, IRNode *Arg2,
                                          IRNode **RetVal,
                                          CorInfoIntrinsics IntrinsicID) = 0;
@@ -2959,6 +3132,10 @@ public:
   // Base calls to alert client it needs a security check
   virtual void methodNeedsSecurityCheck() = 0;
 
+  // Base calls to alert client its code depends on the EE's resolution of a
+  // metadata token
+  virtual void methodDependsOnResolvedToken() = 0;
+
   // Base calls to alert client it needs keep generics context alive
   virtual void
   methodNeedsToKeepAliveGenericsContext(bool KeepGenericsCtxtAlive) = 0;
@@ -3010,10 +3187,14 @@ public:
   virtual bool generateDebugInfo() { return false; }
   virtual bool generateDebugEnC() { return false; }
 
-  // Allocate temporary (Reader lifetime) memory
+  // Allocate temporary (Reader lifetime) memory. The memory is zeroed. It
+  // must not be freed or deleted: the client releases it all at once when
+  // the reader finishes.
   virtual void *getTempMemory(size_t Bytes) = 0;
 
-  // Allocate procedure-lifetime memory
+  // Allocate procedure-lifetime memory. The memory is zeroed. It must not be
+  // freed or deleted: the client releases it all at once when the jit
+  // request finishes.
   virtual void *getProcMemory(size_t Bytes) = 0;
 
   virtual EHRegion *rgnAllocateRegion() = 0;
@@ -3315,6 +3496,13 @@ public:
   /// \returns The class handle that corresponds to the type of the node.
   virtual CORINFO_CLASS_HANDLE inferThisClass(IRNode *ThisArgument) = 0;
 
+  /// \brief Get the exact class of an object, if the reader knows it.
+  ///
+  /// \param Object  The IR node that represents a reference to the object.
+  /// \returns The class the object was allocated as, e.g. by a preceding
+  ///          newobj, or nullptr if it is not known.
+  virtual CORINFO_CLASS_HANDLE getExactClass(IRNode *Object) = 0;
+
   // Called once region tree has been built.
   virtual void setEHInfo(EHRegion *EhRegionTree,
                          EHRegionList *EhRegionList) = 0;
@@ -3461,6 +3649,88 @@ public:
   virtual IRNode *vectorGetItem(IRNode *VectorPointer, IRNode *Index,
                                 CorInfoType ResType) = 0;
 
+  /// \brief Return result of a horizontal reduction on SIMD Vector Types.
+  ///
+  /// Handles Dot, Distance and DistanceSquared, which take two vectors, and
+  /// Length and LengthSquared, which take the address of one.
+  ///
+  /// \param OperationCode code to be done.
+  /// \param ResType The type the call returns.
+  /// \returns an IRNode representing the scalar result
+  /// or nullptr if the reduction is not supported.
+  IRNode *generateSIMDReduction(ReaderSIMDIntrinsic OperationCode,
+                                CorInfoType ResType);
+
+  /// \brief Return IRNode* Sum of the products of the elements of two
+  /// vectors, converted to the stack type of ResType.
+  virtual IRNode *vectorDot(IRNode *Vector1, IRNode *Vector2,
+                            CorInfoType ResType) = 0;
+
+  /// \brief Return IRNode* Euclidean distance, or its square, between two
+  /// vectors, converted to the stack type of ResType.
+  virtual IRNode *vectorDistance(IRNode *Vector1, IRNode *Vector2,
+                                 bool IsSquared, CorInfoType ResType) = 0;
+
+  /// \brief Return IRNode* Euclidean length, or its square, of the vector
+  /// at VectorPointer, converted to the stack type of ResType.
+  virtual IRNode *vectorLength(IRNode *VectorPointer, bool IsSquared,
+                               CorInfoType ResType) = 0;
+
+  /// \brief Return result of ConditionalSelect on SIMD Vector Types.
+  ///
+  /// \returns an IRNode representing the selected vector
+  /// or nullptr if the operation is not supported.
+  IRNode *generateSIMDConditionalSelect();
+
+  /// \brief Return IRNode* Bits of Vector1 where Mask is set and of Vector2
+  /// where it is clear.
+  virtual IRNode *vectorConditionalSelect(IRNode *Mask, IRNode *Vector1,
+                                          IRNode *Vector2) = 0;
+
+  /// \brief Return result of an element type conversion on SIMD Vector
+  /// Types: ConvertTo*, Narrow or Widen.
+  ///
+  /// \param OperationCode code to be done.
+  /// \param SigInfo info for the target Method.
+  /// \returns an IRNode representing the converted vector, the last store
+  /// of Widen, or nullptr if the conversion is not supported.
+  IRNode *generateSIMDConvert(ReaderSIMDIntrinsic OperationCode,
+                              CORINFO_SIG_INFO *SigInfo);
+
+  /// \brief Return IRNode* Vector converted element-wise to the vector class
+  /// ResultClass.
+  ///
+  /// \param IsSigned true if the elements of Vector are signed.
+  virtual IRNode *vectorConvert(IRNode *Vector,
+                                CORINFO_CLASS_HANDLE ResultClass,
+                                bool IsSigned) = 0;
+
+  /// \brief Return IRNode* The elements of both vectors truncated to half
+  /// their width, Vector1's first.
+  virtual IRNode *vectorNarrow(IRNode *Vector1, IRNode *Vector2) = 0;
+
+  /// \brief Extend the elements of Vector to twice their width, storing the
+  /// lower half to LowPointer and the upper half to HighPointer.
+  ///
+  /// \returns The store to HighPointer, or nullptr if unsupported.
+  virtual IRNode *vectorWiden(IRNode *Vector, IRNode *LowPointer,
+                              IRNode *HighPointer, bool IsSigned) = 0;
+
+  /// \brief Return result of CopyTo on SIMD Vector Types.
+  ///
+  /// \param ArgsCount Number of arguments on stack for call, not counting
+  /// the this pointer.
+  /// \returns the last store of the copy or nullptr if it is not supported.
+  IRNode *generateSIMDCopyTo(int ArgsCount);
+
+  /// \brief Store the elements of the vector at VectorPointer to Array,
+  /// starting at Index, with the bounds checks of the array stores.
+  ///
+  /// \param Index The first element to store to, or nullptr for zero.
+  /// \returns The last store, or nullptr if unsupported.
+  virtual IRNode *vectorCopyTo(IRNode *VectorPointer, IRNode *Array,
+                               IRNode *Index) = 0;
+
   /// \brief Return IRNode* The result of the intrinsic or nullptr, if it is
   /// unnsupported.
   ///
@@ -3474,6 +3744,25 @@ public:
                                     CORINFO_SIG_INFO *SigInfo,
                                     ReaderBaseNS::CallOpcode Opcode);
 
+  /// \brief Find which well-known BCL method, if any, a method is.
+  ///
+  /// \param Method The method.
+  /// \returns The method's ReaderNamedIntrinsic, or NI_Undefined.
+  ReaderNamedIntrinsic getNamedIntrinsic(CORINFO_METHOD_HANDLE Method);
+
+  /// \brief Expand a call to a well-known BCL method.
+  ///
+  /// The call's arguments are on the operand stack, and are left there if
+  /// the call is not expanded.
+  ///
+  /// \param Intrinsic The method being called.
+  /// \param SigInfo   The signature of the call.
+  /// \param Expanded [out] true if the call was expanded.
+  /// \returns The result of the call, or nullptr if it returns nothing or
+  /// was not expanded.
+  IRNode *expandNamedIntrinsic(ReaderNamedIntrinsic Intrinsic,
+                               CORINFO_SIG_INFO *SigInfo, bool *Expanded);
+
   /// \brief Check LLVM::VectorType.
   ///
   /// \param Arg The target for checking.
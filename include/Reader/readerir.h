@@ -17,6 +17,7 @@
 #ifndef MSIL_READER_IR_H
 #define MSIL_READER_IR_H
 
+#include "llvm/ADT/BitVector.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
@@ -53,6 +54,7 @@ public:
     TheReaderStack = nullptr;
     IsVisited = false;
     PropagatesOperandStack = true;
+    IDom = nullptr;
   };
 
   /// Byte Offset in the MSIL instruction stream to the first instruction
@@ -76,6 +78,11 @@ public:
   /// true iff this basic block uses an operand stack and propagates it to the
   /// block's successors when it's not empty on exit.
   bool PropagatesOperandStack;
+
+  /// Immediate dominator of this block in the flow graph built from the MSIL,
+  /// or nullptr for the entry block and for blocks that were not in that
+  /// flow graph or not reachable in it.
+  FlowGraphNode *IDom;
 };
 
 /// \brief Represent a node in the LLILC compiler intermediate representation.
@@ -189,8 +196,10 @@ public:
   GenIR(LLILCJitContext *JitContext)
       : ReaderBase(JitContext->JitInfo, JitContext->MethodInfo,
                    JitContext->Flags),
+        TempArena(TempArenaStatistics, JitContext->Options->ArenaSlabSize),
         UnmanagedCallFrame(nullptr), ThreadPointer(nullptr),
-        BuiltinObjectType(nullptr), ElementToArrayTypeMap() {
+        BuiltinObjectType(nullptr), ElementToArrayTypeMap(),
+        BlockProfileBuffer(nullptr) {
     this->JitContext = JitContext;
     this->NameToHandleMap = &JitContext->NameToHandleMap;
     // Cache a few things from the per-thread state.
@@ -200,6 +209,14 @@ public:
     this->BoxedTypeMap = &State->BoxedTypeMap;
     this->ArrayTypeMap = &State->ArrayTypeMap;
     this->FieldIndexMap = &State->FieldIndexMap;
+    // ReadyToRun compiles record the layouts they depend on as they query
+    // the EE, so each method must make its own queries.
+    if (JitContext->Flags & CORJIT_FLG_READYTORUN) {
+      MethodClassLayouts = llvm::make_unique<ClassLayoutCache>();
+      this->ClassLayouts = MethodClassLayouts.get();
+    } else {
+      this->ClassLayouts = &SharedClassLayouts;
+    }
   }
 
   static bool isValidStackType(IRNode *Node);
@@ -348,6 +365,27 @@ public:
   IRNode *loadStaticField(CORINFO_RESOLVED_TOKEN *FieldToken,
                           bool IsVolatile) override;
 
+  /// \brief Check whether a static field is read-only and its class has
+  /// been initialized, so that the field's value can no longer change.
+  ///
+  /// \param FieldToken Resolved token for the field.
+  /// \param FieldInfo  The EE's info on accessing the field.
+  /// \param IsVolatile True if the access is volatile.
+  /// \returns True iff the field's current value may be used for all loads.
+  bool isInitializedReadOnlyStaticField(CORINFO_RESOLVED_TOKEN *FieldToken,
+                                        CORINFO_FIELD_INFO *FieldInfo,
+                                        bool IsVolatile);
+
+  /// \brief Read the current value of a primitive static field.
+  ///
+  /// \param FieldHandle  Handle of the field.
+  /// \param FieldTy      LLVM type of the field.
+  /// \param FieldCorType CorInfoType of the field.
+  /// \returns A constant with the field's value, converted to its stack type.
+  IRNode *readOnlyStaticFieldValue(CORINFO_FIELD_HANDLE FieldHandle,
+                                   llvm::Type *FieldTy,
+                                   CorInfoType FieldCorType);
+
   IRNode *stringLiteral(mdToken Token, void *StringHandle, InfoAccessType Iat);
 
   IRNode *loadStr(mdToken Token) override;
@@ -429,6 +467,11 @@ public:
   IRNode *stringGetChar(IRNode *Arg1, IRNode *Arg2) override;
   bool sqrt(IRNode *Argument, IRNode **Result) override;
 
+  bool round(IRNode *Argument, IRNode **Result) override;
+
+  bool minMax(bool IsMax, bool IsUnsigned, IRNode *Arg1, IRNode *Arg2,
+              IRNode **Result) override;
+
   bool interlockedIntrinsicBinOp(IRNode *Arg1, IRNode *Arg2, IRNode **RetVal,
                                  CorInfoIntrinsics IntrinsicID) override;
 
@@ -448,11 +491,26 @@ public:
 
   void nop() override;
 
+  /// \brief Apply or collect block execution counts.
+  ///
+  /// When the EE asks for code optimized with profile data, the counts it
+  /// has for the method's MSIL blocks are recorded for the blocks that
+  /// start at those offsets. When it asks for instrumented code, a profile
+  /// buffer is allocated and each block counts its executions in it.
   void insertIBCAnnotations() override;
+
+  /// \brief Count the executions of a block in the profile buffer.
+  ///
+  /// \param Node   The block.
+  /// \param Count  Index of the block's entry in the profile buffer.
+  /// \param Offset MSIL offset the block starts at.
+  /// \returns The store of the incremented count.
   IRNode *insertIBCAnnotation(FlowGraphNode *Node, uint32_t Count,
-                              uint32_t Offset) override {
-    throw NotYetImplementedException("insertIBCAnnotation");
-  };
+                              uint32_t Offset) override;
+
+  /// \brief Weight the conditional branches and switches whose targets have
+  /// profile counts.
+  void addProfileBranchWeights();
 
   //
   // REQUIRED Client Helper Routines.
@@ -461,6 +519,11 @@ public:
   // Base calls to alert client it needs a security check
   void methodNeedsSecurityCheck() override { NeedsSecurityObject = true; }
 
+  // Base calls to alert client its code depends on a resolved token
+  void methodDependsOnResolvedToken() override {
+    JitContext->IsCacheable = false;
+  }
+
   // Base calls to alert client it needs keep generics context alive
   void
   methodNeedsToKeepAliveGenericsContext(bool KeepGenericsCtxtAlive) override;
@@ -531,6 +594,37 @@ public:
   FlowGraphNode *fgGetTailBlock(void) override;
   FlowGraphNode *fgNodeGetIDom(FlowGraphNode *Fg) override;
 
+  /// \brief Compute the immediate dominators of the flow graph's blocks.
+  ///
+  /// Handlers can be entered from anywhere in the regions they protect, so
+  /// the first block of each handler is treated as a successor of the entry
+  /// block, and is dominated only by it.
+  void fgComputeDominators();
+
+  /// \brief Order the reachable blocks of the flow graph in reverse post
+  /// order.
+  ///
+  /// As for dominators, the first block of each handler is treated as a
+  /// successor of the entry block.
+  ///
+  /// \param Order        The reachable blocks, in reverse post order.
+  /// \param Predecessors The reachable predecessors of each block.
+  void fgGetReversePostOrder(
+      std::vector<FlowGraphNode *> &Order,
+      llvm::DenseMap<FlowGraphNode *, llvm::SmallVector<FlowGraphNode *, 2>>
+          &Predecessors);
+
+  /// \brief Find the locals that may be read before they are written.
+  ///
+  /// Taking the address of a local counts as reading it.
+  ///
+  /// \returns A bit for each local, set if some path from the method entry
+  /// may read the local before writing it.
+  llvm::BitVector fgFindLocalsReadBeforeWritten();
+
+  /// Get the nearest block known to dominate \p FgNode, ignoring EH regions.
+  FlowGraphNode *fgNodeGetNextIDom(FlowGraphNode *FgNode);
+
   void fgEnterRegion(EHRegion *Region) override;
 
   /// Make an EH pad suitable as the head of the given handler.
@@ -568,6 +662,47 @@ public:
                       bool IsUnmarkedTailCall,
                       bool HasIndirectResultOrArgument);
 
+  /// \brief Check whether a tail call to the method being compiled can be
+  /// turned into a branch back to the method's first MSIL block.
+  ///
+  /// \param CallTargetInfo  The tail call, which has passed tailCallChecks.
+  /// \param CallArguments   The call's arguments, converted to the types of
+  ///                        the callee's parameters.
+  ///
+  /// \returns               True if the arguments can be stored to the
+  ///                        homes of the method's own and nothing else about
+  ///                        the frame has to change.
+  bool
+  canConvertTailRecursionToLoop(ReaderCallTargetData *CallTargetInfo,
+                                llvm::ArrayRef<llvm::Value *> CallArguments);
+
+  /// \brief Turn a tail call to the method being compiled into a loop.
+  ///
+  /// Store \p CallArguments to the homes of the method's arguments, zero
+  /// again the locals the prolog zeroes, and branch to FirstMSILBlock.
+  ///
+  /// \param CallArguments   The call's arguments, as passed to
+  ///                        canConvertTailRecursionToLoop.
+  void genTailRecursionLoop(llvm::ArrayRef<llvm::Value *> CallArguments);
+
+  /// \brief Check whether an explicit tail call can be made a jump.
+  ///
+  /// LLVM makes a musttail call a jump that reuses the caller's incoming
+  /// argument area, so the callee must take the same parameters and return
+  /// the same result as the caller, and the call must be the last thing
+  /// emitted so far. A ReadyToRun call through an indirection cell would
+  /// become jmp [rel32], which a delay-load thunk cannot decode and which
+  /// would give the thunk the caller's return site, so it is never made a
+  /// jump.
+  ///
+  /// \param Call            The call, which has passed tailCallChecks.
+  /// \param Result          The call's result as returned by emitCall.
+  /// \param IndirectionCell The call's indirection cell, or nullptr.
+  ///
+  /// \returns               True if \p Call can be marked musttail.
+  bool canMakeFastTailCall(llvm::CallInst *Call, llvm::Value *Result,
+                           llvm::Value *IndirectionCell);
+
   FlowGraphNode *fgSplitBlock(FlowGraphNode *Block, IRNode *Node) override;
   IRNode *fgMakeBranch(IRNode *LabelNode, IRNode *InsertNode,
                        uint32_t CurrentOffset, bool IsConditional,
@@ -766,6 +901,15 @@ public:
 
   IRNode *genNullCheck(IRNode *Node) override;
 
+  /// \brief Check whether a null check may be folded into a faulting access.
+  ///
+  /// The EE turns faults in managed code into NullReferenceExceptions, but
+  /// the EH info only describes exceptions raised by calls, so checks in
+  /// protected regions and handlers are kept explicit.
+  ///
+  /// \returns true if a null check at the current point may be implicit.
+  bool canUseImplicitNullCheck();
+
   llvm::AllocaInst *createAlloca(llvm::Type *T,
                                  llvm::Value *ArraySize = nullptr,
                                  const llvm::Twine &Name = "");
@@ -782,6 +926,34 @@ public:
 
   IRNode *getHelperCallAddress(CorInfoHelpFunc HelperId) override;
 
+  /// \brief What the EE reported about a jit helper, cached per method.
+  struct JitHelperInfo {
+    void *Descriptor;         ///< Entry point, or the cell holding it.
+    bool IsIndirect;          ///< true if Descriptor is the cell.
+    llvm::Function *Function; ///< Declaration of a direct helper, if made.
+  };
+
+  /// \brief Get what the EE reports about a jit helper, asking it only the
+  /// first time the helper is used in the method.
+  JitHelperInfo &getHelperInfo(CorInfoHelpFunc HelperId);
+
+  /// \brief Get a function declaration for a jit helper whose entry point
+  /// the EE knows.
+  ///
+  /// Calls name the helper rather than loading its address from a handle
+  /// constant. Jitted code uses the large code model, so such a call still
+  /// materializes the 64-bit entry point and calls through a register; only
+  /// prejitted code, with the default code model, gets call [rel32].
+  ///
+  /// \returns The declaration, or nullptr if the helper must be called
+  /// through an indirection cell.
+  llvm::Function *getHelperFunction(CorInfoHelpFunc HelperId);
+
+  /// \brief Get a call target for a jit helper with the given type, direct
+  /// if the helper's entry point is known.
+  llvm::Value *getHelperCallTarget(CorInfoHelpFunc HelperId,
+                                   llvm::FunctionType *FunctionType);
+
   /// \brief Get address of a ReadyToRun helper.
   ///
   /// \param HelperID        Helper ID.
@@ -852,6 +1024,8 @@ public:
 
   CORINFO_CLASS_HANDLE inferThisClass(IRNode *ThisArgument) override;
 
+  CORINFO_CLASS_HANDLE getExactClass(IRNode *Object) override;
+
   // Called once region tree has been built.
   void setEHInfo(EHRegion *EhRegionTree, EHRegionList *EhRegionList) override;
 
@@ -859,6 +1033,7 @@ public:
     throw NotYetImplementedException("setSequencePoint");
   };
   bool needSequencePoints() override;
+  bool generateDebugInfo() override;
 
 #if !defined(CC_PEVERIFY)
   //
@@ -935,6 +1110,15 @@ private:
   getClassTypeWorker(CORINFO_CLASS_HANDLE ClassHandle, bool GetAggregateFields,
                      std::list<CORINFO_CLASS_HANDLE> *DeferredDetailClasses);
 
+  /// \brief Get the layout the EE reports for a class, asking the EE only
+  /// if the layout is not already cached.
+  ///
+  /// \param ClassHandle   Class handle to get the layout for.
+  /// \param IsRefClass    true iff the class is a reference class.
+  /// \returns       The cached layout of the class.
+  std::shared_ptr<const ClassLayout>
+  getClassLayout(CORINFO_CLASS_HANDLE ClassHandle, bool IsRefClass);
+
   /// \brief Construct the LLVM type of the boxed representation of the given
   ///        value type.
   ///
@@ -997,19 +1181,21 @@ private:
   /// \param AlignmentPrefix Alignment of the value.
   /// \param IsVolatile true iff the load is volatile.
   /// \param AddressMayBeNull true iff the address may be null.
+  /// \param TBAATag Optional TBAA access tag for a non-struct load.
   /// \returns Value at the specified address.
   IRNode *loadAtAddress(IRNode *Address, llvm::Type *Ty, CorInfoType CorType,
                         CORINFO_RESOLVED_TOKEN *ResolvedToken,
                         ReaderAlignType AlignmentPrefix, bool IsVolatile,
-                        bool AddressMayBeNull = true);
+                        bool AddressMayBeNull = true,
+                        llvm::MDNode *TBAATag = nullptr);
 
   IRNode *loadAtAddressNonNull(IRNode *Address, llvm::Type *Ty,
                                CorInfoType CorType,
                                CORINFO_RESOLVED_TOKEN *ResolvedToken,
-                               ReaderAlignType AlignmentPrefix,
-                               bool IsVolatile) {
+                               ReaderAlignType AlignmentPrefix, bool IsVolatile,
+                               llvm::MDNode *TBAATag = nullptr) {
     return loadAtAddress(Address, Ty, CorType, ResolvedToken, AlignmentPrefix,
-                         IsVolatile, false);
+                         IsVolatile, false, TBAATag);
   }
 
   IRNode *loadAtAddress(IRNode *Address, llvm::Type *Ty, CorInfoType CorType,
@@ -1036,18 +1222,20 @@ private:
   /// \param IsVolatile true iff the store is volatile.
   /// \param IsField true iff this is a field address.
   /// \param AddressMayBeNull true iff the address may be null.
+  /// \param TBAATag Optional TBAA access tag for a non-struct store.
   void storeAtAddress(IRNode *Address, IRNode *ValueToStore, llvm::Type *Ty,
                       CORINFO_RESOLVED_TOKEN *ResolvedToken,
                       ReaderAlignType AlignmentPrefix, bool IsVolatile,
-                      bool IsField, bool AddressMayBeNull);
+                      bool IsField, bool AddressMayBeNull,
+                      llvm::MDNode *TBAATag = nullptr);
 
   void storeAtAddressNonNull(IRNode *Address, IRNode *ValueToStore,
                              llvm::Type *Ty,
                              CORINFO_RESOLVED_TOKEN *ResolvedToken,
                              ReaderAlignType AlignmentPrefix, bool IsVolatile,
-                             bool IsField) {
+                             bool IsField, llvm::MDNode *TBAATag = nullptr) {
     return storeAtAddress(Address, ValueToStore, Ty, ResolvedToken,
-                          AlignmentPrefix, IsVolatile, IsField, false);
+                          AlignmentPrefix, IsVolatile, IsField, false, TBAATag);
   }
 
   /// Generate instructions for storing value of the specified type at the
@@ -1108,7 +1296,10 @@ private:
   ///                        terminator, and this method will add one. If \p
   ///                        Rejoin is false, \p PointBlock is left unmodified.
   /// \param Rejoin          If true, insert a branch into \p PointBlock back
-  ///                        to the continuation.
+  ///                        to the continuation. If false, \p PointBlock
+  ///                        must not return (it throws), and the branch to
+  ///                        it is weighted as rarely taken so that the code
+  ///                        generator moves it out of the hot path.
   ///
   /// \returns               The continuation block. Insertion point is left
   ///                        within this block at the instruction after the
@@ -1125,6 +1316,15 @@ private:
   /// \returns          The newly-created successor block
   llvm::BasicBlock *splitCurrentBlock(llvm::TerminatorInst **Goto = nullptr);
 
+  /// \brief End the block at the current insertion point with \p Terminator.
+  ///
+  /// The rest of the block's MSIL can no longer be reached. It is read into
+  /// a new block split off from the current one, which is left without
+  /// predecessors. Insertion point is left within the new block.
+  ///
+  /// \param Terminator The new terminator of the current block.
+  void terminateCurrentBlock(llvm::TerminatorInst *Terminator);
+
   /// \brief Move point blocks preceding \p OldBlock to just before \p NewBlock
   ///
   /// Point blocks created during the first pass flow-graph construction are
@@ -1194,6 +1394,10 @@ private:
 
   /// Generate a call to the throw helper if the condition is met.
   ///
+  /// Optimized code branches to one throw block per helper and EH region,
+  /// so that each helper is called from one place rather than once per
+  /// check.
+  ///
   /// \param Condition Condition that will trigger the throw.
   /// \param HelperId Id of the throw-helper.
   /// \param ThrowBlockName Name of the basic block that will contain the throw.
@@ -1202,10 +1406,42 @@ private:
 
   /// Generate array bounds check.
   ///
+  /// The compare is tagged so that bounds check elimination can find it.
+  ///
   /// \param ArrayLength Length of the array to be accessed.
   /// \param Index Index to be accessed.
   void genBoundsCheck(llvm::Value *ArrayLength, llvm::Value *Index);
 
+  /// \brief Get a TBAA access tag for a location on the managed heap.
+  ///
+  /// The tags form a hierarchy under a root for the managed heap: instance
+  /// fields of reference types are grouped by their declaring type and
+  /// array elements by their element type. Accesses left untagged may alias
+  /// any of these.
+  ///
+  /// \param Group Name of the group, either instance fields or array
+  ///              elements, the location belongs to.
+  /// \param Name  Name of the location's type within the group.
+  /// \returns The access tag.
+  llvm::MDNode *getManagedHeapTBAATag(llvm::StringRef Group,
+                                      llvm::StringRef Name);
+
+  /// \brief Get the TBAA access tag for an instance field access.
+  ///
+  /// \param Field The field being accessed.
+  /// \returns The access tag, or nullptr if the field is declared by a value
+  /// type, whose fields may live anywhere.
+  llvm::MDNode *getFieldTBAATag(CORINFO_FIELD_HANDLE Field);
+
+  /// \brief Get the TBAA access tag for an array element access.
+  ///
+  /// Arrays that the runtime allows to be cast to one another, like int[]
+  /// and uint[] or any two arrays of references, share a tag.
+  ///
+  /// \param ElementTy LLVM type of the element being accessed.
+  /// \returns The access tag, or nullptr if the element is not a scalar.
+  llvm::MDNode *getArrayElementTBAATag(llvm::Type *ElementTy);
+
   /// \brief Generate conditional throw for conv.ovf.
   ///
   /// As part of the overflow test sequence, this method may generate code that
@@ -1339,6 +1575,16 @@ private:
   IRNode *genArrayElemAddress(IRNode *Array, IRNode *Index,
                               llvm::Type *ElementTy);
 
+  /// Get address of the array element, without checking that the array is
+  /// not null or that the index is in range.
+  ///
+  /// \param Array Array that the element belongs to.
+  /// \param Index Index of the element.
+  /// \param ElementTy Type of the element.
+  /// \returns Node representing the address of the element.
+  IRNode *getArrayElemAddress(IRNode *Array, IRNode *Index,
+                              llvm::Type *ElementTy);
+
   /// Convert ReaderAlignType to byte alighnment to byte alignment.
   ///
   /// \param ReaderAlignment Reader alignment.
@@ -1474,16 +1720,42 @@ private:
   /// Provides client specific Options look up.
   bool doSimdIntrinsicOpt() override;
 
-  /// If isZeroInitLocals() returns true, zero intitialize all locals;
-  /// otherwise, zero initialize all gc pointers and structs with gc pointers.
+  /// \brief Override of doDevirtualization method
+  /// Provides client specific Options look up.
+  bool doDevirtualization() override;
+
+  /// \brief Override of doNamedIntrinsicExpansion method
+  /// Provides client specific Options look up.
+  bool doNamedIntrinsicExpansion() override;
+
+  /// \brief Override of doBoxPeepholes method
+  /// Provides client specific Options look up.
+  bool doBoxPeepholes() override;
+
+  /// \brief Override of useAtypicalCallSites method
+  /// Provides client specific Options look up.
+  bool useAtypicalCallSites() override;
+
+  /// If isZeroInitLocals() returns true, zero intitialize the non-GC locals
+  /// that may be read before they are written. GC locals are always zero
+  /// initialized in the post-pass.
   void zeroInitLocals();
 
+  /// \brief Pack the GC aggregate homes of locals and arguments into one
+  /// aggregate.
+  ///
+  /// The GC values are then contiguous in the frame, and zero initializing
+  /// them in the post-pass takes a single block initialization. GC pointer
+  /// homes are left alone, since they may hold byrefs that must be reported
+  /// as interior pointers.
+  void packGcAllocas();
+
   /// Zero initialize a stack allocation
   void zeroInit(llvm::Value *Var);
 
-  /// Zero initialize the block.
+  /// Zero initialize the block. Small blocks are zeroed with a few stores.
   ///
-  /// \param Address Address of the block.
+  /// \param Address Address of the block, a stack allocation.
   /// \param Size Size of the block.
   void zeroInitBlock(llvm::Value *Address, uint64_t Size);
 
@@ -1506,6 +1778,33 @@ private:
                            llvm::Value *SourceAddress, bool IsVolatile,
                            ReaderAlignType Alignment = Reader_AlignNatural);
 
+  /// \brief Move a small block with a few loads and stores.
+  ///
+  /// Both addresses must already be known to be non-null. A block that is
+  /// copied must hold no GC pointers.
+  ///
+  /// \param DestinationAddress Address of the block to write.
+  /// \param SourceAddress      Address of the block to read, or nullptr to
+  ///                           zero the block.
+  /// \param Size               Size of the block in bytes.
+  /// \param Align              Known alignment of both blocks in bytes.
+  /// \param IsVolatile         true if the accesses are volatile.
+  /// \returns false, emitting nothing, if the block is too large to be worth
+  /// moving inline.
+  bool moveBlockInline(llvm::Value *DestinationAddress,
+                       llvm::Value *SourceAddress, uint64_t Size,
+                       uint32_t Align, bool IsVolatile);
+
+  /// \brief Copy the part of a struct at [Offset, Offset + Size) that holds
+  /// no GC pointers, inline if it is small enough.
+  void copyNonGCBlock(IRNode *Dst, IRNode *Src, uint32_t Offset,
+                      uint32_t Size, uint32_t Align, ReaderAlignType Alignment,
+                      bool IsVolatile);
+
+  /// \brief Get the alignment in bytes to assume for a block of type \p Ty,
+  /// or of unknown type if \p Ty is nullptr, given the alignment prefix.
+  uint32_t getBlockAlignment(llvm::Type *Ty, ReaderAlignType Alignment);
+
   void copyStruct(CORINFO_CLASS_HANDLE Class, IRNode *Dst, IRNode *Src,
                   ReaderAlignType Alignment, bool IsVolatile,
                   bool IsUnchecked) override;
@@ -1697,6 +1996,38 @@ private:
   IRNode *vectorGetItem(IRNode *VectorPointer, IRNode *Index,
                         CorInfoType ResType) override;
 
+  /// Sum the elements of a vector.
+  ///
+  /// \param Vector                    The vector to reduce.
+  /// \returns                         The sum, of the element type.
+  IRNode *vectorHorizontalAdd(IRNode *Vector);
+
+  /// Compute the Euclidean length of a floating-point vector.
+  ///
+  /// \param Vector                    The vector to measure.
+  /// \param IsSquared                 Return the square of the length if
+  ///                                  true.
+  /// \param ResType                   The type the caller returns.
+  /// \returns                         The length, or nullptr if Vector is
+  ///                                  not floating-point.
+  IRNode *vectorNorm(IRNode *Vector, bool IsSquared, CorInfoType ResType);
+
+  IRNode *vectorDot(IRNode *Vector1, IRNode *Vector2,
+                    CorInfoType ResType) override;
+  IRNode *vectorDistance(IRNode *Vector1, IRNode *Vector2, bool IsSquared,
+                         CorInfoType ResType) override;
+  IRNode *vectorLength(IRNode *VectorPointer, bool IsSquared,
+                       CorInfoType ResType) override;
+  IRNode *vectorConditionalSelect(IRNode *Mask, IRNode *Vector1,
+                                  IRNode *Vector2) override;
+  IRNode *vectorConvert(IRNode *Vector, CORINFO_CLASS_HANDLE ResultClass,
+                        bool IsSigned) override;
+  IRNode *vectorNarrow(IRNode *Vector1, IRNode *Vector2) override;
+  IRNode *vectorWiden(IRNode *Vector, IRNode *LowPointer, IRNode *HighPointer,
+                      bool IsSigned) override;
+  IRNode *vectorCopyTo(IRNode *VectorPointer, IRNode *Array,
+                       IRNode *Index) override;
+
   /// Get information corresponding to the handle.
   ///
   /// \param Class                     The handle to get a type for.
@@ -1734,7 +2065,30 @@ private:
   /// share code with the non-exceptional path.
   ///
   /// \param FinallyRegion  The region whose IR is to be cloned.
-  void cloneFinallyBody(EHRegion *FinallyRegion);
+  /// \param CopyBudget     Instructions that may still be spent on copies
+  ///                       of non-exceptional finally bodies for their
+  ///                       exits; reduced by the copies made.
+  void cloneFinallyBody(EHRegion *FinallyRegion, uint32_t &CopyBudget);
+
+  /// \brief Give exits of a non-exceptional finally body their own copies.
+  ///
+  /// Each non-exceptional entry to a finally stores the selector of its exit
+  /// and the body ends in a switch on it. When optimizing, entries with the
+  /// same selector are grouped, and a group gets its own copy of the body,
+  /// ending in a branch to its exit, if the body is small, or if it is not
+  /// too large and profile data shows the exit is hot. The other groups
+  /// keep sharing the body and its dispatch switch, which becomes a branch
+  /// if just one group is left to use it.
+  ///
+  /// \param CloneBlocks  Blocks of the non-exceptional finally body.
+  /// \param CloneHead    The block the non-exceptional entries target.
+  /// \param CloneSwitch  The dispatch switch that ends the body.
+  /// \param CopyBudget   Instructions that may still be spent on copies;
+  ///                     reduced by the copies made.
+  void specializeFinallyExits(llvm::ArrayRef<llvm::BasicBlock *> CloneBlocks,
+                              llvm::BasicBlock *CloneHead,
+                              llvm::SwitchInst *CloneSwitch,
+                              uint32_t &CopyBudget);
 
   /// Determine whether the IR generated for the given handler should be
   /// allowed to execute (as opposed to inserting a failfast at handler entry).
@@ -1745,6 +2099,7 @@ private:
 
 private:
   LLILCJitContext *JitContext;
+  ReaderArena TempArena; // Backs getTempMemory; released with the reader.
   ABIInfo *TheABIInfo;
   ReaderMethodSignature MethodSignature;
   ABIMethodSignature ABIMethodSig;
@@ -1761,18 +2116,36 @@ private:
   // insertion point parameters).
   llvm::IRBuilder<> *LLVMBuilder;
   llvm::DIBuilder *DBuilder;
-  std::map<CORINFO_CLASS_HANDLE, llvm::Type *> *ClassTypeMap;
-  std::map<llvm::Type *, CORINFO_CLASS_HANDLE> *ReverseClassTypeMap;
-  std::map<CORINFO_CLASS_HANDLE, llvm::Type *> *BoxedTypeMap;
-  std::map<std::tuple<CorInfoType, CORINFO_CLASS_HANDLE, uint32_t, bool>,
-           llvm::Type *> *ArrayTypeMap;
-  std::map<CORINFO_FIELD_HANDLE, uint32_t> *FieldIndexMap;
+  llvm::DenseMap<CORINFO_CLASS_HANDLE, llvm::Type *> *ClassTypeMap;
+  llvm::DenseMap<llvm::Type *, CORINFO_CLASS_HANDLE> *ReverseClassTypeMap;
+  llvm::DenseMap<CORINFO_CLASS_HANDLE, llvm::Type *> *BoxedTypeMap;
+  llvm::DenseMap<LLILCJitPerThreadState::ArrayTypeKey, llvm::Type *>
+      *ArrayTypeMap;
+  llvm::DenseMap<CORINFO_FIELD_HANDLE, uint32_t> *FieldIndexMap;
+  ClassLayoutCache *ClassLayouts; ///< Cache of the class layouts the EE
+                                  ///< reports; shared by all threads unless
+                                  ///< types may not be cached across methods.
+  std::unique_ptr<ClassLayoutCache> MethodClassLayouts; ///< Cache of class
+                                                        ///< layouts for just
+                                                        ///< this reader.
   llvm::StringMap<uint64_t> *NameToHandleMap; ///< Map from GlobalObject names
                                               ///< to handles corresponding to
                                               ///< those GlobalObjects.
   /// \brief Map from handles to global objects representing the handles.
   std::map<uint64_t, llvm::GlobalObject *> HandleToGlobalObjectMap;
+  /// \brief Map from jit helpers to what the EE reported about them.
+  std::map<CorInfoHelpFunc, JitHelperInfo> HelperInfoMap;
+  /// \brief Profile buffer of instrumented code, or nullptr.
+  ICorJitInfo::ProfileBuffer *BlockProfileBuffer;
+  /// \brief Execution counts from profile data, for the blocks they apply to.
+  llvm::DenseMap<llvm::BasicBlock *, uint64_t> BlockProfileCounts;
+  /// \brief Throw blocks shared by the conditional throws of optimized code,
+  /// by helper and by the EH region of the throwing code.
+  std::map<std::pair<CorInfoHelpFunc, EHRegion *>, llvm::BasicBlock *>
+      SharedThrowBlocks;
   std::map<llvm::BasicBlock *, FlowGraphNodeInfo> FlowGraphInfoMap;
+  /// \brief Map from the objects newobj allocated on the heap to their class.
+  llvm::DenseMap<llvm::Value *, CORINFO_CLASS_HANDLE> ExactClassMap;
   std::vector<llvm::Value *> LocalVars;
   llvm::Value *UnmanagedCallFrame; ///< If the method contains unmanaged calls,
                                    ///< this is the address of the unmanaged
@@ -1781,6 +2154,9 @@ private:
                                    ///< this is the address of the pointer to
                                    ///< the runtime thread.
   std::vector<CorInfoType> LocalVarCorTypes;
+  llvm::BitVector LocalsToZeroInit; ///< Locals the prolog zero initializes,
+                                    ///< GC locals included, which a tail
+                                    ///< recursive loop must zero again.
   std::vector<llvm::Value *> Arguments;
   llvm::Value *IndirectResult;
   llvm::DenseMap<uint32_t, llvm::StoreInst *> ContinuationStoreMap;
@@ -1829,6 +2205,13 @@ private:
                                                 ///< helper function.
                                                 ///< This constant is from the
                                                 ///< legacy jit.
+  /// Largest finally body, in instructions, copied for each of its exits.
+  static const uint32_t SmallFinallyCopySize = 24;
+  /// Largest finally body, in instructions, copied for a hot exit.
+  static const uint32_t HotFinallyCopySize = 96;
+  /// Most instructions spent on copies of finally bodies for one method.
+  static const uint32_t FinallyCopyBudget = 512;
+
   struct DebugInfo {
     llvm::DICompileUnit *TheCU;
     llvm::DIScope *FunctionScope;
@@ -30,7 +30,11 @@
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/DataTypes.h"
+#include <algorithm>
+#include <atomic>
 #include <stdarg.h>
+#include <thread>
+#include <vector>
 
 #define DllInterfaceExporter
 #include "coredistools.h"
@@ -38,6 +42,38 @@
 using namespace llvm;
 using namespace std;
 
+// Batch diffing interface. coredistools.h is owned by CoreCLR; these
+// declarations are to be mirrored there.
+
+// A pair of code blocks to compare.
+struct DiffBlockPair {
+  // Passed to the offset comparator for this pair.
+  const void *UserData;
+  const uint8_t *Address1;
+  const uint8_t *Bytes1;
+  size_t Size1;
+  const uint8_t *Address2;
+  const uint8_t *Bytes2;
+  size_t Size2;
+};
+
+// The outcome of comparing a pair of code blocks.
+struct DiffBlockResult {
+  // True if the blocks are identical up to the offset comparator.
+  bool IsEqual;
+  // False if either block could not be decoded to its end.
+  bool IsDecoded;
+  // Offset of the first mismatching instruction; Size1 if there is none.
+  size_t DiffOffset;
+  // Why the blocks differ, or nullptr if they do not.
+  const char *Reason;
+  // Size2 - Size1.
+  int64_t SizeDelta;
+  // Instructions in the second block minus those in the first. Prefixes
+  // are not counted as instructions.
+  int64_t InstructionCountDelta;
+};
+
 class BlockIterator;
 
 // Represents a Code block
@@ -158,7 +194,12 @@ public:
       : TheTargetArch(Target), Print(PControl) {}
 
   bool init();
-  bool decodeInstruction(BlockIterator &BIter, bool MayFail = false) const;
+  unique_ptr<MCDisassembler> createDecoder() const;
+  bool decodeInstruction(BlockIterator &BIter, bool MayFail = false,
+                         const MCDisassembler *Decoder = nullptr) const;
+  bool isPrefix(const BlockIterator &BIter) const;
+  bool countInstructions(BlockIterator &BIter, uint64_t &Count,
+                         const MCDisassembler *Decoder = nullptr) const;
   uint64_t disasmInstruction(BlockIterator &BIter, bool DumpAsm = false) const;
   void dumpInstruction(const BlockIterator &BIter) const;
   void dumpBlock(const BlockInfo &Block) const;
@@ -203,8 +244,14 @@ public:
 
   bool nearDiff(const BlockInfo &LeftBlock, const BlockInfo &RightBlock,
                 const void *UserData) const;
+  void diffBlocks(const BlockInfo &LeftBlock, const BlockInfo &RightBlock,
+                  const void *UserData, const MCDisassembler *Decoder,
+                  DiffBlockResult &Result) const;
 
 private:
+  const char *compareInstructions(const BlockIterator &Left,
+                                  const BlockIterator &Right,
+                                  const void *UserData) const;
   bool fail(const char *Mesg, const BlockIterator &Left,
             const BlockIterator &Right) const;
 
@@ -368,13 +415,25 @@ bool CorDisasm::init() {
   return true;
 }
 
-bool CorDisasm::decodeInstruction(BlockIterator &BIter, bool MayFail) const {
+// Creates another decoder for the target. A decoder keeps the comment
+// stream of the instruction it is decoding, so threads that decode at the
+// same time each need their own.
+unique_ptr<MCDisassembler> CorDisasm::createDecoder() const {
+  return unique_ptr<MCDisassembler>(
+      TheTarget->createMCDisassembler(*STI, *Ctx));
+}
+
+bool CorDisasm::decodeInstruction(BlockIterator &BIter, bool MayFail,
+                                  const MCDisassembler *Decoder) const {
   raw_ostream &CommentStream = nulls();
   raw_ostream &DebugOut = nulls();
   ArrayRef<uint8_t> ByteArray(BIter.Ptr, BIter.BlockSize);
+  if (Decoder == nullptr) {
+    Decoder = Disassembler.get();
+  }
   bool IsDecoded =
-      Disassembler->getInstruction(BIter.Inst, BIter.InstrSize, ByteArray,
-                                   BIter.Addr, DebugOut, CommentStream);
+      Decoder->getInstruction(BIter.Inst, BIter.InstrSize, ByteArray,
+                              BIter.Addr, DebugOut, CommentStream);
 
   if (!IsDecoded) {
     BIter.InstrSize = 0;
@@ -413,26 +472,54 @@ uint64_t CorDisasm::disasmInstruction(BlockIterator &BIter,
       dumpInstruction(BIter);
     }
 
-    ContinueDisasm = false;
-    if ((TheTargetArch == Target_X86) || (TheTargetArch == Target_X64)) {
-
-      // Check if the decoded instruction is a prefix byte, and if so,
-      // continue decoding.
-      if (Size == 1) {
-        for (uint8_t Pfx = 0; Pfx < X86NumPrefixes; Pfx++) {
-          if (BIter.Ptr[0] == X86Prefix[Pfx].MachineOpcode) {
-            ContinueDisasm = true;
-            BIter.advance();
-            break;
-          }
-        }
-      }
+    // Check if the decoded instruction is a prefix byte, and if so,
+    // continue decoding.
+    ContinueDisasm = isPrefix(BIter);
+    if (ContinueDisasm) {
+      BIter.advance();
     }
   } while (ContinueDisasm);
 
   return TotalSize;
 }
 
+bool CorDisasm::isPrefix(const BlockIterator &BIter) const {
+  assert(BIter.isDecoded() && "Cannot check before Decode");
+
+  if ((TheTargetArch != Target_X86) && (TheTargetArch != Target_X64)) {
+    return false;
+  }
+
+  if (BIter.InstrSize != 1) {
+    return false;
+  }
+
+  for (uint8_t Pfx = 0; Pfx < X86NumPrefixes; Pfx++) {
+    if (BIter.Ptr[0] == X86Prefix[Pfx].MachineOpcode) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Counts the instructions from the iterator to the end of its block,
+// leaving the iterator at the end. Returns false on a decode failure.
+bool CorDisasm::countInstructions(BlockIterator &BIter, uint64_t &Count,
+                                  const MCDisassembler *Decoder) const {
+  while (!BIter.isEmpty()) {
+    if (!decodeInstruction(BIter, true, Decoder)) {
+      return false;
+    }
+    if (!isPrefix(BIter)) {
+      Count++;
+    }
+    BIter.advance();
+  }
+
+  return true;
+}
+
 void CorDisasm::dumpInstruction(const BlockIterator &BIter) const {
   assert(BIter.isDecoded() && "Cannot print before Decode");
 
@@ -518,6 +605,11 @@ bool CorAsmDiff::nearDiff(const BlockInfo &LeftBlock,
     return false;
   }
 
+  // Identical blocks need no decoding.
+  if (memcmp(Left.Ptr, Right.Ptr, Left.BlockSize) == 0) {
+    return true;
+  }
+
   while (!Left.isEmpty() && !Right.isEmpty()) {
 
     decodeInstruction(Left);
@@ -537,75 +629,196 @@ bool CorAsmDiff::nearDiff(const BlockInfo &LeftBlock,
     // there are bugs or limitations in the user-supplied heuristics,
     // we don't want to count two Instructions as diffs if they are bitwise
     // identical.
-    if (Left.isBitwiseEqual(Right)) {
-      // Bytes are identical
-    } else {
-      // Compare field-wise
+    if (!Left.isBitwiseEqual(Right)) {
+      const char *Mesg = compareInstructions(Left, Right, UserData);
+      if (Mesg != nullptr) {
+        return fail(Mesg, Left, Right);
+      }
+    }
+
+    Left.advance();
+    Right.advance();
+  }
+
+  return true;
+}
+
+// Compares two decoded instructions of the same size field-wise.
+// Returns nullptr if they are equivalent, or a description of the mismatch.
+const char *CorAsmDiff::compareInstructions(const BlockIterator &Left,
+                                            const BlockIterator &Right,
+                                            const void *UserData) const {
+  const MCInst &InstL = Left.Inst;
+  const MCInst &InstR = Right.Inst;
+
+  if (InstL.getOpcode() != InstR.getOpcode()) {
+    return "OpCode Mismatch";
+  }
+
+  size_t numOperands = InstL.getNumOperands();
+
+  if (numOperands != InstR.getNumOperands()) {
+    return "Operand Count Mismatch";
+  }
+
+  for (size_t i = 0; i < numOperands; i++) {
+    const MCOperand &OperandL = InstL.getOperand(i);
+    const MCOperand &OperandR = InstR.getOperand(i);
+
+    if (OperandL.isExpr() || OperandR.isExpr() || OperandL.isInst() ||
+        OperandR.isInst()) {
+      return "Unexpected Operand Kind";
+    } else if (OperandL.isReg()) {
+      if (!OperandR.isReg()) {
+        return "Operand Kind Mismatch";
+      }
+
+      if (OperandL.getReg() != OperandR.getReg()) {
+        return "Operand Register Mismatch";
+      }
+    } else if (OperandL.isFPImm()) {
+      if (!OperandR.isFPImm()) {
+        return "Operand Kind Mismatch";
+      }
+
+      if (OperandL.getFPImm() != OperandR.getFPImm()) {
+        return "Operand FP value Mismatch";
+      }
+    } else if (OperandL.isImm()) {
+      if (!OperandR.isImm()) {
+        return "Operand Kind Mismatch";
+      }
 
-      const MCInst &InstL = Left.Inst;
-      const MCInst &InstR = Right.Inst;
+      int64_t ImmL = OperandL.getImm();
+      int64_t ImmR = OperandR.getImm();
 
-      if (InstL.getOpcode() != InstL.getOpcode()) {
-        return fail("OpCode Mismatch", Left, Right);
+      if (ImmL == ImmR) {
+        continue;
       }
 
-      size_t numOperands = InstL.getNumOperands();
+      if (Comparator(UserData, Left.BlockOffset(), Left.InstrSize, ImmL,
+                     ImmR)) {
+        // The client somehow thinks that these offsets are equivalent
+        continue;
+      }
+
+      return "Immediate Operand Value Mismatch";
+    }
+  }
+
+  return nullptr;
+}
 
-      if (numOperands != InstL.getNumOperands()) {
-        return fail("Operand Count Mismatch", Left, Right);
+// Returns the length of the common prefix of two byte ranges. Whole chunks
+// are compared with memcmp, which the C library vectorizes.
+static size_t findMismatch(const uint8_t *Left, const uint8_t *Right,
+                           size_t Size) {
+  const size_t ChunkSize = 64;
+  size_t Offset = 0;
+  while ((Offset + ChunkSize <= Size) &&
+         (memcmp(Left + Offset, Right + Offset, ChunkSize) == 0)) {
+    Offset += ChunkSize;
+  }
+  while ((Offset < Size) && (Left[Offset] == Right[Offset])) {
+    Offset++;
+  }
+  return Offset;
+}
+
+// Compares two code blocks like nearDiff, but reports the outcome in Result
+// rather than through the print controls, and also measures how the blocks
+// differ in size and instruction count.
+//
+// Identical bytes decode to identical instructions, so within a run of
+// identical bytes only the left block is decoded, to find the instruction
+// boundaries; both sides are decoded and compared field-wise only from the
+// instruction that contains a mismatching byte. Blocks that are bitwise
+// equal are not decoded at all.
+//
+// This method may run on several threads at once for one CorAsmDiff, given
+// a Decoder of its own from createDecoder on each thread. It calls the
+// comparator with UserData.
+void CorAsmDiff::diffBlocks(const BlockInfo &LeftBlock,
+                            const BlockInfo &RightBlock, const void *UserData,
+                            const MCDisassembler *Decoder,
+                            DiffBlockResult &Result) const {
+  BlockIterator Left(LeftBlock);
+  BlockIterator Right(RightBlock);
+
+  Result.IsEqual = true;
+  Result.IsDecoded = true;
+  Result.DiffOffset = Left.BlockSize;
+  Result.Reason = nullptr;
+  Result.SizeDelta = (int64_t)Right.BlockSize - (int64_t)Left.BlockSize;
+  Result.InstructionCountDelta = 0;
+
+  if (Left.BlockSize != Right.BlockSize) {
+    Result.IsEqual = false;
+    Result.Reason = "Code Size mismatch";
+  }
+
+  // End of the run of identical bytes that the cursor is in. It is only
+  // looked for again once the cursor has passed it, so each byte is
+  // compared once.
+  const uint8_t *RunEnd = nullptr;
+  while (!Left.isEmpty() && !Right.isEmpty()) {
+    if ((RunEnd == nullptr) || (Left.Ptr > RunEnd)) {
+      size_t Common = findMismatch(Left.Ptr, Right.Ptr,
+                                   min(Left.BlockSize, Right.BlockSize));
+      if ((Common == Left.BlockSize) && (Common == Right.BlockSize)) {
+        // The rest of the blocks is identical.
+        return;
       }
+      RunEnd = Left.Ptr + Common;
+    }
+
+    // Step over the instructions that lie within the identical run.
+    if (!decodeInstruction(Left, true, Decoder)) {
+      break;
+    }
+    if (Left.Ptr + Left.InstrSize <= RunEnd) {
+      Right.InstrSize = Left.InstrSize;
+      Left.advance();
+      Right.advance();
+      continue;
+    }
 
-      for (size_t i = 0; i < numOperands; i++) {
-        const MCOperand &OperandL = InstL.getOperand(i);
-        const MCOperand &OperandR = InstR.getOperand(i);
-
-        if (OperandL.isExpr() || OperandR.isExpr() || OperandL.isInst() ||
-            OperandR.isInst()) {
-          return fail("Unexpected Operand Kind", Left, Right);
-        } else if (OperandL.isReg()) {
-          if (!OperandR.isReg()) {
-            return fail("Operand Kind Mismatch", Left, Right);
-          }
-
-          if (OperandL.getReg() != OperandR.getReg()) {
-            return fail("Operand Register Mismatch", Left, Right);
-          }
-        } else if (OperandL.isFPImm()) {
-          if (!OperandR.isFPImm()) {
-            return fail("Operand Kind Mismatch", Left, Right);
-          }
-
-          if (OperandL.getFPImm() != OperandR.getFPImm()) {
-            return fail("Operand FP value Mismatch", Left, Right);
-          }
-        } else if (OperandL.isImm()) {
-          if (!OperandR.isImm()) {
-            return fail("Operand Kind Mismatch", Left, Right);
-          }
-
-          int64_t ImmL = OperandL.getImm();
-          int64_t ImmR = OperandR.getImm();
-
-          if (ImmL == ImmR) {
-            continue;
-          }
-
-          if (Comparator(UserData, Left.BlockOffset(), Left.InstrSize, ImmL,
-                         ImmR)) {
-            // The client somehow thinks that these offsets are equivalent
-            continue;
-          }
-
-          return fail("Immediate Operand Value Mismatch", Left, Right);
-        }
+    if (!decodeInstruction(Right, true, Decoder)) {
+      break;
+    }
+
+    const char *Mesg = nullptr;
+    if (Left.InstrSize != Right.InstrSize) {
+      Mesg = "Instruction Size Mismatch";
+    } else {
+      Mesg = compareInstructions(Left, Right, UserData);
+    }
+    if (Mesg != nullptr) {
+      if (Result.Reason == nullptr) {
+        Result.Reason = Mesg;
       }
+      Result.IsEqual = false;
+      Result.DiffOffset = Left.BlockOffset();
+      break;
     }
 
     Left.advance();
     Right.advance();
   }
 
-  return true;
+  // The instructions before this point pair up one to one, so only the
+  // rest of each block can differ in count.
+  uint64_t LeftCount = 0;
+  uint64_t RightCount = 0;
+  if (!countInstructions(Left, LeftCount, Decoder) ||
+      !countInstructions(Right, RightCount, Decoder)) {
+    Result.IsEqual = false;
+    Result.IsDecoded = false;
+    if (Result.Reason == nullptr) {
+      Result.Reason = "Decode Failure";
+    }
+  }
+  Result.InstructionCountDelta = (int64_t)RightCount - (int64_t)LeftCount;
 }
 
 bool BlockIterator::isBitwiseEqual(const BlockIterator &BIter) const {
@@ -672,6 +885,60 @@ DllIface bool NearDiffCodeBlocks(const CorAsmDiff *AsmDiff,
   return AsmDiff->nearDiff(Left, Right, UserData);
 }
 
+// Compares Count pairs of code blocks on a pool of ThreadCount threads
+// (0 means one per hardware thread), storing the outcome for Pairs[I] in
+// Results[I]. Nothing is printed. The comparator may be called on several
+// threads at once. Returns the number of pairs that are equal.
+DllIface size_t NearDiffCodeBlocksBatch(const CorAsmDiff *AsmDiff,
+                                        const DiffBlockPair *Pairs,
+                                        DiffBlockResult *Results, size_t Count,
+                                        unsigned ThreadCount) {
+  assert((AsmDiff != nullptr) && "Differ object Expected ");
+
+  if (ThreadCount == 0) {
+    ThreadCount = max(thread::hardware_concurrency(), 1u);
+  }
+  ThreadCount = (unsigned)min((size_t)ThreadCount, max(Count, (size_t)1));
+
+  // Decoders are not safe to share between threads, so each worker gets
+  // its own, made here before any of them runs.
+  vector<unique_ptr<MCDisassembler>> Decoders;
+  for (unsigned I = 0; I < ThreadCount; I++) {
+    Decoders.push_back(AsmDiff->createDecoder());
+  }
+
+  // Pairs vary widely in size, so workers take the next pair as they
+  // finish rather than a fixed share.
+  atomic<size_t> NextPair(0);
+  auto Worker = [&](const MCDisassembler *Decoder) {
+    for (size_t I = NextPair++; I < Count; I = NextPair++) {
+      const DiffBlockPair &Pair = Pairs[I];
+      BlockInfo Left(Pair.Bytes1, Pair.Size1, (uintptr_t)Pair.Address1,
+                     "Left");
+      BlockInfo Right(Pair.Bytes2, Pair.Size2, (uintptr_t)Pair.Address2,
+                      "Right");
+      AsmDiff->diffBlocks(Left, Right, Pair.UserData, Decoder, Results[I]);
+    }
+  };
+
+  vector<thread> Workers;
+  for (unsigned I = 1; I < ThreadCount; I++) {
+    Workers.emplace_back(Worker, Decoders[I].get());
+  }
+  Worker(Decoders[0].get());
+  for (thread &W : Workers) {
+    W.join();
+  }
+
+  size_t EqualCount = 0;
+  for (size_t I = 0; I < Count; I++) {
+    if (Results[I].IsEqual) {
+      EqualCount++;
+    }
+  }
+  return EqualCount;
+}
+
 DllIface void DumpCodeBlock(const CorDisasm *Disasm, const uint8_t *Address,
                             const uint8_t *Bytes, size_t Size) {
   BlockInfo Block(Bytes, Size, (uintptr_t)Address);
@@ -22,8 +22,14 @@
 #include "llvm/Object/StackMapParser.h"
 #include "llvm/CodeGen/MachineFrameInfo.h"
 #include "llvm/CodeGen/WinEHFuncInfo.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCDisassembler/MCDisassembler.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/Support/TargetRegistry.h"
 #include "llvm/Target/TargetSubtargetInfo.h"
 #include "llvm/Target/TargetFrameLowering.h"
+#include <algorithm>
 
 using namespace llvm;
 
@@ -161,6 +167,7 @@ GcFuncInfo::GcFuncInfo(const llvm::Function *F) {
   GenericsContextParamType = GENERIC_CONTEXTPARAM_NONE;
   PSPSymOffset = 0;
   HasFunclets = false;
+  OutgoingAreaSize = 0;
 }
 
 void GcFuncInfo::recordAlloca(const AllocaInst *Alloca) {
@@ -306,6 +313,7 @@ bool GcInfoRecorder::runOnMachineFunction(MachineFunction &MF) {
 #endif // !NDEBUG
 
   const MachineFrameInfo *FrameInfo = MF.getFrameInfo();
+  GcFuncInfo->OutgoingAreaSize = FrameInfo->getMaxCallFrameSize();
   int ObjectIndexBegin = FrameInfo->getObjectIndexBegin();
   int ObjectIndexEnd = FrameInfo->getObjectIndexEnd();
 
@@ -403,11 +411,13 @@ bool GcInfoRecorder::runOnMachineFunction(MachineFunction &MF) {
 //-------------------------------GcInfoEmitter-----------------------------------
 
 GcInfoEmitter::GcInfoEmitter(LLILCJitContext *JitCtx, uint8_t *StackMapData,
-                             GcInfoAllocator *Allocator)
+                             GcInfoAllocator *Allocator,
+                             const uint8_t *HotCode)
 
-    : JitContext(JitCtx), LLVMStackMapData(StackMapData),
+    : JitContext(JitCtx), LLVMStackMapData(StackMapData), HotCode(HotCode),
       Encoder(JitContext->JitInfo, JitContext->MethodInfo, Allocator),
-      SlotMap(), FirstTrackedSlot(0), NumTrackedSlots(0) {
+      CallSiteSizeMap(), SlotMap(), FirstTrackedSlot(0), NumTrackedSlots(0),
+      Emitted(), NumEmitted(0) {
 #if !defined(NDEBUG)
   this->EmitLogs = JitContext->Options->LogGcInfo;
 #endif // !NDEBUG
@@ -417,37 +427,58 @@ GcInfoEmitter::GcInfoEmitter(LLILCJitContext *JitCtx, uint8_t *StackMapData,
 #endif // defined(PARTIALLY_INTERRUPTIBLE_GC_SUPPORTED)
 }
 
-void GcInfoEmitter::encodeHeader(const GcFuncInfo *GcFuncInfo) {
+void GcInfoEmitter::getHeader(const GcFuncInfo *GcFuncInfo,
+                              GcInfoHeader &Header) {
   const Function *F = GcFuncInfo->Function;
 
+  Header.HasFunclets = GcFuncInfo->HasFunclets;
+  Header.PSPSymOffset = GcFuncInfo->PSPSymOffset;
+  Header.IsFPBased = GcInfo::isFPBasedFunction(F);
+  Header.IsVarArg = F->isVarArg();
+  Header.CodeLength = getCodeLength();
+  Header.OutgoingAreaSize = GcFuncInfo->OutgoingAreaSize;
+}
+
+uint32_t GcInfoEmitter::getCodeLength() {
+  // JitContext->HotCodeSize is the size of the allocated code block, which
+  // may include padding after the method's code.
+  if (JitContext->CodeLength != 0) {
+    return JitContext->CodeLength;
+  }
+  return JitContext->HotCodeSize;
+}
+
+void GcInfoEmitter::encodeHeader(const GcFuncInfo *GcFuncInfo) {
 #if !defined(NDEBUG)
   if (EmitLogs) {
-    dbgs() << "GcTable for Function: " << F->getName() << "\n";
+    dbgs() << "GcTable for Function: " << GcFuncInfo->Function->getName()
+           << "\n";
   }
 #endif // !NDEBUG
 
-  if (GcFuncInfo->HasFunclets) {
+  getHeader(GcFuncInfo, Emitted.Header);
+  encodeHeader(Emitted.Header);
+}
+
+void GcInfoEmitter::encodeHeader(const GcInfoHeader &Header) {
+  if (Header.HasFunclets) {
     Encoder.SetWantsReportOnlyLeaf();
-    Encoder.SetPSPSymStackSlot(GcFuncInfo->PSPSymOffset);
+    Encoder.SetPSPSymStackSlot(Header.PSPSymOffset);
 #if !defined(NDEBUG)
     if (EmitLogs) {
-      dbgs() << "Has funclets, PSP Slot: " << GcFuncInfo->PSPSymOffset << "\n";
+      dbgs() << "Has funclets, PSP Slot: " << Header.PSPSymOffset << "\n";
     }
 #endif // !NDEBUG
   }
 
-  // TODO: Set Code Length accurately.
-  // https://github.com/dotnet/llilc/issues/679
-  // JitContext->HotCodeSize is the size of the allocated code block.
-  // It is not the actual length of the current function's code.
-  Encoder.SetCodeLength(JitContext->HotCodeSize);
+  Encoder.SetCodeLength(Header.CodeLength);
 #if !defined(NDEBUG)
   if (EmitLogs) {
-    dbgs() << "  Size: " << JitContext->HotCodeSize << "\n";
+    dbgs() << "  Size: " << Header.CodeLength << "\n";
   }
 #endif // !NDEBUG
 
-  if (GcInfo::isFPBasedFunction(F)) {
+  if (Header.IsFPBased) {
     Encoder.SetStackBaseRegister(REGNUM_FPBASE);
 #if !defined(NDEBUG)
     if (EmitLogs) {
@@ -462,18 +493,17 @@ void GcInfoEmitter::encodeHeader(const GcFuncInfo *GcFuncInfo) {
 #endif // !NDEBUG
   }
 
-  if (GcFuncInfo->Function->isVarArg()) {
+  if (Header.IsVarArg) {
     Encoder.SetIsVarArg();
   }
 
 #if defined(FIXED_STACK_PARAMETER_SCRATCH_AREA)
-  // TODO: Set size of outgoing/scratch area accurately
-  // https://github.com/dotnet/llilc/issues/681
-  const unsigned ScratchAreaSize = 0;
-  Encoder.SetSizeOfStackOutgoingAndScratchArea(ScratchAreaSize);
+  // The largest call frame reserved by the prolog, including any home
+  // area for register arguments.
+  Encoder.SetSizeOfStackOutgoingAndScratchArea(Header.OutgoingAreaSize);
 #if !defined(NDEBUG)
   if (EmitLogs) {
-    dbgs() << "  Scratch Area Size: " << ScratchAreaSize << "\n";
+    dbgs() << "  Scratch Area Size: " << Header.OutgoingAreaSize << "\n";
   }
 #endif // !NDEBUG
 #endif // defined(FIXED_STACK_PARAMETER_SCRATCH_AREA)
@@ -507,29 +537,16 @@ void GcInfoEmitter::encodeTrackedPointers(const GcFuncInfo *GcFuncInfo) {
   CallSiteSizes = new BYTE[NumCallSites];
 #endif // defined(PARTIALLY_INTERRUPTIBLE_GC_SUPPORTED)
 
-  // TODO: Determine call-site-size accurately
-  // https://github.com/Microsoft/llvm/issues/56
-  // Call-site size is not available in LLVM's StackMap v1, so just make up
-  // a value for now. The Call-instruction generated by LLILC on X86/X64
-  // is typically Call [rax], which has a two-byte encoding.
-  //
-  // Any size > 0 can be reported as CallSizeSize, see explanation below.
-  //
   // CoreCLR's API expects that we report:
   // (a) the offset at the beginning of the Call instruction, and
   // (b) size of the call instruction.
   //
-  // LLVM's stackMap currently only reports:
+  // LLVM's stackMap (v1) only reports:
   // (c) the offset at the safepoint after the call instruction (= a+b)
   //
-  // When not in a fully-intrruptible block, CoreCLR only
-  // uses the value of (a+b) to determine the end of the call
-  // instruction. Therefore, we simply report a = c-2 and b = 2 for now.
-  //
-  // Once call-size size is available in LLVM StackMap v2, we can remove this
-  // implementation specific workaround.
-
-  const uint8_t CallSiteSize = 2;
+  // So the call instructions are found by decoding the method's code, and
+  // (b) is the size of the call ending at (c).
+  computeCallSiteSizes();
 
   // LLVM StackMap records all live-pointers per Safepoint, whereas
   // CoreCLR's GCTables record pointer birth/deaths per Safepoint.
@@ -546,6 +563,8 @@ void GcInfoEmitter::encodeTrackedPointers(const GcFuncInfo *GcFuncInfo) {
   size_t RecordIndex = 0;
   for (const auto &R : StackMapParser.records()) {
 
+    uint8_t CallSiteSize = getCallSiteSize(R.getInstructionOffset());
+
     // InstructionOffset - CallSiteSize:
     //   to report the start of the Instruction
     //
@@ -576,7 +595,11 @@ void GcInfoEmitter::encodeTrackedPointers(const GcFuncInfo *GcFuncInfo) {
       case StackMapParserType::LocationKind::Register:
         // TODO: Report Live - GC values in Registers
         // https://github.com/dotnet/llilc/issues/474
-        // Live gc-pointers are currently spilled to the stack at Safepoints.
+        // The statepoint lowering of the LLVM the jit is built against
+        // spills every live gc-pointer to the stack at Safepoints, so no
+        // register locations are expected. Reporting them, through the
+        // encoder's register slots, is only worth doing once that lowering
+        // can keep gc-pointers in callee-saved registers.
         assert(false && "GC-Pointer Live in Register");
         break;
 
@@ -625,14 +648,14 @@ void GcInfoEmitter::encodeTrackedPointers(const GcFuncInfo *GcFuncInfo) {
           LiveStream << "  +" << SlotID;
         }
 #endif // !NDEBUG
-        Encoder.SetSlotState(InstructionOffset, SlotID, GC_SLOT_LIVE);
+        setSlotState(InstructionOffset, SlotID, GC_SLOT_LIVE);
       } else if (OldLiveSet[SlotID] && !NewLiveSet[SlotID]) {
 #if !defined(NDEBUG)
         if (EmitLogs) {
           LiveStream << "  -" << SlotID;
         }
 #endif // !NDEBUG
-        Encoder.SetSlotState(InstructionOffset, SlotID, GC_SLOT_DEAD);
+        setSlotState(InstructionOffset, SlotID, GC_SLOT_DEAD);
       }
 
       OldLiveSet[SlotID] = NewLiveSet[SlotID];
@@ -721,6 +744,7 @@ void GcInfoEmitter::encodeGcAggregate(const AllocaInst *Alloca,
 void GcInfoEmitter::finalizeEncoding() {
   // Finalize Slot IDs to enable compact representation
   Encoder.FinalizeSlotIds();
+  Emitted.ReportsPointers = true;
 
 #if defined(PARTIALLY_INTERRUPTIBLE_GC_SUPPORTED)
   // Encode Call-sites
@@ -728,12 +752,15 @@ void GcInfoEmitter::finalizeEncoding() {
   assert(CallSites != nullptr);
   assert(NumCallSites > 0);
   Encoder.DefineCallSites(CallSites, CallSiteSizes, NumCallSites);
+  Emitted.CallSites.assign(CallSites, CallSites + NumCallSites);
+  Emitted.CallSiteSizes.assign(CallSiteSizes, CallSiteSizes + NumCallSites);
 #endif // defined(PARTIALLY_INTERRUPTIBLE_GC_SUPPORTED)
 }
 
 void GcInfoEmitter::emitEncoding() {
   Encoder.Build();
   Encoder.Emit();
+  NumEmitted++;
 
 #if !defined(NDEBUG)
   if (EmitLogs) {
@@ -743,6 +770,56 @@ void GcInfoEmitter::emitEncoding() {
 #endif // !NDEBUG
 }
 
+void GcInfoEmitter::computeCallSiteSizes() {
+  const TargetMachine *TM = JitContext->TM;
+  if ((HotCode == nullptr) || (TM == nullptr) || !CallSiteSizeMap.empty()) {
+    return;
+  }
+
+  const Target &TheTarget = TM->getTarget();
+  MCContext Context(TM->getMCAsmInfo(), TM->getMCRegisterInfo(), nullptr);
+  std::unique_ptr<MCDisassembler> Disassembler(
+      TheTarget.createMCDisassembler(*TM->getMCSubtargetInfo(), Context));
+  const MCInstrInfo *InstrInfo = TM->getMCInstrInfo();
+  if (Disassembler == nullptr) {
+    return;
+  }
+
+  // The code is decoded linearly from the start; the method's code and its
+  // funclets hold no data, so this finds every instruction.
+  ArrayRef<uint8_t> Code(HotCode, getCodeLength());
+  uint64_t Offset = 0;
+  while (Offset < Code.size()) {
+    MCInst Inst;
+    uint64_t Size = 0;
+    MCDisassembler::DecodeStatus Status = Disassembler->getInstruction(
+        Inst, Size, Code.slice(Offset), Offset, nulls(), nulls());
+    if ((Status != MCDisassembler::Success) || (Size == 0)) {
+      // Padding that does not decode; resynchronize at the next byte.
+      Offset++;
+      continue;
+    }
+
+    if (InstrInfo->get(Inst.getOpcode()).isCall()) {
+      CallSiteSizeMap[Offset + Size] = (uint8_t)Size;
+    }
+    Offset += Size;
+  }
+}
+
+uint8_t GcInfoEmitter::getCallSiteSize(uint32_t ReturnOffset) {
+  DenseMap<uint32_t, uint8_t>::const_iterator Iterator =
+      CallSiteSizeMap.find(ReturnOffset);
+  if (Iterator != CallSiteSizeMap.end()) {
+    return Iterator->second;
+  }
+
+  // When not in a fully-interruptible block, CoreCLR only uses the end of
+  // the call instruction, so any size > 0 works. The call instructions
+  // generated by LLILC on X86/X64 are at least two bytes long.
+  return 2;
+}
+
 GcInfoEmitter::~GcInfoEmitter() {
 #if defined(PARTIALLY_INTERRUPTIBLE_GC_SUPPORTED)
   delete CallSites;
@@ -776,6 +853,42 @@ void GcInfoEmitter::emitGCInfo() {
   }
 }
 
+void GcInfoEmitter::emitGCInfo(const GcInfoRecord &Record) {
+  Emitted.Header = Record.Header;
+  encodeHeader(Record.Header);
+
+  if (Record.ReportsPointers) {
+    // Slots are numbered in the order they are defined, so the slot IDs in
+    // the recorded states still hold.
+    for (const GcSlotRecord &Slot : Record.Slots) {
+      getSlot(Slot.Offset, (GcSlotFlags)Slot.Flags);
+    }
+    for (const GcSlotStateRecord &State : Record.SlotStates) {
+      setSlotState(State.CodeOffset, State.SlotID, (GcSlotState)State.State);
+    }
+#if defined(PARTIALLY_INTERRUPTIBLE_GC_SUPPORTED)
+    NumCallSites = Record.CallSites.size();
+    CallSites = new unsigned[NumCallSites];
+    CallSiteSizes = new BYTE[NumCallSites];
+    std::copy(Record.CallSites.begin(), Record.CallSites.end(), CallSites);
+    std::copy(Record.CallSiteSizes.begin(), Record.CallSiteSizes.end(),
+              CallSiteSizes);
+#endif // defined(PARTIALLY_INTERRUPTIBLE_GC_SUPPORTED)
+    finalizeEncoding();
+  }
+
+  emitEncoding();
+}
+
+bool GcInfoEmitter::getEmittedRecord(GcInfoRecord &Record) {
+  if (NumEmitted != 1) {
+    return false;
+  }
+
+  Record = Emitted;
+  return true;
+}
+
 bool GcInfoEmitter::needsGCInfo(const Function *F) {
   return !F->isDeclaration() && GcInfo::isGcFunction(F);
 }
@@ -797,6 +910,7 @@ GcSlotId GcInfoEmitter::getSlot(const int32_t Offset, const GcSlotFlags Flags) {
 
   GcSlotId SlotID = Encoder.GetStackSlotId(Offset, Flags, GC_SP_REL);
   SlotMap[Offset] = SlotID;
+  Emitted.Slots.push_back({Offset, (uint32_t)Flags});
 
   assert(SlotID == (SlotMap.size() - 1) && "SlotIDs dis-contiguous");
 
@@ -817,7 +931,8 @@ GcSlotId GcInfoEmitter::getTrackedSlot(const int32_t Offset) {
   // TODO: Identify Object and Managed pointers differently
   // https://github.com/dotnet/llilc/issues/28
   // We currently conservatively describe all slots as containing
-  // interior pointers
+  // interior pointers. Objects allocated on the stack rely on this: their
+  // references are live at safepoints and point outside of the heap.
   const GcSlotFlags ManagedPointerFlags = (GcSlotFlags)GC_SLOT_INTERIOR;
   GcSlotId SlotID = getSlot(Offset, ManagedPointerFlags);
   NumTrackedSlots++;
@@ -844,3 +959,10 @@ GcSlotId GcInfoEmitter::getUntrackedSlot(const int32_t Offset, bool IsPinned,
 
   return SlotID;
 }
+
+void GcInfoEmitter::setSlotState(const uint32_t CodeOffset,
+                                 const GcSlotId SlotID,
+                                 const GcSlotState State) {
+  Encoder.SetSlotState(CodeOffset, SlotID, State);
+  Emitted.SlotStates.push_back({CodeOffset, SlotID, (uint32_t)State});
+}
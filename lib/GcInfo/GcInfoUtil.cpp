@@ -15,6 +15,7 @@
 
 #include <stdint.h>
 #include "GcInfoUtil.h"
+#include "Reader/arena.h"
 
 //*****************************************************************************
 //  GcInfoAllocator
@@ -22,6 +23,25 @@
 
 int GcInfoAllocator::ZeroLengthAlloc = 0;
 
+void *GcInfoAllocator::Alloc(size_t sz) {
+  if (sz == 0) {
+    return (void *)(&ZeroLengthAlloc);
+  }
+
+  if (Arena != nullptr) {
+    return Arena->allocate(sz);
+  }
+
+  return ::operator new(sz);
+}
+
+void GcInfoAllocator::Free(void *p) {
+  // Arena memory is freed when the arena is released.
+  if ((p != (void *)(&ZeroLengthAlloc)) && (Arena == nullptr)) {
+    ::operator delete(p);
+  }
+}
+
 //*****************************************************************************
 //  Utility Functions
 //*****************************************************************************
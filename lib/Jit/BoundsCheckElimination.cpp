@@ -0,0 +1,403 @@
+//===---- lib/Jit/BoundsCheckElimination.cpp --------------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Implementation of the array bounds check elimination pass.
+///
+/// The reader guards each array element access with `icmp uge Index,
+/// Length` and a branch to a block that throws IndexOutOfRangeException.
+/// This pass removes the checks that always pass, and versions loops so that
+/// the checks of their induction variables are made once, in front of the
+/// loop, rather than on every iteration. The branches to the throw blocks
+/// are left with constant conditions for CFG simplification to remove.
+///
+//===----------------------------------------------------------------------===//
+
+#include "BoundsCheckElimination.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/Pass.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+using namespace llvm;
+
+namespace {
+
+/// \brief A bounds check of an induction variable in a loop.
+struct InductionCheck {
+  ICmpInst *Check;        ///< The check's compare.
+  const SCEV *Start;      ///< 32 bit index on the first iteration.
+  bool IsIncreasing;      ///< True if the index steps by 1, false if by -1.
+  const SCEV *Length;     ///< Loop-invariant length the index is checked to.
+  bool IsOnLastIteration; ///< True if the check also runs on the iteration
+                          ///< that exits the loop.
+};
+
+class BoundsCheckElimination : public FunctionPass {
+public:
+  static char ID;
+
+  BoundsCheckElimination() : FunctionPass(ID) {
+    PassRegistry &Registry = *PassRegistry::getPassRegistry();
+    initializeDominatorTreeWrapperPassPass(Registry);
+    initializeLoopInfoWrapperPassPass(Registry);
+    initializeScalarEvolutionWrapperPassPass(Registry);
+    initializeLoopSimplifyPass(Registry);
+    initializeLCSSAPass(Registry);
+  }
+
+  const char *getPassName() const override {
+    return "LLILC bounds check elimination";
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.addRequiredID(LoopSimplifyID);
+    AU.addRequiredID(LCSSAID);
+  }
+
+  bool runOnFunction(Function &F) override;
+
+private:
+  /// Check whether scalar evolution proves that a check always passes.
+  bool isKnownInBounds(ICmpInst *Check);
+
+  /// Make a check pass unconditionally.
+  void removeCheck(ICmpInst *Check);
+
+  /// Describe a check in \p L of an index that steps by one.
+  /// \returns false if the check is not of that form.
+  bool getInductionCheck(ICmpInst *Check, Loop *L, bool IsBottomTested,
+                         InductionCheck &Result);
+
+  /// Version \p L on the range of its induction variable checks.
+  /// \returns true if the loop was versioned.
+  bool versionLoop(Loop *L);
+
+  /// Get the expression for the last iteration a check runs on, given the
+  /// number of times the backedge is taken before the loop exits.
+  const SCEV *getLastIteration(const InductionCheck &Check,
+                               const SCEV *ExitCount, Type *Ty);
+
+  /// Largest loop, in instructions, that is versioned.
+  static const unsigned MaxVersionedLoopSize = 256;
+
+  unsigned BoundsCheckKind; ///< Kind of the bounds check metadata.
+  Function *TheFunction;    ///< Function being optimized.
+  DominatorTree *DT;
+  LoopInfo *LI;
+  ScalarEvolution *SE;
+};
+
+} // end anonymous namespace
+
+char BoundsCheckElimination::ID = 0;
+
+FunctionPass *createBoundsCheckEliminationPass() {
+  return new BoundsCheckElimination();
+}
+
+// Collect the innermost loops in a loop nest.
+static void collectInnermostLoops(Loop *L, SmallVectorImpl<Loop *> &Loops) {
+  if (L->empty()) {
+    Loops.push_back(L);
+    return;
+  }
+  for (Loop *SubLoop : *L) {
+    collectInnermostLoops(SubLoop, Loops);
+  }
+}
+
+// Check whether a loop exit only throws. The reader's throw blocks call a
+// throw helper and end in unreachable; loop simplification gives one that
+// is shared with code outside the loop a dedicated exit that branches to it.
+static bool isThrowBlock(BasicBlock *Block) {
+  SmallPtrSet<BasicBlock *, 4> Visited;
+  TerminatorInst *Terminator = Block->getTerminator();
+  while (isa<BranchInst>(Terminator) &&
+         cast<BranchInst>(Terminator)->isUnconditional() &&
+         Visited.insert(Block).second) {
+    Block = Terminator->getSuccessor(0);
+    Terminator = Block->getTerminator();
+  }
+  return isa<UnreachableInst>(Terminator);
+}
+
+bool BoundsCheckElimination::runOnFunction(Function &F) {
+  BoundsCheckKind = F.getContext().getMDKindID(getBoundsCheckMDName());
+  SmallVector<ICmpInst *, 16> Checks;
+  for (BasicBlock &Block : F) {
+    for (Instruction &Instr : Block) {
+      if (Instr.getMetadata(BoundsCheckKind) != nullptr) {
+        Checks.push_back(cast<ICmpInst>(&Instr));
+      }
+    }
+  }
+  if (Checks.empty()) {
+    return false;
+  }
+
+  TheFunction = &F;
+  DT = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+  LI = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+  SE = &getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+
+  bool Changed = false;
+  for (ICmpInst *Check : Checks) {
+    if (isKnownInBounds(Check)) {
+      removeCheck(Check);
+      Changed = true;
+    }
+  }
+
+  SmallVector<Loop *, 8> Loops;
+  for (Loop *L : *LI) {
+    collectInnermostLoops(L, Loops);
+  }
+  for (Loop *L : Loops) {
+    Changed |= versionLoop(L);
+  }
+
+  return Changed;
+}
+
+bool BoundsCheckElimination::isKnownInBounds(ICmpInst *Check) {
+  assert(Check->getPredicate() == ICmpInst::ICMP_UGE);
+  return SE->isKnownPredicate(ICmpInst::ICMP_ULT,
+                              SE->getSCEV(Check->getOperand(0)),
+                              SE->getSCEV(Check->getOperand(1)));
+}
+
+void BoundsCheckElimination::removeCheck(ICmpInst *Check) {
+  SE->forgetValue(Check);
+  Check->replaceAllUsesWith(ConstantInt::getFalse(Check->getContext()));
+  Check->eraseFromParent();
+}
+
+bool BoundsCheckElimination::getInductionCheck(ICmpInst *Check, Loop *L,
+                                               bool IsBottomTested,
+                                               InductionCheck &Result) {
+  // The reader zero-extends 32 bit indices to the width of the length, so
+  // negative indices fail the unsigned compare. Restricting the index to 32
+  // bits lets the range test below be made without overflow.
+  ZExtInst *Index = dyn_cast<ZExtInst>(Check->getOperand(0));
+  if ((Index == nullptr) || !Index->getSrcTy()->isIntegerTy(32)) {
+    return false;
+  }
+
+  const SCEVAddRecExpr *Recurrence =
+      dyn_cast<SCEVAddRecExpr>(SE->getSCEV(Index->getOperand(0)));
+  if ((Recurrence == nullptr) || (Recurrence->getLoop() != L) ||
+      !Recurrence->isAffine()) {
+    return false;
+  }
+  const SCEVConstant *Step =
+      dyn_cast<SCEVConstant>(Recurrence->getStepRecurrence(*SE));
+  if (Step == nullptr) {
+    return false;
+  }
+  int64_t StepValue = Step->getValue()->getSExtValue();
+  if ((StepValue != 1) && (StepValue != -1)) {
+    return false;
+  }
+
+  const SCEV *Length = SE->getSCEV(Check->getOperand(1));
+  if (!SE->isLoopInvariant(Length, L)) {
+    return false;
+  }
+
+  Result.Check = Check;
+  Result.Start = Recurrence->getStart();
+  Result.IsIncreasing = (StepValue == 1);
+  Result.Length = Length;
+  Result.IsOnLastIteration =
+      IsBottomTested || (Check->getParent() == L->getHeader());
+  return true;
+}
+
+const SCEV *BoundsCheckElimination::getLastIteration(
+    const InductionCheck &Check, const SCEV *ExitCount, Type *Ty) {
+  // The backedge is taken ExitCount times. A bottom tested loop runs all of
+  // its blocks once more than that; a top tested loop exits from the header,
+  // so the blocks after the exit test run one time fewer. If the result
+  // wraps to -1 the checks never run, so any range test is correct.
+  const SCEV *LastIteration = SE->getNoopOrZeroExtend(ExitCount, Ty);
+  if (!Check.IsOnLastIteration) {
+    LastIteration = SE->getMinusSCEV(LastIteration, SE->getConstant(Ty, 1));
+  }
+  return LastIteration;
+}
+
+bool BoundsCheckElimination::versionLoop(Loop *L) {
+  // Versioning needs a preheader to put the range test in, and a single
+  // exit for the two versions of the loop to rejoin at. Each check still in
+  // the loop adds an exit to a throw block; those exits are not counted,
+  // since both versions of the loop share the throw blocks.
+  if (!L->isLoopSimplifyForm()) {
+    return false;
+  }
+  SmallVector<BasicBlock *, 8> ExitBlocks;
+  L->getUniqueExitBlocks(ExitBlocks);
+  BasicBlock *Exit = nullptr;
+  for (BasicBlock *Block : ExitBlocks) {
+    if (isThrowBlock(Block)) {
+      continue;
+    }
+    if (Exit != nullptr) {
+      return false;
+    }
+    Exit = Block;
+  }
+  if (Exit == nullptr) {
+    return false;
+  }
+  BasicBlock *Exiting = Exit->getSinglePredecessor();
+  if ((Exiting == nullptr) || !L->contains(Exiting)) {
+    return false;
+  }
+  bool IsBottomTested = (Exiting == L->getLoopLatch());
+  if (!IsBottomTested && (Exiting != L->getHeader())) {
+    return false;
+  }
+
+  // The loop's backedge taken count would take the exits to the throw blocks
+  // into account, and with them the very checks being removed. The range
+  // test is instead made for the iterations up to the loop's own exit; if
+  // they are all in range, no exit to a bounds check's throw block is taken.
+  const SCEV *ExitCount = SE->getExitCount(L, Exiting);
+  if (isa<SCEVCouldNotCompute>(ExitCount)) {
+    return false;
+  }
+
+  unsigned LoopSize = 0;
+  SmallVector<InductionCheck, 4> Checks;
+  for (BasicBlock *Block : L->blocks()) {
+    LoopSize += Block->size();
+    for (Instruction &Instr : *Block) {
+      if (Instr.getMetadata(BoundsCheckKind) == nullptr) {
+        continue;
+      }
+      InductionCheck Check;
+      if (getInductionCheck(cast<ICmpInst>(&Instr), L, IsBottomTested,
+                            Check)) {
+        Checks.push_back(Check);
+      }
+    }
+  }
+  if (Checks.empty() || (LoopSize > MaxVersionedLoopSize)) {
+    return false;
+  }
+
+  // Work out the range test before changing anything.
+  SmallVector<const SCEV *, 8> Bounds;
+  for (const InductionCheck &Check : Checks) {
+    Type *Ty = Check.Check->getOperand(1)->getType();
+    const SCEV *Start = SE->getZeroExtendExpr(Check.Start, Ty);
+    const SCEV *LastIteration = getLastIteration(Check, ExitCount, Ty);
+    if (Check.IsIncreasing) {
+      // Start + LastIteration <u Length covers every iteration, and since
+      // the length is below 2^31 the 32 bit index can't wrap.
+      Bounds.push_back(SE->getAddExpr(Start, LastIteration));
+      Bounds.push_back(Check.Length);
+    } else {
+      // LastIteration <=u Start keeps the index from going below zero, and
+      // Start <u Length covers the first iteration, where it is largest.
+      Bounds.push_back(LastIteration);
+      Bounds.push_back(SE->getAddExpr(Start, SE->getConstant(Ty, 1)));
+      Bounds.push_back(Start);
+      Bounds.push_back(Check.Length);
+    }
+  }
+  for (const SCEV *Bound : Bounds) {
+    if (!isSafeToExpand(Bound, *SE)) {
+      return false;
+    }
+  }
+
+  // The preheader becomes the block with the range test, and a new
+  // preheader is split off for each version of the loop.
+  BasicBlock *TestBlock = L->getLoopPreheader();
+  BasicBlock *Preheader =
+      SplitBlock(TestBlock, TestBlock->getTerminator(), DT, LI);
+  Instruction *TestTerminator = TestBlock->getTerminator();
+
+  // Every pair of bounds must be in increasing order.
+  SCEVExpander Expander(*SE, TheFunction->getParent()->getDataLayout(),
+                        "boundscheck");
+  IRBuilder<> Builder(TestTerminator);
+  Value *InRange = nullptr;
+  for (unsigned I = 0; I < Bounds.size(); I += 2) {
+    Value *Lower = Expander.expandCodeFor(Bounds[I], Bounds[I]->getType(),
+                                          TestTerminator);
+    Value *Upper = Expander.expandCodeFor(
+        Bounds[I + 1], Bounds[I + 1]->getType(), TestTerminator);
+    Value *IsOrdered = Builder.CreateICmpULT(Lower, Upper, "InRange");
+    InRange = (InRange == nullptr) ? IsOrdered
+                                   : Builder.CreateAnd(InRange, IsOrdered);
+  }
+
+  // Clone the loop for the out of range case; it keeps its checks.
+  ValueToValueMapTy VMap;
+  SmallVector<BasicBlock *, 8> CheckedBlocks;
+  Loop *CheckedLoop = cloneLoopWithPreheader(Preheader, TestBlock, L, VMap,
+                                             ".checked", LI, DT, CheckedBlocks);
+  remapInstructionsInBlocks(CheckedBlocks, VMap);
+  BranchInst::Create(Preheader, CheckedLoop->getLoopPreheader(), InRange,
+                     TestTerminator);
+  TestTerminator->eraseFromParent();
+
+  // The loop is in LCSSA form, so values used after the loop all flow
+  // through phis in the exit blocks, the throw blocks included; give them
+  // the values from the clone.
+  for (BasicBlock *ExitBlock : ExitBlocks) {
+    for (Instruction &Instr : *ExitBlock) {
+      PHINode *Phi = dyn_cast<PHINode>(&Instr);
+      if (Phi == nullptr) {
+        break;
+      }
+      for (unsigned I = 0, E = Phi->getNumIncomingValues(); I < E; ++I) {
+        BasicBlock *Incoming = Phi->getIncomingBlock(I);
+        if (!L->contains(Incoming)) {
+          continue;
+        }
+        Value *IncomingValue = Phi->getIncomingValue(I);
+        ValueToValueMapTy::iterator Mapped = VMap.find(IncomingValue);
+        if (Mapped != VMap.end()) {
+          IncomingValue = Mapped->second;
+        }
+        Phi->addIncoming(IncomingValue, cast<BasicBlock>(VMap[Incoming]));
+      }
+    }
+  }
+
+  SE->forgetLoop(L);
+  for (const InductionCheck &Check : Checks) {
+    removeCheck(Check.Check);
+  }
+
+  // The exit block and the throw blocks are now reached from both versions
+  // of the loop; recompute the dominators rather than patch them up.
+  DT->recalculate(*TheFunction);
+  return true;
+}
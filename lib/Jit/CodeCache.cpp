@@ -0,0 +1,571 @@
+//===---- lib/Jit/CodeCache.cpp ---------------------------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Implementation of the persistent cache of jitted code.
+///
+//===----------------------------------------------------------------------===//
+
+#include "earlyincludes.h"
+#include "jitpch.h"
+#include "LLILCJit.h"
+#include "CodeCache.h"
+#include "EEMemoryManager.h"
+#include "GcInfo.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstring>
+#if !defined(_MSC_VER)
+#include <dlfcn.h>
+#endif
+
+using namespace llvm;
+
+// Cache files start with this magic string and format version. Bump the
+// version whenever the layout of a cache file changes.
+static const char CacheFileMagic[8] = {'L', 'L', 'I', 'L', 'C', 'C', 'C', 0};
+static const uint32_t CacheFileVersion = 4;
+
+namespace {
+
+/// \brief Appends the bytes of trivially copyable values to a buffer.
+class CacheWriter {
+public:
+  CacheWriter(std::string &Buffer) : Buffer(Buffer) {}
+
+  void writeBytes(const void *Data, size_t Size) {
+    Buffer.append(reinterpret_cast<const char *>(Data), Size);
+  }
+
+  template <typename T> void write(const T &Value) {
+    writeBytes(&Value, sizeof(T));
+  }
+
+  template <typename T> void writeArray(const std::vector<T> &Values) {
+    write<uint32_t>(Values.size());
+    writeBytes(Values.data(), Values.size() * sizeof(T));
+  }
+
+private:
+  std::string &Buffer;
+};
+
+/// \brief Reads back the values written by a \p CacheWriter.
+///
+/// Every read is bounds checked, so a truncated or corrupt file is
+/// rejected rather than trusted.
+class CacheReader {
+public:
+  CacheReader(StringRef Buffer) : Buffer(Buffer) {}
+
+  bool readBytes(void *Data, size_t Size) {
+    if (Buffer.size() < Size) {
+      return false;
+    }
+    memcpy(Data, Buffer.data(), Size);
+    Buffer = Buffer.drop_front(Size);
+    return true;
+  }
+
+  template <typename T> bool read(T &Value) {
+    return readBytes(&Value, sizeof(T));
+  }
+
+  template <typename T> bool readArray(std::vector<T> &Values) {
+    uint32_t Count;
+    if (!read(Count) || ((Buffer.size() / sizeof(T)) < Count)) {
+      return false;
+    }
+    Values.resize(Count);
+    return readBytes(Values.data(), Count * sizeof(T));
+  }
+
+  bool isEmpty() const { return Buffer.empty(); }
+
+private:
+  StringRef Buffer;
+};
+
+} // anonymous namespace
+
+// Get a string that changes whenever the jit binary is rebuilt, or an empty
+// string if the jit binary can't be identified.
+static std::string getJitIdentity() {
+  std::string Path;
+#if defined(_MSC_VER)
+  HMODULE Module;
+  char Buffer[MAX_PATH];
+  if (GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                             GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                         (LPCSTR)&getJitIdentity, &Module) &&
+      (GetModuleFileNameA(Module, Buffer, MAX_PATH) != 0)) {
+    Path = Buffer;
+  }
+#else
+  Dl_info Info;
+  if ((dladdr((void *)&getJitIdentity, &Info) != 0) &&
+      (Info.dli_fname != nullptr)) {
+    Path = Info.dli_fname;
+  }
+#endif
+
+  sys::fs::file_status Status;
+  if (Path.empty() || sys::fs::status(Path, Status)) {
+    return std::string();
+  }
+
+  std::string Identity;
+  raw_string_ostream OS(Identity);
+  OS << Path << ';' << Status.getSize() << ';'
+     << Status.getLastModificationTime().toEpochTime() << ';'
+     << LLVM_VERSION_STRING;
+  return OS.str();
+}
+
+// Add a signature to a cache key.
+// Returns false if the code for the method may depend on the layout of a
+// type named in the signature.
+static bool addSignatureToKey(ICorJitInfo *JitInfo, CORINFO_SIG_INFO &Sig,
+                              CacheWriter &Writer) {
+  if ((Sig.sigInst.classInstCount != 0) || (Sig.sigInst.methInstCount != 0) ||
+      Sig.hasTypeArg()) {
+    // Shared and instantiated generic code looks the same in IL for every
+    // instantiation.
+    return false;
+  }
+
+  if ((Sig.retType == CORINFO_TYPE_VALUECLASS) ||
+      (Sig.retType == CORINFO_TYPE_REFANY)) {
+    return false;
+  }
+
+  Writer.write<uint32_t>(Sig.callConv);
+  Writer.write<uint32_t>(Sig.retType);
+  Writer.write<uint32_t>(Sig.numArgs);
+  Writer.write<uint32_t>(Sig.cbSig);
+  Writer.writeBytes(Sig.pSig, Sig.cbSig);
+
+  CORINFO_ARG_LIST_HANDLE Args = Sig.args;
+  for (uint32_t I = 0; I < Sig.numArgs; ++I) {
+    CORINFO_CLASS_HANDLE Class;
+    CorInfoType CorType = strip(JitInfo->getArgType(&Sig, Args, &Class));
+    if ((CorType == CORINFO_TYPE_VALUECLASS) ||
+        (CorType == CORINFO_TYPE_REFANY)) {
+      return false;
+    }
+    Writer.write<uint32_t>(CorType);
+    Args = JitInfo->getArgNext(Args);
+  }
+
+  return true;
+}
+
+LLILCCodeCache &LLILCCodeCache::get() {
+  static LLILCCodeCache TheCodeCache;
+  return TheCodeCache;
+}
+
+LLILCCodeCache::LLILCCodeCache()
+    : JitIdentity(getJitIdentity()), NumHits(0), NumMisses(0), NumRejected(0),
+      NumUncacheable(0), NumStored(0) {}
+
+bool LLILCCodeCache::computeKey(LLILCJitContext &JitContext,
+                                StringRef Directory, CodeCacheKey &Key) {
+  const uint32_t UncacheableFlags =
+      CORJIT_FLG_PREJIT | CORJIT_FLG_READYTORUN | CORJIT_FLG_IMPORT_ONLY;
+  if (JitIdentity.empty() || ((JitContext.Flags & UncacheableFlags) != 0) ||
+      JitContext.HasLoadedBitCode) {
+    ++NumUncacheable;
+    return false;
+  }
+
+  ICorJitInfo *JitInfo = JitContext.JitInfo;
+  CORINFO_METHOD_INFO *MethodInfo = JitContext.MethodInfo;
+  ::Options *Opts = JitContext.Options;
+
+  std::string &Buffer = Key.Key;
+  Buffer.clear();
+  CacheWriter Writer(Buffer);
+
+  // Identify the jit and the EE it is running against.
+  Writer.write<uint32_t>(JitIdentity.size());
+  Writer.writeBytes(JitIdentity.data(), JitIdentity.size());
+  Writer.write(JITEEVersionIdentifier);
+  Writer.write(JitContext.EEInfo);
+
+  // Identify the jit options in effect.
+  Writer.write<uint32_t>(JitContext.Flags);
+  Writer.write<uint32_t>((uint32_t)Opts->OptLevel);
+  Writer.write<uint8_t>(Opts->UseConservativeGC);
+  Writer.write<uint8_t>(Opts->DoInsertStatepoints);
+  Writer.write<uint8_t>(Opts->DoSIMDIntrinsic);
+  Writer.write<uint8_t>(Opts->DoTailCallOpt);
+  Writer.write<uint8_t>(Opts->DoInline);
+  Writer.write<uint8_t>(Opts->DoImplicitNullChecks);
+  Writer.write<uint8_t>(Opts->ExecuteHandlers);
+  Writer.write<uint32_t>(Opts->PreferredIntrinsicSIMDVectorLength);
+
+  // Identify the method.
+  const char *ClassName = nullptr;
+  const char *MethodName = JitInfo->getMethodName(MethodInfo->ftn, &ClassName);
+  Writer.writeBytes(ClassName, ClassName ? strlen(ClassName) + 1 : 0);
+  Writer.writeBytes(MethodName, MethodName ? strlen(MethodName) + 1 : 0);
+  Writer.write<uint32_t>(JitInfo->getMethodDefFromMethod(MethodInfo->ftn));
+  Writer.write<uint32_t>(JitInfo->getMethodAttribs(MethodInfo->ftn));
+
+  // Add the IL and everything else the reader consumes.
+  Writer.write<uint32_t>(MethodInfo->ILCodeSize);
+  Writer.writeBytes(MethodInfo->ILCode, MethodInfo->ILCodeSize);
+  Writer.write<uint32_t>(MethodInfo->maxStack);
+  Writer.write<uint32_t>(MethodInfo->EHcount);
+  Writer.write<uint32_t>(MethodInfo->options);
+  Writer.write<uint32_t>(MethodInfo->regionKind);
+  if (!addSignatureToKey(JitInfo, MethodInfo->args, Writer) ||
+      !addSignatureToKey(JitInfo, MethodInfo->locals, Writer)) {
+    ++NumUncacheable;
+    return false;
+  }
+
+  // Name the cache file by the hash of the key.
+  MD5 Hash;
+  Hash.update(Buffer);
+  MD5::MD5Result Result;
+  Hash.final(Result);
+  SmallString<32> HashString;
+  MD5::stringifyResult(Result, HashString);
+  SmallString<256> Path(Directory);
+  sys::path::append(Path, HashString.str() + ".llilc");
+  Key.Path = Path.str();
+
+  return true;
+}
+
+bool LLILCCodeCache::install(LLILCJitContext &JitContext,
+                             const CodeCacheKey &Key, BYTE **NativeEntry,
+                             ULONG *NativeSizeOfCode) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufferOrError =
+      MemoryBuffer::getFile(Key.Path);
+  if (!BufferOrError) {
+    ++NumMisses;
+    return false;
+  }
+
+  CodeCacheEntry Entry;
+  std::vector<uint8_t *> HelperTargets;
+  if (!readEntry(BufferOrError.get()->getBuffer(), Key.Key, Entry) ||
+      !validateEntry(JitContext, Entry, HelperTargets)) {
+    ++NumRejected;
+    return false;
+  }
+
+  installEntry(JitContext, Entry, HelperTargets, NativeEntry,
+               NativeSizeOfCode);
+  ++NumHits;
+  return true;
+}
+
+void LLILCCodeCache::store(LLILCJitContext &JitContext,
+                           const CodeCacheKey &Key,
+                           const CodeCacheEntry &Entry) {
+  if (!JitContext.IsCacheable || !Entry.IsReplayable || !Entry.HasGcInfo) {
+    ++NumUncacheable;
+    return;
+  }
+
+  std::string Buffer;
+  CacheWriter Writer(Buffer);
+  Writer.writeBytes(CacheFileMagic, sizeof(CacheFileMagic));
+  Writer.write(CacheFileVersion);
+  Writer.write<uint32_t>(Key.Key.size());
+  Writer.writeBytes(Key.Key.data(), Key.Key.size());
+  Writer.write(Entry.CodeAlign);
+  Writer.write(Entry.RODataAlign);
+  Writer.write<uint8_t>(Entry.HasAbsoluteDebugOffsets);
+  const GcInfoRecord &GcRecord = Entry.GcRecord;
+  Writer.write<uint8_t>(GcRecord.Header.HasFunclets);
+  Writer.write(GcRecord.Header.PSPSymOffset);
+  Writer.write<uint8_t>(GcRecord.Header.IsFPBased);
+  Writer.write<uint8_t>(GcRecord.Header.IsVarArg);
+  Writer.write(GcRecord.Header.CodeLength);
+  Writer.write(GcRecord.Header.OutgoingAreaSize);
+  Writer.write<uint8_t>(GcRecord.ReportsPointers);
+  Writer.writeArray(GcRecord.Slots);
+  Writer.writeArray(GcRecord.SlotStates);
+  Writer.writeArray(GcRecord.CallSites);
+  Writer.writeArray(GcRecord.CallSiteSizes);
+  Writer.writeArray(Entry.HotCode);
+  Writer.writeArray(Entry.ReadOnlyData);
+  Writer.writeArray(Entry.Xdata);
+  Writer.writeArray(Entry.Relocations);
+  Writer.writeArray(Entry.Boundaries);
+  Writer.writeArray(Entry.Vars);
+
+  // Write to a temporary file and rename it into place, so that concurrent
+  // readers never see a partially written entry.
+  std::string Directory = sys::path::parent_path(Key.Path);
+  if (sys::fs::create_directories(Directory)) {
+    return;
+  }
+  int FD;
+  SmallString<256> TempPath;
+  if (sys::fs::createUniqueFile(Key.Path + ".%%%%%%%%.tmp", FD, TempPath)) {
+    return;
+  }
+  {
+    raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS.write(Buffer.data(), Buffer.size());
+    OS.close();
+    if (OS.has_error()) {
+      OS.clear_error();
+      sys::fs::remove(TempPath);
+      return;
+    }
+  }
+  if (sys::fs::rename(TempPath, Key.Path)) {
+    sys::fs::remove(TempPath);
+    return;
+  }
+
+  ++NumStored;
+}
+
+bool LLILCCodeCache::readEntry(StringRef Buffer, const std::string &Key,
+                               CodeCacheEntry &Entry) {
+  CacheReader Reader(Buffer);
+
+  char Magic[sizeof(CacheFileMagic)];
+  uint32_t Version;
+  uint32_t KeySize;
+  if (!Reader.readBytes(Magic, sizeof(Magic)) ||
+      (memcmp(Magic, CacheFileMagic, sizeof(Magic)) != 0) ||
+      !Reader.read(Version) || (Version != CacheFileVersion) ||
+      !Reader.read(KeySize) || (KeySize != Key.size())) {
+    return false;
+  }
+
+  // Compare the whole key, so that a hash collision can't install the code
+  // of some other method.
+  std::string FileKey(KeySize, '\0');
+  if (!Reader.readBytes(&FileKey[0], KeySize) || (FileKey != Key)) {
+    return false;
+  }
+
+  uint8_t HasAbsoluteDebugOffsets;
+  uint8_t HasFunclets;
+  uint8_t IsFPBased;
+  uint8_t IsVarArg;
+  uint8_t ReportsPointers;
+  GcInfoRecord &GcRecord = Entry.GcRecord;
+  if (!Reader.read(Entry.CodeAlign) || !Reader.read(Entry.RODataAlign) ||
+      !Reader.read(HasAbsoluteDebugOffsets) || !Reader.read(HasFunclets) ||
+      !Reader.read(GcRecord.Header.PSPSymOffset) || !Reader.read(IsFPBased) ||
+      !Reader.read(IsVarArg) || !Reader.read(GcRecord.Header.CodeLength) ||
+      !Reader.read(GcRecord.Header.OutgoingAreaSize) ||
+      !Reader.read(ReportsPointers) || !Reader.readArray(GcRecord.Slots) ||
+      !Reader.readArray(GcRecord.SlotStates) ||
+      !Reader.readArray(GcRecord.CallSites) ||
+      !Reader.readArray(GcRecord.CallSiteSizes) ||
+      !Reader.readArray(Entry.HotCode) ||
+      !Reader.readArray(Entry.ReadOnlyData) || !Reader.readArray(Entry.Xdata) ||
+      !Reader.readArray(Entry.Relocations) ||
+      !Reader.readArray(Entry.Boundaries) || !Reader.readArray(Entry.Vars) ||
+      !Reader.isEmpty()) {
+    return false;
+  }
+  Entry.HasAbsoluteDebugOffsets = HasAbsoluteDebugOffsets != 0;
+  GcRecord.Header.HasFunclets = HasFunclets != 0;
+  GcRecord.Header.IsFPBased = IsFPBased != 0;
+  GcRecord.Header.IsVarArg = IsVarArg != 0;
+  GcRecord.ReportsPointers = ReportsPointers != 0;
+  Entry.HasGcInfo = true;
+
+  return true;
+}
+
+bool LLILCCodeCache::validateEntry(LLILCJitContext &JitContext,
+                                   const CodeCacheEntry &Entry,
+                                   std::vector<uint8_t *> &HelperTargets) {
+  if (Entry.HotCode.empty() || (Entry.CodeAlign > 16) ||
+      (Entry.RODataAlign > 16) || !validateGcRecord(Entry.GcRecord)) {
+    return false;
+  }
+  const uint64_t BlockSizes[] = {Entry.HotCode.size(),
+                                 Entry.ReadOnlyData.size()};
+  HelperTargets.assign(Entry.Relocations.size(), nullptr);
+  for (size_t I = 0; I < Entry.Relocations.size(); ++I) {
+    const CodeCacheRelocation &Relocation = Entry.Relocations[I];
+    size_t FixupSize;
+    switch (Relocation.RelocationType) {
+    case IMAGE_REL_BASED_ABSOLUTE:
+    case IMAGE_REL_BASED_REL32:
+      FixupSize = 4;
+      break;
+    case IMAGE_REL_BASED_DIR64:
+      FixupSize = 8;
+      break;
+    default:
+      return false;
+    }
+    if ((Relocation.FixupBlock > CodeCacheRelocation::ReadOnlyData) ||
+        (((uint64_t)Relocation.FixupOffset + FixupSize) >
+         BlockSizes[Relocation.FixupBlock])) {
+      return false;
+    }
+
+    switch (Relocation.TargetBlock) {
+    case CodeCacheRelocation::HotCode:
+    case CodeCacheRelocation::ReadOnlyData:
+      if (Relocation.Target > BlockSizes[Relocation.TargetBlock]) {
+        return false;
+      }
+      break;
+    case CodeCacheRelocation::JitHelper: {
+      // The code was generated for a direct or an indirect reference to the
+      // helper, and the EE must still hand out the same kind.
+      if (Relocation.Target >= CORINFO_HELP_COUNT) {
+        return false;
+      }
+      void *IndirectHelper = nullptr;
+      void *DirectHelper = JitContext.JitInfo->getHelperFtn(
+          (CorInfoHelpFunc)Relocation.Target, &IndirectHelper);
+      void *Helper = Relocation.IsIndirect ? IndirectHelper : DirectHelper;
+      if ((Helper == nullptr) ||
+          (Relocation.IsIndirect && (DirectHelper != nullptr))) {
+        return false;
+      }
+      HelperTargets[I] = (uint8_t *)Helper;
+      break;
+    }
+    default:
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool LLILCCodeCache::validateGcRecord(const GcInfoRecord &Record) {
+  if (!Record.ReportsPointers) {
+    return Record.Slots.empty() && Record.SlotStates.empty() &&
+           Record.CallSites.empty() && Record.CallSiteSizes.empty();
+  }
+
+  // The encoder asserts rather than failing on slots defined twice and on
+  // states of undefined slots.
+  DenseSet<int32_t> SlotOffsets;
+  for (const GcSlotRecord &Slot : Record.Slots) {
+    if (!SlotOffsets.insert(Slot.Offset).second) {
+      return false;
+    }
+  }
+  for (const GcSlotStateRecord &State : Record.SlotStates) {
+    if ((State.SlotID >= Record.Slots.size()) ||
+        ((State.State != GC_SLOT_LIVE) && (State.State != GC_SLOT_DEAD))) {
+      return false;
+    }
+  }
+
+#if defined(PARTIALLY_INTERRUPTIBLE_GC_SUPPORTED)
+  if (Record.CallSites.empty()) {
+    return false;
+  }
+#endif // defined(PARTIALLY_INTERRUPTIBLE_GC_SUPPORTED)
+  return Record.CallSites.size() == Record.CallSiteSizes.size();
+}
+
+void LLILCCodeCache::installEntry(LLILCJitContext &JitContext,
+                                  const CodeCacheEntry &Entry,
+                                  const std::vector<uint8_t *> &HelperTargets,
+                                  BYTE **NativeEntry,
+                                  ULONG *NativeSizeOfCode) {
+  ICorJitInfo *JitInfo = JitContext.JitInfo;
+  CORINFO_METHOD_HANDLE MethodHandle = JitContext.MethodInfo->ftn;
+
+  // Get memory from the EE in the same way the dynamic loader does.
+  EEMemoryManager MM(&JitContext);
+  if (!Entry.Xdata.empty()) {
+    MM.reserveUnwindSpace(Entry.Xdata.data(), Entry.Xdata.size());
+  }
+  MM.reserveAllocationSpace(Entry.HotCode.size(), Entry.CodeAlign,
+                            Entry.ReadOnlyData.size(), Entry.RODataAlign, 0,
+                            0);
+  uint8_t *HotCode = MM.getHotCodeBlock();
+  uint8_t *ReadOnlyData = MM.getReadOnlyDataBlock();
+  memcpy(HotCode, Entry.HotCode.data(), Entry.HotCode.size());
+  if (!Entry.ReadOnlyData.empty()) {
+    memcpy(ReadOnlyData, Entry.ReadOnlyData.data(), Entry.ReadOnlyData.size());
+  }
+
+  // Apply the fixups for the new location of the code.
+  uint8_t *const Blocks[] = {HotCode, ReadOnlyData};
+  for (size_t I = 0; I < Entry.Relocations.size(); ++I) {
+    const CodeCacheRelocation &Relocation = Entry.Relocations[I];
+    uint8_t *FixupAddress =
+        Blocks[Relocation.FixupBlock] + Relocation.FixupOffset;
+    uint8_t *Target =
+        (Relocation.TargetBlock == CodeCacheRelocation::JitHelper)
+            ? HelperTargets[I]
+            : Blocks[Relocation.TargetBlock] + Relocation.Target;
+    JitInfo->recordRelocation(FixupAddress, Target + Relocation.Addend,
+                              Relocation.RelocationType);
+  }
+
+  // Report unwind and EH info.
+  if (!Entry.Xdata.empty()) {
+    std::vector<uint8_t> Xdata(Entry.Xdata);
+    MM.registerEHFrames(Xdata.data(), (uint64_t)Xdata.data(), Xdata.size());
+  }
+
+  // Report debug info.
+  uint32_t DebugBase =
+      Entry.HasAbsoluteDebugOffsets ? (uint32_t)(uint64_t)HotCode : 0;
+  if (!Entry.Boundaries.empty()) {
+    ICorDebugInfo::OffsetMapping *OM =
+        (ICorDebugInfo::OffsetMapping *)JitInfo->allocateArray(
+            Entry.Boundaries.size() * sizeof(ICorDebugInfo::OffsetMapping));
+    for (size_t I = 0; I < Entry.Boundaries.size(); ++I) {
+      OM[I] = Entry.Boundaries[I];
+      OM[I].nativeOffset += DebugBase;
+    }
+    JitInfo->setBoundaries(MethodHandle, Entry.Boundaries.size(), OM);
+  }
+  if (!Entry.Vars.empty()) {
+    ICorDebugInfo::NativeVarInfo *LocalVars =
+        (ICorDebugInfo::NativeVarInfo *)JitInfo->allocateArray(
+            Entry.Vars.size() * sizeof(ICorDebugInfo::NativeVarInfo));
+    for (size_t I = 0; I < Entry.Vars.size(); ++I) {
+      LocalVars[I] = Entry.Vars[I];
+      LocalVars[I].startOffset += DebugBase;
+      LocalVars[I].endOffset += DebugBase;
+    }
+    JitInfo->setVars(MethodHandle, Entry.Vars.size(), LocalVars);
+  }
+
+  // Report GC info.
+  GcInfoAllocator GcInfoAllocator(&JitContext.ProcArena);
+  GcInfoEmitter GcInfoEmitter(&JitContext, nullptr, &GcInfoAllocator);
+  GcInfoEmitter.emitGCInfo(Entry.GcRecord);
+
+  *NativeEntry = HotCode;
+  *NativeSizeOfCode = JitContext.HotCodeSize + JitContext.ReadOnlyDataSize;
+}
+
+void LLILCCodeCache::printStatistics(raw_ostream &OS) {
+  OS << "INFO:  code cache: " << NumHits.load() << " hits, "
+     << NumMisses.load() << " misses, " << NumRejected.load() << " rejected, "
+     << NumUncacheable.load() << " uncacheable, " << NumStored.load()
+     << " stored\n";
+}
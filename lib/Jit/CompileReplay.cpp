@@ -0,0 +1,229 @@
+//===---- lib/Jit/CompileReplay.cpp -----------------------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Implementation of the compile replay records and of their replay.
+///
+/// A record holds the reader's IR rather than the EE's answers to the
+/// reader's questions: the reader asks the EE about every token, class and
+/// field it meets, and recording those answers would mean shadowing most of
+/// ICorJitInfo. Everything after the reader only looks at the IR and the
+/// jit's options, so from the record it runs just as it did in the process
+/// that made it.
+///
+//===----------------------------------------------------------------------===//
+
+#include "earlyincludes.h"
+#include "jitpch.h"
+#include "LLILCJit.h"
+#include "CompileReplay.h"
+#include "CompileTelemetry.h"
+#include "GcInfo.h"
+#include "compiler.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <cstring>
+
+using namespace llvm;
+
+// Kilobytes of LLVMContext a thread may fill with replayed methods before
+// the context is recycled; the default of COMPlus_AltJitContextMemoryLimit.
+static const unsigned ReplayContextMemoryLimit = 64 * 1024;
+
+LLILCReplayRecorder &LLILCReplayRecorder::get() {
+  static LLILCReplayRecorder TheRecorder;
+  return TheRecorder;
+}
+
+bool LLILCReplayRecorder::open(StringRef Path) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  if (IsOpenAttempted) {
+    return IsOpen;
+  }
+  IsOpenAttempted = true;
+
+  uint64_t Size;
+  bool NeedsHeader = sys::fs::file_size(Path, Size) || (Size == 0);
+  std::error_code EC;
+  Output.reset(new raw_fd_ostream(Path, EC, sys::fs::F_Append));
+  if (EC) {
+    errs() << "LLILC: cannot open replay record file " << Path << ": "
+           << EC.message() << '\n';
+    Output.reset();
+    return false;
+  }
+
+  if (NeedsHeader) {
+    Output->write(LLILCReplayMagic, sizeof(LLILCReplayMagic));
+    Output->write(reinterpret_cast<const char *>(&LLILCReplayVersion),
+                  sizeof(LLILCReplayVersion));
+  }
+  IsOpen = true;
+  return true;
+}
+
+void LLILCReplayRecorder::record(LLILCJitContext &Context,
+                                 bool ContainsUnmanagedCall) {
+  // Serialize the module before taking the lock; only the write is shared.
+  SmallVector<char, 0> Bitcode;
+  {
+    raw_svector_ostream BitcodeStream(Bitcode);
+    WriteBitcodeToFile(Context.CurrentModule, BitcodeStream);
+  }
+
+  const ::Options &Options = *Context.Options;
+  LLILCReplayRecordHeader Header;
+  Header.RecordSize = sizeof(Header) + Context.MethodName.size() +
+                      Bitcode.size();
+  Header.Flags = Context.Flags;
+  Header.ILSize = Context.MethodInfo->ILCodeSize;
+  Header.MethodNameSize = Context.MethodName.size();
+  Header.BitcodeSize = Bitcode.size();
+  Header.OptLevel = static_cast<uint8_t>(Options.OptLevel);
+  Header.Options =
+      (Options.EnableOptimization ? ReplayEnableOptimization : 0) |
+      (Options.UseConservativeGC ? ReplayUseConservativeGC : 0) |
+      (Options.DoInsertStatepoints ? ReplayDoInsertStatepoints : 0) |
+      (Options.DoDebugInfo ? ReplayDoDebugInfo : 0) |
+      (ContainsUnmanagedCall ? ReplayContainsUnmanagedCall : 0);
+  Header.Reserved = 0;
+
+  std::lock_guard<std::mutex> Guard(Lock);
+  Output->write(reinterpret_cast<const char *>(&Header), sizeof(Header));
+  Output->write(Context.MethodName.data(), Context.MethodName.size());
+  Output->write(Bitcode.data(), Bitcode.size());
+  // Keep the file usable if the process dies before the jit is unloaded.
+  Output->flush();
+}
+
+bool LLILCJit::replayMethod(const void *Record, size_t RecordSize,
+                            LLILCReplayResult *Result) {
+  Result->ObjectSize = 0;
+  Result->NumPhases = static_cast<uint32_t>(CompilePhase::Count);
+  static_assert(static_cast<unsigned>(CompilePhase::Count) <=
+                    LLILCReplayMaxPhases,
+                "LLILCReplayResult cannot describe all phases");
+  for (uint32_t I = 0; I < Result->NumPhases; ++I) {
+    Result->PhaseNames[I] =
+        CompileTelemetry::getPhaseName(static_cast<CompilePhase>(I));
+    Result->PhaseMicroseconds[I] = 0;
+  }
+
+  LLILCReplayRecordHeader Header;
+  if (RecordSize < sizeof(Header)) {
+    return false;
+  }
+  memcpy(&Header, Record, sizeof(Header));
+  if ((Header.RecordSize > RecordSize) ||
+      ((uint64_t)sizeof(Header) + Header.MethodNameSize + Header.BitcodeSize >
+       Header.RecordSize)) {
+    return false;
+  }
+  const char *MethodName = static_cast<const char *>(Record) + sizeof(Header);
+  StringRef Bitcode(MethodName + Header.MethodNameSize, Header.BitcodeSize);
+
+  CompileTelemetry Telemetry;
+  std::unique_lock<std::recursive_mutex> StateLock;
+  LLILCJitPerThreadState *PerThreadState = getPerThreadState(StateLock);
+  LLILCJitContext Context(PerThreadState);
+  Context.JitInfo = nullptr;
+  Context.JitHost = nullptr;
+  Context.MethodInfo = nullptr;
+  Context.Flags = Header.Flags;
+  memset(&Context.EEInfo, 0, sizeof(Context.EEInfo));
+  Context.MethodName.assign(MethodName, Header.MethodNameSize);
+  Context.LLVMContext = PerThreadState->LLVMContext.get();
+  Context.CurrentModule = nullptr;
+  Context.TM = nullptr;
+  Context.TheABIInfo = nullptr;
+  Context.GcInfo = nullptr;
+  Context.Telemetry = &Telemetry;
+
+  ::Options Options = ::Options();
+  Options.DumpLevel = ::DumpLevel::NODUMP;
+  Options.OptLevel = static_cast<::OptLevel>(Header.OptLevel);
+  Options.EnableOptimization =
+      (Header.Options & ReplayEnableOptimization) != 0;
+  Options.UseConservativeGC = (Header.Options & ReplayUseConservativeGC) != 0;
+  Options.DoInsertStatepoints =
+      (Header.Options & ReplayDoInsertStatepoints) != 0;
+  Options.DoDebugInfo = (Header.Options & ReplayDoDebugInfo) != 0;
+  Context.Options = &Options;
+
+  ErrorOr<std::unique_ptr<Module>> M = parseBitcodeFile(
+      MemoryBufferRef(Bitcode, Context.MethodName), *Context.LLVMContext);
+  if (!M) {
+    return false;
+  }
+  Context.CurrentModule = M->get();
+  PerThreadState->addMethodFootprint(*Context.CurrentModule,
+                                     ReplayContextMemoryLimit);
+
+  // The GcInfoRecorder expects the reader to have made a GcInfo for each
+  // GC function. The allocas the reader noted in it are not recorded, so
+  // none are reported.
+  std::unique_ptr<::GcInfo> MethodGcInfo(new ::GcInfo());
+  Context.GcInfo = MethodGcInfo.get();
+  for (Function &F : *Context.CurrentModule) {
+    if (!F.isDeclaration() && GcInfo::isGcFunction(&F)) {
+      Context.GcInfo->newGcInfo(&F);
+    }
+  }
+
+  bool IsTargetMachineReused;
+  LLILCTargetMachineEntry *TMEntry =
+      getTargetMachine(Context, IsTargetMachineReused);
+  if (TMEntry == nullptr) {
+    return false;
+  }
+  Context.TM = TMEntry->TM.get();
+  Context.TMEntry = TMEntry;
+  Context.TheABIInfo = TMEntry->TheABIInfo;
+  Context.CurrentModule->setDataLayout(TMEntry->DataLayout);
+
+  this->optimizeMethod(&Context);
+  this->lowerMethod(&Context,
+                    (Header.Options & ReplayContainsUnmanagedCall) != 0);
+
+  {
+    PooledObjectBuffer ObjBuffer(PerThreadState);
+    orc::LLILCCompiler Compiler(*Context.TM, ObjBuffer.get(), &Telemetry);
+    object::OwningBinary<object::ObjectFile> Obj =
+        Compiler(*Context.CurrentModule);
+    if (Obj.getBinary() != nullptr) {
+      Result->ObjectSize = ObjBuffer.get().size();
+    }
+  }
+
+  Telemetry.finish();
+  for (uint32_t I = 0; I < Result->NumPhases; ++I) {
+    Result->PhaseMicroseconds[I] =
+        Telemetry.getPhaseMicroseconds(static_cast<CompilePhase>(I));
+  }
+
+  // The target machine and ABI info are owned by the per-thread cache.
+  Context.TM = nullptr;
+  Context.TMEntry = nullptr;
+  Context.TheABIInfo = nullptr;
+  Context.GcInfo = nullptr;
+  Context.ProcArena.release();
+
+  return Result->ObjectSize != 0;
+}
+
+// Replay entry point exported for the replay driver.
+extern "C" int replayMethod(const void *Record, size_t RecordSize,
+                            LLILCReplayResult *Result) {
+  assert((LLILCJit::TheJit != nullptr) && "getJit has not been called");
+  return LLILCJit::TheJit->replayMethod(Record, RecordSize, Result) ? 1 : 0;
+}
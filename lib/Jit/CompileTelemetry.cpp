@@ -0,0 +1,290 @@
+//===---- lib/Jit/CompileTelemetry.cpp --------------------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Implementation of the per-method compile time telemetry.
+///
+//===----------------------------------------------------------------------===//
+
+#include "CompileTelemetry.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+
+using namespace llvm;
+
+/// Name of each phase, as used in the column names of the records.
+static const char *const PhaseNames[] = {
+    "other",         "reader_prepass", "flow_graph", "msil_to_ir",
+    "finally_clone", "verify",         "optimize",   "statepoints",
+    "code_emission", "link",           "debug_info", "gc_info"};
+
+static_assert(sizeof(PhaseNames) / sizeof(PhaseNames[0]) ==
+                  static_cast<unsigned>(CompilePhase::Count),
+              "PhaseNames is out of sync with CompilePhase");
+
+CompileTelemetry::CompileTelemetry()
+    : CurrentPhase(CompilePhase::Other), PhaseStart(Clock::now()),
+      IsFinished(false) {
+  for (uint64_t &Time : PhaseMicroseconds) {
+    Time = 0;
+  }
+}
+
+void CompileTelemetry::chargeCurrentPhase() {
+  Clock::time_point Now = Clock::now();
+  PhaseMicroseconds[static_cast<unsigned>(CurrentPhase)] +=
+      std::chrono::duration_cast<std::chrono::microseconds>(Now - PhaseStart)
+          .count();
+  PhaseStart = Now;
+}
+
+CompilePhase CompileTelemetry::enterPhase(CompilePhase Phase) {
+  CompilePhase PreviousPhase = CurrentPhase;
+  if (!IsFinished) {
+    chargeCurrentPhase();
+    CurrentPhase = Phase;
+  }
+  return PreviousPhase;
+}
+
+void CompileTelemetry::finish() {
+  if (!IsFinished) {
+    chargeCurrentPhase();
+    IsFinished = true;
+  }
+}
+
+uint64_t CompileTelemetry::getTotalMicroseconds() const {
+  uint64_t Total = 0;
+  for (uint64_t Time : PhaseMicroseconds) {
+    Total += Time;
+  }
+  return Total;
+}
+
+const char *CompileTelemetry::getPhaseName(CompilePhase Phase) {
+  return PhaseNames[static_cast<unsigned>(Phase)];
+}
+
+LLILCTelemetry &LLILCTelemetry::get() {
+  static LLILCTelemetry TheTelemetry;
+  return TheTelemetry;
+}
+
+LLILCTelemetry::LLILCTelemetry() : NumRecords(0) {
+  for (auto &Row : Histogram) {
+    for (std::atomic<uint32_t> &Count : Row) {
+      Count = 0;
+    }
+  }
+}
+
+LLILCTelemetry::~LLILCTelemetry() {
+  if (IsOpen && (NumRecords > 0)) {
+    printHistogram(*Output);
+    Output->flush();
+  }
+}
+
+bool LLILCTelemetry::open(StringRef Path, bool IsJSON) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  if (IsOpenAttempted) {
+    return IsOpen;
+  }
+  IsOpenAttempted = true;
+  this->IsJSON = IsJSON;
+
+  bool NeedsHeader = true;
+  if (Path == "-") {
+    // Use a stream of our own rather than errs(), which may already be
+    // destroyed by the time the histogram is written at unload.
+    Output.reset(new raw_fd_ostream(2, /*shouldClose=*/false));
+  } else {
+    // Append, so that the records of several runs can be collected in one
+    // file. The CSV header is only written to a new file.
+    uint64_t Size;
+    if (!sys::fs::file_size(Path, Size) && (Size != 0)) {
+      NeedsHeader = false;
+    }
+    std::error_code EC;
+    Output.reset(
+        new raw_fd_ostream(Path, EC, sys::fs::F_Append | sys::fs::F_Text));
+    if (EC) {
+      errs() << "LLILC: cannot open telemetry file " << Path << ": "
+             << EC.message() << '\n';
+      Output.reset();
+      return false;
+    }
+  }
+
+  if (!IsJSON && NeedsHeader) {
+    writeCSVHeader();
+  }
+  IsOpen = true;
+  return true;
+}
+
+// Get the histogram bucket for a time in microseconds.
+static unsigned getBucket(uint64_t Microseconds, unsigned NumBuckets) {
+  unsigned Bucket = 0;
+  while ((Microseconds != 0) && (Bucket < NumBuckets - 1)) {
+    Microseconds >>= 1;
+    ++Bucket;
+  }
+  return Bucket;
+}
+
+void LLILCTelemetry::report(const CompileTelemetry &Record) {
+  if (!IsOpen) {
+    return;
+  }
+
+  const unsigned NumPhases = static_cast<unsigned>(CompilePhase::Count);
+  for (unsigned I = 0; I < NumPhases; ++I) {
+    uint64_t Time = Record.getPhaseMicroseconds(static_cast<CompilePhase>(I));
+    ++Histogram[I][getBucket(Time, NumBuckets)];
+  }
+  ++Histogram[NumPhases][getBucket(Record.getTotalMicroseconds(), NumBuckets)];
+  ++NumRecords;
+
+  std::lock_guard<std::mutex> Guard(Lock);
+  if (IsJSON) {
+    writeJSON(Record);
+  } else {
+    writeCSV(Record);
+  }
+  // Flush each record, since the jit may never be unloaded.
+  Output->flush();
+}
+
+void LLILCTelemetry::writeCSVHeader() {
+  raw_ostream &OS = *Output;
+  OS << "method,outcome,opt_level,il_size,native_size,basic_blocks,"
+        "vectorized_loops,finally_copies,finally_copy_size,context_bytes,"
+        "statepoints,statepoint_live,max_statepoint_live,reserved_bytes,"
+        "unused_bytes,total_us";
+  for (const char *Name : PhaseNames) {
+    OS << ',' << Name << "_us";
+  }
+  OS << '\n';
+}
+
+// Write a CSV field, quoting it if it contains a separator or a quote.
+static void writeCSVField(raw_ostream &OS, StringRef Field) {
+  if (Field.find_first_of(",\"\n") == StringRef::npos) {
+    OS << Field;
+    return;
+  }
+  OS << '"';
+  for (char C : Field) {
+    if (C == '"') {
+      OS << '"';
+    }
+    OS << C;
+  }
+  OS << '"';
+}
+
+void LLILCTelemetry::writeCSV(const CompileTelemetry &Record) {
+  raw_ostream &OS = *Output;
+  writeCSVField(OS, Record.MethodName);
+  OS << ',' << Record.Outcome << ',' << Record.OptLevel << ',' << Record.ILSize
+     << ',' << Record.NativeSize << ',' << Record.BasicBlockCount << ','
+     << Record.VectorizedLoopCount << ',' << Record.FinallyCopyCount << ','
+     << Record.FinallyCopySize << ',' << Record.ContextFootprint << ','
+     << Record.StatepointCount << ',' << Record.StatepointLiveCount << ','
+     << Record.MaxStatepointLiveCount << ',' << Record.ReservedSize << ','
+     << Record.UnusedSize << ',' << Record.getTotalMicroseconds();
+  for (unsigned I = 0; I < static_cast<unsigned>(CompilePhase::Count); ++I) {
+    OS << ',' << Record.getPhaseMicroseconds(static_cast<CompilePhase>(I));
+  }
+  OS << '\n';
+}
+
+// Write a JSON string literal.
+static void writeJSONString(raw_ostream &OS, StringRef String) {
+  OS << '"';
+  for (unsigned char C : String) {
+    if ((C == '"') || (C == '\\')) {
+      OS << '\\' << C;
+    } else if (C < 0x20) {
+      OS << format("\\u%04x", C);
+    } else {
+      OS << C;
+    }
+  }
+  OS << '"';
+}
+
+void LLILCTelemetry::writeJSON(const CompileTelemetry &Record) {
+  raw_ostream &OS = *Output;
+  OS << "{\"method\":";
+  writeJSONString(OS, Record.MethodName);
+  OS << ",\"outcome\":\"" << Record.Outcome << "\",\"opt_level\":\""
+     << Record.OptLevel << "\",\"il_size\":" << Record.ILSize
+     << ",\"native_size\":" << Record.NativeSize
+     << ",\"basic_blocks\":" << Record.BasicBlockCount
+     << ",\"vectorized_loops\":" << Record.VectorizedLoopCount
+     << ",\"finally_copies\":" << Record.FinallyCopyCount
+     << ",\"finally_copy_size\":" << Record.FinallyCopySize
+     << ",\"context_bytes\":" << Record.ContextFootprint
+     << ",\"statepoints\":" << Record.StatepointCount
+     << ",\"statepoint_live\":" << Record.StatepointLiveCount
+     << ",\"max_statepoint_live\":" << Record.MaxStatepointLiveCount
+     << ",\"reserved_bytes\":" << Record.ReservedSize
+     << ",\"unused_bytes\":" << Record.UnusedSize
+     << ",\"total_us\":" << Record.getTotalMicroseconds();
+  for (unsigned I = 0; I < static_cast<unsigned>(CompilePhase::Count); ++I) {
+    OS << ",\"" << PhaseNames[I] << "_us\":"
+       << Record.getPhaseMicroseconds(static_cast<CompilePhase>(I));
+  }
+  OS << ",\"vectorization_remarks\":[";
+  bool IsFirst = true;
+  for (const VectorizationRemark &Remark : Record.VectorizationRemarks) {
+    OS << (IsFirst ? "" : ",") << "{\"kind\":\"" << Remark.Kind
+       << "\",\"il_offset\":" << Remark.ILOffset << ",\"message\":";
+    writeJSONString(OS, Remark.Message);
+    OS << '}';
+    IsFirst = false;
+  }
+  OS << "]}\n";
+}
+
+void LLILCTelemetry::printHistogram(raw_ostream &OS) {
+  // Each row gives the number of methods per bucket. Bucket 0 counts times
+  // under 1us; bucket I > 0 counts times in [2^(I-1), 2^I) us. In CSV the
+  // rows are comments, so that readers of the records can skip them.
+  const unsigned NumPhases = static_cast<unsigned>(CompilePhase::Count);
+  if (IsJSON) {
+    OS << "{\"histogram\":{\"methods\":" << NumRecords.load();
+  } else {
+    OS << "# histogram of phase times in log2 microsecond buckets, "
+       << NumRecords.load() << " methods\n";
+  }
+  for (unsigned Row = 0; Row < NumRows; ++Row) {
+    const char *Name = (Row < NumPhases) ? PhaseNames[Row] : "total";
+    if (IsJSON) {
+      OS << ",\"" << Name << "_us\":[";
+    } else {
+      OS << "# " << Name << "_us";
+    }
+    for (unsigned Bucket = 0; Bucket < NumBuckets; ++Bucket) {
+      if (IsJSON && (Bucket == 0)) {
+        OS << Histogram[Row][Bucket].load();
+      } else {
+        OS << ',' << Histogram[Row][Bucket].load();
+      }
+    }
+    OS << (IsJSON ? "]" : "\n");
+  }
+  if (IsJSON) {
+    OS << "}}\n";
+  }
+}
@@ -0,0 +1,231 @@
+//===---- lib/Jit/DerivedPointerRematerialization.cpp -----------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Implementation of the derived pointer rematerialization pass.
+///
+/// The reader computes element and field addresses where the MSIL asks for
+/// them, which is often well before their use and with calls in between.
+/// RewriteStatepointsForGC relocates each such derived pointer separately at
+/// every statepoint it is live across, which costs a spill slot and a
+/// relocation record apiece. Recomputing the address from its base after
+/// the safepoint is nearly free: the base is usually live anyway, and the
+/// integer offsets need no relocation.
+///
+//===----------------------------------------------------------------------===//
+
+#include "earlyincludes.h"
+#include "jitpch.h"
+#include "GcInfo.h"
+#include "DerivedPointerRematerialization.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Pass.h"
+
+using namespace llvm;
+
+namespace {
+
+class DerivedPointerRematerialization : public FunctionPass {
+public:
+  static char ID;
+
+  DerivedPointerRematerialization() : FunctionPass(ID) {}
+
+  const char *getPassName() const override {
+    return "LLILC derived pointer rematerialization";
+  }
+
+  bool runOnFunction(Function &F) override;
+
+private:
+  /// Check whether \p Instr computes a GC pointer from another one cheaply
+  /// enough to repeat it at each use.
+  static bool isCheapDerivedPointer(Instruction *Instr);
+
+  /// Check whether GC may happen at an instruction.
+  static bool mayBeSafepoint(Instruction *Instr);
+
+  /// \brief Recompute a derived pointer for uses that a safepoint may
+  /// separate from it.
+  ///
+  /// \returns true if any use was changed.
+  bool rematerialize(Instruction *Derived);
+
+  /// \brief Get the copy of \p Derived to use at \p InsertBefore.
+  ///
+  /// Uses in a block share a copy until a safepoint intervenes.
+  Instruction *getCopy(Instruction *Derived, Instruction *InsertBefore);
+};
+
+} // end anonymous namespace
+
+char DerivedPointerRematerialization::ID = 0;
+
+FunctionPass *createDerivedPointerRematerializationPass() {
+  return new DerivedPointerRematerialization();
+}
+
+bool DerivedPointerRematerialization::runOnFunction(Function &F) {
+  if (!GcInfo::isGcFunction(&F)) {
+    return false;
+  }
+
+  SmallVector<Instruction *, 16> Candidates;
+  for (BasicBlock &Block : F) {
+    for (Instruction &Instr : Block) {
+      if (isCheapDerivedPointer(&Instr)) {
+        Candidates.push_back(&Instr);
+      }
+    }
+  }
+
+  // Visit users before the values they use, so that a chain of address
+  // computations is copied as a whole: the copies of a user refer to the
+  // original value, which is then copied in front of each of them.
+  bool Changed = false;
+  for (auto I = Candidates.rbegin(), E = Candidates.rend(); I != E; ++I) {
+    Changed |= rematerialize(*I);
+  }
+
+  return Changed;
+}
+
+bool DerivedPointerRematerialization::isCheapDerivedPointer(
+    Instruction *Instr) {
+  if (!GcInfo::isGcPointer(Instr->getType())) {
+    return false;
+  }
+
+  if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(Instr)) {
+    return GcInfo::isGcPointer(GEP->getPointerOperandType());
+  }
+
+  if (isa<BitCastInst>(Instr)) {
+    return GcInfo::isGcPointer(Instr->getOperand(0)->getType());
+  }
+
+  return false;
+}
+
+bool DerivedPointerRematerialization::mayBeSafepoint(Instruction *Instr) {
+  CallSite Call(Instr);
+  if (!Call) {
+    return false;
+  }
+
+  if (isa<IntrinsicInst>(Instr)) {
+    return false;
+  }
+
+  return !Call.getAttributes().hasAttribute(AttributeSet::FunctionIndex,
+                                            "gc-leaf-function");
+}
+
+bool DerivedPointerRematerialization::rematerialize(Instruction *Derived) {
+  BasicBlock *DefBlock = Derived->getParent();
+
+  // Find the uses that need a copy: those in other blocks, where a poll
+  // may be placed on the way, and those in the same block after a call.
+  SmallVector<Use *, 8> FarUses;
+  for (Use &U : Derived->uses()) {
+    Instruction *User = cast<Instruction>(U.getUser());
+    if (PHINode *Phi = dyn_cast<PHINode>(User)) {
+      // The value is needed at the end of the incoming block.
+      BasicBlock *Incoming = Phi->getIncomingBlock(U);
+      if (Incoming->getTerminator()->isEHPad()) {
+        continue;
+      }
+      FarUses.push_back(&U);
+      continue;
+    }
+
+    if (User->isEHPad()) {
+      continue;
+    }
+
+    if (User->getParent() != DefBlock) {
+      FarUses.push_back(&U);
+      continue;
+    }
+
+    for (BasicBlock::iterator I = std::next(Derived->getIterator());
+         &*I != User; ++I) {
+      if (mayBeSafepoint(&*I)) {
+        FarUses.push_back(&U);
+        break;
+      }
+    }
+  }
+
+  if (FarUses.empty()) {
+    return false;
+  }
+
+  // Copies are shared by the uses in a block that no safepoint separates,
+  // so group the uses by block and visit each block's uses in order.
+  DenseMap<BasicBlock *, SmallVector<Use *, 4>> UsesByBlock;
+  for (Use *U : FarUses) {
+    Instruction *User = cast<Instruction>(U->getUser());
+    BasicBlock *Block = User->getParent();
+    if (PHINode *Phi = dyn_cast<PHINode>(User)) {
+      Block = Phi->getIncomingBlock(*U);
+    }
+    UsesByBlock[Block].push_back(U);
+  }
+
+  for (auto &BlockUses : UsesByBlock) {
+    BasicBlock *Block = BlockUses.first;
+    SmallVectorImpl<Use *> &Uses = BlockUses.second;
+
+    // Map each user to its uses; PHI uses are at the terminator.
+    DenseMap<Instruction *, SmallVector<Use *, 2>> UsesAt;
+    for (Use *U : Uses) {
+      Instruction *User = cast<Instruction>(U->getUser());
+      Instruction *At = isa<PHINode>(User) ? Block->getTerminator() : User;
+      UsesAt[At].push_back(U);
+    }
+
+    Instruction *Copy = nullptr;
+    for (Instruction &Instr : *Block) {
+      auto Found = UsesAt.find(&Instr);
+      if (Found != UsesAt.end()) {
+        if (Copy == nullptr) {
+          Copy = getCopy(Derived, &Instr);
+        }
+        for (Use *U : Found->second) {
+          U->set(Copy);
+        }
+      }
+      if (mayBeSafepoint(&Instr)) {
+        Copy = nullptr;
+      }
+    }
+  }
+
+  if (Derived->use_empty()) {
+    Derived->eraseFromParent();
+  }
+
+  return true;
+}
+
+Instruction *
+DerivedPointerRematerialization::getCopy(Instruction *Derived,
+                                         Instruction *InsertBefore) {
+  Instruction *Copy = Derived->clone();
+  Copy->setName(Derived->getName() + ".remat");
+  Copy->insertBefore(InsertBefore);
+  return Copy;
+}
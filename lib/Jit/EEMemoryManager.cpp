@@ -16,6 +16,7 @@
 #include "EEMemoryManager.h"
 #include "jitpch.h"
 #include "LLILCJit.h"
+#include "CodeCache.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/DerivedTypes.h"
@@ -25,20 +26,50 @@
 #include "llvm/IR/Verifier.h"
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/IR/PassManager.h"
+#include "llvm/Object/COFF.h"
+#include "llvm/Object/ELFObjectFile.h"
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/Timer.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
 #include <string>
 
 namespace llvm {
 
+bool EEMemoryManager::isJitLocalSection(StringRef SectionName) {
+  // The GcInfoEmitter reads the stackmaps, and registerEHFrames hands the
+  // unwind data to the EE, which copies it to where it keeps it. The EE
+  // builds its own .pdata.
+  return SectionName.equals(".llvm_stackmaps") ||
+         SectionName.equals(".xdata") || SectionName.equals(".pdata") ||
+         SectionName.equals(".eh_frame");
+}
+
+/// Round \p Size up to a multiple of \p Alignment, a power of two.
+static uint64_t alignSize(uint64_t Size, uint64_t Alignment) {
+  return (Size + Alignment - 1) & ~(Alignment - 1);
+}
+
+unsigned EEMemoryManager::getAlignmentIndex(unsigned Alignment) {
+  if (Alignment == 0) {
+    Alignment = 16;
+  }
+  assert(isPowerOf2_32(Alignment) && (Alignment <= 16));
+  return Log2_32(Alignment);
+}
+
 uint8_t *EEMemoryManager::allocateCodeSection(uintptr_t Size,
                                               unsigned int Alignment,
                                               unsigned int SectionID,
                                               StringRef SectionName) {
-  // TODO: ColdCodeBlock is not currently used.
+  // TODO: ColdCodeBlock is not currently used. The code generator emits
+  // each function, funclets included, into one text section, so there is
+  // nothing to put in it yet; rarely run blocks (throw paths) are instead
+  // weighted cold by the reader, and block placement lays them out after
+  // the method's hot code within the hot block.
   return this->HotCodeBlock;
 }
 
@@ -55,31 +86,55 @@ uint8_t *EEMemoryManager::allocateDataSection(uintptr_t Size,
   // We don't expect to see RW data requests.
   assert(IsReadOnly);
 
-  // Pad for alignment needs.
-  unsigned int Offset = 0;
-  if ((this->Context->Flags & CORJIT_FLG_PREJIT) != 0) {
-    // In ngen scenario ReadOnlyDataBlock will have a 16 bytes alignment in the
-    // image but the memory block we get may not have a 16 bytes alignment. We
-    // calculate alignment padding based on the image alignment of
-    // ReadOnlyDataBlock.
-    assert(Alignment <= 16);
-    Offset = ((uint64_t)ReadOnlyDataUnallocated - (uint64_t)ReadOnlyDataBlock) %
-             Alignment;
+  uint8_t *Result;
+  if (isJitLocalSection(SectionName)) {
+    assert(Alignment <= ReaderArena::Alignment);
+    Result = (uint8_t *)this->Context->ProcArena.allocate(Size);
+  } else if (this->CanPackReadOnlyData) {
+    // Sections of each alignment have their own part of the block, so that
+    // no padding is needed between them whatever order they come in.
+    unsigned Index = getAlignmentIndex(Alignment);
+    uint64_t Offset = this->ReadOnlyDataBucketNext[Index];
+    uint64_t End = Offset + alignSize(Size, 1ULL << Index);
+    if (End > this->ReadOnlyDataBucketEnd[Index]) {
+      // The object has a section that reserveObjectSpace did not see.
+      assert(false && "Read-only data exceeds its reservation");
+      LLILCJit::fatal(CORJIT_INTERNALERROR);
+    }
+    this->ReadOnlyDataBucketNext[Index] = End;
+    Result = ReadOnlyDataBlock + Offset;
+    assert(((this->Context->Flags & CORJIT_FLG_PREJIT) != 0) ||
+           (((uint64_t)Result & ((1ULL << Index) - 1)) == 0));
+    this->ReadOnlyDataUsed += Size;
   } else {
-    Offset = ((uint64_t)ReadOnlyDataUnallocated) % Alignment;
-  }
-  if (Offset > 0) {
-    ReadOnlyDataUnallocated += Alignment - Offset;
-  }
+    // Pad for alignment needs.
+    unsigned int Offset = 0;
+    if ((this->Context->Flags & CORJIT_FLG_PREJIT) != 0) {
+      // In ngen scenario ReadOnlyDataBlock will have a 16 bytes alignment in
+      // the image but the memory block we get may not have a 16 bytes
+      // alignment. We calculate alignment padding based on the image
+      // alignment of ReadOnlyDataBlock.
+      assert(Alignment <= 16);
+      Offset =
+          ((uint64_t)ReadOnlyDataUnallocated - (uint64_t)ReadOnlyDataBlock) %
+          Alignment;
+    } else {
+      Offset = ((uint64_t)ReadOnlyDataUnallocated) % Alignment;
+    }
+    if (Offset > 0) {
+      ReadOnlyDataUnallocated += Alignment - Offset;
+    }
 
-  // There are multiple read-only sections, so we need to keep
-  // track of the current allocation point in the read-only memory region.
-  uint8_t *Result = ReadOnlyDataUnallocated;
-  ReadOnlyDataUnallocated += Size;
+    // There are multiple read-only sections, so we need to keep
+    // track of the current allocation point in the read-only memory region.
+    Result = ReadOnlyDataUnallocated;
+    ReadOnlyDataUnallocated += Size;
 
-  // Make sure we are not allocating more than we expected to.
-  assert(ReadOnlyDataUnallocated <=
-         (ReadOnlyDataBlock + this->Context->ReadOnlyDataSize));
+    // Make sure we are not allocating more than we expected to.
+    assert(ReadOnlyDataUnallocated <=
+           (ReadOnlyDataBlock + this->Context->ReadOnlyDataSize));
+    this->ReadOnlyDataUsed += Size;
+  }
 
   if (SectionName.equals(".llvm_stackmaps")) {
     assert((this->StackMapBlock == nullptr) &&
@@ -146,49 +201,118 @@ static void getXdataSize(const uint8_t *XdataPtr, size_t *ReportedSize,
   }
 }
 
-void EEMemoryManager::reserveUnwindSpace(const object::ObjectFile &Obj) {
-  // The EE needs to be informed for each funclet (and the main function)
-  // what the size of its unwind codes will be.  Parse the header info in
-  // the xdata section to determine this.
-  BOOL IsHandler = FALSE;
+/// Check whether the dynamic loader will load \p Section, using the same
+/// test it does.
+static bool isLoadedSection(const object::ObjectFile &Obj,
+                            const object::SectionRef &Section) {
+  if (const object::COFFObjectFile *COFFObj =
+          dyn_cast<object::COFFObjectFile>(&Obj)) {
+    const object::coff_section *COFFSection = COFFObj->getCOFFSection(Section);
+    bool HasContent =
+        (COFFSection->VirtualSize > 0) || (COFFSection->SizeOfRawData > 0);
+    bool IsDiscardable =
+        (COFFSection->Characteristics &
+         (COFF::IMAGE_SCN_MEM_DISCARDABLE | COFF::IMAGE_SCN_LNK_INFO)) != 0;
+    return HasContent && !IsDiscardable;
+  }
+  return (object::ELFSectionRef(Section).getFlags() & ELF::SHF_ALLOC) != 0;
+}
+
+void EEMemoryManager::reserveObjectSpace(const object::ObjectFile &Obj) {
+  uint64_t CodeSize = 0;
+  this->CanPackReadOnlyData = true;
   for (const object::SectionRef &Section : Obj.sections()) {
+    if (!isLoadedSection(Obj, Section)) {
+      continue;
+    }
+
     StringRef SectionName;
-    if (!Section.getName(SectionName) && (SectionName == ".xdata")) {
-      StringRef Contents;
-      if (!Section.getContents(Contents)) {
-        const uint8_t *DataPtr =
-            reinterpret_cast<const uint8_t *>(Contents.data());
-        const uint8_t *DataEnd =
-            reinterpret_cast<const uint8_t *>(Contents.end());
-        do {
-          size_t ReportedByteCount;
-          size_t TotalByteCount;
-          getXdataSize(DataPtr, &ReportedByteCount, &TotalByteCount);
-          // Bit 5 indicates whether this is chained unwind info.  If we saw
-          // that here, we'd have wanted to include it with the previous
-          // reservation (or we'd be separating cold code).  Since it's not
-          // currently emitted, just verify that we don't see it.
-          assert((*DataPtr & 0x20) != 0x10 &&
-                 "chained unwind info not supported");
-          this->Context->JitInfo->reserveUnwindInfo(IsHandler, FALSE,
-                                                    ReportedByteCount);
-          IsHandler = TRUE;
-          DataPtr += TotalByteCount;
-          if (DataPtr == DataEnd) {
-            break;
-          }
-
-          // The next thing should either be the next xdata entry or the
-          // sentinel we insert between that and the clause descriptors.
-          // If it is the next xdata entry, bits 0-2 will be the version
-          // number (currently only version 1 exists).
-        } while ((*DataPtr & 0x7) == 1);
-        // If we didn't reach the end of the xdata, the next thing should be
-        // our sentinel.
-        assert(DataPtr == DataEnd || *DataPtr == 0xff && "Malformed .xdata");
+    if (Section.getName(SectionName)) {
+      this->CanPackReadOnlyData = false;
+      continue;
+    }
+
+    // The loader asks for at least one byte for every section it loads.
+    uint64_t Size = std::max<uint64_t>(Section.getSize(), 1);
+    if (Section.isText()) {
+      CodeSize += Size;
+      continue;
+    }
+
+    if (isJitLocalSection(SectionName)) {
+      this->LocalDataSizes.push_back(Size);
+      if (SectionName == ".xdata") {
+        StringRef Contents;
+        if (!Section.getContents(Contents)) {
+          reserveUnwindSpace(
+              reinterpret_cast<const uint8_t *>(Contents.data()),
+              Contents.size());
+        }
+      }
+      continue;
+    }
+
+    // The loader leaves room after a section for a stub per relocation in
+    // it. We don't know how big those are, so place such sections the way
+    // the loader counted them.
+    uint64_t Alignment = Section.getAlignment();
+    if (Alignment > 16) {
+      this->CanPackReadOnlyData = false;
+      continue;
+    }
+    for (const object::SectionRef &RelocationSection : Obj.sections()) {
+      if ((RelocationSection.getRelocatedSection() == Section) &&
+          (RelocationSection.relocation_begin() !=
+           RelocationSection.relocation_end())) {
+        this->CanPackReadOnlyData = false;
+        break;
       }
     }
+    unsigned Index = getAlignmentIndex(Alignment);
+    this->ReadOnlyDataBucketSize[Index] += alignSize(Size, 1ULL << Index);
   }
+
+  // The loader also leaves stub room after code, but the COFF loader never
+  // fills it in, and we report the relocations to the EE rather than going
+  // through stubs. The ELF loader does write stubs for external calls.
+  if (Obj.isCOFF()) {
+    this->PlannedCodeSize = CodeSize;
+  }
+}
+
+void EEMemoryManager::reserveUnwindSpace(const uint8_t *XdataPtr,
+                                         size_t Size) {
+  // The EE needs to be informed for each funclet (and the main function)
+  // what the size of its unwind codes will be.  Parse the header info in
+  // the xdata section to determine this.
+  BOOL IsHandler = FALSE;
+  const uint8_t *DataPtr = XdataPtr;
+  const uint8_t *DataEnd = XdataPtr + Size;
+  do {
+    size_t ReportedByteCount;
+    size_t TotalByteCount;
+    getXdataSize(DataPtr, &ReportedByteCount, &TotalByteCount);
+    // Bit 5 indicates whether this is chained unwind info.  If we saw
+    // that here, we'd have wanted to include it with the previous
+    // reservation (or we'd be separating cold code).  Since it's not
+    // currently emitted, just verify that we don't see it.
+    assert((*DataPtr & 0x20) != 0x10 && "chained unwind info not supported");
+    this->Context->JitInfo->reserveUnwindInfo(IsHandler, FALSE,
+                                              ReportedByteCount);
+    IsHandler = TRUE;
+    DataPtr += TotalByteCount;
+    if (DataPtr == DataEnd) {
+      break;
+    }
+
+    // The next thing should either be the next xdata entry or the
+    // sentinel we insert between that and the clause descriptors.
+    // If it is the next xdata entry, bits 0-2 will be the version
+    // number (currently only version 1 exists).
+  } while ((*DataPtr & 0x7) == 1);
+  // If we didn't reach the end of the xdata, the next thing should be
+  // our sentinel.
+  assert(DataPtr == DataEnd || *DataPtr == 0xff && "Malformed .xdata");
 }
 
 void EEMemoryManager::reserveAllocationSpace(
@@ -196,17 +320,46 @@ void EEMemoryManager::reserveAllocationSpace(
     uint32_t RODataAlign, uintptr_t RWDataSize, uint32_t RWDataAlign) {
   // Treat all code for now as "hot section"
   uintptr_t HotCodeSize = CodeSize;
+  if ((this->PlannedCodeSize != 0) && (this->PlannedCodeSize < CodeSize)) {
+    HotCodeSize = this->PlannedCodeSize;
+  }
   uintptr_t ColdCodeSize = 0;
 
-  // We still need to allocate space for the RO data here too, because
-  // LLVM's dynamic loader does not know where the EE's reservation was made.
-  // So this gives the dynamic loader room to copy the RO sections, and later
-  // the EE will copy from there to the place it really keeps unwind data.
-
+  // The loader counts every RO section rounded up to the largest RO
+  // alignment, including the sections we keep in jit memory.
   uintptr_t ReadOnlyDataSize = RODataSize;
+  for (uint64_t Size : this->LocalDataSizes) {
+    uint64_t AlignedSize = alignSize(Size, std::max<uint32_t>(RODataAlign, 1));
+    assert(AlignedSize <= ReadOnlyDataSize);
+    ReadOnlyDataSize -= AlignedSize;
+  }
+
+  // Lay out the sections of each alignment together, largest alignment
+  // first, so that each part starts suitably aligned and nothing is lost to
+  // padding. Small constants are the common case, and the loader would
+  // otherwise give each of them the largest alignment.
+  if (this->CanPackReadOnlyData) {
+    uint64_t PackedSize = 0;
+    for (unsigned Index = NumAlignments; Index-- > 0;) {
+      this->ReadOnlyDataBucketNext[Index] = PackedSize;
+      PackedSize += this->ReadOnlyDataBucketSize[Index];
+      this->ReadOnlyDataBucketEnd[Index] = PackedSize;
+    }
+    if (PackedSize <= ReadOnlyDataSize) {
+      ReadOnlyDataSize = PackedSize;
+    } else {
+      this->CanPackReadOnlyData = false;
+    }
+  }
+
   assert(RWDataSize == 0);
   uint32_t ExceptionCount = 0;
 
+  if (this->Context->CodeCacheRecord != nullptr) {
+    this->Context->CodeCacheRecord->CodeAlign = CodeAlign;
+    this->Context->CodeCacheRecord->RODataAlign = RODataAlign;
+  }
+
   // Remap alignment to the EE notion of alignment.
   assert(CodeAlign <= 16);
   assert(RODataAlign <= 16);
@@ -252,6 +405,15 @@ void EEMemoryManager::registerEHFrames(uint8_t *Addr, uint64_t LoadAddr,
   // ColdCodeBlock, i.e. separated code is not supported.
   assert(this->ColdCodeBlock == 0 && "ColdCodeBlock must be zero");
 
+  CodeCacheEntry *Record = this->Context->CodeCacheRecord;
+  if (Record != nullptr) {
+    if (Record->Xdata.empty()) {
+      Record->Xdata.assign(Addr, Addr + Size);
+    } else {
+      Record->IsReplayable = false;
+    }
+  }
+
   // The xdata section always starts with the standard xdata entry for the main
   // function.  If there are no funclets, that's the entire section.  If
   // there are funclets, it is followed by the standard xdata entries for each
@@ -338,6 +500,16 @@ void EEMemoryManager::registerEHFrames(uint8_t *Addr, uint64_t LoadAddr,
   }
 }
 
+uintptr_t EEMemoryManager::getUnusedSize() const {
+  uintptr_t CodeLength = this->Context->CodeLength;
+  if ((CodeLength == 0) || (CodeLength > this->Context->HotCodeSize)) {
+    CodeLength = this->Context->HotCodeSize;
+  }
+  assert(this->ReadOnlyDataUsed <= this->Context->ReadOnlyDataSize);
+  return (this->Context->HotCodeSize - CodeLength) +
+         (this->Context->ReadOnlyDataSize - this->ReadOnlyDataUsed);
+}
+
 void EEMemoryManager::deregisterEHFrames(uint8_t *Addr, uint64_t LoadAddr,
                                          size_t Size) {}
 
@@ -0,0 +1,425 @@
+//===---- lib/Jit/Inliner.cpp -----------------------------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Implementation of the inliner for small managed callees.
+///
+//===----------------------------------------------------------------------===//
+
+#include "earlyincludes.h"
+#include "jitpch.h"
+#include "LLILCJit.h"
+#include "GcInfo.h"
+#include "Inliner.h"
+#include "readerir.h"
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+using namespace llvm;
+
+/// Name of the metadata marking allocas that an inlined callee had
+/// frame-escaped, until they are escaped by the method being jitted.
+static const char *const EscapeMDName = "llilc.inline.escape";
+
+LLILCInliner::LLILCInliner(LLILCJitContext &JitContext)
+    : JitContext(JitContext), TotalILSize(0), NumInlined(0) {
+  Root = JitContext.CurrentModule->getFunction(JitContext.MethodName);
+  assert(Root != nullptr && "Missing function for method being jitted");
+  CandidateKind = JitContext.LLVMContext->getMDKindID(getCandidateMDName());
+  EscapeKind = JitContext.LLVMContext->getMDKindID(EscapeMDName);
+}
+
+bool LLILCInliner::isEnabled(LLILCJitContext &JitContext) {
+  const uint32_t NoInlineFlags =
+      CORJIT_FLG_PREJIT | CORJIT_FLG_READYTORUN | CORJIT_FLG_IMPORT_ONLY;
+  ::Options *Options = JitContext.Options;
+  return Options->DoInline && Options->EnableOptimization &&
+         !JitContext.HasLoadedBitCode &&
+         ((JitContext.Flags & NoInlineFlags) == 0);
+}
+
+uint32_t LLILCInliner::run() {
+  inlineCandidates(Root, 0);
+  recordInlinedAllocas();
+
+  // The code cache key only covers the MSIL of the method being jitted, so
+  // code with callees inlined into it can't be cached.
+  if (NumInlined > 0) {
+    JitContext.IsCacheable = false;
+  }
+  return NumInlined;
+}
+
+// Remove the candidate metadata from the calls in a function.
+static void stripCandidates(Function *F, unsigned CandidateKind) {
+  for (BasicBlock &Block : *F) {
+    for (Instruction &Instr : Block) {
+      Instr.setMetadata(CandidateKind, nullptr);
+    }
+  }
+}
+
+void LLILCInliner::inlineCandidates(Function *Caller, uint32_t Depth) {
+  if (Depth >= MaxDepth) {
+    stripCandidates(Caller, CandidateKind);
+    return;
+  }
+
+  // Inlining a call splits its block, but leaves the other instructions in
+  // place, so the candidates can be collected up front.
+  SmallVector<WeakVH, 8> Candidates;
+  for (BasicBlock &Block : *Caller) {
+    for (Instruction &Instr : Block) {
+      if (Instr.getMetadata(CandidateKind) != nullptr) {
+        Candidates.push_back(&Instr);
+      }
+    }
+  }
+
+  ICorJitInfo *JitInfo = JitContext.JitInfo;
+  for (WeakVH &Candidate : Candidates) {
+    Instruction *Call = cast_or_null<Instruction>(Candidate);
+    if (Call == nullptr) {
+      continue;
+    }
+    MDNode *Node = Call->getMetadata(CandidateKind);
+    CORINFO_METHOD_HANDLE Callee = (CORINFO_METHOD_HANDLE)mdconst::extract<
+        ConstantInt>(Node->getOperand(0))->getZExtValue();
+    Call->setMetadata(CandidateKind, nullptr);
+
+    const char *Reason = "";
+    CorInfoInline Decision = tryInline(CallSite(Call), Callee, Depth + 1,
+                                       Reason);
+
+    // Decisions are reported relative to the method being jitted, like the
+    // EE's own inlining checks.
+    JitInfo->reportInliningDecision(JitContext.MethodInfo->ftn, Callee,
+                                    Decision, Reason);
+    if (JitContext.Options->DumpLevel >= ::DumpLevel::SUMMARY) {
+      const char *ClassName = nullptr;
+      const char *MethodName = JitInfo->getMethodName(Callee, &ClassName);
+      dbgs() << "INFO:  "
+             << ((Decision == INLINE_PASS) ? "Inlined " : "Did not inline ")
+             << ClassName << '.' << MethodName << " into "
+             << JitContext.MethodName;
+      if (Decision != INLINE_PASS) {
+        dbgs() << " [" << Reason << ']';
+      }
+      dbgs() << '\n';
+    }
+  }
+}
+
+CorInfoInline LLILCInliner::tryInline(CallSite Call,
+                                      CORINFO_METHOD_HANDLE Callee,
+                                      uint32_t Depth, const char *&Reason) {
+  // Calls in funclets would need the funclet bundle propagated to every call
+  // in the callee.
+  if (Call.getOperandBundle(LLVMContext::OB_funclet)) {
+    Reason = "call site is in a funclet";
+    return INLINE_FAIL;
+  }
+
+  ICorJitInfo *JitInfo = JitContext.JitInfo;
+  DWORD Restrictions = 0;
+  CorInfoInline Decision =
+      JitInfo->canInline(JitContext.MethodInfo->ftn, Callee, &Restrictions);
+  if (Decision != INLINE_PASS) {
+    Reason = "the EE disallows inlining";
+    return Decision;
+  }
+  if (Restrictions != 0) {
+    // Security and boundary restrictions need the callee's frame kept.
+    Reason = "the EE restricts inlining";
+    return INLINE_FAIL;
+  }
+
+  if ((JitInfo->getMethodAttribs(Callee) & CORINFO_FLG_SYNCH) != 0) {
+    Reason = "callee is synchronized";
+    return INLINE_NEVER;
+  }
+
+  CORINFO_METHOD_INFO CalleeInfo;
+  if (!JitInfo->getMethodInfo(Callee, &CalleeInfo)) {
+    Reason = "callee has no MSIL";
+    return INLINE_NEVER;
+  }
+  if (CalleeInfo.EHcount > 0) {
+    Reason = "callee has exception handling";
+    return INLINE_NEVER;
+  }
+  if ((CalleeInfo.options & CORINFO_GENERICS_CTXT_KEEP_ALIVE) != 0) {
+    Reason = "callee keeps its generics context alive";
+    return INLINE_FAIL;
+  }
+
+  // The size budgets are LLILC's own, so a callee over them is not reported
+  // as never inlinable; other jits may still want to inline it.
+  if (CalleeInfo.ILCodeSize > MaxCalleeILSize) {
+    Reason = "callee MSIL is too large";
+    return INLINE_FAIL;
+  }
+  if (TotalILSize + CalleeInfo.ILCodeSize > MaxTotalILSize) {
+    Reason = "inline budget for the method is used up";
+    return INLINE_FAIL;
+  }
+
+  Function *CalleeFunction = readCallee(&CalleeInfo, Reason);
+  if (CalleeFunction == nullptr) {
+    return INLINE_FAIL;
+  }
+
+  // The signatures should match, but a mismatch (say from a call whose
+  // target is not the method in the call info) can't be inlined.
+  if ((Call.getCalledValue()->getType() != CalleeFunction->getType()) ||
+      (Call.getCallingConv() != CalleeFunction->getCallingConv())) {
+    eraseCallee(CalleeFunction);
+    Reason = "call site does not match callee signature";
+    return INLINE_FAIL;
+  }
+
+  TotalILSize += CalleeInfo.ILCodeSize;
+  inlineCandidates(CalleeFunction, Depth);
+
+  // The callee's frame-escaped allocas will move into the caller's frame;
+  // mark them so that they can be escaped by the method being jitted.
+  for (Instruction &Instr : CalleeFunction->getEntryBlock()) {
+    IntrinsicInst *Escape = dyn_cast<IntrinsicInst>(&Instr);
+    if ((Escape == nullptr) ||
+        (Escape->getIntrinsicID() != Intrinsic::localescape)) {
+      continue;
+    }
+    MDNode *Empty = MDNode::get(*JitContext.LLVMContext, None);
+    for (unsigned I = 0; I < Escape->getNumArgOperands(); ++I) {
+      cast<AllocaInst>(Escape->getArgOperand(I))->setMetadata(EscapeKind,
+                                                              Empty);
+    }
+    Escape->eraseFromParent();
+    break;
+  }
+
+  Value *Target = Call.getCalledValue();
+  Call.setCalledFunction(CalleeFunction);
+  InlineFunctionInfo IFI;
+  if (!InlineFunction(Call, IFI)) {
+    Call.setCalledFunction(Target);
+    eraseCallee(CalleeFunction);
+    Reason = "LLVM could not inline the callee";
+    return INLINE_FAIL;
+  }
+
+  eraseCallee(CalleeFunction);
+  ++NumInlined;
+  Reason = "small callee";
+  return INLINE_PASS;
+}
+
+Function *LLILCInliner::readCallee(CORINFO_METHOD_INFO *CalleeInfo,
+                                   const char *&Reason) {
+  Module *M = JitContext.CurrentModule;
+  Function *LastFunction = &M->getFunctionList().back();
+  NamedMDNode *CompileUnits = M->getNamedMetadata("llvm.dbg.cu");
+  unsigned NumCompileUnits =
+      (CompileUnits == nullptr) ? 0 : CompileUnits->getNumOperands();
+
+  bool IsRead = true;
+  {
+    // Read the callee as though it were a nested jit request, sharing the
+    // module, type caches and GC info of the method being jitted.
+    LLILCJitContext CalleeContext(JitContext.State);
+    CalleeContext.JitInfo = JitContext.JitInfo;
+    CalleeContext.JitHost = JitContext.JitHost;
+    CalleeContext.MethodInfo = CalleeInfo;
+    CalleeContext.Flags =
+        JitContext.Flags & ~CORJIT_FLG_PUBLISH_SECRET_PARAM;
+    CalleeContext.EEInfo = JitContext.EEInfo;
+    CalleeContext.UseAtypicalCallSites = JitContext.UseAtypicalCallSites;
+    const char *ClassName = nullptr;
+    const char *MethodName =
+        JitContext.JitInfo->getMethodName(CalleeInfo->ftn, &ClassName);
+    CalleeContext.MethodName = std::string(ClassName) + '.' + MethodName;
+    CalleeContext.EEMethodName = MethodName;
+    CalleeContext.EEClassName = ClassName;
+    CalleeContext.LLVMContext = JitContext.LLVMContext;
+    CalleeContext.CurrentModule = M;
+    CalleeContext.TM = JitContext.TM;
+    CalleeContext.TheABIInfo = JitContext.TheABIInfo;
+    CalleeContext.Options = JitContext.Options;
+    CalleeContext.GcInfo = JitContext.GcInfo;
+    CalleeContext.InlineRoot = &JitContext;
+    CalleeContext.ProcArena.setSlabSize(JitContext.Options->ArenaSlabSize);
+
+    try {
+      GenIR Reader(&CalleeContext);
+      Reader.msilToIR();
+      if (Reader.containsUnmanagedCall()) {
+        Reason = "callee makes unmanaged calls";
+        IsRead = false;
+      }
+    } catch (NotYetImplementedException &) {
+      Reason = "reader cannot read callee";
+      IsRead = false;
+    }
+
+    // The callee's code refers to handles and helpers just like the code
+    // of the method being jitted, so they have to be reported with it.
+    for (auto &Entry : CalleeContext.NameToHandleMap) {
+      JitContext.NameToHandleMap[Entry.getKey()] = Entry.getValue();
+    }
+    for (auto &Entry : CalleeContext.ReadyToRunCallCells) {
+      JitContext.ReadyToRunCallCells.insert(Entry.getKey());
+    }
+    JitContext.HelperDescriptorMap.insert(
+        CalleeContext.HelperDescriptorMap.begin(),
+        CalleeContext.HelperDescriptorMap.end());
+    JitContext.IsCacheable &= CalleeContext.IsCacheable;
+  }
+
+  // The callee's function is the first definition the reader added.
+  Function *Callee = nullptr;
+  for (auto I = std::next(LastFunction->getIterator()), E = M->end();
+       I != E;) {
+    Function *F = &*I++;
+    if (F->isDeclaration()) {
+      continue;
+    }
+    if (Callee == nullptr) {
+      Callee = F;
+    } else {
+      assert(!IsRead && "Reader defined more than one function for callee");
+      eraseCallee(F);
+    }
+  }
+
+  if (IsRead) {
+    assert(Callee != nullptr && "Missing function for callee");
+    Reason = checkCallee(Callee);
+    IsRead = (Reason == nullptr);
+  }
+  if (!IsRead) {
+    if (Callee != nullptr) {
+      eraseCallee(Callee);
+      Callee = nullptr;
+    }
+  } else {
+    // Inlined code is described by the debug info of the call site.
+    stripDebugInfo(*Callee);
+  }
+
+  // Drop the compile unit the reader created for the callee.
+  if ((CompileUnits != nullptr) &&
+      (CompileUnits->getNumOperands() > NumCompileUnits)) {
+    SmallVector<MDNode *, 1> Kept;
+    for (unsigned I = 0; I < NumCompileUnits; ++I) {
+      Kept.push_back(CompileUnits->getOperand(I));
+    }
+    CompileUnits->dropAllReferences();
+    for (MDNode *CompileUnit : Kept) {
+      CompileUnits->addOperand(CompileUnit);
+    }
+  }
+
+  return Callee;
+}
+
+const char *LLILCInliner::checkCallee(Function *Callee) {
+  GcFuncInfo *CalleeGcInfo = JitContext.GcInfo->getGcInfo(Callee);
+  assert(CalleeGcInfo != nullptr && "Missing GcInfo for callee");
+  if (CalleeGcInfo->HasFunclets) {
+    return "callee has funclets";
+  }
+  for (auto &Entry : CalleeGcInfo->AllocaMap) {
+    if ((Entry.second.Flags & ~AllocaFlags::GcValue) != 0) {
+      return "callee has special frame slots";
+    }
+  }
+
+  for (BasicBlock &Block : *Callee) {
+    for (Instruction &Instr : Block) {
+      if (AllocaInst *Alloca = dyn_cast<AllocaInst>(&Instr)) {
+        if (!Alloca->isStaticAlloca()) {
+          return "callee allocates stack dynamically";
+        }
+      } else if (CallInst *Call = dyn_cast<CallInst>(&Instr)) {
+        if (Call->isMustTailCall()) {
+          return "callee makes a jmp or explicit tail call";
+        }
+      }
+    }
+  }
+
+  return nullptr;
+}
+
+void LLILCInliner::eraseCallee(Function *Callee) {
+  ::GcInfo *TheGcInfo = JitContext.GcInfo;
+  GcFuncInfo *CalleeGcInfo = TheGcInfo->getGcInfo(Callee);
+  if (CalleeGcInfo != nullptr) {
+    TheGcInfo->GcInfoMap.erase(Callee);
+    delete CalleeGcInfo;
+  }
+  assert(Callee->use_empty() && "Callee still in use");
+  Callee->eraseFromParent();
+}
+
+void LLILCInliner::recordInlinedAllocas() {
+  // Inlining moves the static allocas of a callee into the caller's entry
+  // block, so all of the marked allocas end up in the root's entry block.
+  BasicBlock &EntryBlock = Root->getEntryBlock();
+  SmallVector<AllocaInst *, 4> InlinedAllocas;
+  for (Instruction &Instr : EntryBlock) {
+    AllocaInst *Alloca = dyn_cast<AllocaInst>(&Instr);
+    if ((Alloca != nullptr) && (Alloca->getMetadata(EscapeKind) != nullptr)) {
+      Alloca->setMetadata(EscapeKind, nullptr);
+      InlinedAllocas.push_back(Alloca);
+    }
+  }
+  if (InlinedAllocas.empty()) {
+    return;
+  }
+
+  // A function may only have one localescape, so replace the root's with
+  // one that also escapes the inlined allocas. Inlining a call in the entry
+  // block splits it, so the root's may no longer be there.
+  SmallVector<Value *, 8> EscapingLocs;
+  for (BasicBlock &Block : *Root) {
+    for (auto I = Block.begin(), E = Block.end(); I != E;) {
+      IntrinsicInst *Escape = dyn_cast<IntrinsicInst>(&*I++);
+      if ((Escape != nullptr) &&
+          (Escape->getIntrinsicID() == Intrinsic::localescape)) {
+        for (unsigned J = 0; J < Escape->getNumArgOperands(); ++J) {
+          EscapingLocs.push_back(Escape->getArgOperand(J));
+        }
+        Escape->eraseFromParent();
+      }
+    }
+  }
+
+  // The GC reports these slots as live throughout the method, so they are
+  // zeroed in the prolog as well as at each inlined call.
+  GcFuncInfo *RootGcInfo = JitContext.GcInfo->getGcInfo(Root);
+  IRBuilder<> Builder(EntryBlock.getTerminator());
+  for (AllocaInst *Alloca : InlinedAllocas) {
+    RootGcInfo->recordGcAlloca(Alloca);
+    Builder.CreateStore(Constant::getNullValue(Alloca->getAllocatedType()),
+                        Alloca);
+    EscapingLocs.push_back(Alloca);
+  }
+  Function *FrameEscape =
+      Intrinsic::getDeclaration(JitContext.CurrentModule,
+                                Intrinsic::localescape);
+  Builder.CreateCall(FrameEscape, EscapingLocs);
+}
@@ -21,8 +21,22 @@
 #include "compiler.h"
 #include "readerir.h"
 #include "abi.h"
+#include "BoundsCheckElimination.h"
+#include "CodeCache.h"
+#include "CompileReplay.h"
+#include "CompileTelemetry.h"
+#include "DerivedPointerRematerialization.h"
 #include "EEMemoryManager.h"
 #include "EEObjectLinkingLayer.h"
+#include "Inliner.h"
+#include "ObjectStackAllocation.h"
+#include "ReadyToRunCallSiteLowering.h"
+#include "RuntimeLookupOptimization.h"
+#include "WriteBarrierElimination.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/TypeBasedAliasAnalysis.h"
 #include "llvm/CodeGen/GCs.h"
 #include "llvm/Config/llvm-config.h"
 #include "llvm/DebugInfo/DIContext.h"
@@ -36,6 +50,7 @@
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/DebugLoc.h"
 #include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/DiagnosticInfo.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/IR/LegacyPassManager.h"
@@ -44,6 +59,7 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/IR/PassManager.h"
+#include "llvm/IR/Statepoint.h"
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/Object/SymbolSize.h"
 #include "llvm/Support/CommandLine.h"
@@ -56,8 +72,11 @@
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/Timer.h"
+#include "llvm/InitializePasses.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Vectorize.h"
+#include <atomic>
 #include <string>
 #if defined(WIN32) && defined(_MSC_VER)
 #include <crtdbg.h>
@@ -68,7 +87,10 @@ using namespace llvm::object;
 
 class ObjectLoadListener {
 public:
-  ObjectLoadListener(LLILCJitContext *Context) { this->Context = Context; }
+  ObjectLoadListener(LLILCJitContext *Context, EEMemoryManager *MM) {
+    this->Context = Context;
+    this->MM = MM;
+  }
 
   template <typename ObjSetT, typename LoadResult>
   void operator()(llvm::orc::ObjectLinkingLayerBase::ObjSetHandleT ObjHandles,
@@ -80,7 +102,10 @@ public:
       const object::ObjectFile &Obj = *PObj->getBinary();
       const RuntimeDyld::LoadedObjectInfo &L = *LoadedObjInfos[I];
 
-      getDebugInfoForObject(Obj, L);
+      {
+        CompilePhaseTimer Timer(Context->Telemetry, CompilePhase::DebugInfo);
+        getDebugInfoForObject(Obj, L);
+      }
 
       recordRelocations(Obj, L);
 
@@ -91,16 +116,58 @@ public:
 private:
   /// \brief Get debug info for object and send to CLR EE
   ///
+  /// Only the code length is computed if the EE did not ask for debug info.
+  ///
   /// \param Obj Object file to get debug info for
   void getDebugInfoForObject(const ObjectFile &Obj,
                              const RuntimeDyld::LoadedObjectInfo &L);
 
+  /// \brief Find the code of the method and its funclets.
+  ///
+  /// \param Obj          Object file holding the method.
+  /// \param Addr [out]   Address of the method in \p Obj.
+  /// \param Size [out]   Size of the code from the start of the method to
+  ///                     the end of its last funclet, the alignment padding
+  ///                     in between included.
+  void getFunctionRange(const ObjectFile &Obj, uint64_t &Addr,
+                        uint64_t &Size);
+
+  /// \brief A relocation to report to the EE.
+  struct PendingRelocation {
+    uint8_t *FixupAddress;     ///< Address where the reloc is applied.
+    uint8_t *Target;           ///< Address of the symbol it refers to.
+    uint64_t Addend;           ///< Value added to \p Target.
+    uint64_t EERelocationType; ///< EE relocation type.
+    bool IsExtern;             ///< True if the symbol is not defined in the
+                               ///< object.
+  };
+
+  /// \brief What a relocation's symbol resolves to.
+  struct SymbolTarget {
+    uint8_t *Address; ///< Address of the symbol.
+    bool IsExtern;    ///< True if the symbol is not defined in the object.
+    bool IsCallCell;  ///< True if the symbol is a ReadyToRun indirection
+                      ///< cell that code may only call through.
+  };
+
   /// \brief Record relocations for external symbols via Jit interface.
   ///
+  /// If any reference to a ReadyToRun call cell is not a call [rel32], the
+  /// context is marked as having an atypical call site and nothing is
+  /// reported.
+  ///
   /// \param Obj Object file to record relocations for.
   void recordRelocations(const ObjectFile &Obj,
                          const RuntimeDyld::LoadedObjectInfo &L);
 
+  /// \brief Check whether the relocations of a section are reported to
+  /// the EE.
+  ///
+  /// \param Section   The section the relocations apply to.
+  /// \returns false for debug, unwind and stackmap sections, which are not
+  ///          part of the code and data the EE keeps.
+  bool isReportedSection(const SectionRef &Section);
+
   /// \brief Compute EE relocation type from LLVM relocation.
   ///
   /// \param LLVMRelocationType      LLVM relocation type to translate from.
@@ -115,6 +182,27 @@ private:
   uint64_t getRelocationAddend(uint64_t LLVMRelocationType,
                                uint8_t *FixupAddress);
 
+  /// \brief Record a relocation reported to the EE in the code cache record.
+  ///
+  /// \param FixupAddress       Address where the reloc is applied.
+  /// \param RelocationTarget   Address of the symbol the reloc refers to.
+  /// \param Addend             Value added to \p RelocationTarget.
+  /// \param EERelocationType   EE relocation type.
+  /// \param IsExtern           True if the symbol is not defined in the
+  ///                           object.
+  void recordRelocationForCache(uint8_t *FixupAddress,
+                                uint8_t *RelocationTarget, uint64_t Addend,
+                                uint64_t EERelocationType, bool IsExtern);
+
+  /// \brief Find the memory block holding an address.
+  ///
+  /// \param Address       The address to find.
+  /// \param Block [out]   The CodeCacheRelocation::BlockKind of the block.
+  /// \param Offset [out]  The offset of \p Address in the block.
+  /// \returns true if \p Address is in (or just past) the hot code or the
+  ///          read-only data.
+  bool findBlock(uint8_t *Address, uint8_t &Block, uint32_t &Offset);
+
   /// \brief Extract stack offsets for locals
   ///
   /// \param CU Dwarf Unit where locals exist
@@ -144,12 +232,23 @@ private:
 
 private:
   LLILCJitContext *Context;
+  EEMemoryManager *MM;
 };
 
 // The one and only Jit Object.
 LLILCJit *LLILCJit::TheJit = nullptr;
 ICorJitHost *LLILCJit::TheJitHost = nullptr;
 
+// Number of times the EE has asked the jit to clear its caches.
+static std::atomic<uint32_t> CacheGeneration(0);
+
+// Estimated bytes held by the LLVM contexts of all threads.
+static std::atomic<uint64_t> TotalContextFootprint(0);
+
+// True if fast-isel was turned off by the jit rather than by the user, so
+// that methods without statepoints may still use it.
+static bool IsFastISelOffByDefault = false;
+
 // This is guaranteed to be called by the EE
 // in single-threaded mode.
 ICorJitCompiler *__stdcall getJit() {
@@ -164,6 +263,14 @@ ICorJitCompiler *__stdcall getJit() {
     // is properly initialized.
     sys::AddSignalHandler(&LLILCJit::signalHandler, LLILCJit::TheJit);
 
+    // The null checks the reader marks make.implicit are only folded into
+    // faulting loads and stores with -enable-implicit-null-checks. That
+    // stays off by default: codegen describes the folded checks in a fault
+    // map, and the jit interface has no way to give the EE the faulting
+    // offsets in it. Until it does, null checks are explicit and the
+    // folding is only for experiments.
+    // TODO: Report the faulting offsets and enable implicit null checks.
+
     // Allow LLVM to pick up options via the environment
     cl::ParseEnvironmentOptions("LLILCJit", "COMPlus_AltJitOptions");
 
@@ -190,10 +297,15 @@ ICorJitCompiler *__stdcall getJit() {
 
     auto &Opts = cl::getRegisteredOptions();
     if (Opts["fast-isel"]->getNumOccurrences() == 0) {
-      // Statepoint GC does not support Fast ISel yet.
+      // Statepoint GC does not support Fast ISel yet: FastISel selects
+      // bottom-up and falls back to SelectionDAG one intrinsic at a time,
+      // so each gc.relocate would be lowered before its gc.statepoint.
       // TODO: Enable Statepoints with fast-isel
       // https://github.com/dotnet/llilc/issues/512
+      // lowerMethod turns FastISel back on for minimal-opt methods that
+      // have no statepoints.
       Opts["fast-isel"]->addOccurrence(0, "fast-isel", "false");
+      IsFastISelOffByDefault = true;
     }
     if (Opts["disable-cgp-gc-opts"]->getNumOccurrences() == 0) {
       // There is a bug in the CGP gc-opts, so this optimization
@@ -214,9 +326,14 @@ LLILCJit::LLILCJit() {
   initializeCore(Registry);
   initializeScalarOpts(Registry);
 
+  initializeTransformUtils(Registry);
+  initializeInstCombine(Registry);
+  initializeAnalysis(Registry);
+
   InitializeNativeTarget();
   InitializeNativeTargetAsmPrinter();
   InitializeNativeTargetAsmParser();
+  InitializeNativeTargetDisassembler();
 
   llvm::linkCoreCLRGC();
 }
@@ -242,7 +359,9 @@ extern "C" void __stdcall jitStartup(ICorJitHost *JitHost) {
 }
 
 LLILCJitContext::LLILCJitContext(LLILCJitPerThreadState *PerThreadState)
-    : HasLoadedBitCode(false), State(PerThreadState) {
+    : HasLoadedBitCode(false), State(PerThreadState),
+      ProcArena(ProcArenaStatistics) {
+  this->Options = nullptr;
   this->Next = State->JitContext;
   State->JitContext = this;
 }
@@ -253,11 +372,103 @@ LLILCJitContext::~LLILCJitContext() {
   State->JitContext = TopContext->Next;
 }
 
+// Get the name of an OptLevel, for diagnostics.
+static const char *getOptLevelName(::OptLevel OptLevel) {
+  switch (OptLevel) {
+  case ::OptLevel::DEBUG_CODE:
+    return "debug";
+  case ::OptLevel::BLENDED_CODE:
+    return "blended";
+  case ::OptLevel::SMALL_CODE:
+    return "small";
+  case ::OptLevel::FAST_CODE:
+    return "fast";
+  case ::OptLevel::TIER0_CODE:
+    return "tier0";
+  default:
+    return "invalid";
+  }
+}
+
+// Finish the telemetry record of a jit request, if there is one, and hand it
+// to the telemetry sink.
+static void reportTelemetry(LLILCJitContext &Context, const char *Outcome,
+                            ULONG NativeSize) {
+  CompileTelemetry *Telemetry = Context.Telemetry;
+  if (Telemetry == nullptr) {
+    return;
+  }
+  Telemetry->finish();
+  Telemetry->Outcome = Outcome;
+  Telemetry->NativeSize = NativeSize;
+  LLILCTelemetry::get().report(*Telemetry);
+  Context.Telemetry = nullptr;
+}
+
+// Check whether a module has any statepoints.
+static bool hasStatepoints(Module &M) {
+  for (Function &F : M) {
+    for (BasicBlock &Block : F) {
+      for (Instruction &Instr : Block) {
+        if (isStatepoint(&Instr)) {
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+// Record the number of statepoints in a module and the GC pointers live at
+// each of them.
+static void recordStatepointLiveSets(Module &M, CompileTelemetry &Telemetry) {
+  for (Function &F : M) {
+    for (BasicBlock &Block : F) {
+      for (Instruction &Instr : Block) {
+        if (!isStatepoint(&Instr)) {
+          continue;
+        }
+        ImmutableStatepoint Statepoint(&Instr);
+        uint32_t LiveCount = std::distance(Statepoint.gc_args_begin(),
+                                           Statepoint.gc_args_end());
+        ++Telemetry.StatepointCount;
+        Telemetry.StatepointLiveCount += LiveCount;
+        Telemetry.MaxStatepointLiveCount =
+            std::max(Telemetry.MaxStatepointLiveCount, LiveCount);
+      }
+    }
+  }
+}
+
 // This is the method invoked by the EE to Jit code.
 CorJitResult LLILCJit::compileMethod(ICorJitInfo *JitInfo,
                                      CORINFO_METHOD_INFO *MethodInfo,
                                      UINT Flags, BYTE **NativeEntry,
                                      ULONG *NativeSizeOfCode) {
+  bool HasAtypicalCallSite = false;
+  CorJitResult Result =
+      compileMethod(JitInfo, MethodInfo, Flags, NativeEntry, NativeSizeOfCode,
+                    false, HasAtypicalCallSite);
+
+  // Shared delay-load thunks find the cell a ReadyToRun call goes through by
+  // decoding the call instruction. If the code reaches a cell any other way,
+  // compile the method again and tell the EE its call sites are atypical.
+  if (HasAtypicalCallSite) {
+    Result = compileMethod(JitInfo, MethodInfo, Flags, NativeEntry,
+                           NativeSizeOfCode, true, HasAtypicalCallSite);
+    assert(!HasAtypicalCallSite && "Atypical call sites are not checked");
+  }
+
+  return Result;
+}
+
+CorJitResult LLILCJit::compileMethod(ICorJitInfo *JitInfo,
+                                     CORINFO_METHOD_INFO *MethodInfo,
+                                     UINT Flags, BYTE **NativeEntry,
+                                     ULONG *NativeSizeOfCode,
+                                     bool UseAtypicalCallSites,
+                                     bool &HasAtypicalCallSite) {
+  HasAtypicalCallSite = false;
 
   // Bail if input is malformed
   if (nullptr == JitInfo || nullptr == MethodInfo || nullptr == NativeEntry ||
@@ -270,11 +481,8 @@ CorJitResult LLILCJit::compileMethod(ICorJitInfo *JitInfo,
   *NativeSizeOfCode = 0;
 
   // Set up state for this thread (if necessary)
-  LLILCJitPerThreadState *PerThreadState = State.get();
-  if (PerThreadState == nullptr) {
-    PerThreadState = new LLILCJitPerThreadState();
-    State.set(PerThreadState);
-  }
+  std::unique_lock<std::recursive_mutex> StateLock;
+  LLILCJitPerThreadState *PerThreadState = getPerThreadState(StateLock);
 
   // Set up context for this Jit request
   LLILCJitContext Context(PerThreadState);
@@ -283,17 +491,19 @@ CorJitResult LLILCJit::compileMethod(ICorJitInfo *JitInfo,
   Context.JitInfo = JitInfo;
   Context.MethodInfo = MethodInfo;
   Context.Flags = Flags;
+  Context.UseAtypicalCallSites = UseAtypicalCallSites;
+  // Clear the padding too, since the code cache hashes the EE info bytes.
+  memset(&Context.EEInfo, 0, sizeof(Context.EEInfo));
   JitInfo->getEEInfo(&Context.EEInfo);
 
   // Fill in context information from LLVM
-  Context.LLVMContext = &PerThreadState->LLVMContext;
+  Context.LLVMContext = PerThreadState->LLVMContext.get();
   std::unique_ptr<Module> M = Context.getModuleForMethod(MethodInfo);
   Context.CurrentModule = M.get();
   Context.CurrentModule->setTargetTriple(LLILC_TARGET_TRIPLE);
   Context.CurrentModule->addModuleFlag(Module::Warning, "Debug Info Version",
                                        DEBUG_METADATA_VERSION);
   Context.MethodName = Context.CurrentModule->getModuleIdentifier();
-  Context.TheABIInfo = ABIInfo::get(*Context.CurrentModule);
   Context.GcInfo = new GcInfo();
 
   // Initialize per invocation JIT options. This should be done after the
@@ -311,56 +521,73 @@ CorJitResult LLILCJit::compileMethod(ICorJitInfo *JitInfo,
   CorJitResult Result = CORJIT_INTERNALERROR;
   if (JitOptions.IsAltJit && !JitOptions.IsExcludeMethod) {
     Context.Options = &JitOptions;
+    Context.ProcArena.setSlabSize(JitOptions.ArenaSlabSize);
+
+    // Collect compile time telemetry if there is somewhere to send it.
+    CompileTelemetry Telemetry;
+    if (!JitOptions.TelemetryPath.empty() &&
+        LLILCTelemetry::get().open(JitOptions.TelemetryPath,
+                                   JitOptions.IsTelemetryJSON)) {
+      Telemetry.MethodName = Context.MethodName;
+      Telemetry.OptLevel = getOptLevelName(JitOptions.OptLevel);
+      Telemetry.ILSize = MethodInfo->ILCodeSize;
+      Context.Telemetry = &Telemetry;
+    }
+
+    // Install the method from the persistent code cache if it's there;
+    // otherwise record what is reported to the EE so it can be saved.
+    LLILCCodeCache &CodeCache = LLILCCodeCache::get();
+    CodeCacheKey CacheKey;
+    CodeCacheEntry CacheRecord;
+    bool IsCacheCandidate =
+        !JitOptions.CodeCacheDirectory.empty() &&
+        CodeCache.computeKey(Context, JitOptions.CodeCacheDirectory, CacheKey);
+    if (IsCacheCandidate) {
+      if (CodeCache.install(Context, CacheKey, NativeEntry, NativeSizeOfCode)) {
+        if (JitOptions.DumpLevel == DumpLevel::SUMMARY) {
+          dbgs() << "INFO:  installed method " << Context.MethodName
+                 << " from the code cache\n";
+          CodeCache.printStatistics(dbgs());
+        }
+        reportTelemetry(Context, "cached", *NativeSizeOfCode);
+        delete Context.GcInfo;
+        return CORJIT_OK;
+      }
+      Context.CodeCacheRecord = &CacheRecord;
+    }
 
-    // Construct the TargetMachine that we will emit code for
-    std::string ErrStr;
-    const llvm::Target *TheTarget =
-        TargetRegistry::lookupTarget(LLILC_TARGET_TRIPLE, ErrStr);
-    if (!TheTarget) {
-      errs() << "Could not create Target: " << ErrStr << "\n";
+    // Find the TargetMachine that we will emit code for
+    bool IsTargetMachineReused = false;
+    LLILCTargetMachineEntry *TMEntry =
+        getTargetMachine(Context, IsTargetMachineReused);
+    if (TMEntry == nullptr) {
+      reportTelemetry(Context, "failed", 0);
       return CORJIT_INTERNALERROR;
     }
-    TargetOptions Options;
-    CodeGenOpt::Level OptLevel;
-    bool IsNgen = Context.Flags & CORJIT_FLG_PREJIT;
-    bool IsReadyToRun = Context.Flags & CORJIT_FLG_READYTORUN;
-
-    // Optimal code for ReadyToRun should have all calls in call [rel32] form to
-    // enable crossgen to use shared delay-load thunks. We can't guarantee that
-    // LLVM will always generate this form so we currently don't take advantage
-    // of that and use non-shared delay-load thunks. The plan is to have as many
-    // calls as possible in that form and use shared delay-load thunks when
-    // possible. Setting OptLevel to Default increases the chances of calls via
-    // memory and setting CodeModel to Default enables rel32 relocations.
-    if ((Context.Options->EnableOptimization) || IsNgen || IsReadyToRun) {
-      OptLevel = CodeGenOpt::Level::Default;
-    } else {
-      OptLevel = CodeGenOpt::Level::None;
-      // Options.NoFramePointerElim = true;
-    }
-    llvm::CodeModel::Model CodeModel =
-        (IsNgen || IsReadyToRun) ? CodeModel::Default : CodeModel::JITDefault;
-    TargetMachine *TM =
-        TheTarget->createTargetMachine(LLILC_TARGET_TRIPLE, "", "", Options,
-                                       Reloc::Default, CodeModel, OptLevel);
+    TargetMachine *TM = TMEntry->TM.get();
     Context.TM = TM;
+    Context.TMEntry = TMEntry;
 
     // Set target machine datalayout on the method module.
-    Context.CurrentModule->setDataLayout(TM->createDataLayout());
+    Context.CurrentModule->setDataLayout(TMEntry->DataLayout);
+    Context.TheABIInfo = TMEntry->TheABIInfo;
 
-    // Construct the jitting layers.
+    // Construct the jitting layers. The object buffer is declared first so
+    // that it outlives the object files the layers hold on to.
+    PooledObjectBuffer ObjBuffer(PerThreadState);
     EEMemoryManager MM(&Context);
-    ObjectLoadListener Listener(&Context);
+    ObjectLoadListener Listener(&Context, &MM);
     orc::EEObjectLinkingLayer<decltype(Listener)> Loader(Listener);
-    auto ReserveUnwindSpace =
+    auto ReserveObjectSpace =
         [&MM](std::unique_ptr<object::OwningBinary<object::ObjectFile>> Obj) {
-          MM.reserveUnwindSpace(*Obj->getBinary());
+          MM.reserveObjectSpace(*Obj->getBinary());
           return std::move(Obj);
         };
-    orc::ObjectTransformLayer<decltype(Loader), decltype(ReserveUnwindSpace)>
-        UnwindReserver(Loader, ReserveUnwindSpace);
-    orc::IRCompileLayer<decltype(UnwindReserver)> Compiler(
-        UnwindReserver, orc::LLILCCompiler(*TM));
+    orc::ObjectTransformLayer<decltype(Loader), decltype(ReserveObjectSpace)>
+        SpaceReserver(Loader, ReserveObjectSpace);
+    orc::IRCompileLayer<decltype(SpaceReserver)> Compiler(
+        SpaceReserver,
+        orc::LLILCCompiler(*TM, ObjBuffer.get(), Context.Telemetry));
 
     // Now jit the method.
     if (Context.Options->DumpLevel == DumpLevel::VERBOSE) {
@@ -381,30 +608,40 @@ CorJitResult LLILCJit::compileMethod(ICorJitInfo *JitInfo,
 
       JitInfo->setMethodAttribs(MethodInfo->ftn, verFlag);
 
+      reportTelemetry(Context, "import_only", 0);
       return Result;
     }
 #endif
 
     if (HasMethod) {
+      PerThreadState->addMethodFootprint(*M, JitOptions.ContextMemoryLimit);
+      if (Context.Telemetry != nullptr) {
+        for (Function &F : *M) {
+          Context.Telemetry->BasicBlockCount += F.size();
+        }
+        Context.Telemetry->ContextFootprint =
+            PerThreadState->getContextFootprint();
+      }
+
       if (JitOptions.IsLLVMDumpMethod) {
         dbgs() << "INFO:  Dumping LLVM for method " << Context.MethodName
                << "\n";
         Context.CurrentModule->dump();
       }
-      // If using Precise GC, run the GC-Safepoint insertion
-      // and lowering passes before generating code.  If
-      // using conservative GC but the function has an unmanaged
-      // call, skip safepoint insertion but run the lowering
-      // pass to lower the gc-transition arguments.
-      if (ContainsUnmanagedCall || Context.Options->DoInsertStatepoints) {
-        legacy::PassManager Passes;
-        if (Context.Options->DoInsertStatepoints) {
-          Passes.add(createPlaceSafepointsPass());
-        }
-        Passes.add(createRewriteStatepointsForGCPass());
-        Passes.run(*M);
+
+      // Keep what the reader made, so the rest of the compile can be
+      // replayed without the EE.
+      if (!JitOptions.ReplayRecordPath.empty() && !Context.HasLoadedBitCode &&
+          LLILCReplayRecorder::get().open(JitOptions.ReplayRecordPath)) {
+        LLILCReplayRecorder::get().record(Context, ContainsUnmanagedCall);
       }
 
+      // Run the mid-level optimizer, if one is called for.
+      this->optimizeMethod(&Context);
+
+      // Lower the IR for GC and ReadyToRun before generating code.
+      this->lowerMethod(&Context, ContainsUnmanagedCall);
+
       // Use a custom resolver that will tell the dynamic linker to skip
       // relocation processing for external symbols that we create. We will
       // report relocations for those symbols via Jit interface's
@@ -413,44 +650,94 @@ CorJitResult LLILCJit::compileMethod(ICorJitInfo *JitInfo,
       auto HandleSet =
           Compiler.addModuleSet<ArrayRef<Module *>>(M.get(), &MM, &Resolver);
 
-      *NativeEntry =
-          (BYTE *)Compiler.findSymbol(Context.MethodName, false).getAddress();
-
-      // TODO: ColdCodeSize, or separated code, is not enabled or included.
-      *NativeSizeOfCode = Context.HotCodeSize + Context.ReadOnlyDataSize;
-      if (JitOptions.IsCodeRangeMethod) {
-        errs() << "LLILC compiled: "
-               << ", Entry = " << *NativeEntry
-               << ", End = " << (*NativeEntry + *NativeSizeOfCode)
-               << ", size = " << *NativeSizeOfCode
-               << " method = " << Context.MethodName << '\n';
+      // Looking up the symbol is what has RuntimeDyld load the object.
+      {
+        CompilePhaseTimer Timer(Context.Telemetry, CompilePhase::Link);
+        *NativeEntry =
+            (BYTE *)Compiler.findSymbol(Context.MethodName, false).getAddress();
       }
 
-      // The Method Jitted must begin at the start of the allocated
-      // Code block. The EE's DebugInfoManager relies on this.
-      // It allocates a CoreHeader block immediately before the
-      // code block address returned, and expects to find it
-      // at a fixed offset from *NativeEntry.
-      assert(*NativeEntry == MM.getHotCodeBlock() &&
-             "Expect the JITted method at the beginning of the code block");
-      GcInfoAllocator GcInfoAllocator;
-      GcInfoEmitter GcInfoEmitter(&Context, MM.getStackMapSection(),
-                                  &GcInfoAllocator);
-      GcInfoEmitter.emitGCInfo();
-
-      // Dump out any enabled timing info.
-      TimerGroup::printAll(errs());
+      // Code that reaches a ReadyToRun call cell other than by call [rel32]
+      // is not used; the caller compiles the method again.
+      HasAtypicalCallSite = Context.HasAtypicalCallSite;
+      if (!Context.HasAtypicalCallSite) {
+        // TODO: ColdCodeSize, or separated code, is not enabled or included.
+        *NativeSizeOfCode = Context.HotCodeSize + Context.ReadOnlyDataSize;
+        if (JitOptions.IsCodeRangeMethod) {
+          errs() << "LLILC compiled: "
+                 << ", Entry = " << *NativeEntry
+                 << ", End = " << (*NativeEntry + *NativeSizeOfCode)
+                 << ", size = " << *NativeSizeOfCode
+                 << " method = " << Context.MethodName << '\n';
+        }
+
+        // The Method Jitted must begin at the start of the allocated
+        // Code block. The EE's DebugInfoManager relies on this.
+        // It allocates a CoreHeader block immediately before the
+        // code block address returned, and expects to find it
+        // at a fixed offset from *NativeEntry.
+        assert(*NativeEntry == MM.getHotCodeBlock() &&
+               "Expect the JITted method at the beginning of the code block");
+        GcInfoAllocator GcInfoAllocator(&Context.ProcArena);
+        GcInfoEmitter GcInfoEmitter(&Context, MM.getStackMapSection(),
+                                    &GcInfoAllocator, MM.getHotCodeBlock());
+        {
+          CompilePhaseTimer Timer(Context.Telemetry, CompilePhase::GcInfo);
+          GcInfoEmitter.emitGCInfo();
+        }
+
+        if (Context.Telemetry != nullptr) {
+          Context.Telemetry->ReservedSize =
+              Context.HotCodeSize + Context.ReadOnlyDataSize;
+          Context.Telemetry->UnusedSize = MM.getUnusedSize();
+        }
+
+        if (IsCacheCandidate) {
+          CacheRecord.HotCode.assign(MM.getHotCodeBlock(),
+                                     MM.getHotCodeBlock() +
+                                         Context.HotCodeSize);
+          CacheRecord.ReadOnlyData.assign(MM.getReadOnlyDataBlock(),
+                                          MM.getReadOnlyDataBlock() +
+                                              Context.ReadOnlyDataSize);
+          CacheRecord.HasGcInfo =
+              GcInfoEmitter.getEmittedRecord(CacheRecord.GcRecord);
+          CodeCache.store(Context, CacheKey, CacheRecord);
+          Context.CodeCacheRecord = nullptr;
+          if (JitOptions.DumpLevel == DumpLevel::SUMMARY) {
+            CodeCache.printStatistics(dbgs());
+          }
+        }
+
+        // Dump out any enabled timing info.
+        TimerGroup::printAll(errs());
+        if (TimePassesIsEnabled && IsTargetMachineReused) {
+          errs() << "INFO:  Reused cached TargetMachine for "
+                 << Context.MethodName << ", saved "
+                 << format("%.4f", TMEntry->CreationTime * 1000.0) << " ms\n";
+        }
+
+        // Tell the CLR that we've successfully generated code for this method.
+        Result = CORJIT_OK;
+      }
 
       // Give the jit layers a chance to free resources.
       Compiler.removeModuleSet(HandleSet);
-
-      // Tell the CLR that we've successfully generated code for this method.
-      Result = CORJIT_OK;
     }
 
-    // Clean up a bit
-    delete Context.TM;
+    // The target machine and ABI info are owned by the per-thread cache.
     Context.TM = nullptr;
+    Context.TMEntry = nullptr;
+    Context.TheABIInfo = nullptr;
+
+    reportTelemetry(Context, (Result == CORJIT_OK) ? "jitted" : "failed",
+                    *NativeSizeOfCode);
+
+    // The reader is done with its procedure-lifetime memory.
+    Context.ProcArena.release();
+    if (JitOptions.DumpLevel == DumpLevel::SUMMARY) {
+      TempArenaStatistics.print(dbgs());
+      ProcArenaStatistics.print(dbgs());
+    }
   } else {
     // This method was not selected for jitting by LLILC.
     if (JitOptions.DumpLevel == DumpLevel::SUMMARY) {
@@ -460,20 +747,245 @@ CorJitResult LLILCJit::compileMethod(ICorJitInfo *JitInfo,
   }
 
   // Clean up a bit more
-  delete Context.TheABIInfo;
   delete Context.GcInfo;
-  Context.TheABIInfo = nullptr;
   Context.GcInfo = nullptr;
 
   return Result;
 }
 
+LLILCJitPerThreadState *
+LLILCJit::getPerThreadState(std::unique_lock<std::recursive_mutex> &StateLock) {
+  LLILCJitPerThreadState *PerThreadState = State.get();
+  if (PerThreadState == nullptr) {
+    PerThreadState = new LLILCJitPerThreadState();
+    PerThreadState->ContextGeneration = CacheGeneration;
+    State.set(PerThreadState);
+    std::lock_guard<std::mutex> Guard(AllStatesLock);
+    AllStates.push_back(PerThreadState);
+  }
+
+  StateLock = std::unique_lock<std::recursive_mutex>(PerThreadState->Lock);
+  if ((PerThreadState->JitContext == nullptr) &&
+      PerThreadState->isContextRecycleDue()) {
+    // Nothing from earlier requests is still using the LLVMContext.
+    PerThreadState->recycleContext();
+  }
+  return PerThreadState;
+}
+
+LLILCTargetMachineEntry *LLILCJit::getTargetMachine(LLILCJitContext &Context,
+                                                    bool &IsReused) {
+  CodeGenOpt::Level OptLevel;
+  bool IsNgen = Context.Flags & CORJIT_FLG_PREJIT;
+  bool IsReadyToRun = Context.Flags & CORJIT_FLG_READYTORUN;
+
+  // ReadyToRun calls through indirection cells must be in call [rel32] form
+  // for crossgen to share their delay-load thunks. Instruction selection
+  // only folds the load of the cell into the call when optimizing, and the
+  // Default code model makes the cell's address a rel32 relocation.
+  if ((Context.Options->EnableOptimization) || IsNgen || IsReadyToRun) {
+    OptLevel = CodeGenOpt::Level::Default;
+  } else {
+    OptLevel = CodeGenOpt::Level::None;
+    // Options.NoFramePointerElim = true;
+  }
+  // Jitted code keeps the JIT default (large) code model, so that direct
+  // calls to helpers and methods load a 64-bit target: RuntimeDyld resolves
+  // rel32 fixups to external symbols itself before the relocations are
+  // reported, so the EE would never get to route a call that cannot reach
+  // its target through a jump stub.
+  llvm::CodeModel::Model CodeModel =
+      (IsNgen || IsReadyToRun) ? CodeModel::Default : CodeModel::JITDefault;
+  // Jitted code only runs on this machine, so it may use AVX2 when the EE
+  // says the CPU has it; Vector<T> is then 32 bytes wide.
+  bool UseAVX2 = false;
+#if defined(_TARGET_X86_) || defined(_TARGET_AMD64_)
+  UseAVX2 = !IsNgen && !IsReadyToRun &&
+            ((Context.Flags & CORJIT_FLG_USE_AVX2) != 0);
+#endif
+  return Context.State->getTargetMachine(OptLevel, CodeModel, IsNgen,
+                                         IsReadyToRun, UseAVX2, IsReused);
+}
+
+void LLILCJit::lowerMethod(LLILCJitContext *JitContext,
+                           bool ContainsUnmanagedCall) {
+  Module &M = *JitContext->CurrentModule;
+
+  // If using Precise GC, run the GC-Safepoint insertion
+  // and lowering passes before generating code.  If
+  // using conservative GC but the function has an unmanaged
+  // call, skip safepoint insertion but run the lowering
+  // pass to lower the gc-transition arguments.
+  if (ContainsUnmanagedCall || JitContext->Options->DoInsertStatepoints) {
+    CompilePhaseTimer Timer(JitContext->Telemetry, CompilePhase::Statepoints);
+    legacy::PassManager Passes;
+    Passes.add(createDerivedPointerRematerializationPass());
+    if (JitContext->Options->DoInsertStatepoints) {
+      Passes.add(createPlaceSafepointsPass());
+    }
+    Passes.add(createRewriteStatepointsForGCPass());
+    Passes.run(M);
+
+    if (JitContext->Telemetry != nullptr) {
+      recordStatepointLiveSets(M, *JitContext->Telemetry);
+    }
+  }
+
+  // Shared delay-load thunks need every call through a ReadyToRun
+  // indirection cell to be call [rel32]. Put the load of the cell next
+  // to each such call so that instruction selection folds it.
+  if ((JitContext->Flags & CORJIT_FLG_READYTORUN) != 0) {
+    legacy::PassManager Passes;
+    Passes.add(createReadyToRunCallSiteLoweringPass());
+    Passes.run(M);
+  }
+
+  // Minimal-opt methods select instructions with FastISel unless they have
+  // statepoints, which it cannot select. The target machine is shared by
+  // the thread's requests, so this is decided for every method.
+  if (IsFastISelOffByDefault) {
+    bool UseFastISel = (JitContext->TM->getOptLevel() == CodeGenOpt::None) &&
+                       !hasStatepoints(M);
+    JitContext->TM->setFastISel(UseFastISel);
+  }
+}
+
+LLILCJitPerThreadState::LLILCJitPerThreadState()
+    : LLVMContext(new llvm::LLVMContext()), JitContext(nullptr),
+      TargetMachineMap(), ClassTypeMap(), ReverseClassTypeMap(),
+      BoxedTypeMap(), ArrayTypeMap(), FieldIndexMap(), ABISignatures() {}
+
+LLILCJitPerThreadState::~LLILCJitPerThreadState() {}
+
+std::unique_ptr<SmallVector<char, 0>>
+LLILCJitPerThreadState::takeObjectBuffer() {
+  if (FreeObjectBuffers.empty()) {
+    return llvm::make_unique<SmallVector<char, 0>>();
+  }
+  std::unique_ptr<SmallVector<char, 0>> Buffer =
+      std::move(FreeObjectBuffers.back());
+  FreeObjectBuffers.pop_back();
+  return Buffer;
+}
+
+void LLILCJitPerThreadState::returnObjectBuffer(
+    std::unique_ptr<SmallVector<char, 0>> Buffer) {
+  // Don't let one huge method pin its object buffer for the life of the
+  // thread.
+  const size_t MaxKeptCapacity = 1024 * 1024;
+  if (Buffer->capacity() <= MaxKeptCapacity) {
+    FreeObjectBuffers.push_back(std::move(Buffer));
+  }
+}
+
+// Rough bytes of constants, metadata and attribute sets that reading a
+// method leaves in the LLVMContext for each instruction of its IR.
+static const uint64_t ContextBytesPerInstruction = 32;
+
+// Rough bytes of an LLVM type built for a class, with its name and elements.
+static const uint64_t ContextBytesPerType = 128;
+
+uint64_t LLILCJitPerThreadState::getContextFootprint() const {
+  uint64_t NumTypes =
+      ClassTypeMap.size() + BoxedTypeMap.size() + ArrayTypeMap.size();
+  return MethodFootprint + NumTypes * ContextBytesPerType +
+         ClassTypeMap.getMemorySize() + ReverseClassTypeMap.getMemorySize() +
+         BoxedTypeMap.getMemorySize() + ArrayTypeMap.getMemorySize() +
+         FieldIndexMap.getMemorySize();
+}
+
+void LLILCJitPerThreadState::addMethodFootprint(const Module &M,
+                                                unsigned Limit) {
+  uint64_t NumInstructions = 0;
+  for (const Function &F : M) {
+    for (const BasicBlock &Block : F) {
+      NumInstructions += Block.size();
+    }
+  }
+  MethodFootprint += NumInstructions * ContextBytesPerInstruction;
+
+  // The maps into the context never shrink, so neither does the footprint.
+  uint64_t Footprint = getContextFootprint();
+  TotalContextFootprint += Footprint - ReportedFootprint;
+  ReportedFootprint = Footprint;
+  IsContextOverLimit = (Limit != 0) && (Footprint > (uint64_t)Limit * 1024);
+}
+
+bool LLILCJitPerThreadState::isContextRecycleDue() const {
+  return IsContextOverLimit || (ContextGeneration != CacheGeneration);
+}
+
+void LLILCJitPerThreadState::recycleContext() {
+  assert(JitContext == nullptr && "LLVMContext is in use");
+
+  // The maps point into the context, so they go first.
+  ClassTypeMap.clear();
+  ReverseClassTypeMap.clear();
+  BoxedTypeMap.clear();
+  ArrayTypeMap.clear();
+  FieldIndexMap.clear();
+  ABISignatures.reset();
+  LLVMContext.reset(new llvm::LLVMContext());
+
+  TotalContextFootprint -= ReportedFootprint;
+  ReportedFootprint = 0;
+  MethodFootprint = 0;
+  IsContextOverLimit = false;
+  ContextGeneration = CacheGeneration;
+}
+
+LLILCTargetMachineEntry::LLILCTargetMachineEntry(TargetMachine *TM,
+                                                 double CreationTime)
+    : TM(TM), DataLayout(TM->createDataLayout()),
+      TheABIInfo(ABIInfo::get(TM->getTargetTriple(), DataLayout)),
+      CreationTime(CreationTime) {}
+
+LLILCTargetMachineEntry::~LLILCTargetMachineEntry() { delete TheABIInfo; }
+
+LLILCTargetMachineEntry *
+LLILCJitPerThreadState::getTargetMachine(CodeGenOpt::Level OptLevel,
+                                         CodeModel::Model CodeModel,
+                                         bool IsNgen, bool IsReadyToRun,
+                                         bool UseAVX2, bool &IsReused) {
+  auto Key =
+      std::make_tuple(OptLevel, CodeModel, IsNgen, IsReadyToRun, UseAVX2);
+  auto Iter = TargetMachineMap.find(Key);
+  if (Iter != TargetMachineMap.end()) {
+    IsReused = true;
+    return Iter->second.get();
+  }
+
+  IsReused = false;
+  TimeRecord StartTime = TimeRecord::getCurrentTime(true);
+  std::string ErrStr;
+  const llvm::Target *TheTarget =
+      TargetRegistry::lookupTarget(LLILC_TARGET_TRIPLE, ErrStr);
+  if (!TheTarget) {
+    errs() << "Could not create Target: " << ErrStr << "\n";
+    return nullptr;
+  }
+  TargetOptions Options;
+  const char *Features = UseAVX2 ? "+avx,+avx2" : "";
+  TargetMachine *TM =
+      TheTarget->createTargetMachine(LLILC_TARGET_TRIPLE, "", Features, Options,
+                                     Reloc::Default, CodeModel, OptLevel);
+  LLILCTargetMachineEntry *Entry = new LLILCTargetMachineEntry(TM, 0.0);
+  TimeRecord EndTime = TimeRecord::getCurrentTime(false);
+  Entry->CreationTime = EndTime.getWallTime() - StartTime.getWallTime();
+
+  TargetMachineMap[Key].reset(Entry);
+  return Entry;
+}
+
 std::unique_ptr<Module>
 LLILCJitContext::getModuleForMethod(CORINFO_METHOD_INFO *MethodInfo) {
-  // Grab name info from the EE.
+  // Grab name info from the EE. The names are kept in the context so that
+  // the method set queries do not have to ask for them again.
   const char *DebugClassName = nullptr;
   const char *DebugMethodName = nullptr;
   DebugMethodName = JitInfo->getMethodName(MethodInfo->ftn, &DebugClassName);
+  EEMethodName = DebugMethodName;
+  EEClassName = DebugClassName;
 
   // Stop gap name.  The full naming will likely require some more info.
   std::string ModName(DebugClassName);
@@ -525,6 +1037,7 @@ bool LLILCJit::readMethod(LLILCJitContext *JitContext,
   std::string FuncName = JitContext->MethodName;
 
   try {
+    CompilePhaseTimer Timer(JitContext->Telemetry, CompilePhase::MSILToIR);
     GenIR Reader(JitContext);
     Reader.msilToIR();
     ContainsUnmanagedCall = Reader.containsUnmanagedCall();
@@ -535,7 +1048,27 @@ bool LLILCJit::readMethod(LLILCJitContext *JitContext,
     return false;
   }
 
-  bool IsOk = !verifyModule(*JitContext->CurrentModule, &dbgs());
+  // Inline small callees now that the method is read. Callees that can't be
+  // inlined are left as calls, so this never fails the method.
+  if (LLILCInliner::isEnabled(*JitContext)) {
+    CompilePhaseTimer Timer(JitContext->Telemetry, CompilePhase::MSILToIR);
+    LLILCInliner Inliner(*JitContext);
+    Inliner.run();
+  }
+
+  // Allocate objects that do not escape on the stack, once inlining has
+  // exposed the uses constructors and other callees make of them.
+  if (ObjectStackAllocator::isEnabled(*JitContext)) {
+    CompilePhaseTimer Timer(JitContext->Telemetry, CompilePhase::MSILToIR);
+    ObjectStackAllocator StackAllocator(*JitContext);
+    StackAllocator.run();
+  }
+
+  bool IsOk;
+  {
+    CompilePhaseTimer Timer(JitContext->Telemetry, CompilePhase::Verify);
+    IsOk = !verifyModule(*JitContext->CurrentModule, &dbgs());
+  }
   assert(IsOk && "verification failed");
 
   if (IsOk) {
@@ -556,11 +1089,174 @@ bool LLILCJit::readMethod(LLILCJitContext *JitContext,
   return IsOk;
 }
 
+// Build the mid-level IR optimization pipeline for an OptLevel.
+static legacy::PassManager *createOptimizer(::OptLevel OptLevel,
+                                            TargetMachine *TM) {
+  legacy::PassManager *Passes = new legacy::PassManager();
+
+  switch (OptLevel) {
+  case ::OptLevel::BLENDED_CODE:
+  case ::OptLevel::SMALL_CODE:
+    // Cheap cleanup: promote the locals the reader homes in allocas, then
+    // remove the obvious redundancies and dead flow that the reader leaves
+    // behind.
+    Passes->add(createPromoteMemoryToRegisterPass());
+    Passes->add(createEarlyCSEPass());
+    Passes->add(createWriteBarrierEliminationPass());
+    Passes->add(createCFGSimplificationPass());
+    break;
+
+  case ::OptLevel::FAST_CODE:
+    // Let the cost models, the vectorizers' in particular, see the target.
+    Passes->add(createTargetTransformInfoWrapperPass(
+        TM->getTargetIRAnalysis()));
+    // Let alias analysis use the reader's TBAA tags for the managed heap.
+    Passes->add(createTypeBasedAAWrapperPass());
+    Passes->add(createSROAPass());
+    Passes->add(createEarlyCSEPass());
+    Passes->add(createInstructionCombiningPass());
+    Passes->add(createCFGSimplificationPass());
+    Passes->add(createReassociatePass());
+    Passes->add(createLICMPass());
+    Passes->add(createGVNPass());
+    // With the dictionary chains hoisted and shared, share and hoist the
+    // generic lookups whose slot checks and helper calls remain.
+    Passes->add(createRuntimeLookupOptimizationPass());
+    // With array lengths hoisted and shared, remove or version the bounds
+    // checks; the cleanup below deletes the unused throw blocks.
+    Passes->add(createBoundsCheckEliminationPass());
+    // With stored values propagated, remove the barriers of null stores and
+    // stores into new objects, so that DSE can see the plain stores.
+    Passes->add(createWriteBarrierEliminationPass());
+    Passes->add(createDeadStoreEliminationPass());
+    Passes->add(createInstructionCombiningPass());
+    Passes->add(createCFGSimplificationPass());
+    // Vectorize the loops that are now free of bounds checks and barriers.
+    // GC polls are only placed after this pipeline, and safepoint placement
+    // leaves loops with a 32-bit trip count, which includes the vector
+    // bodies made here, without back-edge polls; so polls neither block
+    // vectorization nor end up in the vector bodies.
+    Passes->add(createLoopRotatePass());
+    Passes->add(createIndVarSimplifyPass());
+    Passes->add(createLoopVectorizePass());
+    Passes->add(createSLPVectorizerPass());
+    Passes->add(createInstructionCombiningPass());
+    Passes->add(createCFGSimplificationPass());
+    break;
+
+  default:
+    llvm_unreachable("Unexpected OptLevel");
+  }
+
+  return Passes;
+}
+
+// Run the mid-level IR optimization pipeline for the method's OptLevel.
+void LLILCJit::optimizeMethod(LLILCJitContext *JitContext) {
+  CompilePhaseTimer Timer(JitContext->Telemetry, CompilePhase::Optimize);
+  ::OptLevel OptLevel = JitContext->Options->OptLevel;
+  if ((OptLevel == ::OptLevel::DEBUG_CODE) ||
+      (OptLevel == ::OptLevel::TIER0_CODE) || JitContext->HasLoadedBitCode) {
+    // Debuggable code must preserve the IR as read, tier 0 code is all about
+    // compiling quickly, and side-loaded bitcode is presumed to be in the
+    // desired shape already.
+    return;
+  }
+
+  // Reuse the thread's pipeline for this target machine and OptLevel.
+  std::unique_ptr<legacy::PassManager> &Optimizer =
+      JitContext->TMEntry->Optimizers[OptLevel];
+  if (!Optimizer) {
+    Optimizer.reset(createOptimizer(OptLevel, JitContext->TM));
+  }
+
+  // Collect the vectorizers' remarks for the telemetry record while the
+  // pipeline runs.
+  LLVMContext &Context = *JitContext->LLVMContext;
+  LLVMContext::DiagnosticHandlerTy OldHandler =
+      Context.getDiagnosticHandler();
+  void *OldHandlerContext = Context.getDiagnosticContext();
+  if (JitContext->Telemetry != nullptr) {
+    Context.setDiagnosticHandler(handleOptimizerDiagnostic, JitContext);
+  }
+
+  Optimizer->run(*JitContext->CurrentModule);
+
+  Context.setDiagnosticHandler(OldHandler, OldHandlerContext);
+}
+
+void LLILCJit::handleOptimizerDiagnostic(const DiagnosticInfo &Diagnostic,
+                                         void *HandlerContext) {
+  LLILCJitContext *JitContext = static_cast<LLILCJitContext *>(HandlerContext);
+  const char *Kind = nullptr;
+  switch (Diagnostic.getKind()) {
+  case DK_OptimizationRemark:
+    Kind = "vectorized";
+    break;
+  case DK_OptimizationRemarkMissed:
+    Kind = "missed";
+    break;
+  case DK_OptimizationRemarkAnalysis:
+    Kind = "analysis";
+    break;
+  default:
+    break;
+  }
+
+  if (Kind != nullptr) {
+    const DiagnosticInfoOptimizationBase &Remark =
+        static_cast<const DiagnosticInfoOptimizationBase &>(Diagnostic);
+    StringRef PassName = Remark.getPassName();
+    if ((PassName == "loop-vectorize") || (PassName == "slp-vectorizer")) {
+      // The reader's debug locations have the IL offset as the line.
+      unsigned ILOffset = 0;
+      if (Remark.isLocationAvailable()) {
+        StringRef FileName;
+        unsigned Column = 0;
+        Remark.getLocation(&FileName, &ILOffset, &Column);
+      }
+      CompileTelemetry *Telemetry = JitContext->Telemetry;
+      Telemetry->VectorizationRemarks.push_back(
+          {Kind, ILOffset, Remark.getMsg().str()});
+      if ((PassName == "loop-vectorize") &&
+          (Diagnostic.getKind() == DK_OptimizationRemark)) {
+        ++Telemetry->VectorizedLoopCount;
+      }
+      return;
+    }
+  }
+
+  // Give everything else LLVM's default handling.
+  LLVMContext &Context = *JitContext->LLVMContext;
+  Context.setDiagnosticHandler(nullptr);
+  Context.diagnose(Diagnostic);
+  Context.setDiagnosticHandler(handleOptimizerDiagnostic, JitContext);
+}
+
 // Notification from the runtime that any caches should be cleaned up.
-void LLILCJit::clearCache() { return; }
+void LLILCJit::clearCache() {
+  ++CacheGeneration;
+
+  // The EE may reuse the handles of the classes it has unloaded.
+  SharedClassLayouts.clear();
+
+  // Threads that are not jitting may not jit again for a long time, so
+  // replace their contexts now. A thread that is jitting holds its state's
+  // lock, and replaces its context once the request is done.
+  std::lock_guard<std::mutex> Guard(AllStatesLock);
+  for (LLILCJitPerThreadState *ThreadState : AllStates) {
+    std::unique_lock<std::recursive_mutex> StateLock(ThreadState->Lock,
+                                                     std::try_to_lock);
+    if (StateLock.owns_lock() && (ThreadState->JitContext == nullptr)) {
+      ThreadState->recycleContext();
+    }
+  }
+}
 
 // Notify runtime if we have something to clean up
-BOOL LLILCJit::isCacheCleanupRequired() { return FALSE; }
+BOOL LLILCJit::isCacheCleanupRequired() {
+  return (TotalContextFootprint != 0) ? TRUE : FALSE;
+}
 
 // Verify the JIT/EE interface identifier.
 void LLILCJit::getVersionIdentifier(GUID *VersionIdentifier) {
@@ -581,25 +1277,19 @@ void LLILCJit::signalHandler(void *Cookie) {
   // do nothing
 }
 
-void ObjectLoadListener::getDebugInfoForObject(
-    const ObjectFile &Obj, const RuntimeDyld::LoadedObjectInfo &L) {
-  OwningBinary<ObjectFile> DebugObjOwner = L.getObjectForDebug(Obj);
-  const ObjectFile &DebugObj = *DebugObjOwner.getBinary();
-
-  // TODO: This extracts DWARF information from the object file, but we will
-  // want to also be able to eventually extract WinCodeView information as well
-  DWARFContextInMemory DwarfContext(DebugObj);
-
+void ObjectLoadListener::getFunctionRange(const ObjectFile &Obj,
+                                          uint64_t &Addr, uint64_t &Size) {
   // Use symbol info to find the function size.
   // If there are funclets, they will each have separate symbols, so we need
-  // to sum the sizes, since the EE wants a single report for the entire
-  // function+funclets.
+  // the extent of all of them, since the EE wants a single report for the
+  // entire function+funclets. Their sizes do not add up to that extent: the
+  // funclets are aligned, and the symbol sizes leave out the padding.
 
-  uint64_t Addr = UINT64_MAX;
-  uint64_t Size = 0;
+  Addr = UINT64_MAX;
+  uint64_t EndAddr = 0;
 
   std::vector<std::pair<SymbolRef, uint64_t>> SymbolSizes =
-      object::computeSymbolSizes(DebugObj);
+      object::computeSymbolSizes(Obj);
 
   for (const auto &Pair : SymbolSizes) {
     object::SymbolRef Symbol = Pair.first;
@@ -618,9 +1308,39 @@ void ObjectLoadListener::getDebugInfoForObject(
       // The main function is always laid out first
       Addr = SingleAddr;
     }
-    Size += SingleSize;
+    if (SingleAddr + SingleSize > EndAddr) {
+      EndAddr = SingleAddr + SingleSize;
+    }
   }
 
+  Size = (EndAddr > Addr) ? (EndAddr - Addr) : 0;
+}
+
+void ObjectLoadListener::getDebugInfoForObject(
+    const ObjectFile &Obj, const RuntimeDyld::LoadedObjectInfo &L) {
+  uint64_t Addr;
+  uint64_t Size;
+
+  if (!Context->Options->DoDebugInfo) {
+    // The object has no DWARF to read, but the GC info still needs the
+    // length of the code, which doesn't depend on where it was loaded.
+    getFunctionRange(Obj, Addr, Size);
+    Context->CodeLength = Size;
+    return;
+  }
+
+  OwningBinary<ObjectFile> DebugObjOwner = L.getObjectForDebug(Obj);
+  const ObjectFile &DebugObj = *DebugObjOwner.getBinary();
+
+  // TODO: This extracts DWARF information from the object file, but we will
+  // want to also be able to eventually extract WinCodeView information as well
+  DWARFContextInMemory DwarfContext(DebugObj);
+
+  getFunctionRange(DebugObj, Addr, Size);
+
+  // The GC info covers exactly the code of the method and its funclets.
+  Context->CodeLength = Size;
+
   uint32_t LastDebugOffset = (uint32_t)-1;
   uint32_t NumDebugRanges = 0;
   ICorDebugInfo::OffsetMapping *OM;
@@ -679,90 +1399,141 @@ void ObjectLoadListener::getDebugInfoForObject(
 
     Context->JitInfo->setBoundaries(MethodHandle, NumDebugRanges, OM);
 
+    CodeCacheEntry *Record = Context->CodeCacheRecord;
+    if (Record != nullptr) {
+      // Record the offsets relative to the start of the code.
+      Record->HasAbsoluteDebugOffsets = (Addr != 0);
+      if (Record->HasAbsoluteDebugOffsets &&
+          (Addr != (uint64_t)MM->getHotCodeBlock())) {
+        Record->IsReplayable = false;
+      }
+      for (unsigned I = 0; I < NumDebugRanges; ++I) {
+        Record->Boundaries.push_back(OM[I]);
+        Record->Boundaries.back().nativeOffset -= (uint32_t)Addr;
+      }
+    }
+
     getDebugInfoForLocals(DwarfContext, Addr, Size);
   }
 }
 
+bool ObjectLoadListener::isReportedSection(const SectionRef &Section) {
+  StringRef SectionName;
+  std::error_code ErrorCode = Section.getName(SectionName);
+  if (ErrorCode) {
+    assert(false && ErrorCode.message().c_str());
+  }
+
+  // Skip sections whose contents are not directly reported to the EE
+  return !(SectionName.startswith(".debug") ||
+           SectionName.startswith(".rela.debug") ||
+           SectionName.startswith(".eh_frame") ||
+           SectionName.startswith(".rela.eh_frame") ||
+           EEMemoryManager::isJitLocalSection(SectionName));
+}
+
 void ObjectLoadListener::recordRelocations(
     const ObjectFile &Obj, const RuntimeDyld::LoadedObjectInfo &L) {
+  // Each symbol is resolved once, however many relocations refer to it:
+  // calls to the same helper or method share one name lookup.
+  DenseMap<uintptr_t, SymbolTarget> SymbolTargets;
+
+  // Gather the fixups of all sections first, then report them together.
+  SmallVector<PendingRelocation, 64> Relocations;
+
   for (section_iterator SI = Obj.section_begin(), SE = Obj.section_end();
        SI != SE; ++SI) {
-    section_iterator Section = SI->getRelocatedSection();
-
-    if (Section == SE) {
+    relocation_iterator I = SI->relocation_begin();
+    relocation_iterator E = SI->relocation_end();
+    if (I == E) {
       continue;
     }
 
-    StringRef SectionName;
-    std::error_code ErrorCode = Section->getName(SectionName);
-    if (ErrorCode) {
-      assert(false && ErrorCode.message().c_str());
-    }
-
-    if (SectionName.startswith(".debug") ||
-        SectionName.startswith(".rela.debug") ||
-        !SectionName.compare(".pdata") || SectionName.startswith(".eh_frame") ||
-        SectionName.startswith(".rela.eh_frame")) {
-      // Skip sections whose contents are not directly reported to the EE
+    section_iterator Section = SI->getRelocatedSection();
+    if ((Section == SE) || !isReportedSection(*Section)) {
       continue;
     }
 
-    relocation_iterator I = SI->relocation_begin();
-    relocation_iterator E = SI->relocation_end();
+    uint64_t SectionAddress = L.getSectionLoadAddress(*Section);
+    assert(SectionAddress != 0);
 
     for (; I != E; ++I) {
       symbol_iterator Symbol = I->getSymbol();
       assert(Symbol != Obj.symbol_end());
-      ErrorOr<section_iterator> SymbolSectionOrErr = Symbol->getSection();
-      assert(!SymbolSectionOrErr.getError());
-      object::section_iterator SymbolSection = *SymbolSectionOrErr;
-      const bool IsExtern = SymbolSection == Obj.section_end();
-      uint64_t RelType = I->getType();
-      uint64_t Offset = I->getOffset();
-      uint8_t *RelocationTarget;
-      if (IsExtern) {
-        // This is an external symbol. Verify that it's one we created for
-        // a global variable and report the relocation via Jit interface.
-        ErrorOr<StringRef> NameOrError = Symbol->getName();
-        assert(NameOrError);
-        StringRef TargetName = NameOrError.get();
-        auto MapIter = Context->NameToHandleMap.find(TargetName);
-        if (MapIter == Context->NameToHandleMap.end()) {
-          // The xdata gets a pointer to our personality routine, which we
-          // dummied up.  We can safely skip it since the EE isn't actually
-          // going to use the value (it inserts the correct one before handing
-          // the xdata off to the OS).
-          assert(!TargetName.compare("ProcessCLRException"));
-          assert(SectionName.startswith(".xdata"));
-          continue;
+      uintptr_t SymbolKey = Symbol->getRawDataRefImpl().p;
+      auto Inserted = SymbolTargets.insert(
+          std::make_pair(SymbolKey, SymbolTarget{nullptr, false, false}));
+      SymbolTarget &Target = Inserted.first->second;
+      if (Inserted.second) {
+        ErrorOr<section_iterator> SymbolSectionOrErr = Symbol->getSection();
+        assert(!SymbolSectionOrErr.getError());
+        object::section_iterator SymbolSection = *SymbolSectionOrErr;
+        Target.IsExtern = SymbolSection == Obj.section_end();
+        if (Target.IsExtern) {
+          ErrorOr<StringRef> NameOrError = Symbol->getName();
+          assert(NameOrError);
+          StringRef TargetName = NameOrError.get();
+          // This is an external symbol. It must be one we created for a
+          // global variable; the xdata's reference to our dummied-up
+          // personality routine was skipped with the rest of the xdata.
+          auto MapIter = Context->NameToHandleMap.find(TargetName);
+          assert(MapIter != Context->NameToHandleMap.end() &&
+                 "Unexpected external symbol");
+          Target.Address = (uint8_t *)MapIter->second;
+          Target.IsCallCell = Context->ReadyToRunCallCells.count(TargetName);
         } else {
-          assert(MapIter->second == Context->NameToHandleMap[TargetName]);
-          RelocationTarget = (uint8_t *)MapIter->second;
+          Target.Address =
+              (uint8_t *)(L.getSectionLoadAddress(*SymbolSection) +
+                          Symbol->getValue());
         }
-      } else {
-        RelocationTarget = (uint8_t *)(L.getSectionLoadAddress(*SymbolSection) +
-                                       Symbol->getValue());
       }
 
-      uint64_t Addend = 0;
-      uint64_t EERelType = getRelocationType(RelType);
-      uint64_t SectionAddress = L.getSectionLoadAddress(*Section);
-      assert(SectionAddress != 0);
-      uint8_t *FixupAddress = (uint8_t *)(SectionAddress + Offset);
+      uint64_t RelType = I->getType();
+      PendingRelocation Relocation;
+      Relocation.FixupAddress = (uint8_t *)(SectionAddress + I->getOffset());
+      Relocation.Target = Target.Address;
+      Relocation.EERelocationType = getRelocationType(RelType);
+      Relocation.IsExtern = Target.IsExtern;
+
+      // A call cell may only be referenced by call qword ptr [rip+rel32].
+      if (Target.IsCallCell &&
+          ((Relocation.EERelocationType != IMAGE_REL_BASED_REL32) ||
+           (Relocation.FixupAddress[-2] != 0xFF) ||
+           (Relocation.FixupAddress[-1] != 0x15))) {
+        Context->HasAtypicalCallSite = true;
+        return;
+      }
 
       if (Obj.isELF()) {
         // Addend is part of the relocation
         ELFRelocationRef ElfReloc(*I);
         ErrorOr<uint64_t> ElfAddend = ElfReloc.getAddend();
         assert(!ElfAddend.getError());
-        Addend = ElfAddend.get();
+        Relocation.Addend = ElfAddend.get();
       } else {
         // Addend is read from the location to be fixed up
-        Addend = getRelocationAddend(RelType, FixupAddress);
+        Relocation.Addend =
+            getRelocationAddend(RelType, Relocation.FixupAddress);
       }
 
-      Context->JitInfo->recordRelocation(FixupAddress,
-                                         RelocationTarget + Addend, EERelType);
+      Relocations.push_back(Relocation);
+    }
+  }
+
+  for (const PendingRelocation &Relocation : Relocations) {
+    Context->JitInfo->recordRelocation(
+        Relocation.FixupAddress, Relocation.Target + Relocation.Addend,
+        Relocation.EERelocationType);
+  }
+
+  CodeCacheEntry *Record = Context->CodeCacheRecord;
+  if (Record != nullptr) {
+    Record->Relocations.reserve(Record->Relocations.size() +
+                                Relocations.size());
+    for (const PendingRelocation &Relocation : Relocations) {
+      recordRelocationForCache(Relocation.FixupAddress, Relocation.Target,
+                               Relocation.Addend, Relocation.EERelocationType,
+                               Relocation.IsExtern);
     }
   }
 }
@@ -786,6 +1557,66 @@ uint64_t ObjectLoadListener::getRelocationAddend(uint64_t LLVMRelocationType,
   return Addend;
 }
 
+void ObjectLoadListener::recordRelocationForCache(uint8_t *FixupAddress,
+                                                  uint8_t *RelocationTarget,
+                                                  uint64_t Addend,
+                                                  uint64_t EERelocationType,
+                                                  bool IsExtern) {
+  CodeCacheEntry *Record = Context->CodeCacheRecord;
+  CodeCacheRelocation Relocation = {};
+  Relocation.RelocationType = EERelocationType;
+  if (!findBlock(FixupAddress, Relocation.FixupBlock, Relocation.FixupOffset)) {
+    Record->IsReplayable = false;
+    return;
+  }
+
+  if (IsExtern) {
+    // Only references to jit helpers can be bound again in another process.
+    auto HelperIter =
+        Context->HelperDescriptorMap.find((uint64_t)RelocationTarget);
+    if (HelperIter == Context->HelperDescriptorMap.end()) {
+      Record->IsReplayable = false;
+      return;
+    }
+    void *IndirectHelper;
+    void *DirectHelper =
+        Context->JitInfo->getHelperFtn(HelperIter->second, &IndirectHelper);
+    Relocation.TargetBlock = CodeCacheRelocation::JitHelper;
+    Relocation.Target = HelperIter->second;
+    Relocation.IsIndirect = (DirectHelper == nullptr);
+    Relocation.Addend = Addend;
+  } else {
+    uint32_t TargetOffset;
+    if (!findBlock(RelocationTarget + Addend, Relocation.TargetBlock,
+                   TargetOffset)) {
+      Record->IsReplayable = false;
+      return;
+    }
+    Relocation.Target = TargetOffset;
+    Relocation.Addend = 0;
+  }
+
+  Record->Relocations.push_back(Relocation);
+}
+
+bool ObjectLoadListener::findBlock(uint8_t *Address, uint8_t &Block,
+                                   uint32_t &Offset) {
+  uint8_t *HotCode = MM->getHotCodeBlock();
+  uint8_t *ReadOnlyData = MM->getReadOnlyDataBlock();
+  if ((Address >= HotCode) && (Address <= HotCode + Context->HotCodeSize)) {
+    Block = CodeCacheRelocation::HotCode;
+    Offset = Address - HotCode;
+    return true;
+  }
+  if ((ReadOnlyData != nullptr) && (Address >= ReadOnlyData) &&
+      (Address <= ReadOnlyData + Context->ReadOnlyDataSize)) {
+    Block = CodeCacheRelocation::ReadOnlyData;
+    Offset = Address - ReadOnlyData;
+    return true;
+  }
+  return false;
+}
+
 uint64_t ObjectLoadListener::getRelocationType(uint64_t LLVMRelocationType) {
   switch (LLVMRelocationType) {
   case IMAGE_REL_AMD64_ABSOLUTE:
@@ -861,6 +1692,16 @@ void ObjectLoadListener::getDebugInfoForLocals(
       CORINFO_METHOD_HANDLE MethodHandle = MethodInfo->ftn;
 
       Context->JitInfo->setVars(MethodHandle, Offsets.size(), LocalVars);
+
+      CodeCacheEntry *Record = Context->CodeCacheRecord;
+      if (Record != nullptr) {
+        // Record the offsets relative to the start of the code.
+        for (unsigned I = 0; I < Offsets.size(); ++I) {
+          Record->Vars.push_back(LocalVars[I]);
+          Record->Vars.back().startOffset -= (uint32_t)Addr;
+          Record->Vars.back().endOffset -= (uint32_t)Addr;
+        }
+      }
     }
   }
 }
@@ -965,5 +1806,13 @@ ObjectLoadListener::mapDwarfRegisterToRegNum(uint8_t DwarfRegister) {
 }
 
 unsigned LLILCJit::getMaxIntrinsicSIMDVectorLength(DWORD CpuCompileFlags) {
-  return getLLILCJitContext()->Options->PreferredIntrinsicSIMDVectorLength;
+  // During a jit request, answer as the request's options do: when LLILC is
+  // the alternative jit, it leaves the size of Vector<T> to the primary jit.
+  LLILCJitPerThreadState *PerThreadState = State.get();
+  if ((PerThreadState != nullptr) && (PerThreadState->JitContext != nullptr) &&
+      (PerThreadState->JitContext->Options != nullptr)) {
+    ::Options *Opts = PerThreadState->JitContext->Options;
+    return Opts->PreferredIntrinsicSIMDVectorLength;
+  }
+  return JitOptions::querySIMDVectorLength(CpuCompileFlags);
 }
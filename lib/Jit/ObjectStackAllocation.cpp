@@ -0,0 +1,387 @@
+//===---- lib/Jit/ObjectStackAllocation.cpp ---------------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Implementation of the stack allocation of objects that do not
+/// escape the method being jitted.
+///
+//===----------------------------------------------------------------------===//
+
+#include "earlyincludes.h"
+#include "jitpch.h"
+#include "LLILCJit.h"
+#include "GcInfo.h"
+#include "ObjectStackAllocation.h"
+#include "WriteBarrierElimination.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+
+using namespace llvm;
+
+ObjectStackAllocator::ObjectStackAllocator(LLILCJitContext &JitContext)
+    : JitContext(JitContext), TotalSize(0) {
+  Root = JitContext.CurrentModule->getFunction(JitContext.MethodName);
+  assert(Root != nullptr && "Missing function for method being jitted");
+  DL = &JitContext.CurrentModule->getDataLayout();
+  CandidateKind = JitContext.LLVMContext->getMDKindID(getCandidateMDName());
+  WriteBarrierKind =
+      JitContext.LLVMContext->getMDKindID(getWriteBarrierMDName());
+}
+
+bool ObjectStackAllocator::isEnabled(LLILCJitContext &JitContext) {
+  return JitContext.Options->EnableOptimization &&
+         !JitContext.HasLoadedBitCode;
+}
+
+uint32_t ObjectStackAllocator::run() {
+  for (BasicBlock &Block : *Root) {
+    if (Block.isEHPad()) {
+      return 0;
+    }
+  }
+
+  // An allocation in a cycle may run more than once per call, and the
+  // object of each run needs storage of its own.
+  SmallPtrSet<BasicBlock *, 16> CycleBlocks;
+  for (scc_iterator<Function *> I = scc_begin(Root); !I.isAtEnd(); ++I) {
+    if (I.hasLoop()) {
+      CycleBlocks.insert(I->begin(), I->end());
+    }
+  }
+
+  SmallVector<Instruction *, 4> Candidates;
+  for (BasicBlock &Block : *Root) {
+    if (CycleBlocks.count(&Block) != 0) {
+      continue;
+    }
+    for (Instruction &Instr : Block) {
+      if (Instr.getMetadata(CandidateKind) != nullptr) {
+        Candidates.push_back(&Instr);
+      }
+    }
+  }
+
+  uint32_t NumAllocated = 0;
+  const uint32_t PointerSize = DL->getPointerSize();
+  for (Instruction *Allocation : Candidates) {
+    CallSite Call(Allocation);
+    assert(Call && (Call.arg_size() == 1) && "Unexpected allocation");
+    MDNode *Candidate = Allocation->getMetadata(CandidateKind);
+    uint64_t Size =
+        mdconst::extract<ConstantInt>(Candidate->getOperand(0))->getZExtValue();
+
+    // The reader's type for the object must cover all of the fields the EE
+    // reported, and the class handle must fit in the method table slot.
+    Type *ObjectTy =
+        cast<PointerType>(Allocation->getType())->getElementType();
+    if (!ObjectTy->isSized() ||
+        (DL->getTypeStoreSize(Call.getArgument(0)->getType()) !=
+         PointerSize)) {
+      continue;
+    }
+    uint64_t SlotSize = PointerSize + DL->getTypeAllocSize(ObjectTy);
+    if ((SlotSize < Size) || (SlotSize > MaxObjectSize) ||
+        (TotalSize + SlotSize > MaxTotalSize)) {
+      continue;
+    }
+
+    SmallVector<Instruction *, 4> Barriers;
+    if (isEscaping(Allocation, Barriers)) {
+      continue;
+    }
+
+    moveToStack(Allocation, Barriers);
+    TotalSize += SlotSize;
+    ++NumAllocated;
+  }
+
+  recordGcSlots();
+  return NumAllocated;
+}
+
+bool ObjectStackAllocator::isEscaping(
+    Instruction *Allocation, SmallVectorImpl<Instruction *> &Barriers) {
+  // Follow the values that may be the object's reference or point into the
+  // object. Values computed from the allocation itself must point into the
+  // object; values loaded from stack slots it was stored to may instead be
+  // references that were stored to the slots on other paths.
+  SmallVector<std::pair<Value *, bool>, 16> Worklist;
+  SmallPtrSet<Value *, 16> Visited;
+  Worklist.push_back(std::make_pair(Allocation, true));
+  Visited.insert(Allocation);
+
+  while (!Worklist.empty()) {
+    Value *Reference = Worklist.back().first;
+    bool IsDirect = Worklist.back().second;
+    Worklist.pop_back();
+
+    for (Use &U : Reference->uses()) {
+      Instruction *User = cast<Instruction>(U.getUser());
+
+      if (isa<BitCastInst>(User) || isa<AddrSpaceCastInst>(User) ||
+          isa<GetElementPtrInst>(User)) {
+        if (Visited.insert(User).second) {
+          Worklist.push_back(std::make_pair(User, IsDirect));
+        }
+        continue;
+      }
+
+      if (isa<LoadInst>(User) || isa<ICmpInst>(User)) {
+        continue;
+      }
+
+      if (StoreInst *Store = dyn_cast<StoreInst>(User)) {
+        if (U.getOperandNo() == Store->getPointerOperandIndex()) {
+          continue;
+        }
+
+        // The reference itself is stored, which is only allowed to a slot
+        // whose every load is known. Loads that read the stored reference
+        // are followed in turn.
+        AllocaInst *Base;
+        uint64_t Offset;
+        const SlotAccessList *Accesses =
+            getSlot(Store->getPointerOperand(), Base, Offset);
+        if ((Accesses == nullptr) || !isInteriorSlot(Base)) {
+          return true;
+        }
+        uint64_t StoreSize = DL->getTypeStoreSize(Reference->getType());
+        for (const SlotAccess &Access : *Accesses) {
+          if ((Access.Offset + Access.Size <= Offset) ||
+              (Offset + StoreSize <= Access.Offset)) {
+            continue;
+          }
+          LoadInst *Load = dyn_cast<LoadInst>(Access.Access);
+          if (Load == nullptr) {
+            continue;
+          }
+          if ((Access.Offset != Offset) || (Access.Size != StoreSize)) {
+            return true;
+          }
+          if (Visited.insert(Load).second) {
+            Worklist.push_back(std::make_pair(Load, false));
+          }
+        }
+        continue;
+      }
+
+      if (isa<MemIntrinsic>(User)) {
+        // Copying to or from the object copies its fields, not its
+        // reference.
+        continue;
+      }
+
+      if (User->getMetadata(WriteBarrierKind) != nullptr) {
+        // A store into the object needs no barrier, but only a store into
+        // the object alone can be made a plain store.
+        CallSite Barrier(User);
+        if (IsDirect && Barrier.isArgOperand(&U) &&
+            (Barrier.getArgumentNo(&U) == 0)) {
+          Barriers.push_back(User);
+          continue;
+        }
+        return true;
+      }
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool ObjectStackAllocator::isInteriorSlot(AllocaInst *Slot) {
+  GcFuncInfo *RootGcInfo = JitContext.GcInfo->getGcInfo(Root);
+  auto Found = RootGcInfo->AllocaMap.find(Slot);
+  if (Found == RootGcInfo->AllocaMap.end()) {
+    // The GC does not look at the slot.
+    return true;
+  }
+
+  // GC aggregates and pinned slots are reported as holding object
+  // references, which the GC may validate and relocate as heap objects.
+  const AllocaInfo &Info = Found->second;
+  return !Info.isGcAggregate() && !Info.isPinned();
+}
+
+const ObjectStackAllocator::SlotAccessList *
+ObjectStackAllocator::getSlot(Value *Address, AllocaInst *&Base,
+                              uint64_t &Offset) {
+  int64_t BaseOffset = 0;
+  Base = dyn_cast<AllocaInst>(
+      GetPointerBaseWithConstantOffset(Address, BaseOffset, *DL));
+  if ((Base == nullptr) || (BaseOffset < 0)) {
+    return nullptr;
+  }
+  Offset = BaseOffset;
+
+  auto Found = Slots.find(Base);
+  if (Found == Slots.end()) {
+    std::unique_ptr<SlotAccessList> Accesses(new SlotAccessList());
+    if (!collectSlotAccesses(Base, *Accesses)) {
+      Accesses.reset();
+    }
+    Found = Slots.insert(std::make_pair(Base, std::move(Accesses))).first;
+  }
+  return Found->second.get();
+}
+
+bool ObjectStackAllocator::collectSlotAccesses(AllocaInst *Alloca,
+                                               SlotAccessList &Accesses) {
+  if (!Alloca->isStaticAlloca()) {
+    return false;
+  }
+
+  SmallVector<std::pair<Value *, uint64_t>, 8> Worklist;
+  Worklist.push_back(std::make_pair(Alloca, 0));
+
+  while (!Worklist.empty()) {
+    Value *Address = Worklist.back().first;
+    uint64_t Offset = Worklist.back().second;
+    Worklist.pop_back();
+
+    for (User *U : Address->users()) {
+      Instruction *User = cast<Instruction>(U);
+
+      if (isa<BitCastInst>(User)) {
+        Worklist.push_back(std::make_pair(User, Offset));
+      } else if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(User)) {
+        unsigned AddressSpace = GEP->getPointerAddressSpace();
+        APInt GEPOffset(DL->getPointerSizeInBits(AddressSpace), 0);
+        if (!GEP->accumulateConstantOffset(*DL, GEPOffset) ||
+            GEPOffset.isNegative()) {
+          return false;
+        }
+        Worklist.push_back(
+            std::make_pair(GEP, Offset + GEPOffset.getZExtValue()));
+      } else if (LoadInst *Load = dyn_cast<LoadInst>(User)) {
+        Accesses.push_back(
+            {Load, Offset, DL->getTypeStoreSize(Load->getType())});
+      } else if (StoreInst *Store = dyn_cast<StoreInst>(User)) {
+        Value *Stored = Store->getValueOperand();
+        if (Stored == Address) {
+          return false;
+        }
+        Accesses.push_back(
+            {Store, Offset, DL->getTypeStoreSize(Stored->getType())});
+      } else if (MemSetInst *Set = dyn_cast<MemSetInst>(User)) {
+        ConstantInt *Length = dyn_cast<ConstantInt>(Set->getLength());
+        if (Length == nullptr) {
+          return false;
+        }
+        Accesses.push_back({Set, Offset, Length->getZExtValue()});
+      } else {
+        // Frame-escaping the slot only reports it to the GC, since methods
+        // with handlers are not changed.
+        IntrinsicInst *Escape = dyn_cast<IntrinsicInst>(User);
+        if ((Escape == nullptr) ||
+            (Escape->getIntrinsicID() != Intrinsic::localescape)) {
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+void ObjectStackAllocator::moveToStack(Instruction *Allocation,
+                                       ArrayRef<Instruction *> Barriers) {
+  // Methods with handlers are not changed, so the allocation is a call.
+  assert(isa<CallInst>(Allocation) && "Unexpected allocation");
+  CallSite Call(Allocation);
+  PointerType *ReferenceTy = cast<PointerType>(Allocation->getType());
+  Type *ObjectTy = ReferenceTy->getElementType();
+
+  // The object header is at a negative offset from the object, so the slot
+  // has room for it ahead of the object.
+  LLVMContext &Context = Allocation->getContext();
+  const uint32_t PointerSize = DL->getPointerSize();
+  Type *SlotFields[] = {DL->getIntPtrType(Context), ObjectTy};
+  StructType *SlotTy = StructType::get(Context, SlotFields);
+  Instruction *InsertPt = &*Root->getEntryBlock().getFirstInsertionPt();
+  AllocaInst *Slot = new AllocaInst(SlotTy, "StackObject", InsertPt);
+  Slot->setAlignment(std::max(DL->getABITypeAlignment(SlotTy), PointerSize));
+
+  // The GC reports the references in the slot throughout the method, so it
+  // is zeroed in the prolog.
+  if (GcInfo::isGcAggregate(SlotTy)) {
+    new StoreInst(Constant::getNullValue(SlotTy), Slot, InsertPt);
+    GcSlots.push_back(Slot);
+  }
+
+  // Initialize the object as the allocation helper would: zero it and set
+  // its method table pointer, which is the helper's argument.
+  IRBuilder<> Builder(Allocation);
+  Value *Object = Builder.CreateStructGEP(SlotTy, Slot, 1);
+  Builder.CreateMemSet(Object, Builder.getInt8(0),
+                       DL->getTypeAllocSize(ObjectTy), PointerSize);
+  Value *MethodTable = Call.getArgument(0);
+  Value *MethodTableAddress =
+      Builder.CreateBitCast(Object, MethodTable->getType()->getPointerTo());
+  Builder.CreateStore(MethodTable, MethodTableAddress);
+  Value *Reference = Builder.CreateAddrSpaceCast(Object, ReferenceTy);
+  Allocation->replaceAllUsesWith(Reference);
+  Allocation->eraseFromParent();
+
+  // Stores into the object no longer store to the heap.
+  for (Instruction *Barrier : Barriers) {
+    CallSite BarrierCall(Barrier);
+    Value *Address = BarrierCall.getArgument(0);
+    Value *Stored = BarrierCall.getArgument(1);
+    PointerType *AddressTy = cast<PointerType>(Address->getType());
+    Type *StoredPtrTy =
+        PointerType::get(Stored->getType(), AddressTy->getAddressSpace());
+    if (AddressTy != StoredPtrTy) {
+      Address = new BitCastInst(Address, StoredPtrTy, "", Barrier);
+    }
+    new StoreInst(Stored, Address, Barrier);
+    Barrier->eraseFromParent();
+  }
+}
+
+void ObjectStackAllocator::recordGcSlots() {
+  if (GcSlots.empty()) {
+    return;
+  }
+
+  // A function may only have one localescape, so replace the root's with
+  // one that also escapes the new slots, keeping them in memory where the
+  // GC can find them.
+  SmallVector<Value *, 8> EscapingLocs;
+  for (BasicBlock &Block : *Root) {
+    for (auto I = Block.begin(), E = Block.end(); I != E;) {
+      IntrinsicInst *Escape = dyn_cast<IntrinsicInst>(&*I++);
+      if ((Escape != nullptr) &&
+          (Escape->getIntrinsicID() == Intrinsic::localescape)) {
+        for (unsigned J = 0; J < Escape->getNumArgOperands(); ++J) {
+          EscapingLocs.push_back(Escape->getArgOperand(J));
+        }
+        Escape->eraseFromParent();
+      }
+    }
+  }
+
+  GcFuncInfo *RootGcInfo = JitContext.GcInfo->getGcInfo(Root);
+  for (AllocaInst *Slot : GcSlots) {
+    RootGcInfo->recordGcAlloca(Slot);
+    EscapingLocs.push_back(Slot);
+  }
+  IRBuilder<> Builder(Root->getEntryBlock().getTerminator());
+  Function *FrameEscape = Intrinsic::getDeclaration(JitContext.CurrentModule,
+                                                    Intrinsic::localescape);
+  Builder.CreateCall(FrameEscape, EscapingLocs);
+}
@@ -0,0 +1,164 @@
+//===---- lib/Jit/ReadyToRunCallSiteLowering.cpp ----------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Implementation of the ReadyToRun call site lowering pass.
+///
+/// The reader calls a ReadyToRun method or helper by loading the target from
+/// its indirection cell and calling the loaded value. Crossgen shares one
+/// delay-load thunk among all the calls through a cell only if each of them
+/// is call [rel32], which is what the load becomes once instruction
+/// selection folds it into the call. Folding requires the load to have no
+/// other use and nothing in between, so this pass reloads the cell right
+/// before each call. The object loader checks the result.
+///
+//===----------------------------------------------------------------------===//
+
+#include "earlyincludes.h"
+#include "jitpch.h"
+#include "ReadyToRunCallSiteLowering.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Statepoint.h"
+#include "llvm/Pass.h"
+#include <algorithm>
+
+using namespace llvm;
+
+namespace {
+
+class ReadyToRunCallSiteLowering : public FunctionPass {
+public:
+  static char ID;
+
+  ReadyToRunCallSiteLowering() : FunctionPass(ID) {}
+
+  const char *getPassName() const override {
+    return "LLILC ReadyToRun call site lowering";
+  }
+
+  bool runOnFunction(Function &F) override;
+
+private:
+  /// \brief Get the indirection cell that \p Addr refers to.
+  ///
+  /// \returns The cell's global variable, or nullptr if \p Addr is not the
+  ///          address of a global variable.
+  static GlobalVariable *getIndirectionCell(Value *Addr);
+
+  /// \brief Make \p Call load its target from the cell just before it.
+  ///
+  /// \param CalleeUse The use of the call's target by \p Call.
+  /// \returns true if the call was changed.
+  bool lowerCall(Instruction *Call, Use &CalleeUse);
+};
+
+} // end anonymous namespace
+
+char ReadyToRunCallSiteLowering::ID = 0;
+
+FunctionPass *createReadyToRunCallSiteLoweringPass() {
+  return new ReadyToRunCallSiteLowering();
+}
+
+bool ReadyToRunCallSiteLowering::runOnFunction(Function &F) {
+  SmallVector<Instruction *, 16> Calls;
+  for (BasicBlock &Block : F) {
+    for (Instruction &Instr : Block) {
+      CallSite Call(&Instr);
+      if (isStatepoint(&Instr) ||
+          (Call && !isa<Function>(Call.getCalledValue()))) {
+        Calls.push_back(&Instr);
+      }
+    }
+  }
+
+  bool Changed = false;
+  for (Instruction *Instr : Calls) {
+    CallSite Call(Instr);
+    // The target of a statepoint is one of its arguments.
+    Use &CalleeUse =
+        isStatepoint(Instr)
+            ? *(Call.arg_begin() + ImmutableStatepoint::CalledFunctionPos)
+            : *Call.getCallee();
+    Changed |= lowerCall(Instr, CalleeUse);
+  }
+
+  return Changed;
+}
+
+GlobalVariable *ReadyToRunCallSiteLowering::getIndirectionCell(Value *Addr) {
+  // The reader forms the address as inttoptr (ptrtoint @cell).
+  if (ConstantExpr *Expr = dyn_cast<ConstantExpr>(Addr)) {
+    if ((Expr->getOpcode() == Instruction::IntToPtr) &&
+        isa<ConstantExpr>(Expr->getOperand(0)) &&
+        (cast<ConstantExpr>(Expr->getOperand(0))->getOpcode() ==
+         Instruction::PtrToInt)) {
+      Addr = cast<ConstantExpr>(Expr->getOperand(0))->getOperand(0);
+    }
+  }
+  return dyn_cast<GlobalVariable>(Addr->stripPointerCasts());
+}
+
+bool ReadyToRunCallSiteLowering::lowerCall(Instruction *Call, Use &CalleeUse) {
+  // Find the load of the cell and the casts of the loaded target, in the
+  // order they are computed.
+  SmallVector<Instruction *, 4> Chain;
+  Value *Target = CalleeUse.get();
+  while (isa<IntToPtrInst>(Target) || isa<BitCastInst>(Target)) {
+    Chain.push_back(cast<Instruction>(Target));
+    Target = cast<Instruction>(Target)->getOperand(0);
+  }
+  LoadInst *Load = dyn_cast<LoadInst>(Target);
+  if ((Load == nullptr) || Load->isVolatile() ||
+      (getIndirectionCell(Load->getPointerOperand()) == nullptr)) {
+    return false;
+  }
+  Chain.push_back(Load);
+  std::reverse(Chain.begin(), Chain.end());
+
+  // Leave the call alone if the chain is used by it alone and ends right
+  // before it.
+  bool IsLowered = true;
+  for (size_t I = 0, E = Chain.size(); I != E; ++I) {
+    Instruction *Next = (I + 1 < E) ? Chain[I + 1] : Call;
+    if (!Chain[I]->hasOneUse() || (Chain[I]->getNextNode() != Next)) {
+      IsLowered = false;
+      break;
+    }
+  }
+  if (IsLowered) {
+    return false;
+  }
+
+  Instruction *Copy = nullptr;
+  for (Instruction *Instr : Chain) {
+    Instruction *NewCopy = Instr->clone();
+    if (Copy != nullptr) {
+      NewCopy->setOperand(0, Copy);
+    }
+    NewCopy->insertBefore(Call);
+    Copy = NewCopy;
+  }
+  CalleeUse.set(Copy);
+
+  for (auto I = Chain.rbegin(), E = Chain.rend(); I != E; ++I) {
+    if (!(*I)->use_empty()) {
+      break;
+    }
+    (*I)->eraseFromParent();
+  }
+
+  return true;
+}
@@ -0,0 +1,322 @@
+//===---- lib/Jit/RuntimeLookupOptimization.cpp -----------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Implementation of the generic dictionary lookup optimization pass.
+///
+/// Shared generic code finds the handles it needs in the generic dictionary
+/// of its instantiation: a chain of invariant loads leads to a dictionary
+/// slot, and a CORINFO_HELP_RUNTIMEHANDLE_* helper fills in the slot the
+/// first time it is found null. The loads are CSEd and hoisted like any
+/// other invariant loads, but the conditional helper call keeps each lookup
+/// where the reader put it. This pass shares lookups of the same handle and
+/// moves the ones made on every iteration of a loop in front of the loop.
+///
+/// The helpers are treated as pure: they always return the same handle for
+/// the same arguments, and the only memory they change is the dictionary
+/// slot, which the method only reads through the lookups.
+///
+//===----------------------------------------------------------------------===//
+
+#include "RuntimeLookupOptimization.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/Pass.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+using namespace llvm;
+
+namespace {
+
+/// \brief A runtime lookup the reader emitted.
+struct RuntimeLookup {
+  Instruction *Helper;   ///< The helper call or invoke.
+  Instruction *Result;   ///< The handle the lookup finds.
+  BranchInst *NullCheck; ///< Branch to the helper when the dictionary slot
+                         ///< is null, or nullptr if the helper is always
+                         ///< called.
+  unsigned HelperIndex;  ///< Successor of NullCheck that calls the helper.
+  Value *Slot;           ///< Value of the dictionary slot, if checked.
+  bool IsRemoved;        ///< True once the lookup is replaced.
+
+  /// Get the first instruction of the lookup that this pass moves.
+  Instruction *getStart() const {
+    return (NullCheck != nullptr) ? NullCheck : Helper;
+  }
+};
+
+class RuntimeLookupOptimization : public FunctionPass {
+public:
+  static char ID;
+
+  RuntimeLookupOptimization() : FunctionPass(ID) {
+    PassRegistry &Registry = *PassRegistry::getPassRegistry();
+    initializeDominatorTreeWrapperPassPass(Registry);
+    initializeLoopInfoWrapperPassPass(Registry);
+    initializeLoopSimplifyPass(Registry);
+  }
+
+  const char *getPassName() const override {
+    return "LLILC runtime lookup optimization";
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequiredID(LoopSimplifyID);
+  }
+
+  bool runOnFunction(Function &F) override;
+
+private:
+  /// Describe the lookup a marked helper call makes.
+  RuntimeLookup getLookup(Instruction *Helper);
+
+  /// Check whether two lookups find the same handle.
+  bool isSameLookup(const RuntimeLookup &A, const RuntimeLookup &B);
+
+  /// Replace the result of a lookup, leaving a constant branch around its
+  /// helper call for CFG simplification to remove.
+  void removeLookup(RuntimeLookup &Lookup, Value *Replacement);
+
+  /// Find the outermost loop that a lookup can be hoisted out of.
+  /// \returns nullptr if the lookup can't be hoisted.
+  Loop *getHoistLoop(const RuntimeLookup &Lookup);
+
+  /// Make a lookup once in the preheader of \p L.
+  void hoistLookup(RuntimeLookup &Lookup, Loop *L);
+
+  unsigned RuntimeLookupKind; ///< Kind of the runtime lookup metadata.
+  DominatorTree *DT;
+  LoopInfo *LI;
+};
+
+} // end anonymous namespace
+
+char RuntimeLookupOptimization::ID = 0;
+
+FunctionPass *createRuntimeLookupOptimizationPass() {
+  return new RuntimeLookupOptimization();
+}
+
+bool RuntimeLookupOptimization::runOnFunction(Function &F) {
+  RuntimeLookupKind = F.getContext().getMDKindID(getRuntimeLookupMDName());
+  DT = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+  LI = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+
+  SmallVector<RuntimeLookup, 8> Lookups;
+  for (BasicBlock &Block : F) {
+    for (Instruction &Instr : Block) {
+      if (Instr.getMetadata(RuntimeLookupKind) != nullptr) {
+        Lookups.push_back(getLookup(&Instr));
+      }
+    }
+  }
+  if (Lookups.empty()) {
+    return false;
+  }
+
+  // Share the result of each lookup with the identical lookups it
+  // dominates. Removing an unconditional invoke would change the CFG under
+  // the dominator tree, so those are left alone.
+  bool Changed = false;
+  for (RuntimeLookup &Lookup : Lookups) {
+    if ((Lookup.NullCheck == nullptr) && !isa<CallInst>(Lookup.Helper)) {
+      continue;
+    }
+    for (RuntimeLookup &Earlier : Lookups) {
+      if ((&Earlier == &Lookup) || Earlier.IsRemoved ||
+          !isSameLookup(Earlier, Lookup) ||
+          !DT->dominates(Earlier.Result, Lookup.getStart())) {
+        continue;
+      }
+      removeLookup(Lookup, Earlier.Result);
+      Changed = true;
+      break;
+    }
+  }
+
+  for (RuntimeLookup &Lookup : Lookups) {
+    if (Lookup.IsRemoved) {
+      continue;
+    }
+    if (Loop *L = getHoistLoop(Lookup)) {
+      hoistLookup(Lookup, L);
+      Changed = true;
+    }
+  }
+
+  return Changed;
+}
+
+RuntimeLookup RuntimeLookupOptimization::getLookup(Instruction *Helper) {
+  RuntimeLookup Lookup = {Helper, Helper, nullptr, 0, nullptr, false};
+
+  // The reader merges the slot's value and the helper's result when the
+  // helper is only called for a null slot. Anything else is treated as an
+  // unconditional call, whose result is the handle just the same.
+  if (!Helper->hasOneUse()) {
+    return Lookup;
+  }
+  PHINode *Phi = dyn_cast<PHINode>(*Helper->user_begin());
+  if ((Phi == nullptr) || (Phi->getNumIncomingValues() != 2)) {
+    return Lookup;
+  }
+  unsigned SlotIndex = (Phi->getIncomingValue(0) == Helper) ? 1 : 0;
+  Value *Slot = Phi->getIncomingValue(SlotIndex);
+  BasicBlock *TestBlock = Phi->getIncomingBlock(SlotIndex);
+  BranchInst *Branch = dyn_cast<BranchInst>(TestBlock->getTerminator());
+  if ((Branch == nullptr) || !Branch->isConditional()) {
+    return Lookup;
+  }
+  ICmpInst *Compare = dyn_cast<ICmpInst>(Branch->getCondition());
+  if ((Compare == nullptr) || !Compare->isEquality() ||
+      (Compare->getOperand(0) != Slot)) {
+    return Lookup;
+  }
+  Constant *Null = dyn_cast<Constant>(Compare->getOperand(1));
+  if ((Null == nullptr) || !Null->isNullValue()) {
+    return Lookup;
+  }
+  unsigned HelperIndex =
+      (Compare->getPredicate() == CmpInst::Predicate::ICMP_EQ) ? 0 : 1;
+  if ((Branch->getSuccessor(HelperIndex) != Helper->getParent()) ||
+      (Branch->getSuccessor(1 - HelperIndex) != Phi->getParent())) {
+    return Lookup;
+  }
+
+  Lookup.Result = Phi;
+  Lookup.NullCheck = Branch;
+  Lookup.HelperIndex = HelperIndex;
+  Lookup.Slot = Slot;
+  return Lookup;
+}
+
+bool RuntimeLookupOptimization::isSameLookup(const RuntimeLookup &A,
+                                             const RuntimeLookup &B) {
+  CallSite CallA(A.Helper);
+  CallSite CallB(B.Helper);
+  if ((CallA.getCalledValue() != CallB.getCalledValue()) ||
+      (CallA.arg_size() != CallB.arg_size())) {
+    return false;
+  }
+  for (unsigned I = 0; I < CallA.arg_size(); ++I) {
+    if (CallA.getArgument(I) != CallB.getArgument(I)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void RuntimeLookupOptimization::removeLookup(RuntimeLookup &Lookup,
+                                             Value *Replacement) {
+  Lookup.Result->replaceAllUsesWith(Replacement);
+  Lookup.IsRemoved = true;
+
+  if (Lookup.NullCheck != nullptr) {
+    // Never take the branch to the helper.
+    LLVMContext &Context = Lookup.NullCheck->getContext();
+    Lookup.NullCheck->setCondition(
+        ConstantInt::get(Type::getInt1Ty(Context), Lookup.HelperIndex != 0));
+    Lookup.Result->eraseFromParent();
+    return;
+  }
+
+  assert(isa<CallInst>(Lookup.Helper) && "Unexpected runtime lookup");
+  Lookup.Helper->eraseFromParent();
+}
+
+Loop *RuntimeLookupOptimization::getHoistLoop(const RuntimeLookup &Lookup) {
+  // The helper call that is hoisted may not have an unwind edge.
+  if (!isa<CallInst>(Lookup.Helper)) {
+    return nullptr;
+  }
+
+  CallSite Call(Lookup.Helper);
+  Instruction *Start = Lookup.getStart();
+  Loop *Result = nullptr;
+  for (Loop *L = LI->getLoopFor(Start->getParent()); L != nullptr;
+       L = L->getParentLoop()) {
+    if (L->getLoopPreheader() == nullptr) {
+      break;
+    }
+
+    bool IsInvariant =
+        (Lookup.Slot == nullptr) || L->isLoopInvariant(Lookup.Slot);
+    for (unsigned I = 0; IsInvariant && (I < Call.arg_size()); ++I) {
+      IsInvariant = L->isLoopInvariant(Call.getArgument(I));
+    }
+    if (!IsInvariant) {
+      break;
+    }
+
+    // Only hoist a lookup that is made whenever the loop runs, so that the
+    // helper is not called for a handle the method might not use.
+    SmallVector<BasicBlock *, 4> ExitingBlocks;
+    L->getExitingBlocks(ExitingBlocks);
+    if (ExitingBlocks.empty()) {
+      break;
+    }
+    bool IsGuaranteed = true;
+    for (BasicBlock *Exiting : ExitingBlocks) {
+      if (!DT->dominates(Start->getParent(), Exiting)) {
+        IsGuaranteed = false;
+        break;
+      }
+    }
+    if (!IsGuaranteed) {
+      break;
+    }
+
+    Result = L;
+  }
+
+  return Result;
+}
+
+void RuntimeLookupOptimization::hoistLookup(RuntimeLookup &Lookup, Loop *L) {
+  BasicBlock *Preheader = L->getLoopPreheader();
+  Instruction *InsertPt = Preheader->getTerminator();
+  if (Lookup.NullCheck == nullptr) {
+    Lookup.Helper->moveBefore(InsertPt);
+    return;
+  }
+
+  // Check the slot and call the helper in front of the loop, as the reader
+  // did in the loop.
+  Value *Slot = Lookup.Slot;
+  Value *IsNull = new ICmpInst(InsertPt, CmpInst::Predicate::ICMP_EQ, Slot,
+                               Constant::getNullValue(Slot->getType()),
+                               "NullCheck");
+  TerminatorInst *HelperTerm =
+      SplitBlockAndInsertIfThen(IsNull, InsertPt, false, nullptr, DT);
+  BasicBlock *HelperBlock = HelperTerm->getParent();
+  BasicBlock *JoinBlock = InsertPt->getParent();
+  if (Loop *Parent = L->getParentLoop()) {
+    Parent->addBasicBlockToLoop(HelperBlock, *LI);
+    Parent->addBasicBlockToLoop(JoinBlock, *LI);
+  }
+
+  Instruction *Helper = Lookup.Helper->clone();
+  Helper->insertBefore(HelperTerm);
+  PHINode *Phi = PHINode::Create(Lookup.Result->getType(), 2, "RuntimeHandle",
+                                 &JoinBlock->front());
+  Phi->addIncoming(Slot, Preheader);
+  Phi->addIncoming(Helper, HelperBlock);
+
+  removeLookup(Lookup, Phi);
+}
@@ -0,0 +1,192 @@
+//===---- lib/Jit/WriteBarrierElimination.cpp -------------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Implementation of the write barrier elimination pass.
+///
+/// The reader routes every store of a reference to the heap through a write
+/// barrier helper, which records the store in the GC's card table. The card
+/// table only needs to know about references from older generations to
+/// younger ones, so stores of null and stores into objects that are still
+/// known to be in generation 0 can be plain stores.
+///
+//===----------------------------------------------------------------------===//
+
+#include "WriteBarrierElimination.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+
+using namespace llvm;
+
+namespace {
+
+class WriteBarrierElimination : public FunctionPass {
+public:
+  static char ID;
+
+  WriteBarrierElimination() : FunctionPass(ID) {}
+
+  const char *getPassName() const override {
+    return "LLILC write barrier elimination";
+  }
+
+  bool runOnFunction(Function &F) override;
+
+private:
+  /// Check whether a barrier is needed for the store a barrier call makes.
+  bool isBarrierNeeded(CallSite Barrier);
+
+  /// Check whether \p Object is a small object allocated with no safepoint
+  /// between the allocation and \p Barrier.
+  bool isFreshAllocation(Value *Object, Instruction *Barrier);
+
+  /// Check whether GC may happen at an instruction.
+  bool mayBeSafepoint(Instruction *Instr);
+
+  /// Replace a barrier call with a plain store.
+  void replaceWithStore(CallSite Barrier);
+
+  const DataLayout *DL;         ///< Data layout of the module.
+  unsigned WriteBarrierKind;    ///< Kind of the write barrier metadata.
+  unsigned SmallAllocationKind; ///< Kind of the small allocation metadata.
+};
+
+} // end anonymous namespace
+
+char WriteBarrierElimination::ID = 0;
+
+FunctionPass *createWriteBarrierEliminationPass() {
+  return new WriteBarrierElimination();
+}
+
+bool WriteBarrierElimination::runOnFunction(Function &F) {
+  LLVMContext &Context = F.getContext();
+  DL = &F.getParent()->getDataLayout();
+  WriteBarrierKind = Context.getMDKindID(getWriteBarrierMDName());
+  SmallAllocationKind = Context.getMDKindID(getSmallAllocationMDName());
+
+  SmallVector<Instruction *, 8> Barriers;
+  for (BasicBlock &Block : F) {
+    for (Instruction &Instr : Block) {
+      if (Instr.getMetadata(WriteBarrierKind) != nullptr) {
+        Barriers.push_back(&Instr);
+      }
+    }
+  }
+
+  bool Changed = false;
+  for (Instruction *Barrier : Barriers) {
+    CallSite Call(Barrier);
+    assert(Call && (Call.arg_size() == 2) && "Unexpected write barrier");
+    if (!Call.getArgument(0)->getType()->isPointerTy()) {
+      continue;
+    }
+    if (!isBarrierNeeded(Call)) {
+      replaceWithStore(Call);
+      Changed = true;
+    }
+  }
+
+  return Changed;
+}
+
+bool WriteBarrierElimination::isBarrierNeeded(CallSite Barrier) {
+  // Storing null cannot create a reference between generations.
+  Value *Reference = Barrier.getArgument(1)->stripPointerCasts();
+  if (isa<ConstantPointerNull>(Reference)) {
+    return false;
+  }
+
+  Value *Object = GetUnderlyingObject(Barrier.getArgument(0), *DL);
+  return !isFreshAllocation(Object, Barrier.getInstruction());
+}
+
+bool WriteBarrierElimination::isFreshAllocation(Value *Object,
+                                                Instruction *Barrier) {
+  Instruction *Allocation = dyn_cast<Instruction>(Object);
+  if ((Allocation == nullptr) ||
+      (Allocation->getMetadata(SmallAllocationKind) == nullptr)) {
+    return false;
+  }
+
+  // Find where the allocated object is first available. Only a barrier in
+  // that same block is considered, so that no loop back-edge, where
+  // safepoint placement adds polls, can be in between.
+  BasicBlock::iterator Start;
+  if (InvokeInst *Invoke = dyn_cast<InvokeInst>(Allocation)) {
+    BasicBlock *Normal = Invoke->getNormalDest();
+    if (Normal->getSinglePredecessor() == nullptr) {
+      return false;
+    }
+    Start = Normal->begin();
+  } else {
+    Start = std::next(Allocation->getIterator());
+  }
+
+  if (Start->getParent() != Barrier->getParent()) {
+    return false;
+  }
+
+  for (BasicBlock::iterator I = Start; &*I != Barrier; ++I) {
+    if (mayBeSafepoint(&*I)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool WriteBarrierElimination::mayBeSafepoint(Instruction *Instr) {
+  CallSite Call(Instr);
+  if (!Call) {
+    return false;
+  }
+
+  // The barrier helpers never trigger a GC, and neither do the intrinsics
+  // the reader emits or calls it marked as GC leaves.
+  if ((Instr->getMetadata(WriteBarrierKind) != nullptr) ||
+      isa<IntrinsicInst>(Instr)) {
+    return false;
+  }
+
+  return !Call.getAttributes().hasAttribute(AttributeSet::FunctionIndex,
+                                            "gc-leaf-function");
+}
+
+void WriteBarrierElimination::replaceWithStore(CallSite Barrier) {
+  Instruction *Call = Barrier.getInstruction();
+  Value *Address = Barrier.getArgument(0);
+  Value *Reference = Barrier.getArgument(1);
+
+  // The helper takes the address and the reference with the types the
+  // reader had for them; store through the address as the reference's type.
+  PointerType *AddressTy = cast<PointerType>(Address->getType());
+  Type *ReferencePtrTy =
+      PointerType::get(Reference->getType(), AddressTy->getAddressSpace());
+  if (AddressTy != ReferencePtrTy) {
+    Address = new BitCastInst(Address, ReferencePtrTy, "", Call);
+  }
+  new StoreInst(Reference, Address, Call);
+
+  if (InvokeInst *Invoke = dyn_cast<InvokeInst>(Call)) {
+    // The store cannot throw, so drop the unwind edge.
+    BasicBlock *Block = Invoke->getParent();
+    Invoke->getUnwindDest()->removePredecessor(Block);
+    BranchInst::Create(Invoke->getNormalDest(), Invoke);
+  }
+  Call->eraseFromParent();
+}
@@ -41,6 +41,7 @@ MethodSet JitOptions::BreakMethodSet;
 MethodSet JitOptions::MSILMethodSet;
 MethodSet JitOptions::LLVMMethodSet;
 MethodSet JitOptions::CodeRangeMethodSet;
+MethodSet JitOptions::HotMethodSet;
 
 template <typename UTF16CharT>
 char16_t *getStringConfigValue(ICorJitInfo *CorInfo, const UTF16CharT *Name) {
@@ -55,17 +56,10 @@ void freeStringConfigValue(ICorJitInfo *CorInfo, UTF16CharT *Value) {
   return LLILCJit::TheJitHost->freeStringConfigValue((wchar_t *)Value);
 }
 
-JitOptions::JitOptions(LLILCJitContext &Context) {
-  // Set 'IsAltJit' based on environment information.
-  IsAltJit = queryIsAltJit(Context);
-
+JitOptions::ConfigOptions::ConfigOptions(LLILCJitContext &Context) {
   // Set dump level for this JIT invocation.
   DumpLevel = queryDumpLevel(Context);
 
-  // Set optimization level for this JIT invocation.
-  OptLevel = queryOptLevel(Context);
-  EnableOptimization = OptLevel != ::OptLevel::DEBUG_CODE;
-
   // Set whether to use conservative GC.
   UseConservativeGC = queryUseConservativeGC(Context);
 
@@ -77,21 +71,98 @@ JitOptions::JitOptions(LLILCJitContext &Context) {
   // Set whether to do tail call opt.
   DoTailCallOpt = queryDoTailCallOpt(Context);
 
+  // Set whether to inline small callees.
+  DoInline = queryDoInline(Context);
+
+  // Set whether null checks may be folded into faulting accesses.
+  DoImplicitNullChecks = queryDoImplicitNullChecks(Context);
+
   LogGcInfo = queryLogGcInfo(Context);
 
   // Set whether to insert failfast in exception handlers.
   ExecuteHandlers = queryExecuteHandlers(Context);
 
+  IsTieredCompilation = queryIsTieredCompilation(Context);
+  CodeCacheDirectory = queryCodeCacheDirectory(Context);
+  ArenaSlabSize = queryArenaSlabSize(Context);
+  ContextMemoryLimit = queryContextMemoryLimit(Context);
+  TelemetryPath = queryTelemetryPath(Context);
+  IsTelemetryJSON = !TelemetryPath.empty() && queryIsTelemetryJSON(Context);
+  ReplayRecordPath = queryReplayRecordPath(Context);
+
+  // Compile the method sets.
+#if !defined(NDEBUG)
+  initMethodSet(Context, AltJitMethodSet, (const char16_t *)UTF16("AltJit"));
+  initMethodSet(Context, AltJitNgenMethodSet,
+                (const char16_t *)UTF16("AltJitNgen"));
+#else
+  IsAltJitAll = queryIsStar(Context, (const char16_t *)UTF16("AltJit"));
+  IsAltJitNgenAll =
+      queryIsStar(Context, (const char16_t *)UTF16("AltJitNgen"));
+#endif
+  initMethodSet(Context, ExcludeMethodSet,
+                (const char16_t *)UTF16("AltJitExclude"));
+  initMethodSet(Context, BreakMethodSet,
+                (const char16_t *)UTF16("AltJitBreakAtJitStart"));
+  initMethodSet(Context, MSILMethodSet,
+                (const char16_t *)UTF16("AltJitMSILDump"));
+  initMethodSet(Context, LLVMMethodSet,
+                (const char16_t *)UTF16("AltJitLLVMDump"));
+  initMethodSet(Context, CodeRangeMethodSet,
+                (const char16_t *)UTF16("AltJitCodeRangeDump"));
+  initMethodSet(Context, HotMethodSet,
+                (const char16_t *)UTF16("AltJitHotMethods"));
+}
+
+const JitOptions::ConfigOptions &
+JitOptions::getConfigOptions(LLILCJitContext &Context) {
+  static const ConfigOptions TheConfigOptions(Context);
+  return TheConfigOptions;
+}
+
+JitOptions::JitOptions(LLILCJitContext &Context) {
+  const ConfigOptions &Config = getConfigOptions(Context);
+
+  // Set 'IsAltJit' based on environment information.
+  IsAltJit = queryIsAltJit(Context, Config);
+
+  // Set dump level for this JIT invocation.
+  DumpLevel = Config.DumpLevel;
+
+  // Set optimization level for this JIT invocation.
+  OptLevel = queryOptLevel(Context, Config);
+  EnableOptimization = (OptLevel != ::OptLevel::DEBUG_CODE) &&
+                       (OptLevel != ::OptLevel::TIER0_CODE);
+
+  UseConservativeGC = Config.UseConservativeGC;
+  DoInsertStatepoints = Config.DoInsertStatepoints;
+  DoSIMDIntrinsic = Config.DoSIMDIntrinsic;
+  DoTailCallOpt = Config.DoTailCallOpt;
+  DoInline = Config.DoInline;
+  // Debuggable code keeps its null checks at the IL offsets that make them.
+  DoImplicitNullChecks = EnableOptimization && Config.DoImplicitNullChecks;
+  LogGcInfo = Config.LogGcInfo;
+  ExecuteHandlers = Config.ExecuteHandlers;
+  // The EE asks for line and local variable info when a debugger or
+  // profiler may need it; otherwise none is generated.
+  DoDebugInfo = (Context.Flags & CORJIT_FLG_DEBUG_INFO) != 0;
+
   IsExcludeMethod = queryIsExcludeMethod(Context);
   IsBreakMethod = queryIsBreakMethod(Context);
   IsMSILDumpMethod = queryIsMSILDumpMethod(Context);
   IsLLVMDumpMethod = queryIsLLVMDumpMethod(Context);
   IsCodeRangeMethod = queryIsCodeRangeMethod(Context);
+  CodeCacheDirectory = Config.CodeCacheDirectory;
+  ArenaSlabSize = Config.ArenaSlabSize;
+  ContextMemoryLimit = Config.ContextMemoryLimit;
+  TelemetryPath = Config.TelemetryPath;
+  IsTelemetryJSON = Config.IsTelemetryJSON;
+  ReplayRecordPath = Config.ReplayRecordPath;
 
   if (IsAltJit) {
     PreferredIntrinsicSIMDVectorLength = 0;
   } else {
-    PreferredIntrinsicSIMDVectorLength = 32;
+    PreferredIntrinsicSIMDVectorLength = querySIMDVectorLength(Context.Flags);
   }
 
   // Validate Statepoint and Conservative GC state.
@@ -99,11 +170,21 @@ JitOptions::JitOptions(LLILCJitContext &Context) {
          UseConservativeGC && "Statepoints required for precise-GC");
 }
 
+unsigned JitOptions::querySIMDVectorLength(uint32_t CpuCompileFlags) {
+#if defined(_TARGET_X86_) || defined(_TARGET_AMD64_)
+  if ((CpuCompileFlags & CORJIT_FLG_USE_AVX2) != 0) {
+    return 32;
+  }
+#endif
+  return 16;
+}
+
 bool JitOptions::queryDoTailCallOpt(LLILCJitContext &Context) {
   return (bool)DEFAULT_TAIL_CALL_OPT;
 }
 
-bool JitOptions::queryIsAltJit(LLILCJitContext &Context) {
+bool JitOptions::queryIsAltJit(LLILCJitContext &Context,
+                               const ConfigOptions &Config) {
   // Initial state is that we are not an alternative jit until proven otherwise;
   bool IsAlternateJit = false;
 
@@ -113,54 +194,20 @@ bool JitOptions::queryIsAltJit(LLILCJitContext &Context) {
 
   // DEBUG case
 
-  // Get/reuse method set that contains the altjit method value.
-  MethodSet *AltJit = nullptr;
-
-  if (Context.Flags & CORJIT_FLG_PREJIT) {
-    if (!AltJitNgenMethodSet.isInitialized()) {
-      char16_t *NgenStr =
-          getStringConfigValue(Context.JitInfo, UTF16("AltJitNgen"));
-      std::unique_ptr<std::string> NgenUtf8 = Convert::utf16ToUtf8(NgenStr);
-      AltJitNgenMethodSet.init(std::move(NgenUtf8));
-      freeStringConfigValue(Context.JitInfo, NgenStr);
-    }
-    // Set up AltJitNgen set to be used for AltJit test.
-    AltJit = &AltJitNgenMethodSet;
-  } else {
-    if (!AltJitMethodSet.isInitialized()) {
-      char16_t *JitStr = getStringConfigValue(Context.JitInfo, UTF16("AltJit"));
-      // Move this to the UTIL code and ifdef it for platform
-      std::unique_ptr<std::string> JitUtf8 = Convert::utf16ToUtf8(JitStr);
-      AltJitMethodSet.init(std::move(JitUtf8));
-      freeStringConfigValue(Context.JitInfo, JitStr);
-    }
-    // Set up AltJit set to be use for AltJit test.
-    AltJit = &AltJitMethodSet;
-  }
+  // Use the method set that contains the altjit method value.
+  MethodSet *AltJit = (Context.Flags & CORJIT_FLG_PREJIT)
+                          ? &AltJitNgenMethodSet
+                          : &AltJitMethodSet;
 
 #ifdef ALT_JIT
-  const char *ClassName = nullptr;
-  const char *MethodName = nullptr;
-  MethodName =
-      Context.JitInfo->getMethodName(Context.MethodInfo->ftn, &ClassName);
-  IsAlternateJit =
-      AltJit->contains(MethodName, ClassName, Context.MethodInfo->args.pSig);
+  IsAlternateJit = queryMethodSet(Context, *AltJit);
 #endif // ALT_JIT
 
 #else
   if (Context.Flags & CORJIT_FLG_PREJIT) {
-    char16_t *NgenStr =
-        getStringConfigValue(Context.JitInfo, UTF16("AltJitNgen"));
-    std::unique_ptr<std::string> NgenUtf8 = Convert::utf16ToUtf8(NgenStr);
-    if (NgenUtf8->compare("*") == 0) {
-      IsAlternateJit = true;
-    }
+    IsAlternateJit = Config.IsAltJitNgenAll;
   } else {
-    char16_t *JitStr = getStringConfigValue(Context.JitInfo, UTF16("AltJit"));
-    std::unique_ptr<std::string> JitUtf8 = Convert::utf16ToUtf8(JitStr);
-    if (JitUtf8->compare("*") == 0) {
-      IsAlternateJit = true;
-    }
+    IsAlternateJit = Config.IsAltJitAll;
   }
 #endif
 
@@ -186,53 +233,60 @@ bool JitOptions::queryIsAltJit(LLILCJitContext &Context) {
 }
 
 bool JitOptions::queryIsExcludeMethod(LLILCJitContext &JitContext) {
-  return queryMethodSet(JitContext, ExcludeMethodSet,
-                        (const char16_t *)UTF16("AltJitExclude"));
+  return queryMethodSet(JitContext, ExcludeMethodSet);
 }
 
 bool JitOptions::queryIsBreakMethod(LLILCJitContext &JitContext) {
-  return queryMethodSet(JitContext, BreakMethodSet,
-                        (const char16_t *)UTF16("AltJitBreakAtJitStart"));
+  return queryMethodSet(JitContext, BreakMethodSet);
 }
 
 bool JitOptions::queryIsMSILDumpMethod(LLILCJitContext &JitContext) {
-  return queryMethodSet(JitContext, MSILMethodSet,
-                        (const char16_t *)UTF16("AltJitMSILDump"));
+  return queryMethodSet(JitContext, MSILMethodSet);
 }
 
 bool JitOptions::queryIsLLVMDumpMethod(LLILCJitContext &JitContext) {
-  return queryMethodSet(JitContext, LLVMMethodSet,
-                        (const char16_t *)UTF16("AltJitLLVMDump"));
+  return queryMethodSet(JitContext, LLVMMethodSet);
 }
 
 bool JitOptions::queryIsCodeRangeMethod(LLILCJitContext &JitContext) {
-  return queryMethodSet(JitContext, CodeRangeMethodSet,
-                        (const char16_t *)UTF16("AltJitCodeRangeDump"));
-}
-
-bool JitOptions::queryMethodSet(LLILCJitContext &JitContext, MethodSet &TheSet,
-                                const char16_t *Name) {
-  if (!TheSet.isInitialized()) {
-    char16_t *ConfigStr = getStringConfigValue(JitContext.JitInfo, Name);
-    bool NeedFree = true;
-    if (ConfigStr == nullptr) {
-      ConfigStr = const_cast<char16_t *>((const char16_t *)UTF16(""));
-      NeedFree = false;
-    }
-    std::unique_ptr<std::string> ConfigUtf8 = Convert::utf16ToUtf8(ConfigStr);
-    TheSet.init(std::move(ConfigUtf8));
-    if (NeedFree) {
-      freeStringConfigValue(JitContext.JitInfo, ConfigStr);
-    }
+  return queryMethodSet(JitContext, CodeRangeMethodSet);
+}
+
+bool JitOptions::queryIsHotMethod(LLILCJitContext &JitContext) {
+  return queryMethodSet(JitContext, HotMethodSet);
+}
+
+void JitOptions::initMethodSet(LLILCJitContext &JitContext, MethodSet &TheSet,
+                               const char16_t *Name) {
+  char16_t *ConfigStr = getStringConfigValue(JitContext.JitInfo, Name);
+  bool NeedFree = true;
+  if (ConfigStr == nullptr) {
+    ConfigStr = const_cast<char16_t *>((const char16_t *)UTF16(""));
+    NeedFree = false;
+  }
+  std::unique_ptr<std::string> ConfigUtf8 = Convert::utf16ToUtf8(ConfigStr);
+  TheSet.init(std::move(ConfigUtf8));
+  if (NeedFree) {
+    freeStringConfigValue(JitContext.JitInfo, ConfigStr);
   }
+}
+
+bool JitOptions::queryMethodSet(LLILCJitContext &JitContext,
+                                MethodSet &TheSet) {
+  assert(TheSet.isInitialized() && "method set not compiled");
+  return TheSet.contains(JitContext.EEMethodName, JitContext.EEClassName,
+                         JitContext.MethodInfo->args.pSig);
+}
 
-  const char *ClassName = nullptr;
-  const char *MethodName = nullptr;
-  MethodName =
-      JitContext.JitInfo->getMethodName(JitContext.MethodInfo->ftn, &ClassName);
-  bool IsInMethodSet =
-      TheSet.contains(MethodName, ClassName, JitContext.MethodInfo->args.pSig);
-  return IsInMethodSet;
+bool JitOptions::queryIsStar(LLILCJitContext &JitContext,
+                             const char16_t *Name) {
+  char16_t *ConfigStr = getStringConfigValue(JitContext.JitInfo, Name);
+  if (ConfigStr == nullptr) {
+    return false;
+  }
+  std::unique_ptr<std::string> ConfigUtf8 = Convert::utf16ToUtf8(ConfigStr);
+  freeStringConfigValue(JitContext.JitInfo, ConfigStr);
+  return ConfigUtf8->compare("*") == 0;
 }
 
 bool JitOptions::queryNonNullNonEmpty(LLILCJitContext &JitContext,
@@ -253,6 +307,18 @@ bool JitOptions::queryDoInsertStatepoints(LLILCJitContext &Context) {
                               (const char16_t *)UTF16("INSERTSTATEPOINTS"));
 }
 
+// Determine if small callees should be inlined.
+bool JitOptions::queryDoInline(LLILCJitContext &Context) {
+  return !queryNonNullNonEmpty(Context,
+                               (const char16_t *)UTF16("AltJitNoInline"));
+}
+
+// Determine if null checks may be folded into faulting accesses.
+bool JitOptions::queryDoImplicitNullChecks(LLILCJitContext &Context) {
+  return !queryNonNullNonEmpty(
+      Context, (const char16_t *)UTF16("AltJitExplicitNullChecks"));
+}
+
 // Determine if GCInfo encoding logs should be emitted
 bool JitOptions::queryLogGcInfo(LLILCJitContext &Context) {
   return queryNonNullNonEmpty(Context,
@@ -265,18 +331,121 @@ bool JitOptions::queryExecuteHandlers(LLILCJitContext &Context) {
                               (const char16_t *)UTF16("ExecuteHandlers"));
 }
 
+// Get the directory holding the persistent code cache, if any.
+std::string JitOptions::queryCodeCacheDirectory(LLILCJitContext &Context) {
+  std::string Directory;
+  char16_t *DirectoryWStr =
+      getStringConfigValue(Context.JitInfo, UTF16("AltJitCodeCache"));
+  if (DirectoryWStr) {
+    Directory = *Convert::utf16ToUtf8(DirectoryWStr);
+    freeStringConfigValue(Context.JitInfo, DirectoryWStr);
+  }
+
+  return Directory;
+}
+
+// Get the slab size of the reader's memory arenas, or 0 for the default.
+unsigned JitOptions::queryArenaSlabSize(LLILCJitContext &Context) {
+  unsigned SlabSize = 0;
+  char16_t *SizeWStr =
+      getStringConfigValue(Context.JitInfo, UTF16("AltJitArenaSlabSize"));
+  if (SizeWStr) {
+    std::unique_ptr<std::string> Size = Convert::utf16ToUtf8(SizeWStr);
+    if (llvm::StringRef(*Size).getAsInteger(0, SlabSize)) {
+      SlabSize = 0;
+    }
+    freeStringConfigValue(Context.JitInfo, SizeWStr);
+  }
+
+  return SlabSize;
+}
+
+// Get the kilobytes a thread's LLVM context may hold before it is recycled.
+unsigned JitOptions::queryContextMemoryLimit(LLILCJitContext &Context) {
+  unsigned Limit = 64 * 1024;
+  char16_t *LimitWStr =
+      getStringConfigValue(Context.JitInfo, UTF16("AltJitContextMemoryLimit"));
+  if (LimitWStr) {
+    std::unique_ptr<std::string> LimitStr = Convert::utf16ToUtf8(LimitWStr);
+    if (llvm::StringRef(*LimitStr).getAsInteger(0, Limit)) {
+      Limit = 64 * 1024;
+    }
+    freeStringConfigValue(Context.JitInfo, LimitWStr);
+  }
+
+  return Limit;
+}
+
+// Get the file compile time telemetry is written to, if any.
+std::string JitOptions::queryTelemetryPath(LLILCJitContext &Context) {
+  std::string Path;
+  char16_t *PathWStr =
+      getStringConfigValue(Context.JitInfo, UTF16("AltJitTelemetry"));
+  if (PathWStr) {
+    Path = *Convert::utf16ToUtf8(PathWStr);
+    freeStringConfigValue(Context.JitInfo, PathWStr);
+  }
+
+  return Path;
+}
+
+// Determine if compile time telemetry should be written as JSON.
+bool JitOptions::queryIsTelemetryJSON(LLILCJitContext &Context) {
+  bool IsJSON = false;
+  char16_t *FormatWStr =
+      getStringConfigValue(Context.JitInfo, UTF16("AltJitTelemetryFormat"));
+  if (FormatWStr) {
+    std::unique_ptr<std::string> Format = Convert::utf16ToUtf8(FormatWStr);
+    std::transform(Format->begin(), Format->end(), Format->begin(), ::toupper);
+    IsJSON = (Format->compare("JSON") == 0);
+    freeStringConfigValue(Context.JitInfo, FormatWStr);
+  }
+
+  return IsJSON;
+}
+
+// Determine the file compile replay records are appended to.
+std::string JitOptions::queryReplayRecordPath(LLILCJitContext &Context) {
+  std::string Path;
+  char16_t *PathWStr =
+      getStringConfigValue(Context.JitInfo, UTF16("AltJitReplayRecord"));
+  if (PathWStr) {
+    Path = *Convert::utf16ToUtf8(PathWStr);
+    freeStringConfigValue(Context.JitInfo, PathWStr);
+  }
+
+  return Path;
+}
+
+// Determine if methods should be compiled at tier 0 unless known to be hot.
+bool JitOptions::queryIsTieredCompilation(LLILCJitContext &Context) {
+  return queryNonNullNonEmpty(
+      Context, (const char16_t *)UTF16("AltJitTieredCompilation"));
+}
+
 // Determine if SIMD intrinsics should be used.
 bool JitOptions::queryDoSIMDIntrinsic(LLILCJitContext &Context) {
   return queryNonNullNonEmpty(Context,
                               (const char16_t *)UTF16("SIMDINTRINSIC"));
 }
 
-OptLevel JitOptions::queryOptLevel(LLILCJitContext &Context) {
+OptLevel JitOptions::queryOptLevel(LLILCJitContext &Context,
+                                   const ConfigOptions &Config) {
   ::OptLevel JitOptLevel = ::OptLevel::BLENDED_CODE;
-  // Currently we only check for the debug flag but this will be extended
-  // to account for further opt levels as we move forward.
+  // The debug flag takes precedence over the EE's size/speed preference.
   if ((Context.Flags & CORJIT_FLG_DEBUG_CODE) != 0) {
     JitOptLevel = ::OptLevel::DEBUG_CODE;
+  } else if (((Context.Flags & CORJIT_FLG_PREJIT) == 0) &&
+             Config.IsTieredCompilation) {
+    // The EE has no way to have the jit replace code it has already
+    // handed out, so a method stays at the tier it is first compiled at.
+    // Methods known to be hot go straight to full optimization.
+    JitOptLevel = queryIsHotMethod(Context) ? ::OptLevel::FAST_CODE
+                                            : ::OptLevel::TIER0_CODE;
+  } else if ((Context.Flags & CORJIT_FLG_SIZE_OPT) != 0) {
+    JitOptLevel = ::OptLevel::SMALL_CODE;
+  } else if ((Context.Flags & CORJIT_FLG_SPEED_OPT) != 0) {
+    JitOptLevel = ::OptLevel::FAST_CODE;
   }
 
   return JitOptLevel;
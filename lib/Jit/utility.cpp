@@ -29,40 +29,45 @@ unique_ptr<MethodID> MethodID::parse(const string &S, size_t &I) {
   MethodID MId;
   size_t SLen = S.length();
 
-  string Token = MId.scan(S, I);
-
-  if (Token == "") // off the end of S
+  // Skip the whitespace separating this pattern from the previous one.
+  I = S.find_first_not_of(" \t", I);
+  if (I == string::npos) { // off the end of S
+    I = SLen;
     return nullptr;
+  }
+
+  string Token = MId.scan(S, I);
 
-  if (Token == "*") {
+  if (Token == "*" && (I >= SLen || S[I] == ' ' || S[I] == '\t')) {
     MId.ClassName = llvm::make_unique<string>(Token);
     MId.MethodName = nullptr;
-    if (I >= SLen || S[I] == ' ') {
-      MId.NumArgs = MethodIDState::AnyArgs;
-    }
+    MId.NumArgs = MethodIDState::AnyArgs;
     return llvm::make_unique<MethodID>(MId);
-    return nullptr;
   }
 
-  if (S[I] == ':') { // C:M | C:M(A)
-    MId.ClassName = llvm::make_unique<string>(Token);
+  if (I < SLen && S[I] == ':') { // C:M | C:M(A)
+    if (!Token.empty()) {
+      MId.ClassName = llvm::make_unique<string>(Token);
+    }
     Token = MId.scan(S, ++I); // M | M(A)
   }
 
-  MId.MethodName = llvm::make_unique<string>(Token);
+  if (!Token.empty()) {
+    MId.MethodName = llvm::make_unique<string>(Token);
+  }
 
-  if (I >= SLen || S[I] == ' ') {
-    MId.NumArgs = MethodIDState::AnyArgs;
-    return llvm::make_unique<MethodID>(MId);
-    return nullptr;
+  if (I < SLen && S[I] == '(') {
+    MId.NumArgs = MId.parseArgs(S, I);
   }
 
-  if (S[I] != '(') // illegal
+  if (I < SLen && S[I] != ' ' && S[I] != '\t') // illegal
+    return nullptr;
+
+  if (!MId.ClassName && !MId.MethodName &&
+      MId.NumArgs == MethodIDState::AnyArgs) // nothing specified
     return nullptr;
 
-  MId.NumArgs = MId.parseArgs(S, I);
   return llvm::make_unique<MethodID>(MId);
-  return nullptr;
 }
 
 string MethodID::scan(const string &S, size_t &I) {
@@ -71,9 +76,13 @@ string MethodID::scan(const string &S, size_t &I) {
   if (I >= SLen) // already 'off the end'
     return string{""};
 
-  size_t Start = I = S.find_first_not_of(" \t", I); // skip whitespace
+  size_t Start = S.find_first_not_of(" \t", I); // skip whitespace
+  if (Start == string::npos) {
+    I = SLen;
+    return string{""};
+  }
 
-  I = S.find_first_of(" :()", I);
+  I = S.find_first_of(" \t:()", Start);
 
   if (I == string::npos) // eg: S = "*"
     I = SLen;
@@ -90,23 +99,64 @@ void MethodSet::init(unique_ptr<string> ConfigValue) {
 
 void MethodSet::insert(unique_ptr<string> Ups) {
   size_t I = 0;
-  std::list<MethodID> *MIdList = new std::list<MethodID>();
-  string S = *Ups;
+  const string &S = *Ups;
+
+  for (auto MId = MethodID::parse(S, I); MId; MId = MethodID::parse(S, I)) {
+    if (MId->ClassName && *MId->ClassName == "*" && !MId->MethodName) {
+      MatchesAll = true;
+      continue;
+    }
+
+    Pattern P;
+    P.ClassName = MId->ClassName ? *MId->ClassName : "";
+    P.MethodName = MId->MethodName ? *MId->MethodName : "";
+    P.NumArgs = MId->NumArgs;
 
-  auto MId = MethodID::parse(S, I);
-  while (MId) {
-    MIdList->push_back(*MId);
-    MId = MethodID::parse(S, I);
+    if (P.MethodName.empty() || P.MethodName.find('*') != string::npos) {
+      OtherPatterns.push_back(std::move(P));
+    } else {
+      ExactMethods[P.MethodName].push_back(std::move(P));
+    }
   }
 
-  // This write should be atomic, delete if we're not the first.
-  llvm::sys::cas_flag F = llvm::sys::CompareAndSwap(
-      (llvm::sys::cas_flag *)&(this->Initialized), 0x1, 0x0);
-  if (F != 0x0) {
-    delete MIdList;
-  } else {
-    this->MethodIDList = MIdList;
+  this->Initialized = true;
+}
+
+bool MethodSet::matchesGlob(llvm::StringRef Glob, llvm::StringRef Text) {
+  // Match greedily, backtracking to the most recent '*' on a mismatch.
+  size_t G = 0, T = 0;
+  size_t StarG = llvm::StringRef::npos, StarT = 0;
+  while (T < Text.size()) {
+    if (G < Glob.size() && Glob[G] == '*') {
+      StarG = G++;
+      StarT = T;
+    } else if (G < Glob.size() && Glob[G] == Text[T]) {
+      ++G;
+      ++T;
+    } else if (StarG != llvm::StringRef::npos) {
+      G = StarG + 1;
+      T = ++StarT;
+    } else {
+      return false;
+    }
   }
+  while (G < Glob.size() && Glob[G] == '*') {
+    ++G;
+  }
+  return G == Glob.size();
+}
+
+bool MethodSet::matchesClassAndArgs(const Pattern &P,
+                                    llvm::StringRef ClassName, int NumArgs) {
+  // Check for mis-match on NumArgs
+  if (P.NumArgs != MethodIDState::AnyArgs && P.NumArgs != NumArgs)
+    return false;
+
+  // Check for match on ClassName
+  if (P.ClassName.empty()) // no ClassName
+    return true;
+
+  return matchesGlob(P.ClassName, ClassName);
 }
 
 bool MethodSet::contains(const char *MethodName, const char *ClassName,
@@ -114,6 +164,10 @@ bool MethodSet::contains(const char *MethodName, const char *ClassName,
 
   assert(this->isInitialized());
 
+  // Check for "*", the common case, first
+  if (MatchesAll)
+    return true;
+
   int NumArgs = MethodIDState::AnyArgs; // assume no signature supplied
 
   if (PCSig) {
@@ -121,31 +175,21 @@ bool MethodSet::contains(const char *MethodName, const char *ClassName,
     NumArgs = CorSigUncompressData(PCSig);
   }
 
-  string StrClassName = ClassName ? ClassName : "";
-  string StrMethodName = MethodName ? MethodName : "";
-
-  auto Begin = this->MethodIDList->begin();
-  auto End = this->MethodIDList->end();
-
-  for (auto P = Begin; P != End; ++P) { // P => "pattern"
+  llvm::StringRef StrClassName = ClassName ? ClassName : "";
+  llvm::StringRef StrMethodName = MethodName ? MethodName : "";
 
-    // Check for "*", the common case, first
-    if (P->ClassName && *P->ClassName == "*")
-      return true;
-
-    // Check for mis-match on NumArgs
-    if (P->NumArgs != MethodIDState::AnyArgs && P->NumArgs != NumArgs)
-      continue;
+  auto Exact = ExactMethods.find(StrMethodName);
+  if (Exact != ExactMethods.end()) {
+    for (const Pattern &P : Exact->second) {
+      if (matchesClassAndArgs(P, StrClassName, NumArgs))
+        return true;
+    }
+  }
 
-    // Check for mis-match on MethodName
-    if (P->MethodName && (*P->MethodName != StrMethodName))
+  for (const Pattern &P : OtherPatterns) { // P => "pattern"
+    if (!P.MethodName.empty() && !matchesGlob(P.MethodName, StrMethodName))
       continue;
-
-    // Check for match on ClassName (we already match NumArgs and MethodName)
-    if (!P->ClassName) // no ClassName
-      return true;
-
-    if (*P->ClassName == StrClassName)
+    if (matchesClassAndArgs(P, StrClassName, NumArgs))
       return true;
   }
 
@@ -13,6 +13,7 @@
 ///
 //===----------------------------------------------------------------------===//
 
+#include "llvm/ADT/Hashing.h"
 #include "llvm/CodeGen/AsmPrinter.h"
 #include "llvm/DebugInfo/CodeView/CodeView.h"
 #include "llvm/DebugInfo/CodeView/Line.h"
@@ -42,6 +43,7 @@
 #include "llvm/Support/Host.h"
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/PrettyStackTrace.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/TargetRegistry.h"
@@ -52,7 +54,9 @@
 #include "llvm/Target/TargetOptions.h"
 #include "llvm/Target/TargetSubtargetInfo.h"
 #include "cfi.h"
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include "jitDebugInfo.h"
 
 using namespace llvm;
@@ -120,6 +124,20 @@ static const Target *GetTarget() {
   return TheTarget;
 }
 
+// Target registration and the triple are process-wide, and several writers
+// may be initialized concurrently on different threads, so they are set up
+// once. After that TripleName is only read.
+static std::once_flag TargetInitFlag;
+static const Target *NativeTarget = nullptr;
+
+static void InitTarget() {
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+
+  TripleName = Triple::normalize(TripleName);
+  NativeTarget = GetTarget();
+}
+
 bool error(const Twine &Error) {
   errs() << Twine("error: ") + Error + "\n";
   return false;
@@ -150,6 +168,33 @@ public:
   std::set<MCSection *> Sections;
   int FuncId;
 
+  // Identical code and data folding. Between BeginFoldableSymbol and
+  // EndFoldableSymbol the content is recorded rather than emitted, so that
+  // a body seen before can be replaced by an alias to its first copy.
+  struct FoldableItem {
+    enum ItemKind { Alignment, Blob, IntValue, SymbolRef } Kind;
+    std::string Data; // Blob bytes or referenced symbol name
+    uint64_t Value;   // Alignment, integer value or relocation type
+    int Size;
+    int Delta;
+    bool operator==(const FoldableItem &Other) const {
+      return (Kind == Other.Kind) && (Value == Other.Value) &&
+             (Size == Other.Size) && (Delta == Other.Delta) &&
+             (Data == Other.Data);
+    }
+  };
+  struct FoldedBody {
+    MCSection *Section;
+    std::vector<FoldableItem> Items;
+    std::string SymbolName;
+  };
+  bool Folding;
+  std::string FoldableSymbolName;
+  std::vector<FoldableItem> FoldableItems;
+  // Content hash to the first copy of each body
+  std::unordered_multimap<size_t, FoldedBody> FoldedBodies;
+  uint64_t FoldedSize;
+
 public:
   bool init(StringRef FunctionName);
   void finish();
@@ -159,16 +204,11 @@ public:
 };
 
 bool ObjectWriter::init(llvm::StringRef ObjectFilePath) {
-  llvm_shutdown_obj Y; // Call llvm_shutdown() on exit.
-
-  // Initialize targets
-  InitializeNativeTarget();
-  InitializeNativeTargetAsmPrinter();
+  std::call_once(TargetInitFlag, InitTarget);
 
   MCOptions = InitMCTargetOptionsFromFlags();
-  TripleName = Triple::normalize(TripleName);
 
-  TheTarget = GetTarget();
+  TheTarget = NativeTarget;
   if (!TheTarget)
     return error("Unable to get Target");
   // Now that GetTarget() has (potentially) replaced TripleName, it's safe to
@@ -229,6 +269,8 @@ bool ObjectWriter::init(llvm::StringRef ObjectFilePath) {
 
   FrameOpened = false;
   FuncId = 1;
+  Folding = false;
+  FoldedSize = 0;
 
   return true;
 }
@@ -247,6 +289,24 @@ extern "C" ObjectWriter *InitObjWriter(const char *ObjectFilePath) {
   return nullptr;
 }
 
+// Each shard is an independent object writer with its own MC context and
+// output file, so shards can be filled on different threads. The shard is
+// written next to ObjectFilePath with the index before the extension
+// (foo.obj becomes foo.3.obj). Symbols defined by EmitSymbolDef are global,
+// so references between shards are resolved when the shards are linked; the
+// image is the same for any thread schedule as long as the client assigns
+// work to shards deterministically and links them in index order. Each shard
+// is written and freed by FinishObjWriter, so only the shards still being
+// filled are held in memory.
+extern "C" ObjectWriter *InitObjWriterShard(const char *ObjectFilePath,
+                                            int ShardIndex) {
+  assert(ShardIndex >= 0 && "Invalid shard index");
+  SmallString<256> ShardPath(ObjectFilePath);
+  std::string Extension = sys::path::extension(ShardPath).str();
+  sys::path::replace_extension(ShardPath, "." + Twine(ShardIndex) + Extension);
+  return InitObjWriter(ShardPath.c_str());
+}
+
 extern "C" void FinishObjWriter(ObjectWriter *OW) {
   assert(OW && "ObjWriter is null");
   OW->finish();
@@ -340,6 +400,7 @@ extern "C" bool CreateCustomSection(ObjectWriter *OW, const char *SectionName,
 
 extern "C" void SwitchSection(ObjectWriter *OW, const char *SectionName) {
   assert(OW && "ObjWriter is null");
+  assert(!OW->Folding && "Foldable body is still open");
   auto *AsmPrinter = &OW->getAsmPrinter();
   auto &OST = *AsmPrinter->OutStreamer;
   MCContext &OutContext = OST.getContext();
@@ -380,6 +441,11 @@ extern "C" void SwitchSection(ObjectWriter *OW, const char *SectionName) {
 
 extern "C" void EmitAlignment(ObjectWriter *OW, int ByteAlignment) {
   assert(OW && "ObjWriter is null");
+  if (OW->Folding) {
+    OW->FoldableItems.push_back(
+        {ObjectWriter::FoldableItem::Alignment, "", (uint64_t)ByteAlignment});
+    return;
+  }
   auto *AsmPrinter = &OW->getAsmPrinter();
   auto &OST = *AsmPrinter->OutStreamer;
 
@@ -388,6 +454,11 @@ extern "C" void EmitAlignment(ObjectWriter *OW, int ByteAlignment) {
 
 extern "C" void EmitBlob(ObjectWriter *OW, int BlobSize, const char *Blob) {
   assert(OW && "ObjWriter null");
+  if (OW->Folding) {
+    OW->FoldableItems.push_back({ObjectWriter::FoldableItem::Blob,
+                                 std::string(Blob, BlobSize), 0, BlobSize});
+    return;
+  }
   auto *AsmPrinter = &OW->getAsmPrinter();
   auto &OST = *AsmPrinter->OutStreamer;
 
@@ -396,6 +467,11 @@ extern "C" void EmitBlob(ObjectWriter *OW, int BlobSize, const char *Blob) {
 
 extern "C" void EmitIntValue(ObjectWriter *OW, uint64_t Value, unsigned Size) {
   assert(OW && "ObjWriter is null");
+  if (OW->Folding) {
+    OW->FoldableItems.push_back(
+        {ObjectWriter::FoldableItem::IntValue, "", Value, (int)Size});
+    return;
+  }
   auto *AsmPrinter = &OW->getAsmPrinter();
   auto &OST = *AsmPrinter->OutStreamer;
 
@@ -404,6 +480,7 @@ extern "C" void EmitIntValue(ObjectWriter *OW, uint64_t Value, unsigned Size) {
 
 extern "C" void EmitSymbolDef(ObjectWriter *OW, const char *SymbolName) {
   assert(OW && "ObjWriter is null");
+  assert(!OW->Folding && "Symbols cannot be defined inside a foldable body");
   auto *AsmPrinter = &OW->getAsmPrinter();
   auto &OST = *AsmPrinter->OutStreamer;
   MCContext &OutContext = OST.getContext();
@@ -438,6 +515,13 @@ enum class RelocType {
 extern "C" int EmitSymbolRef(ObjectWriter *OW, const char *SymbolName,
                              RelocType RelocType, int Delta) {
   assert(OW && "ObjWriter is null");
+  if (OW->Folding) {
+    int Size = (RelocType == RelocType::IMAGE_REL_BASED_DIR64) ? 8 : 4;
+    OW->FoldableItems.push_back({ObjectWriter::FoldableItem::SymbolRef,
+                                 SymbolName, (uint64_t)RelocType, Size,
+                                 Delta});
+    return Size;
+  }
   auto *AsmPrinter = &OW->getAsmPrinter();
   auto &OST = static_cast<MCObjectStreamer &>(*AsmPrinter->OutStreamer);
   MCContext &OutContext = OST.getContext();
@@ -486,6 +570,92 @@ extern "C" int EmitSymbolRef(ObjectWriter *OW, const char *SymbolName,
   return Size;
 }
 
+// Identical code and data folding. BeginFoldableSymbol takes the place of
+// EmitSymbolDef for a body whose content is emitted with EmitAlignment,
+// EmitBlob, EmitIntValue and EmitSymbolRef only; alignment of the symbol
+// itself goes before it. EndFoldableSymbol then compares the bytes and
+// relocations with the bodies seen so far in the same section. A new body is
+// emitted; a repeated one is not, and its symbol becomes an alias of the
+// first copy. The return value is nonzero if the body was folded, in which
+// case the client must not emit unwind or debug info for it.
+extern "C" void BeginFoldableSymbol(ObjectWriter *OW, const char *SymbolName) {
+  assert(OW && "ObjWriter is null");
+  assert(!OW->Folding && "Foldable bodies cannot be nested");
+  OW->Folding = true;
+  OW->FoldableSymbolName = SymbolName;
+  OW->FoldableItems.clear();
+}
+
+extern "C" int EndFoldableSymbol(ObjectWriter *OW) {
+  assert(OW && "ObjWriter is null");
+  assert(OW->Folding && "No foldable body is open");
+  auto *AsmPrinter = &OW->getAsmPrinter();
+  auto &OST = *AsmPrinter->OutStreamer;
+  MCContext &OutContext = OST.getContext();
+
+  OW->Folding = false;
+
+  // Bodies are looked up by a hash of the section and every item with its
+  // operands. Only bodies with the same hash are compared item by item, so
+  // they match only if their bytes and relocations are the same.
+  MCSection *Section = OST.getCurrentSection().first;
+  hash_code Hash = hash_value((const void *)Section);
+  uint64_t Size = 0;
+  for (const auto &Item : OW->FoldableItems) {
+    Hash = hash_combine(Hash, (int)Item.Kind, Item.Value, Item.Size,
+                        Item.Delta, hash_value(StringRef(Item.Data)));
+    if (Item.Kind != ObjectWriter::FoldableItem::Alignment) {
+      Size += Item.Size;
+    }
+  }
+
+  auto Range = OW->FoldedBodies.equal_range((size_t)Hash);
+  for (auto I = Range.first; I != Range.second; ++I) {
+    const ObjectWriter::FoldedBody &Body = I->second;
+    if ((Body.Section != Section) || (Body.Items != OW->FoldableItems)) {
+      continue;
+    }
+    MCSymbol *Sym = OutContext.getOrCreateSymbol(OW->FoldableSymbolName);
+    MCSymbol *Target = OutContext.getOrCreateSymbol(Body.SymbolName);
+    OST.EmitSymbolAttribute(Sym, MCSA_Global);
+    OST.EmitAssignment(Sym, MCSymbolRefExpr::create(Target, OutContext));
+    OW->FoldedSize += Size;
+    OW->FoldableItems.clear();
+    return 1;
+  }
+
+  EmitSymbolDef(OW, OW->FoldableSymbolName.c_str());
+  for (const auto &Item : OW->FoldableItems) {
+    switch (Item.Kind) {
+    case ObjectWriter::FoldableItem::Alignment:
+      EmitAlignment(OW, (int)Item.Value);
+      break;
+    case ObjectWriter::FoldableItem::Blob:
+      EmitBlob(OW, Item.Size, Item.Data.data());
+      break;
+    case ObjectWriter::FoldableItem::IntValue:
+      EmitIntValue(OW, Item.Value, (unsigned)Item.Size);
+      break;
+    case ObjectWriter::FoldableItem::SymbolRef:
+      EmitSymbolRef(OW, Item.Data.c_str(), (RelocType)Item.Value, Item.Delta);
+      break;
+    }
+  }
+
+  // The recorded items become the copy that later bodies are compared with.
+  ObjectWriter::FoldedBody Body = {Section, std::move(OW->FoldableItems),
+                                   OW->FoldableSymbolName};
+  OW->FoldedBodies.insert(std::make_pair((size_t)Hash, std::move(Body)));
+  OW->FoldableItems.clear();
+  return 0;
+}
+
+// Bytes of code and data not emitted because they were folded.
+extern "C" uint64_t GetFoldedSize(ObjectWriter *OW) {
+  assert(OW && "ObjWriter is null");
+  return OW->FoldedSize;
+}
+
 extern "C" void EmitWinFrameInfo(ObjectWriter *OW, const char *FunctionName,
                                  int StartOffset, int EndOffset,
                                  const char *BlobSymbolName) {
@@ -522,6 +692,7 @@ extern "C" void EmitWinFrameInfo(ObjectWriter *OW, const char *FunctionName,
 extern "C" void EmitCFIStart(ObjectWriter *OW, int Offset) {
   assert(OW && "ObjWriter is null");
   assert(!OW->FrameOpened && "frame should be closed before CFIStart");
+  assert(!OW->Folding && "CFI cannot be emitted inside a foldable body");
   auto *AsmPrinter = &OW->getAsmPrinter();
   auto &OST = *AsmPrinter->OutStreamer;
 
@@ -828,6 +999,7 @@ extern "C" void EmitDebugLoc(ObjectWriter *OW, int NativeOffset, int FileId,
   const MCObjectFileInfo *MOFI = OutContext.getObjectFileInfo();
 
   assert(FileId > 0 && "FileId should be greater than 0.");
+  assert(!OW->Folding && "Locations cannot be emitted inside a foldable body");
   if (MOFI->getObjectFileType() == MOFI->IsCOFF) {
     OST.EmitCVLocDirective(OW->FuncId, FileId, LineNumber, ColNumber, false,
                            true, "");
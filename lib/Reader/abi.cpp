@@ -352,11 +352,13 @@ void X86_64ABIInfo::computeSignatureInfo(
 }
 
 ABIInfo *ABIInfo::get(Module &M) {
-  Triple TargetTriple(M.getTargetTriple());
+  return get(Triple(M.getTargetTriple()), M.getDataLayout());
+}
 
+ABIInfo *ABIInfo::get(const Triple &TargetTriple, const DataLayout &DL) {
   switch (TargetTriple.getArch()) {
   case Triple::x86_64:
-    return new X86_64ABIInfo(TargetTriple, M.getDataLayout());
+    return new X86_64ABIInfo(TargetTriple, DL);
 
   default:
     llvm_unreachable("Unsupported architecture");
@@ -394,6 +396,13 @@ ABIArgInfo &ABIArgInfo::operator=(ABIArgInfo &&Other) {
   return *this;
 }
 
+ABIArgInfo ABIArgInfo::copy() const {
+  if (TheKind == Kind::Expand) {
+    return ABIArgInfo(TheKind, getExpansions());
+  }
+  return ABIArgInfo(TheKind, TheType);
+}
+
 ABIArgInfo ABIArgInfo::getDirect(llvm::Type *TheType) {
   return ABIArgInfo(Kind::Direct, TheType);
 }
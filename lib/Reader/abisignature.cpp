@@ -80,6 +80,29 @@ static Type *getExpandedResultType(LLVMContext &LLVMContext,
   return StructType::get(LLVMContext, FieldTypes);
 }
 
+const ABISignatureCache::Entry *
+ABISignatureCache::lookup(ArrayRef<uintptr_t> Key) const {
+  StringRef KeyBytes((const char *)Key.data(), Key.size() * sizeof(uintptr_t));
+  auto MapElem = Entries.find(KeyBytes);
+  if (MapElem == Entries.end()) {
+    return nullptr;
+  }
+  return MapElem->second.get();
+}
+
+void ABISignatureCache::insert(ArrayRef<uintptr_t> Key, Type *FuncResultType,
+                               const ABIArgInfo &Result,
+                               ArrayRef<ABIArgInfo> Args) {
+  std::unique_ptr<Entry> NewEntry = llvm::make_unique<Entry>();
+  NewEntry->FuncResultType = FuncResultType;
+  NewEntry->Result = Result.copy();
+  for (const ABIArgInfo &Arg : Args) {
+    NewEntry->Args.push_back(Arg.copy());
+  }
+  StringRef KeyBytes((const char *)Key.data(), Key.size() * sizeof(uintptr_t));
+  Entries[KeyBytes] = std::move(NewEntry);
+}
+
 ABISignature::ABISignature(const ReaderCallSignature &Signature, GenIR &Reader,
                            const ABIInfo &TheABIInfo) {
   const CallArgType &ResultType = Signature.getResultType();
@@ -101,17 +124,54 @@ ABISignature::ABISignature(const ReaderCallSignature &Signature, GenIR &Reader,
   bool IsManagedCallingConv = false;
   CallingConv::ID CC = getLLVMCallingConv(
       getNormalizedCallingConvention(Signature), IsManagedCallingConv);
-  TheABIInfo.computeSignatureInfo(*Reader.JitContext, CC, IsManagedCallingConv,
+
+  // ReadyToRun compiles record the struct layouts they depend on as they
+  // query the EE, so each signature must make its own queries.
+  LLILCJitContext &JitContext = *Reader.JitContext;
+  ABISignatureCache *Cache = nullptr;
+  SmallVector<uintptr_t, 32> Key;
+  if ((JitContext.Flags & CORJIT_FLG_READYTORUN) == 0) {
+    LLILCJitPerThreadState *State = JitContext.State;
+    if (State->ABISignatures == nullptr) {
+      State->ABISignatures = llvm::make_unique<ABISignatureCache>();
+    }
+    Cache = State->ABISignatures.get();
+
+    Key.push_back(((uintptr_t)CC << 1) | (IsManagedCallingConv ? 1 : 0));
+    Key.push_back((uintptr_t)ABIResultType.getType());
+    Key.push_back((uintptr_t)ABIResultType.getClass());
+    Key.push_back(ABIResultType.isSigned() ? 1 : 0);
+    for (const ABIType &ArgType : ABIArgTypes) {
+      Key.push_back((uintptr_t)ArgType.getType());
+      Key.push_back((uintptr_t)ArgType.getClass());
+      Key.push_back(ArgType.isSigned() ? 1 : 0);
+    }
+
+    if (const ABISignatureCache::Entry *Cached = Cache->lookup(Key)) {
+      FuncResultType = Cached->FuncResultType;
+      Result = Cached->Result.copy();
+      for (const ABIArgInfo &Arg : Cached->Args) {
+        Args.push_back(Arg.copy());
+      }
+      return;
+    }
+  }
+
+  TheABIInfo.computeSignatureInfo(JitContext, CC, IsManagedCallingConv,
                                   ABIResultType, ABIArgTypes, Result, Args);
 
   if (Result.getKind() == ABIArgInfo::Indirect) {
     FuncResultType = Reader.getManagedPointerType(Result.getType());
   } else if (Result.getKind() == ABIArgInfo::Expand) {
-    FuncResultType = getExpandedResultType(*Reader.JitContext->LLVMContext,
+    FuncResultType = getExpandedResultType(*JitContext.LLVMContext,
                                            Result.getExpansions());
   } else {
     FuncResultType = Result.getType();
   }
+
+  if (Cache != nullptr) {
+    Cache->insert(Key, FuncResultType, Result, Args);
+  }
 }
 
 uint32_t ABISignature::getNumABIArgs() const {
@@ -0,0 +1,129 @@
+//===------------------- lib/Reader/arena.cpp -------------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Defines the bump pointer arenas backing the reader's temporary
+/// and procedure-lifetime memory.
+///
+//===----------------------------------------------------------------------===//
+
+#include "arena.h"
+#include "llvm/Support/ErrorHandling.h"
+#include <cstdlib>
+#include <cstring>
+
+using namespace llvm;
+
+ReaderArenaStatistics TempArenaStatistics("temp");
+ReaderArenaStatistics ProcArenaStatistics("proc");
+
+ReaderArenaStatistics::ReaderArenaStatistics(const char *Name)
+    : Name(Name), NumReleases(0), TotalBytesAllocated(0),
+      HighWaterAllocated(0), HighWaterReserved(0) {}
+
+// Raise Value to at least NewValue.
+static void updateMaximum(std::atomic<uint64_t> &Value, uint64_t NewValue) {
+  uint64_t OldValue = Value.load();
+  while ((OldValue < NewValue) &&
+         !Value.compare_exchange_weak(OldValue, NewValue)) {
+  }
+}
+
+void ReaderArenaStatistics::noteRelease(size_t BytesAllocated,
+                                        size_t BytesReserved) {
+  ++NumReleases;
+  TotalBytesAllocated += BytesAllocated;
+  updateMaximum(HighWaterAllocated, BytesAllocated);
+  updateMaximum(HighWaterReserved, BytesReserved);
+}
+
+void ReaderArenaStatistics::print(raw_ostream &OS) const {
+  uint64_t Releases = NumReleases.load();
+  uint64_t Average = (Releases == 0) ? 0 : (TotalBytesAllocated / Releases);
+  OS << "INFO:  " << Name << " arenas: " << Releases
+     << " released, average " << Average << " bytes, high water "
+     << HighWaterAllocated.load() << " bytes allocated in "
+     << HighWaterReserved.load() << " bytes reserved\n";
+}
+
+ReaderArena::ReaderArena(ReaderArenaStatistics &Statistics, size_t SlabSize)
+    : Statistics(Statistics), SlabSize(DefaultSlabSize), Slabs(nullptr),
+      Current(nullptr), End(nullptr), BytesAllocated(0), BytesReserved(0) {
+  setSlabSize(SlabSize);
+}
+
+void ReaderArena::setSlabSize(size_t SlabSize) {
+  // Keep room for a reasonable number of allocations after the header.
+  const size_t MinSlabSize = 256;
+  if (SlabSize == 0) {
+    SlabSize = DefaultSlabSize;
+  } else if (SlabSize < MinSlabSize) {
+    SlabSize = MinSlabSize;
+  }
+  this->SlabSize = SlabSize;
+}
+
+char *ReaderArena::allocateSlab(size_t NumBytes) {
+  // The header is padded so that the usable memory is aligned as well.
+  const size_t HeaderSize = (sizeof(Slab) + Alignment - 1) & ~(Alignment - 1);
+  size_t Size = HeaderSize + NumBytes;
+  Slab *NewSlab = (Slab *)calloc(1, Size);
+  if (NewSlab == nullptr) {
+    report_fatal_error("Out of memory in reader arena");
+  }
+  NewSlab->Next = Slabs;
+  Slabs = NewSlab;
+  BytesReserved += Size;
+  return (char *)NewSlab + HeaderSize;
+}
+
+void *ReaderArena::allocate(size_t NumBytes) {
+  size_t Size = (NumBytes + Alignment - 1) & ~(Alignment - 1);
+  if (Size == 0) {
+    Size = Alignment;
+  }
+  BytesAllocated += Size;
+
+  if (Size <= (size_t)(End - Current)) {
+    void *Result = Current;
+    Current += Size;
+    return Result;
+  }
+
+  // Give an allocation that would use up most of a slab a slab of its own,
+  // so that the rest of the current slab is not wasted.
+  if (Size > SlabSize / 2) {
+    return allocateSlab(Size);
+  }
+
+  // Slabs are zeroed when allocated and never reused, so memory handed out
+  // is always zero.
+  char *Start = allocateSlab(SlabSize);
+  Current = Start + Size;
+  End = Start + SlabSize;
+  return Start;
+}
+
+void ReaderArena::release() {
+  if (BytesReserved != 0) {
+    Statistics.noteRelease(BytesAllocated, BytesReserved);
+  }
+
+  Slab *Next;
+  for (Slab *S = Slabs; S != nullptr; S = Next) {
+    Next = S->Next;
+    free(S);
+  }
+  Slabs = nullptr;
+  Current = nullptr;
+  End = nullptr;
+  BytesAllocated = 0;
+  BytesReserved = 0;
+}
@@ -0,0 +1,45 @@
+//===---------------- lib/Reader/classlayout.cpp ----------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Defines the process-wide cache of the class layouts the EE
+/// reports, which the reader builds LLVM types from.
+///
+//===----------------------------------------------------------------------===//
+
+#include "classlayout.h"
+
+using namespace llvm;
+
+ClassLayoutCache SharedClassLayouts;
+
+std::shared_ptr<const ClassLayout>
+ClassLayoutCache::lookup(CORINFO_CLASS_HANDLE ClassHandle) {
+  sys::SmartScopedReader<true> Guard(Lock);
+  auto MapElem = Layouts.find(ClassHandle);
+  if (MapElem == Layouts.end()) {
+    return nullptr;
+  }
+  return MapElem->second;
+}
+
+std::shared_ptr<const ClassLayout>
+ClassLayoutCache::insert(CORINFO_CLASS_HANDLE ClassHandle,
+                         std::unique_ptr<ClassLayout> Layout) {
+  sys::SmartScopedWriter<true> Guard(Lock);
+  auto Result = Layouts.insert(std::make_pair(
+      ClassHandle, std::shared_ptr<const ClassLayout>(std::move(Layout))));
+  return Result.first->second;
+}
+
+void ClassLayoutCache::clear() {
+  sys::SmartScopedWriter<true> Guard(Lock);
+  Layouts.clear();
+}
@@ -40,9 +40,6 @@ extern int _cdecl dbPrint(const char *Form, ...);
 
 #define BADCODE(Message) (ReaderBase::verGlobalError(Message))
 
-// Max elements per entry in FlowGraphNodeListArray.
-#define FLOW_GRAPH_NODE_LIST_ARRAY_STRIDE 32
-
 // OPCODE REMAP
 ReaderBaseNS::CallOpcode remapCallOpcode(ReaderBaseNS::OPCODE Op) {
   ReaderBaseNS::CallOpcode CallOp = (ReaderBaseNS::CallOpcode)OpcodeRemap[Op];
@@ -106,26 +103,43 @@ static inline int readSwitchCase(uint8_t **ILCursor) {
   return Val;
 }
 
-// FlowGraphNodeOffsetList - maintains a list of byte offsets at which branches
-// need to be inserted along with the associated labels. Used for building
-// flow graph.
-class FlowGraphNodeOffsetList {
-  FlowGraphNodeOffsetList *Next;
-  FlowGraphNode *Node;
-  uint32_t Offset;
-  IRNode *ReaderStack;
-
-public:
-  FlowGraphNodeOffsetList *getNext(void) const { return Next; }
-  void setNext(FlowGraphNodeOffsetList *N) { Next = N; }
-  FlowGraphNode *getNode(void) const { return Node; }
-  void setNode(FlowGraphNode *N) { Node = N; }
-  uint32_t getOffset(void) const { return Offset; }
-  void setOffset(uint32_t O) { Offset = O; }
-
-  IRNode *getStack(void) const { return ReaderStack; }
-  void setStack(IRNode *RS) { ReaderStack = RS; }
-};
+MSILLocalAccess getMSILLocalAccess(ReaderBaseNS::OPCODE Opcode,
+                                   uint8_t *Operand, uint32_t *LocalNum) {
+  switch (Opcode) {
+  case ReaderBaseNS::CEE_LDLOC_0:
+  case ReaderBaseNS::CEE_LDLOC_1:
+  case ReaderBaseNS::CEE_LDLOC_2:
+  case ReaderBaseNS::CEE_LDLOC_3:
+    *LocalNum = OpcodeRemap[Opcode];
+    return MSILLocalAccess::Load;
+  case ReaderBaseNS::CEE_LDLOC_S:
+    *LocalNum = readValue<uint8_t>(Operand);
+    return MSILLocalAccess::Load;
+  case ReaderBaseNS::CEE_LDLOC:
+    *LocalNum = readValue<uint16_t>(Operand);
+    return MSILLocalAccess::Load;
+  case ReaderBaseNS::CEE_STLOC_0:
+  case ReaderBaseNS::CEE_STLOC_1:
+  case ReaderBaseNS::CEE_STLOC_2:
+  case ReaderBaseNS::CEE_STLOC_3:
+    *LocalNum = OpcodeRemap[Opcode];
+    return MSILLocalAccess::Store;
+  case ReaderBaseNS::CEE_STLOC_S:
+    *LocalNum = readValue<uint8_t>(Operand);
+    return MSILLocalAccess::Store;
+  case ReaderBaseNS::CEE_STLOC:
+    *LocalNum = readValue<uint16_t>(Operand);
+    return MSILLocalAccess::Store;
+  case ReaderBaseNS::CEE_LDLOCA_S:
+    *LocalNum = readValue<uint8_t>(Operand);
+    return MSILLocalAccess::AddressTaken;
+  case ReaderBaseNS::CEE_LDLOCA:
+    *LocalNum = readValue<uint16_t>(Operand);
+    return MSILLocalAccess::AddressTaken;
+  default:
+    return MSILLocalAccess::None;
+  }
+}
 
 class ReaderBitVector {
 private:
@@ -778,7 +792,7 @@ ReaderBase::getFieldInClass(CORINFO_CLASS_HANDLE Class, uint32_t Ordinal) {
 void ReaderBase::getFieldInfo(CORINFO_RESOLVED_TOKEN *ResolvedToken,
                               CORINFO_ACCESS_FLAGS AccessFlags,
                               CORINFO_FIELD_INFO *FieldInfo) {
-  if (Flags & CORJIT_FLG_READYTORUN) {
+  if ((Flags & CORJIT_FLG_READYTORUN) && useAtypicalCallSites()) {
     // CORINFO_ACCESS_ATYPICAL_CALLSITE means that we can't guarantee
     // that we'll be able to generate call [rel32] form of the helper call so
     // crossgen shouldn't try to disassemble the call instruction.
@@ -1071,6 +1085,11 @@ CorInfoHelpFunc ReaderBase::getUnBoxHelper(CORINFO_CLASS_HANDLE Class) {
   return JitInfo->getUnBoxHelper(Class);
 }
 
+bool ReaderBase::canCast(CORINFO_CLASS_HANDLE Child,
+                         CORINFO_CLASS_HANDLE Parent) {
+  return JitInfo->canCast(Child, Parent) != FALSE;
+}
+
 void *ReaderBase::getAddrOfCaptureThreadGlobal(bool *IsIndirect) {
   void *Address, *IndirectAddress;
 
@@ -1097,7 +1116,7 @@ void ReaderBase::getCallInfo(CORINFO_RESOLVED_TOKEN *ResolvedToken,
   if (VerificationNeeded)
     Flags = (CORINFO_CALLINFO_FLAGS)(Flags | CORINFO_CALLINFO_VERIFICATION);
 
-  if (this->Flags & CORJIT_FLG_READYTORUN) {
+  if ((this->Flags & CORJIT_FLG_READYTORUN) && useAtypicalCallSites()) {
     // CORINFO_ACCESS_ATYPICAL_CALLSITE means that we can't guarantee
     // that we'll be able to generate call [rel32] form so crossgen shouldn't
     // try to disassemble the call instruction.
@@ -1756,71 +1775,41 @@ FlowGraphNode *ReaderBase::buildFlowGraph(FlowGraphNode **FgTail) {
 
 // fgAddNodeMSILOffset
 //
-//  The FlowGraphNodeOffsetList acts as a work list. Each time a
-//  branch is added to the the IR stream a temporary target node is
-//  added to the FlowGraphNodeOffsetList.  After all the branches have
-//  been added the worklist is traversed and each temporary node is
+//  BranchTargetNodes acts as a work list. Each time a branch is added
+//  to the the IR stream a temporary target node is recorded in
+//  BranchTargetNodes at the target's offset, and the offset is marked
+//  in BranchTargetOffsets. After all the branches have been added the
+//  marked offsets are traversed in order and each temporary node is
 //  replaced with a real one.
 //
 //  During reader flow graph building the first argument must always
 //  be a valid pointer. After the function call this pointer will
 //  point to either a new temporary FlowGraphNode if there was no
 //  previous node at the given offset (the second argument) or it will
-//  point to the node stored in the NodeOffsetListArray at the given
-//  offset. For new nodes the function sets the MSIL offset of the
-//  node.  New entries into the NodeOffsetListArray are inserted
-//  into NodeOffsetListArray (in ReaderBase). These entries are
-//  inserted in order of their MSIL offset for easy retrieval. A
-//  pointer to the new entry is then returned.
+//  point to the node already recorded at the given offset. For new
+//  nodes the function sets the MSIL offset of the node. The node is
+//  then returned.
 //
-FlowGraphNodeOffsetList *ReaderBase::fgAddNodeMSILOffset(
+FlowGraphNode *ReaderBase::fgAddNodeMSILOffset(
     FlowGraphNode **Node, // A pointer to FlowGraphNode* node
     uint32_t TargetOffset // The MSIL offset of the node
     ) {
-  FlowGraphNodeOffsetList *Element, *PreviousElement, *NewElement;
-  uint32_t Index;
+  ASSERTNR(TargetOffset <= MethodInfo->ILCodeSize);
 
   // Check to see if we already have this offset
-  PreviousElement = nullptr;
-
-  Index = TargetOffset / FLOW_GRAPH_NODE_LIST_ARRAY_STRIDE;
-  Element = NodeOffsetListArray[Index];
-
-  while (Element) {
-    if (Element->getOffset() == TargetOffset) {
-      if (Node) {
-        *Node = Element->getNode();
-      }
-      return Element;
-    } else if (Element->getOffset() > TargetOffset) {
-      // we must insert offsets in order, so since we've
-      //  passed the offset we're looking for we're done
-      break;
-    }
-    PreviousElement = Element;
-    Element = Element->getNext();
+  if (BranchTargetOffsets->getBit(TargetOffset)) {
+    *Node = BranchTargetNodes[TargetOffset];
+    return *Node;
   }
 
   // We need to create a new label
-  NewElement =
-      (FlowGraphNodeOffsetList *)getTempMemory(sizeof(FlowGraphNodeOffsetList));
-  NewElement->setOffset(TargetOffset);
-
   if (*Node == nullptr) {
     *Node = makeFlowGraphNode(TargetOffset, nullptr);
   }
-  NewElement->setNode(*Node);
+  BranchTargetNodes[TargetOffset] = *Node;
+  BranchTargetOffsets->setBit(TargetOffset);
 
-  // Insert the new Element at the right spot
-  if (PreviousElement) {
-    NewElement->setNext(Element);
-    PreviousElement->setNext(NewElement);
-  } else {
-    NewElement->setNext(NodeOffsetListArray[Index]);
-    NodeOffsetListArray[Index] = NewElement;
-  }
-
-  return NewElement;
+  return *Node;
 }
 
 void ReaderBase::fgDeleteBlockAndNodes(FlowGraphNode *Block) {
@@ -1963,30 +1952,16 @@ ReaderBase::fgReplaceBranchTarget(uint32_t Offset,
   return Block;
 }
 
-int __cdecl labelSortFunction(const void *C1, const void *C2) {
-  uint32_t O1, O2;
-
-  O1 = ((const FlowGraphNodeOffsetList *)C1)->getOffset();
-  O2 = ((const FlowGraphNodeOffsetList *)C2)->getOffset();
-
-  if (O1 < O2)
-    return -1;
-  return (O1 > O2);
-}
-
-// Insert labels from label offset list into block stream, splitting
-// blocks if necessary.  The list is currently ordered.
+// Insert labels from the branch target bitmap into block stream, splitting
+// blocks if necessary.  The bitmap is walked in offset order, so each
+// search for a target's block can start from the previous target's block.
 void ReaderBase::fgReplaceBranchTargets() {
-  FlowGraphNodeOffsetList *List;
-  FlowGraphNode *Block;
-  uint32_t Index;
-
-  Block = nullptr;
+  FlowGraphNode *Block = nullptr;
+  const uint32_t ILCodeSize = MethodInfo->ILCodeSize;
 
-  for (Index = 0; Index < NodeOffsetListArraySize; Index++) {
-    for (List = NodeOffsetListArray[Index]; List != nullptr;
-         List = List->getNext()) {
-      Block = fgReplaceBranchTarget(List->getOffset(), List->getNode(), Block);
+  for (uint32_t Offset = 0; Offset <= ILCodeSize; Offset++) {
+    if (BranchTargetOffsets->getBit(Offset)) {
+      Block = fgReplaceBranchTarget(Offset, BranchTargetNodes[Offset], Block);
     }
   }
 }
@@ -2292,7 +2267,7 @@ void ReaderBase::fgBuildPhase1(FlowGraphNode *Block, uint8_t *ILInput,
   uint32_t NextRegionTransitionOffset;
   bool IsShortInstr, IsConditional, IsTailCall, IsReadOnly, PreviousWasPrefix;
   mdToken TokenConstrained;
-  uint32_t StackOffset = 0;
+  uint32_t InstrIndex = 0;
   ReaderBaseNS::OPCODE Opcode = ReaderBaseNS::CEE_ILLEGAL;
 
   // If we're doing verification build up a bit vector of legal branch targets
@@ -2309,10 +2284,6 @@ void ReaderBase::fgBuildPhase1(FlowGraphNode *Block, uint8_t *ILInput,
     // Add 1 so that there is enough room for the offset after the
     // last instruction (asycronous flow can target this)
     LegalTargetOffsets->allocateBitVector(ILInputSize + 1, this);
-
-    GvStackPush = (uint16_t *)getTempMemory(ILInputSize * sizeof(uint16_t));
-    GvStackPop = (uint16_t *)getTempMemory(ILInputSize * sizeof(uint16_t));
-    StackOffset = 0;
   }
 
   // init stuff prior to loop
@@ -2344,9 +2315,12 @@ void ReaderBase::fgBuildPhase1(FlowGraphNode *Block, uint8_t *ILInput,
       // previous block's region when it was split off from it).
       fgNodeChangeRegion(Block, CurrentRegion);
     }
-    uint8_t *Operand;
-    NextOffset = parseILOpcode(ILInput, CurrentOffset, ILInputSize, this,
-                               &Opcode, &Operand);
+    // The MSIL was decoded in one linear pass, which this loop mirrors.
+    DecodedMSILInstr &Instr = MSILInstrs[InstrIndex++];
+    ASSERTNR(Instr.Offset == CurrentOffset);
+    uint8_t *Operand = &ILInput[Instr.OperandOffset];
+    Opcode = Instr.Opcode;
+    NextOffset = MSILInstrs[InstrIndex].Offset;
 
     // If we're doing verification, build up a bit vector of legal
     // branch targets.  note : the instruction following a prefix is
@@ -2613,14 +2587,8 @@ void ReaderBase::fgBuildPhase1(FlowGraphNode *Block, uint8_t *ILInput,
       // compute and store the stack contributions
       // this is required for global verification
 
-      getMSILInstrStackDelta(Opcode, Operand, &GvStackPop[StackOffset],
-                             &GvStackPush[StackOffset]);
-      StackOffset++;
-      while (StackOffset < CurrentOffset) {
-        GvStackPop[StackOffset] = 0;
-        GvStackPush[StackOffset] = 0;
-        StackOffset++;
-      }
+      getMSILInstrStackDelta(Opcode, Operand, &Instr.StackPop,
+                             &Instr.StackPush);
     }
   }
 
@@ -2722,7 +2690,8 @@ void ReaderBase::fgAttachGlobalVerifyData(FlowGraphNode *HeadBlock) {
     int Min = 0;
     int Max = 0;
     int Current;
-    int Start, End, I, NumTOSTemps;
+    uint32_t Start, End, I;
+    int NumTOSTemps;
     GlobalVerifyData *GvData;
 
     // compute high/low watermarks for reader stack
@@ -2735,11 +2704,18 @@ void ReaderBase::fgAttachGlobalVerifyData(FlowGraphNode *HeadBlock) {
     Max = Current;
     Start = fgNodeGetStartMSILOffset(Block);
     End = fgNodeGetEndMSILOffset(Block);
-    for (I = Start; I < End; I++) {
-      Current -= GvStackPop[I];
+
+    // Find the first instruction at or after the start of the block.
+    I = Start;
+    while (MSILInstrIndex[I] == NoMSILInstrIndex) {
+      I++;
+    }
+    for (const DecodedMSILInstr *Instr = &MSILInstrs[MSILInstrIndex[I]];
+         Instr->Offset < End; Instr++) {
+      Current -= Instr->StackPop;
       if (Current < Min)
         Min = Current;
-      Current += GvStackPush[I];
+      Current += Instr->StackPush;
       if (Current > Max)
         Max = Current;
     }
@@ -2793,7 +2769,7 @@ void ReaderBase::verifyRecordBranchForVerification(IRNode *Branch,
 /// It operates in four phases
 /// - PHASE 1: Read byte codes and create some basic blocks
 ///            based on branches and switches. Create the branch
-///            IR for those byte codes. Populate the NodeOffsetList
+///            IR for those byte codes. Populate BranchTargetNodes
 ///            with the information to adjust branch targets.
 /// - PHASE 2: Complete the flow graph by correctly adjusting branch
 ///            targets and spliting basic blocks based on those
@@ -2824,7 +2800,7 @@ FlowGraphNode *ReaderBase::fgBuildBasicBlocksFromBytes(uint8_t *Buffer,
 
   // PHASE 2:
   // replace temporary branch targets that were gathered into
-  // NodeOffsetList during phase 1 with real ones
+  // BranchTargetNodes during phase 1 with real ones
   fgReplaceBranchTargets();
 
   insertIBCAnnotations();
@@ -2927,7 +2903,8 @@ IRNode *ReaderBase::genericTokenToNode(CORINFO_RESOLVED_TOKEN *ResolvedToken,
                               false);
       } else {
         ASSERTNR(Result.lookup.constLookup.accessType == IAT_PVALUE);
-        // TODO: Can we mark this as readonly for aliasing?
+        // The cell is read-only, so the load from it is marked invariant and
+        // can be shared and hoisted along with the dictionary lookups.
         return handleToIRNode(Token, Result.lookup.constLookup.addr,
                               Result.compileTimeHandle, true, true, true,
                               false);
@@ -2973,9 +2950,9 @@ IRNode *ReaderBase::runtimeLookupToNode(CORINFO_RUNTIME_LOOKUP_KIND Kind,
         // use inst-param
         Arg1 = instParam();
       } else {
-        // use this ptr
+        // use this ptr; an object's method table never changes.
         ASSERTNR(Kind == CORINFO_LOOKUP_THISOBJ);
-        Arg1 = derefAddress(thisObj(), false, false);
+        Arg1 = derefAddress(thisObj(), false, true);
       }
     }
 
@@ -2993,9 +2970,10 @@ IRNode *ReaderBase::runtimeLookupToNode(CORINFO_RUNTIME_LOOKUP_KIND Kind,
       // Use the vtable pointer that was passed in
       VTableNode = instParam();
     } else {
-      // Use the vtable of "this" to get at instantiation info
+      // Use the vtable of "this" to get at instantiation info. An object's
+      // method table never changes.
       ASSERTNR(Kind == CORINFO_LOOKUP_THISOBJ);
-      VTableNode = derefAddress(thisObj(), false, false);
+      VTableNode = derefAddress(thisObj(), false, true);
     }
   }
 
@@ -3099,6 +3077,10 @@ IRNode *ReaderBase::box(CORINFO_RESOLVED_TOKEN *ResolvedToken, IRNode *Arg2,
     return Arg2;
   }
 
+  if (tryBoxPeephole(ResolvedToken, Arg2, NextOffset, RetVal)) {
+    return RetVal;
+  }
+
   // Ensure that operand from operand stack has size that is
   // compatible with box destination, then get the (possibly
   // converted) operand's address.
@@ -3120,6 +3102,129 @@ IRNode *ReaderBase::box(CORINFO_RESOLVED_TOKEN *ResolvedToken, IRNode *Arg2,
   return RetVal;
 }
 
+// TryBoxPeephole - Read the instruction after a box without the box, if
+// the value that instruction computes is known without it.
+bool ReaderBase::tryBoxPeephole(CORINFO_RESOLVED_TOKEN *ResolvedToken,
+                                IRNode *Arg, uint32_t *NextOffset,
+                                IRNode *&Result) {
+  if ((NextOffset == nullptr) || VerificationNeeded || !doBoxPeepholes()) {
+    return false;
+  }
+
+  // Boxing a Nullable<T> makes a null reference or a box of T.
+  CORINFO_CLASS_HANDLE Class = ResolvedToken->hClass;
+  if (getBoxHelper(Class) != CORINFO_HELP_BOX) {
+    return false;
+  }
+
+  // The instructions folded into the box must be in its block, which no
+  // branch enters in the middle.
+  const uint32_t EndOffset = fgNodeGetEndMSILOffset(CurrentFgNode);
+  uint32_t Offset = *NextOffset;
+  if (Offset >= EndOffset) {
+    return false;
+  }
+  ReaderBaseNS::OPCODE Opcode;
+  uint8_t *Operand;
+  uint32_t AfterOffset = getDecodedMSILInstr(Offset, &Opcode, &Operand, false);
+
+  switch (Opcode) {
+  case ReaderBaseNS::CEE_BRFALSE:
+  case ReaderBaseNS::CEE_BRFALSE_S:
+  case ReaderBaseNS::CEE_BRTRUE:
+  case ReaderBaseNS::CEE_BRTRUE_S:
+    // The box is never null; leave the branch to test a non-null value.
+    Result = loadConstantI(1);
+    return true;
+
+  case ReaderBaseNS::CEE_UNBOX_ANY: {
+    CORINFO_RESOLVED_TOKEN UnboxToken;
+    resolveToken(readValue<mdToken>(Operand), CORINFO_TOKENKIND_Class,
+                 &UnboxToken);
+    if (UnboxToken.hClass != Class) {
+      return false;
+    }
+    handleClassAccess(&UnboxToken);
+    CorInfoType CorType = getClassType(Class);
+    if (isPrimitiveType(CorType)) {
+      // The box holds the value narrowed to the class's type, which
+      // unbox.any widens back to the stack type. Go through memory the same
+      // way, so that e.g. an int8 comes back truncated and sign extended.
+      Arg = convertToBoxHelperArgumentType(Arg, getClassSize(Class));
+      const bool IsVolatile = false;
+      const bool IsInterfConst = false;
+      Result = loadPrimitiveTypeNonNull(addressOfValue(Arg), CorType,
+                                        Reader_AlignNatural, IsVolatile,
+                                        IsInterfConst);
+    } else {
+      Result = Arg;
+    }
+    *NextOffset = AfterOffset;
+    return true;
+  }
+
+  case ReaderBaseNS::CEE_ISINST: {
+    // Only a cast known to succeed is folded, since isinst of a boxed
+    // value class also succeeds for some classes it does not cast to, such
+    // as Nullable<T> of the value class.
+    if (AfterOffset >= EndOffset) {
+      return false;
+    }
+    ReaderBaseNS::OPCODE BranchOpcode;
+    uint8_t *BranchOperand;
+    getDecodedMSILInstr(AfterOffset, &BranchOpcode, &BranchOperand, false);
+    if ((BranchOpcode != ReaderBaseNS::CEE_BRFALSE) &&
+        (BranchOpcode != ReaderBaseNS::CEE_BRFALSE_S) &&
+        (BranchOpcode != ReaderBaseNS::CEE_BRTRUE) &&
+        (BranchOpcode != ReaderBaseNS::CEE_BRTRUE_S)) {
+      return false;
+    }
+    CORINFO_RESOLVED_TOKEN CastToken;
+    resolveToken(readValue<mdToken>(Operand), CORINFO_TOKENKIND_Casting,
+                 &CastToken);
+    if (!canCast(Class, CastToken.hClass)) {
+      return false;
+    }
+    handleClassAccess(&CastToken);
+    Result = loadConstantI(1);
+    *NextOffset = AfterOffset;
+    return true;
+  }
+
+  case ReaderBaseNS::CEE_CALLVIRT: {
+    // Only a call whose 'this' is the box can use the value instead, so
+    // the method may have no other parameters. Methods of the value class
+    // itself can't be called on a box.
+    mdToken Token = readValue<mdToken>(Operand);
+    CORINFO_RESOLVED_TOKEN MethodToken;
+    resolveToken(Token, CORINFO_TOKENKIND_Method, &MethodToken);
+    CORINFO_SIG_INFO Sig;
+    getMethodSig(MethodToken.hMethod, &Sig);
+    if ((Sig.numArgs != 0) ||
+        ((getClassAttribs(MethodToken.hClass) & CORINFO_FLG_VALUECLASS) !=
+         0)) {
+      return false;
+    }
+
+    // The callee may change the value, as it could have changed the box,
+    // so it gets the address of a copy.
+    Arg = convertToBoxHelperArgumentType(Arg, getClassSize(Class));
+    ReaderOperandStack->push(addressOfValue(Arg));
+    CurrInstrOffset = Offset;
+    NextInstrOffset = AfterOffset;
+    const bool IsCall = true;
+    setDebugLocation(Offset, IsCall);
+    Result = call(ReaderBaseNS::CallVirt, Token, ResolvedToken->token,
+                  mdTokenNil, false, false, false, Offset);
+    *NextOffset = AfterOffset;
+    return true;
+  }
+
+  default:
+    return false;
+  }
+}
+
 // CastClass - Generate a simple helper call for the cast class.
 IRNode *ReaderBase::castClass(CORINFO_RESOLVED_TOKEN *ResolvedToken,
                               IRNode *ObjRefNode) {
@@ -3335,10 +3440,10 @@ void ReaderBase::insertClassConstructor() {
     case CORINFO_LOOKUP_THISOBJ: {
       // call CORINFO_HELP_INITINSTCLASS(thisobj, embedMethodHandle(M))
       Method = embedMethodHandle(Method, &IsIndirect);
-      // TODO: Aliasing -- always readonly?
       MethodNode = handleToIRNode(MethodToken, Method, 0, IsIndirect,
                                   IsIndirect, true, false);
-      ClassNode = derefAddress(thisObj(), false, false);
+      // An object's method table never changes.
+      ClassNode = derefAddress(thisObj(), false, true);
       const bool MayThrow = true;
       callHelper(CORINFO_HELP_INITINSTCLASS, MayThrow, nullptr, ClassNode,
                  MethodNode);
@@ -3666,7 +3771,6 @@ IRNode *ReaderBase::rdrCallGetStaticBase(CORINFO_CLASS_HANDLE Class,
   // ModuleDomainID. Because the module returned may not be the proper
   // unique value, use the class handle here to provide uniqueness
   ASSERTNR(((size_t)Class & 2) == 0);
-  // TODO: Aliasing -- always readonly?
   IRNode *ModuleDomainIDNode =
       handleToIRNode(mdtModuleID, EmbedModuleDomainID,
                      (CORINFO_MODULE_HANDLE)((size_t)Class | 2), IsIndirect,
@@ -3810,7 +3914,7 @@ ReaderBase::rdrGetStaticFieldAddress(CORINFO_RESOLVED_TOKEN *ResolvedToken,
           assert(AccessType != IAT_PPVALUE);
           bool IsIndirect = (AccessType != IAT_VALUE);
           const bool IsRelocatable = true;
-          const bool IsCallTarget = false;
+          const bool IsCallTarget = true;
           void *RealHandle = nullptr;
           IRNode *HelperAddress = handleToIRNode(
               ResolvedToken->token, Address, RealHandle, IsIndirect, IsIndirect,
@@ -4165,6 +4269,184 @@ inline bool eeIsNativeMethod(CORINFO_METHOD_HANDLE Method) {
   return ((((size_t)Method) & 0x2) == 0x2);
 }
 
+namespace {
+
+/// \brief An entry in the table of well-known BCL methods.
+struct NamedIntrinsicInfo {
+  const char *AssemblyName;       ///< Assembly that defines the class.
+  const char *ClassName;          ///< Namespace-qualified class name.
+  const char *MethodName;         ///< Method name.
+  ReaderNamedIntrinsic Intrinsic; ///< Which method this is.
+};
+
+/// The well-known BCL methods the reader expands. Overloads share an
+/// entry; the expansions check the types of the arguments.
+const NamedIntrinsicInfo NamedIntrinsics[] = {
+    {"System.Private.CoreLib", "System.Math", "Max", NI_Math_Max},
+    {"System.Private.CoreLib", "System.Math", "Min", NI_Math_Min},
+    {"System.Private.CoreLib", "System.Array", "get_Length",
+     NI_Array_GetLength},
+    {"System.Private.CoreLib", "System.Runtime.CompilerServices.RuntimeHelpers",
+     "IsReferenceOrContainsReferences",
+     NI_RuntimeHelpers_IsReferenceOrContainsReferences},
+    {"System.Runtime.CompilerServices.Unsafe",
+     "System.Runtime.CompilerServices.Unsafe", "Add", NI_Unsafe_Add},
+    {"System.Runtime.CompilerServices.Unsafe",
+     "System.Runtime.CompilerServices.Unsafe", "AreSame", NI_Unsafe_AreSame},
+    {"System.Runtime.CompilerServices.Unsafe",
+     "System.Runtime.CompilerServices.Unsafe", "AsPointer",
+     NI_Unsafe_AsPointer},
+    {"System.Runtime.CompilerServices.Unsafe",
+     "System.Runtime.CompilerServices.Unsafe", "SizeOf", NI_Unsafe_SizeOf}};
+
+/// Check whether a stack type is an unsigned integer type.
+bool isUnsignedIntegerType(CorInfoType CorType) {
+  switch (CorType) {
+  case CORINFO_TYPE_UINT:
+  case CORINFO_TYPE_ULONG:
+  case CORINFO_TYPE_NATIVEUINT:
+    return true;
+  default:
+    return false;
+  }
+}
+
+} // end anonymous namespace
+
+ReaderNamedIntrinsic
+ReaderBase::getNamedIntrinsic(CORINFO_METHOD_HANDLE Method) {
+  const char *ClassName = nullptr;
+  const char *MethodName = getMethodName(Method, &ClassName, JitInfo);
+  if ((MethodName == nullptr) || (ClassName == nullptr)) {
+    return NI_Undefined;
+  }
+
+  const char *AssemblyName = nullptr;
+  for (const NamedIntrinsicInfo &Info : NamedIntrinsics) {
+    if ((strcmp(MethodName, Info.MethodName) != 0) ||
+        (strcmp(ClassName, Info.ClassName) != 0)) {
+      continue;
+    }
+
+    // Only trust the name if the class comes from the assembly that is
+    // known to define it.
+    if (AssemblyName == nullptr) {
+      CORINFO_MODULE_HANDLE Module = JitInfo->getMethodModule(Method);
+      AssemblyName =
+          JitInfo->getAssemblyName(JitInfo->getModuleAssembly(Module));
+    }
+    if ((strcmp(AssemblyName, Info.AssemblyName) == 0) ||
+        ((strcmp(AssemblyName, "mscorlib") == 0) &&
+         (strcmp(Info.AssemblyName, "System.Private.CoreLib") == 0))) {
+      return Info.Intrinsic;
+    }
+  }
+
+  return NI_Undefined;
+}
+
+IRNode *ReaderBase::expandNamedIntrinsic(ReaderNamedIntrinsic Intrinsic,
+                                         CORINFO_SIG_INFO *SigInfo,
+                                         bool *Expanded) {
+  IRNode *Arg1;
+  IRNode *Arg2;
+  IRNode *Result = nullptr;
+  *Expanded = false;
+
+  // Size of the type argument, for the generic methods that have one.
+  uint32_t TypeArgSize = 0;
+  if (SigInfo->sigInst.methInstCount == 1) {
+    CORINFO_CLASS_HANDLE Class = SigInfo->sigInst.methInst[0];
+    TypeArgSize = ((getClassAttribs(Class) & CORINFO_FLG_VALUECLASS) != 0)
+                      ? getClassSize(Class)
+                      : getPointerByteSize();
+  }
+
+  switch (Intrinsic) {
+  case NI_Math_Max:
+  case NI_Math_Min:
+    if (SigInfo->numArgs != 2) {
+      break;
+    }
+    Arg2 = ReaderOperandStack->pop();
+    Arg1 = ReaderOperandStack->pop();
+    if (minMax(Intrinsic == NI_Math_Max,
+               isUnsignedIntegerType(SigInfo->retType), Arg1, Arg2, &Result)) {
+      *Expanded = true;
+      return Result;
+    }
+    ReaderOperandStack->push(Arg1);
+    ReaderOperandStack->push(Arg2);
+    break;
+
+  case NI_Array_GetLength:
+    // The element count is at the same place in all arrays, including
+    // multi-dimensional ones.
+    Arg1 = ReaderOperandStack->pop();
+    Result = conv(ReaderBaseNS::ConvI4, loadLen(Arg1));
+    *Expanded = true;
+    return Result;
+
+  case NI_RuntimeHelpers_IsReferenceOrContainsReferences: {
+    if (SigInfo->sigInst.methInstCount != 1) {
+      break;
+    }
+    // In shared code the type argument is System.__Canon, which is a
+    // reference type, as all the types sharing the code are.
+    CORINFO_CLASS_HANDLE Class = SigInfo->sigInst.methInst[0];
+    uint32_t ClassAttribs = getClassAttribs(Class);
+    bool Answer = ((ClassAttribs & CORINFO_FLG_VALUECLASS) == 0) ||
+                  ((ClassAttribs & CORINFO_FLG_CONTAINS_GC_PTR) != 0);
+    *Expanded = true;
+    return loadConstantI4(Answer ? 1 : 0);
+  }
+
+  case NI_Unsafe_Add: {
+    if ((SigInfo->numArgs != 2) || (SigInfo->sigInst.methInstCount != 1)) {
+      break;
+    }
+    // Add(ref T source, int elementOffset) is
+    // source + (native int)elementOffset * sizeof(T).
+    Arg2 = ReaderOperandStack->pop();
+    Arg1 = ReaderOperandStack->pop();
+    IRNode *Offset =
+        binaryOp(ReaderBaseNS::Mul, conv(ReaderBaseNS::ConvI, Arg2),
+                 loadConstantI(TypeArgSize));
+    *Expanded = true;
+    return binaryOp(ReaderBaseNS::Add, Arg1, Offset);
+  }
+
+  case NI_Unsafe_AreSame:
+    if (SigInfo->numArgs != 2) {
+      break;
+    }
+    Arg2 = ReaderOperandStack->pop();
+    Arg1 = ReaderOperandStack->pop();
+    *Expanded = true;
+    return cmp(ReaderBaseNS::Ceq, Arg1, Arg2);
+
+  case NI_Unsafe_AsPointer:
+    if (SigInfo->numArgs != 1) {
+      break;
+    }
+    Arg1 = ReaderOperandStack->pop();
+    *Expanded = true;
+    return conv(ReaderBaseNS::ConvU, Arg1);
+
+  case NI_Unsafe_SizeOf:
+    if (SigInfo->sigInst.methInstCount != 1) {
+      break;
+    }
+    *Expanded = true;
+    return loadConstantI4(TypeArgSize);
+
+  default:
+    break;
+  }
+
+  return nullptr;
+}
+
 const char *ReaderBase::getMethodName(CORINFO_METHOD_HANDLE Method,
                                       const char **ClassNamePtr,
                                       ICorJitInfo *JitInfo) {
@@ -4392,6 +4674,12 @@ ReaderBase::rdrCall(ReaderCallTargetData *Data, ReaderBaseNS::CallOpcode Opcode,
           break;
 
         case CORINFO_INTRINSIC_Round:
+          IntrinsicArg1 = (IRNode *)ReaderOperandStack->pop();
+
+          if (round(IntrinsicArg1, &IntrinsicRet))
+            return IntrinsicRet;
+
+          ReaderOperandStack->push(IntrinsicArg1);
           break;
 
         case CORINFO_INTRINSIC_StringLength:
@@ -4475,6 +4763,26 @@ ReaderBase::rdrCall(ReaderCallTargetData *Data, ReaderBaseNS::CallOpcode Opcode,
       }
     }
 
+    // A well-known BCL method implemented in IL. Ask if client would like to
+    // expand it. Only calls whose target is known qualify.
+    const uint32_t MethodAttribs = Data->getMethodAttribs();
+    if ((Opcode != ReaderBaseNS::NewObj) && doNamedIntrinsicExpansion() &&
+        (((MethodAttribs & CORINFO_FLG_VIRTUAL) == 0) ||
+         ((MethodAttribs & CORINFO_FLG_FINAL) != 0)) &&
+        (!Data->hasThis() ||
+         (CallInfo->thisTransform == CORINFO_NO_THIS_TRANSFORM))) {
+      ReaderNamedIntrinsic Intrinsic =
+          getNamedIntrinsic(Data->getMethodHandle());
+      if (Intrinsic != NI_Undefined) {
+        bool Expanded = false;
+        IRNode *IntrinsicRet =
+            expandNamedIntrinsic(Intrinsic, Data->getSigInfo(), &Expanded);
+        if (Expanded) {
+          return IntrinsicRet;
+        }
+      }
+    }
+
     CORINFO_CLASS_HANDLE Class = Data->getClassHandle();
     CORINFO_SIG_INFO *SigInfo = Data->getSigInfo();
     if (doSimdIntrinsicOpt() && JitInfo->isInSIMDModule(Class)) {
@@ -4840,10 +5148,18 @@ void ReaderBase::rdrMakeCallTargetNode(ReaderCallTargetData *CallTargetData,
     // target
     // method's instance argument (e.g. if callvirt was used but the method is
     // virtual and lookup is performed via the target's VTable).
+    bool IsDevirtualized = false;
+    if (((CallInfo->kind == CORINFO_VIRTUALCALL_STUB) ||
+         (CallInfo->kind == CORINFO_VIRTUALCALL_VTABLE)) &&
+        (ThisPtr != nullptr) && doDevirtualization()) {
+      IsDevirtualized = rdrDevirtualizeCall(CallTargetData, *ThisPtr);
+    }
+
     switch (CallInfo->kind) {
     case CORINFO_CALL:
       // Direct Call
-      CallTargetData->NeedsNullCheck = CallInfo->nullInstanceCheck == TRUE;
+      CallTargetData->NeedsNullCheck =
+          IsDevirtualized || (CallInfo->nullInstanceCheck == TRUE);
       Target = rdrGetDirectCallTarget(CallTargetData);
       break;
     case CORINFO_CALL_CODE_POINTER:
@@ -4873,6 +5189,54 @@ void ReaderBase::rdrMakeCallTargetNode(ReaderCallTargetData *CallTargetData,
   CallTargetData->CallTargetNode = Target;
 }
 
+bool ReaderBase::rdrDevirtualizeCall(ReaderCallTargetData *CallTargetData,
+                                     IRNode *ThisPointer) {
+  ASSERTNR(CallTargetData->isCallVirt());
+
+  // Constrained calls already have the target the constraint gives them.
+  if (CallTargetData->getResolvedConstraintToken()->token != mdTokenNil) {
+    return false;
+  }
+
+  uint32_t MethodAttribs = CallTargetData->getMethodAttribs();
+  if ((MethodAttribs & (CORINFO_FLG_ABSTRACT | CORINFO_FLG_STATIC)) != 0) {
+    return false;
+  }
+
+  // Find out whether the method the token resolved to is the one that will
+  // be called. Interface methods never are; for those, finding the
+  // implementation would take the EE.
+  CORINFO_METHOD_HANDLE Method = CallTargetData->getMethodHandle();
+  if ((MethodAttribs & CORINFO_FLG_FINAL) == 0) {
+    CORINFO_CLASS_HANDLE MethodClass = getMethodClass(Method);
+    uint32_t ClassAttribs = getClassAttribs(MethodClass);
+    if ((ClassAttribs & CORINFO_FLG_INTERFACE) != 0) {
+      return false;
+    }
+    if (((ClassAttribs & CORINFO_FLG_FINAL) == 0) &&
+        (getExactClass(ThisPointer) != MethodClass)) {
+      return false;
+    }
+  }
+
+  // Ask the EE how to call the method non-virtually. Only take the answer if
+  // it is a plain direct call that takes the same arguments, since those have
+  // already been set up for the virtual call.
+  CORINFO_CALL_INFO DirectCallInfo;
+  getCallInfo(CallTargetData->getResolvedToken(), nullptr,
+              CORINFO_CALLINFO_ALLOWINSTPARAM, &DirectCallInfo);
+  if ((DirectCallInfo.kind != CORINFO_CALL) ||
+      (DirectCallInfo.hMethod != Method) ||
+      (DirectCallInfo.thisTransform != CORINFO_NO_THIS_TRANSFORM) ||
+      (DirectCallInfo.sig.hasTypeArg() !=
+       CallTargetData->getSigInfo()->hasTypeArg())) {
+    return false;
+  }
+
+  CallTargetData->CallInfo = DirectCallInfo;
+  return true;
+}
+
 IRNode *
 ReaderBase::rdrMakeLdFtnTargetNode(CORINFO_RESOLVED_TOKEN *ResolvedToken,
                                    CORINFO_CALL_INFO *CallInfo) {
@@ -5779,8 +6143,7 @@ bool ReaderBase::isUnmarkedTailCallHelper(uint8_t *ILInput,
   ReaderBaseNS::OPCODE Opcode;
 
   do {
-    Offset = parseILOpcode(ILInput, Offset, ILInputSize, this, &Opcode,
-                           &UnusedOperand, false);
+    Offset = getDecodedMSILInstr(Offset, &Opcode, &UnusedOperand, false);
   } while (Offset < ILInputSize &&
            ((Opcode == ReaderBaseNS::CEE_NOP) ||
             ((Opcode == ReaderBaseNS::CEE_POP) && (++NumPops == 1))));
@@ -5859,14 +6222,12 @@ bool ReaderBase::isUnmarkedTailCallHelper(uint8_t *ILInput,
 bool ReaderBase::checkExplicitTailCall(uint32_t ILOffset, bool AllowPop) {
   // Get the next instruction (if any)
   const uint32_t ILInputSize = MethodInfo->ILCodeSize;
-  uint8_t *ILInput = MethodInfo->ILCode;
   uint8_t *UnusedOperand;
   uint32_t Offset = ILOffset + SizeOfCEECall;
   ReaderBaseNS::OPCODE Opcode;
 
   do {
-    Offset = parseILOpcode(ILInput, Offset, ILInputSize, this, &Opcode,
-                           &UnusedOperand, false);
+    Offset = getDecodedMSILInstr(Offset, &Opcode, &UnusedOperand, false);
     if (AllowPop && (Opcode == ReaderBaseNS::CEE_POP)) {
       AllowPop = false;
       Opcode = ReaderBaseNS::CEE_NOP;
@@ -5891,7 +6252,6 @@ void ReaderBase::readBytesForFlowGraphNodeHelper(
   IRNode *Arg3;
   IRNode *ResultIR;
   uint8_t *ILInput = nullptr;
-  uint32_t ILSize;
   uint32_t CurrentOffset = Param->CurrentOffset;
   uint32_t NextOffset;
   uint32_t TargetOffset;
@@ -5912,7 +6272,6 @@ void ReaderBase::readBytesForFlowGraphNodeHelper(
   TheVerificationState = verifyInitializeBlock(Fg, CurrentOffset);
 
   ILInput = MethodInfo->ILCode;
-  ILSize = MethodInfo->ILCodeSize;
   NextOffset = CurrentOffset;
   LastLoadToken = mdTokenNil;
 
@@ -5924,8 +6283,7 @@ void ReaderBase::readBytesForFlowGraphNodeHelper(
 #endif
 
     ReaderBaseNS::OPCODE PrevOp = Opcode;
-    NextOffset =
-        parseILOpcode(ILInput, CurrentOffset, ILSize, this, &Opcode, &Operand);
+    NextOffset = getDecodedMSILInstr(CurrentOffset, &Opcode, &Operand);
     CurrInstrOffset = CurrentOffset;
     NextInstrOffset = NextOffset;
 
@@ -6007,7 +6365,9 @@ void ReaderBase::readBytesForFlowGraphNodeHelper(
       handleClassAccess(&ResolvedToken);
       ResultIR = box(&ResolvedToken, Arg1, &NextOffset, TheVerificationState);
       NextInstrOffset = NextOffset;
-      ReaderOperandStack->push(ResultIR);
+      if (ResultIR != nullptr) {
+        ReaderOperandStack->push(ResultIR);
+      }
       break;
 
     case ReaderBaseNS::CEE_BEQ:
@@ -7240,7 +7600,8 @@ void ReaderBase::readBytesForFlowGraphNode(FlowGraphNode *Fg,
       // already.
       if (ReaderOperandStack != Temp) {
         if (ReaderOperandStack != nullptr) {
-          delete ReaderOperandStack;
+          // The stack's memory belongs to the temp arena.
+          ReaderOperandStack->~ReaderStack();
         }
       }
       ReaderOperandStack = Temp->copy();
@@ -7399,12 +7760,17 @@ void ReaderBase::msilToIR(void) {
 #endif
   }
 
-  // Initialize the NodeOffsetListArray so it can be used even in the
-  // reader pre-pass
-  NodeOffsetListArraySize =
-      (MethodInfo->ILCodeSize / FLOW_GRAPH_NODE_LIST_ARRAY_STRIDE) + 1;
-  NodeOffsetListArray = (FlowGraphNodeOffsetList **)getTempMemory(
-      sizeof(FlowGraphNodeOffsetList *) * NodeOffsetListArraySize);
+  // Decode the MSIL once for all the passes that walk it.
+  decodeMSIL(MethodInfo->ILCode, MethodInfo->ILCodeSize);
+
+  // Initialize the branch target map so it can be used even in the
+  // reader pre-pass. Add 1 so that there is room for the offset after
+  // the last instruction.
+  BranchTargetNodes = (FlowGraphNode **)getTempMemory(
+      sizeof(FlowGraphNode *) * (MethodInfo->ILCodeSize + 1));
+  BranchTargetOffsets =
+      (ReaderBitVector *)getTempMemory(sizeof(ReaderBitVector));
+  BranchTargetOffsets->allocateBitVector(MethodInfo->ILCodeSize + 1, this);
 
   // Compiler dependent pre-pass
   readerPrePass(MethodInfo->ILCode, MethodInfo->ILCodeSize);
@@ -7497,7 +7863,6 @@ void ReaderBase::msilToIR(void) {
     // Pop top block
     FlowGraphNode *Block = Worklist->Block;
     FlowGraphNodeWorkList *Next = Worklist->Next;
-    delete Worklist;
     // Prepend unvisited successors to worklist
     Worklist = fgPrependUnvisitedSuccToWorklist(Next, Block);
   }
@@ -7622,45 +7987,24 @@ void ReaderBase::msilToIR(void) {
   //
   readerPostPass(IsImportOnly);
 
-  // Cleanup memory used
-  for (uint32_t Index = 0; Index < NodeOffsetListArraySize; Index++) {
-    FlowGraphNodeOffsetList *Element = NodeOffsetListArray[Index];
-    while (Element != nullptr) {
-      FlowGraphNodeOffsetList *NextElement = Element->getNext();
-      delete Element;
-      Element = NextElement;
-    }
-  }
-  delete NodeOffsetListArray;
-
+  // Cleanup memory used. Temp and proc memory is released by the client
+  // all at once, so only the operand stacks, which own memory of their own,
+  // need to be destroyed here.
   for (FlowGraphNode *Block = FgHead; Block != nullptr;
        Block = fgNodeGetNext(Block)) {
     ReaderStack *Stack = fgNodeGetOperandStack(Block);
     if (Stack != nullptr) {
-      delete Stack;
+      if (Stack != ReaderOperandStack) {
+        Stack->~ReaderStack();
+      }
       fgNodeSetOperandStack(Block, nullptr);
     }
   }
 
   if (ReaderOperandStack != nullptr) {
-    delete ReaderOperandStack;
+    ReaderOperandStack->~ReaderStack();
     ReaderOperandStack = nullptr;
   }
-
-  EHRegionList *RegionList = AllRegionList;
-  while (RegionList != nullptr) {
-    EHRegionList *Next = rgnListGetNext(RegionList);
-    EHRegion *Region = rgnListGetRgn(RegionList);
-    EHRegionList *Children = rgnGetChildList(Region);
-    while (Children != nullptr) {
-      EHRegionList *NextChild = rgnListGetNext(Children);
-      free(Children);
-      Children = NextChild;
-    }
-    free(RegionList);
-    free(Region);
-    RegionList = Next;
-  }
 }
 
 bool ReaderBase::fgNodeHasMultiplePredsPropagatingStack(FlowGraphNode *Node) {
@@ -7709,6 +8053,71 @@ bool ReaderBase::isOffsetInstrStart(uint32_t TargetOffset) {
          LegalTargetOffsets->getBit(TargetOffset);
 }
 
+// Decode the MSIL of the method into MSILInstrs in a single linear pass,
+// recording where each instruction starts in MSILInstrIndex. Malformed
+// instructions are reported here, once, rather than by each pass.
+void ReaderBase::decodeMSIL(uint8_t *ILInput, uint32_t ILInputSize) {
+  MSILInstrIndex =
+      (uint32_t *)getTempMemory(sizeof(uint32_t) * (ILInputSize + 1));
+  for (uint32_t Offset = 0; Offset <= ILInputSize; Offset++) {
+    MSILInstrIndex[Offset] = NoMSILInstrIndex;
+  }
+
+  // MSIL instructions average a few bytes each.
+  MSILInstrs.clear();
+  MSILInstrs.reserve(ILInputSize / 2 + 1);
+
+  uint32_t CurrentOffset = 0;
+  while (CurrentOffset < ILInputSize) {
+    ReaderBaseNS::OPCODE Opcode;
+    uint8_t *Operand;
+    uint32_t NextOffset = parseILOpcode(ILInput, CurrentOffset, ILInputSize,
+                                        this, &Opcode, &Operand);
+
+    DecodedMSILInstr Instr;
+    Instr.Offset = CurrentOffset;
+    Instr.OperandOffset =
+        (Operand != nullptr) ? (uint32_t)(Operand - ILInput) : CurrentOffset;
+    Instr.Opcode = Opcode;
+    Instr.StackPop = 0;
+    Instr.StackPush = 0;
+    MSILInstrIndex[CurrentOffset] = MSILInstrs.size();
+    MSILInstrs.push_back(Instr);
+
+    CurrentOffset = NextOffset;
+  }
+
+  // Add the sentinel, which gives the last instruction a successor.
+  DecodedMSILInstr Sentinel;
+  Sentinel.Offset = ILInputSize;
+  Sentinel.OperandOffset = ILInputSize;
+  Sentinel.Opcode = ReaderBaseNS::CEE_ILLEGAL;
+  Sentinel.StackPop = 0;
+  Sentinel.StackPush = 0;
+  MSILInstrIndex[ILInputSize] = MSILInstrs.size();
+  MSILInstrs.push_back(Sentinel);
+}
+
+uint32_t ReaderBase::getDecodedMSILInstr(uint32_t Offset,
+                                         ReaderBaseNS::OPCODE *Opcode,
+                                         uint8_t **Operand,
+                                         bool ReportErrors) {
+  const uint32_t ILCodeSize = MethodInfo->ILCodeSize;
+  ASSERTNR(Offset <= ILCodeSize);
+
+  const uint32_t Index = MSILInstrIndex[Offset];
+  if (Index == NoMSILInstrIndex) {
+    // A branch into the middle of an instruction of the decoded stream.
+    return parseILOpcode(MethodInfo->ILCode, Offset, ILCodeSize, this, Opcode,
+                         Operand, ReportErrors);
+  }
+
+  const DecodedMSILInstr &Instr = MSILInstrs[Index];
+  *Opcode = Instr.Opcode;
+  *Operand = &MethodInfo->ILCode[Instr.OperandOffset];
+  return (Offset == ILCodeSize) ? ILCodeSize : MSILInstrs[Index + 1].Offset;
+}
+
 // runtimeFilter allows the JIT to catch exceptions that may be
 // thrown by the runtime using a runtime-supplied filter.
 int ReaderBase::runtimeFilter(struct _EXCEPTION_POINTERS *ExceptionPointers,
@@ -8190,6 +8599,9 @@ void ReaderBase::resolveToken(mdToken Token, CORINFO_CONTEXT_HANDLE Context,
   ResolvedToken->token = Token;
   ResolvedToken->tokenType = TokenType;
 
+  // Whatever the token resolves to is now baked into the generated code.
+  methodDependsOnResolvedToken();
+
 #ifdef CC_PEVERIFY
   struct Param : JITFilterParam {
     CORINFO_RESOLVED_TOKEN *ResolvedToken;
@@ -8267,6 +8679,9 @@ IRNode *ReaderBase::generateSIMDBinOp(ReaderSIMDIntrinsic OperationCode,
     case BITEXOR:
       ReturnNode = vectorBitExOr(Vector1, Vector2, VectorByteSize);
       break;
+    case NARROW:
+      ReturnNode = vectorNarrow(Vector1, Vector2);
+      break;
     default:
       break;
     }
@@ -8349,6 +8764,26 @@ IRNode *ReaderBase::generateSIMDIntrinsicCall(CORINFO_CLASS_HANDLE Class,
     OperationType = GETCOUNTOP;
   } else if (!strcmp(MethodName, "get_Item")) {
     OperationType = GETITEM;
+  } else if (!strcmp(MethodName, "Dot")) {
+    OperationType = DOT;
+  } else if (!strcmp(MethodName, "Distance")) {
+    OperationType = DISTANCE;
+  } else if (!strcmp(MethodName, "DistanceSquared")) {
+    OperationType = DISTANCESQ;
+  } else if (!strcmp(MethodName, "Length")) {
+    OperationType = LENGTH;
+  } else if (!strcmp(MethodName, "LengthSquared")) {
+    OperationType = LENGTHSQ;
+  } else if (!strcmp(MethodName, "ConditionalSelect")) {
+    OperationType = CONDSELECT;
+  } else if (!strncmp(MethodName, "ConvertTo", 9)) {
+    OperationType = CONVERT;
+  } else if (!strcmp(MethodName, "Narrow")) {
+    OperationType = NARROW;
+  } else if (!strcmp(MethodName, "Widen")) {
+    OperationType = WIDEN;
+  } else if (!strcmp(MethodName, "CopyTo")) {
+    OperationType = COPYTO;
   }
   CorInfoType ResType = SigInfo->retType;
 
@@ -8362,6 +8797,7 @@ IRNode *ReaderBase::generateSIMDIntrinsicCall(CORINFO_CLASS_HANDLE Class,
   case BITOR:
   case BITAND:
   case BITEXOR:
+  case NARROW:
     ReturnNode = generateSIMDBinOp(OperationType, Class);
     break;
   case ABS:
@@ -8379,6 +8815,24 @@ IRNode *ReaderBase::generateSIMDIntrinsicCall(CORINFO_CLASS_HANDLE Class,
   case GETITEM:
     ReturnNode = generateSIMDGetItem(ResType);
     break;
+  case DOT:
+  case DISTANCE:
+  case DISTANCESQ:
+  case LENGTH:
+  case LENGTHSQ:
+    ReturnNode = generateSIMDReduction(OperationType, ResType);
+    break;
+  case CONDSELECT:
+    ReturnNode = generateSIMDConditionalSelect();
+    break;
+  case CONVERT:
+  case WIDEN:
+    ReturnNode = generateSIMDConvert(OperationType, SigInfo);
+    break;
+  case COPYTO:
+    assert(SigInfo->hasThis());
+    ReturnNode = generateSIMDCopyTo(SigInfo->numArgs);
+    break;
   default:
     break;
   }
@@ -8421,4 +8875,118 @@ IRNode *ReaderBase::generateSIMDGetItem(CorInfoType ResType) {
   return 0;
 }
 
+IRNode *ReaderBase::generateSIMDReduction(ReaderSIMDIntrinsic OperationCode,
+                                          CorInfoType ResType) {
+  if ((OperationCode == LENGTH) || (OperationCode == LENGTHSQ)) {
+    IRNode *VectorPointer = ReaderOperandStack->pop();
+    IRNode *ReturnNode =
+        vectorLength(VectorPointer, OperationCode == LENGTHSQ, ResType);
+    if (ReturnNode) {
+      return ReturnNode;
+    }
+    ReaderOperandStack->push(VectorPointer);
+    return 0;
+  }
+
+  IRNode *Arg2 = ReaderOperandStack->pop();
+  IRNode *Arg1 = ReaderOperandStack->pop();
+  if (isVectorType(Arg1) && isVectorType(Arg2)) {
+    IRNode *ReturnNode = 0;
+    switch (OperationCode) {
+    case DOT:
+      ReturnNode = vectorDot(Arg1, Arg2, ResType);
+      break;
+    case DISTANCE:
+    case DISTANCESQ:
+      ReturnNode =
+          vectorDistance(Arg1, Arg2, OperationCode == DISTANCESQ, ResType);
+      break;
+    default:
+      break;
+    }
+    if (ReturnNode) {
+      return ReturnNode;
+    }
+  }
+  ReaderOperandStack->push(Arg1);
+  ReaderOperandStack->push(Arg2);
+  return 0;
+}
+
+IRNode *ReaderBase::generateSIMDConditionalSelect() {
+  IRNode *Arg3 = ReaderOperandStack->pop();
+  IRNode *Arg2 = ReaderOperandStack->pop();
+  IRNode *Arg1 = ReaderOperandStack->pop();
+  if (isVectorType(Arg1) && isVectorType(Arg2) && isVectorType(Arg3)) {
+    IRNode *ReturnNode = vectorConditionalSelect(Arg1, Arg2, Arg3);
+    if (ReturnNode) {
+      return ReturnNode;
+    }
+  }
+  ReaderOperandStack->push(Arg1);
+  ReaderOperandStack->push(Arg2);
+  ReaderOperandStack->push(Arg3);
+  return 0;
+}
+
+IRNode *ReaderBase::generateSIMDConvert(ReaderSIMDIntrinsic OperationCode,
+                                        CORINFO_SIG_INFO *SigInfo) {
+  // The overloads differ only in the vector class of the source, which is
+  // what says whether its elements are signed.
+  CORINFO_CLASS_HANDLE SourceClass = getArgClass(SigInfo, SigInfo->args);
+  bool IsSigned = getIsSigned(SourceClass);
+
+  if (OperationCode == WIDEN) {
+    assert(SigInfo->numArgs == 3);
+    IRNode *HighPointer = ReaderOperandStack->pop();
+    IRNode *LowPointer = ReaderOperandStack->pop();
+    IRNode *Source = ReaderOperandStack->pop();
+    if (isVectorType(Source)) {
+      IRNode *ReturnNode =
+          vectorWiden(Source, LowPointer, HighPointer, IsSigned);
+      if (ReturnNode) {
+        return ReturnNode;
+      }
+    }
+    ReaderOperandStack->push(Source);
+    ReaderOperandStack->push(LowPointer);
+    ReaderOperandStack->push(HighPointer);
+    return 0;
+  }
+
+  assert(SigInfo->numArgs == 1);
+  IRNode *Source = ReaderOperandStack->pop();
+  if (isVectorType(Source)) {
+    IRNode *ReturnNode =
+        vectorConvert(Source, SigInfo->retTypeClass, IsSigned);
+    if (ReturnNode) {
+      return ReturnNode;
+    }
+  }
+  ReaderOperandStack->push(Source);
+  return 0;
+}
+
+IRNode *ReaderBase::generateSIMDCopyTo(int ArgsCount) {
+  if ((ArgsCount != 1) && (ArgsCount != 2)) { // CopyTo(Span<T>) etc.
+    return 0;
+  }
+  IRNode *Index = 0;
+  if (ArgsCount == 2) {
+    Index = ReaderOperandStack->pop();
+  }
+  IRNode *Array = ReaderOperandStack->pop();
+  IRNode *VectorPointer = ReaderOperandStack->pop();
+  IRNode *ReturnNode = vectorCopyTo(VectorPointer, Array, Index);
+  if (ReturnNode) {
+    return ReturnNode;
+  }
+  ReaderOperandStack->push(VectorPointer);
+  ReaderOperandStack->push(Array);
+  if (Index) {
+    ReaderOperandStack->push(Index);
+  }
+  return 0;
+}
+
 #pragma endregion
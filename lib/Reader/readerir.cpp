@@ -17,13 +17,22 @@
 #include "readerir.h"
 #include "imeta.h"
 #include "newvstate.h"
+#include "BoundsCheckElimination.h"
+#include "CompileTelemetry.h"
+#include "Inliner.h"
+#include "ObjectStackAllocation.h"
+#include "RuntimeLookupOptimization.h"
+#include "WriteBarrierElimination.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/Triple.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/IR/DebugLoc.h"
 #include "llvm/IR/InlineAsm.h"
 #include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/Support/Debug.h"            // for dbgs()
 #include "llvm/Support/Format.h"           // for format()
+#include "llvm/Support/MathExtras.h"       // for MinAlign()
 #include "llvm/Support/raw_ostream.h"      // for errs()
 #include "llvm/Support/ConvertUTF.h"       // for ConvertUTF16toUTF8
 #include "llvm/Transforms/Utils/Cloning.h" // for CloneBasicBlock/RemapInstr
@@ -31,6 +40,7 @@
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/DebugInfoMetadata.h"
 #include <cstdlib>
+#include <cstring>
 #include <new>
 
 using namespace llvm;
@@ -245,11 +255,15 @@ EHRegion *rgnGetEntryRegion(EHRegion *TryRegion) {
 //===----------------------------------------------------------------------===//
 
 // Get memory that will be freed at end of reader
+void *GenIR::getTempMemory(size_t NumBytes) {
+  return TempArena.allocate(NumBytes);
+}
 
-void *GenIR::getTempMemory(size_t NumBytes) { return calloc(1, NumBytes); }
-
-// Get memory that will persist after the reader
-void *GenIR::getProcMemory(size_t NumBytes) { return calloc(1, NumBytes); }
+// Get memory that will persist after the reader, until the end of the jit
+// request.
+void *GenIR::getProcMemory(size_t NumBytes) {
+  return JitContext->ProcArena.allocate(NumBytes);
+}
 
 #pragma endregion
 
@@ -283,6 +297,11 @@ static bool doesArgumentHaveHome(const ABIArgInfo &Info) {
 }
 
 void GenIR::readerPrePass(uint8_t *Buffer, uint32_t NumBytes) {
+  CompileTelemetry *Telemetry = JitContext->Telemetry;
+  if (Telemetry != nullptr) {
+    Telemetry->enterPhase(CompilePhase::ReaderPrePass);
+  }
+
   Triple PT(Triple::normalize(LLVM_DEFAULT_TARGET_TRIPLE));
   if (PT.isArch16Bit()) {
     TargetPointerSizeInBits = 16;
@@ -321,10 +340,17 @@ void GenIR::readerPrePass(uint8_t *Buffer, uint32_t NumBytes) {
 
   LLVMBuilder = new IRBuilder<>(LLVMContext);
 
-  DBuilder = new DIBuilder(*JitContext->CurrentModule);
-  LLILCDebugInfo.TheCU = DBuilder->createCompileUnit(dwarf::DW_LANG_C_plus_plus,
-                                                     Function->getName().str(),
-                                                     ".", "LLILCJit", 0, "", 0);
+  // Debug metadata is only built when the EE wants the debug info; it is
+  // costly to carry through code generation and to read back afterwards.
+  DBuilder = nullptr;
+  LLILCDebugInfo.TheCU = nullptr;
+  LLILCDebugInfo.FunctionScope = nullptr;
+  if (generateDebugInfo()) {
+    DBuilder = new DIBuilder(*JitContext->CurrentModule);
+    LLILCDebugInfo.TheCU = DBuilder->createCompileUnit(
+        dwarf::DW_LANG_C_plus_plus, Function->getName().str(), ".", "LLILCJit",
+        0, "", 0);
+  }
 
   LLVMBuilder->SetInsertPoint(EntryBlock);
 
@@ -345,19 +371,21 @@ void GenIR::readerPrePass(uint8_t *Buffer, uint32_t NumBytes) {
   PersonalityFunction = nullptr;
 
   // Setup function for emiting debug locations
-  DIFile *Unit = DBuilder->createFile(LLILCDebugInfo.TheCU->getFilename(),
-                                      LLILCDebugInfo.TheCU->getDirectory());
-  bool IsOptimized = JitContext->Options->EnableOptimization;
-  DIScope *FContext = Unit;
-  unsigned LineNo = 0;
-  unsigned ScopeLine = ICorDebugInfo::PROLOG;
-  bool IsDefinition = true;
-  DISubprogram *SP = DBuilder->createFunction(
-      FContext, Function->getName(), StringRef(), Unit, LineNo,
-      createFunctionType(Function, Unit), Function->hasInternalLinkage(),
-      IsDefinition, ScopeLine, DINode::FlagPrototyped, IsOptimized);
-
-  LLILCDebugInfo.FunctionScope = SP;
+  if (DBuilder != nullptr) {
+    DIFile *Unit = DBuilder->createFile(LLILCDebugInfo.TheCU->getFilename(),
+                                        LLILCDebugInfo.TheCU->getDirectory());
+    bool IsOptimized = JitContext->Options->EnableOptimization;
+    DIScope *FContext = Unit;
+    unsigned LineNo = 0;
+    unsigned ScopeLine = ICorDebugInfo::PROLOG;
+    bool IsDefinition = true;
+    DISubprogram *SP = DBuilder->createFunction(
+        FContext, Function->getName(), StringRef(), Unit, LineNo,
+        createFunctionType(Function, Unit), Function->hasInternalLinkage(),
+        IsDefinition, ScopeLine, DINode::FlagPrototyped, IsOptimized);
+
+    LLILCDebugInfo.FunctionScope = SP;
+  }
 
   initParamsAndAutos(MethodSignature);
 
@@ -435,8 +463,6 @@ void GenIR::readerPrePass(uint8_t *Buffer, uint32_t NumBytes) {
     J++;
   }
 
-  zeroInitLocals();
-
   // Check for special cases where the Jit needs to do extra work.
   const uint32_t MethodFlags = getCurrentMethodAttribs();
 
@@ -507,9 +533,27 @@ void GenIR::readerPrePass(uint8_t *Buffer, uint32_t NumBytes) {
   Instruction *CurrentInstruction = &*LLVMBuilder->GetInsertPoint();
   IRNode *CurrentIRNode = (IRNode *)CurrentInstruction;
   FirstMSILBlock = fgSplitBlock(CurrentFlowGraphNode, CurrentIRNode);
+
+  // The reader builds the EH region tree and the flow graph next, and
+  // calls readerMiddlePass once it is done.
+  if (Telemetry != nullptr) {
+    Telemetry->enterPhase(CompilePhase::FlowGraph);
+  }
 }
 
-void GenIR::readerMiddlePass() { return; }
+void GenIR::readerMiddlePass() {
+  if (JitContext->Telemetry != nullptr) {
+    JitContext->Telemetry->enterPhase(CompilePhase::MSILToIR);
+  }
+
+  // Compute dominators now that the flow graph is built, so that class
+  // initialization and static base lookups can be shared between blocks.
+  fgComputeDominators();
+
+  // Zero initialize locals now that the flow graph can tell which locals
+  // are read before being written.
+  zeroInitLocals();
+}
 
 void GenIR::readerPostVisit() {
   // Insert IR for some deferred prolog actions.  These logically have offset
@@ -540,7 +584,9 @@ void GenIR::readerPostVisit() {
   // out the non-exceptional paths so as to better-optimize them).
   cloneFinallyBodies();
 
-  DBuilder->finalize();
+  if (DBuilder != nullptr) {
+    DBuilder->finalize();
+  }
 }
 
 void GenIR::cloneFinallyBodies() {
@@ -549,6 +595,8 @@ void GenIR::cloneFinallyBodies() {
     return;
   }
 
+  CompilePhaseTimer Timer(JitContext->Telemetry, CompilePhase::FinallyCloning);
+
   // Find the finallies, pushing them onto a stack while walking down the
   // region tree so that we'll pop inner finallies before outer ones
   SmallVector<EHRegion *, 8> FinallyRegions;
@@ -569,9 +617,10 @@ void GenIR::cloneFinallyBodies() {
     }
   }
 
+  uint32_t CopyBudget = FinallyCopyBudget;
   while (!FinallyRegions.empty()) {
     EHRegion *Finally = FinallyRegions.pop_back_val();
-    cloneFinallyBody(Finally);
+    cloneFinallyBody(Finally, CopyBudget);
   }
 
   // As a temporary measure during EH bring-up, insert a FAIL_FAST at the start
@@ -597,7 +646,7 @@ void GenIR::cloneFinallyBodies() {
   }
 }
 
-void GenIR::cloneFinallyBody(EHRegion *FinallyRegion) {
+void GenIR::cloneFinallyBody(EHRegion *FinallyRegion, uint32_t &CopyBudget) {
   CleanupPadInst *Cleanup = FinallyRegion->CleanupPad;
   SwitchInst *ExitSwitch = FinallyRegion->EndFinallySwitch;
 
@@ -776,9 +825,223 @@ void GenIR::cloneFinallyBody(EHRegion *FinallyRegion) {
 
   // The switch in the exceptional path is no longer necessary and can just
   // branch to the cleanupret.
+  Value *CloneExitSwitch = ValueMap.lookup(ExitSwitch);
+  SwitchInst *CloneSwitch = cast_or_null<SwitchInst>(CloneExitSwitch);
   IRBuilder<> Builder(ExitSwitch);
   Builder.CreateBr(CleanupRetBlock);
   ExitSwitch->eraseFromParent();
+
+  // When optimizing, see whether the exits of the non-exceptional path are
+  // worth their own copies of it. A finally that never ends has no switch.
+  if (JitContext->Options->EnableOptimization && (CloneSwitch != nullptr)) {
+    specializeFinallyExits(CloneBlocks, NewHead, CloneSwitch, CopyBudget);
+  }
+}
+
+// Replace a finally dispatch switch with a branch to one of its targets.
+// Unless the switch is in a block just copied, whose successors do not yet
+// know it as a predecessor, the switch's other targets are updated.
+static void foldFinallyDispatch(SwitchInst *Switch, BasicBlock *Target,
+                                bool UpdateSuccessors) {
+  BasicBlock *Block = Switch->getParent();
+  if (UpdateSuccessors) {
+    bool IsTargetKept = false;
+    for (BasicBlock *Successor : successors(Block)) {
+      if ((Successor == Target) && !IsTargetKept) {
+        IsTargetKept = true;
+        continue;
+      }
+      Successor->removePredecessor(Block);
+    }
+  }
+
+  Instruction *Selector = cast<Instruction>(Switch->getCondition());
+  BranchInst::Create(Target, Switch);
+  Switch->eraseFromParent();
+  if (Selector->use_empty()) {
+    Selector->eraseFromParent();
+  }
+}
+
+void GenIR::specializeFinallyExits(ArrayRef<BasicBlock *> CloneBlocks,
+                                   BasicBlock *CloneHead,
+                                   SwitchInst *CloneSwitch,
+                                   uint32_t &CopyBudget) {
+  if (isa<PHINode>(CloneHead->begin())) {
+    return;
+  }
+
+  // Group the entries by the exit selector they store. The store may be in
+  // a block leading to the entry, such as the exit of an inner finally
+  // left by the same leave. If the selector of any entry is not known, the
+  // entries all keep sharing the dispatch.
+  struct ExitGroup {
+    ConstantInt *Selector;                ///< Selector of the exit.
+    BasicBlock *Exit;                     ///< Where the finally goes.
+    SmallVector<BasicBlock *, 2> Entries; ///< Blocks entering the finally.
+    uint64_t Count;                       ///< Profiled runs of the entries.
+    bool IsCopied;                        ///< True if given its own copy.
+  };
+  SmallVector<ExitGroup, 4> Groups;
+  Value *SelectorAddr =
+      cast<LoadInst>(CloneSwitch->getCondition())->getPointerOperand();
+  SmallPtrSet<BasicBlock *, 16> CloneSet(CloneBlocks.begin(),
+                                         CloneBlocks.end());
+  SmallPtrSet<BasicBlock *, 8> Entries;
+  for (BasicBlock *Entry : predecessors(CloneHead)) {
+    if (CloneSet.count(Entry) || !Entries.insert(Entry).second) {
+      continue;
+    }
+
+    ConstantInt *Selector = nullptr;
+    SmallPtrSet<BasicBlock *, 4> Visited;
+    for (BasicBlock *Block = Entry; (Block != nullptr) &&
+                                    (Selector == nullptr) &&
+                                    Visited.insert(Block).second;
+         Block = Block->getSinglePredecessor()) {
+      for (auto I = Block->rbegin(), E = Block->rend(); I != E; ++I) {
+        StoreInst *Store = dyn_cast<StoreInst>(&*I);
+        if ((Store != nullptr) &&
+            (Store->getPointerOperand() == SelectorAddr)) {
+          Selector = dyn_cast<ConstantInt>(Store->getValueOperand());
+          if (Selector == nullptr) {
+            return;
+          }
+          break;
+        }
+      }
+    }
+    if (Selector == nullptr) {
+      return;
+    }
+    SwitchInst::CaseIt Case = CloneSwitch->findCaseValue(Selector);
+    if (Case == CloneSwitch->case_default()) {
+      return;
+    }
+
+    ExitGroup *Group = nullptr;
+    for (ExitGroup &Candidate : Groups) {
+      if (Candidate.Selector == Selector) {
+        Group = &Candidate;
+        break;
+      }
+    }
+    if (Group == nullptr) {
+      Groups.push_back(ExitGroup());
+      Group = &Groups.back();
+      Group->Selector = Selector;
+      Group->Exit = Case.getCaseSuccessor();
+      Group->Count = 0;
+      Group->IsCopied = false;
+    }
+    Group->Entries.push_back(Entry);
+    Group->Count += BlockProfileCounts.lookup(Entry);
+  }
+  if (Groups.empty()) {
+    return;
+  }
+
+  // Decide which exits get their own copies, hottest first. An exit is hot
+  // if it is taken at least once per call of the method. One exit always
+  // keeps the shared body.
+  uint32_t Size = 0;
+  for (BasicBlock *Block : CloneBlocks) {
+    Size += Block->size();
+  }
+  std::stable_sort(Groups.begin(), Groups.end(),
+                   [](const ExitGroup &A, const ExitGroup &B) {
+                     return A.Count > B.Count;
+                   });
+  Optional<uint64_t> EntryCount = Function->getEntryCount();
+  uint32_t NumShared = Groups.size();
+  for (ExitGroup &Group : Groups) {
+    const bool IsHot = EntryCount.hasValue() && (Group.Count > 0) &&
+                       (Group.Count >= EntryCount.getValue());
+    const uint32_t Limit = IsHot ? HotFinallyCopySize : SmallFinallyCopySize;
+    if ((NumShared > 1) && (Size <= Limit) && (Size <= CopyBudget)) {
+      Group.IsCopied = true;
+      CopyBudget -= Size;
+      --NumShared;
+    }
+  }
+
+  BasicBlock *SwitchBlock = CloneSwitch->getParent();
+  CompileTelemetry *Telemetry = JitContext->Telemetry;
+  for (ExitGroup &Group : Groups) {
+    if (!Group.IsCopied) {
+      continue;
+    }
+
+    ValueToValueMapTy CopyMap;
+    for (BasicBlock *Block : CloneBlocks) {
+      BasicBlock *Copy = CloneBasicBlock(Block, CopyMap, ".exit");
+      Copy->insertInto(Function, Block);
+      CopyMap[Block] = Copy;
+      if (fgNodeIsVisited((FlowGraphNode *)Block)) {
+        fgNodeSetVisited((FlowGraphNode *)Copy, true);
+      }
+    }
+    for (BasicBlock *Block : CloneBlocks) {
+      Value *Copy = CopyMap[Block];
+      for (Instruction &CopyInstr : *cast<BasicBlock>(Copy)) {
+        RemapInstruction(&CopyInstr, CopyMap,
+                         RF_IgnoreMissingEntries | RF_NoModuleLevelChanges);
+      }
+    }
+
+    // The copy always leaves to the same exit.
+    Value *CopySwitch = CopyMap[CloneSwitch];
+    foldFinallyDispatch(cast<SwitchInst>(CopySwitch), Group.Exit, false);
+
+    // Blocks outside the copy that it branches or unwinds to get the same
+    // PHI inputs from it as from the shared body.
+    for (BasicBlock *Block : CloneBlocks) {
+      BasicBlock *Copy =
+          cast<BasicBlock>(static_cast<Value *>(CopyMap[Block]));
+      for (BasicBlock *Successor : successors(Copy)) {
+        if (CloneSet.count(Successor)) {
+          continue;
+        }
+        for (Instruction &Instr : *Successor) {
+          PHINode *Phi = dyn_cast<PHINode>(&Instr);
+          if (Phi == nullptr) {
+            break;
+          }
+          Value *Incoming = Phi->getIncomingValueForBlock(Block);
+          Value *CopyIncoming = CopyMap.lookup(Incoming);
+          Phi->addIncoming(CopyIncoming ? CopyIncoming : Incoming, Copy);
+        }
+      }
+    }
+
+    BasicBlock *CopyHead =
+        cast<BasicBlock>(static_cast<Value *>(CopyMap[CloneHead]));
+    for (BasicBlock *Entry : Group.Entries) {
+      Entry->getTerminator()->replaceUsesOfWith(CloneHead, CopyHead);
+    }
+
+    // The shared body no longer goes to this exit.
+    CloneSwitch->removeCase(CloneSwitch->findCaseValue(Group.Selector));
+    if (std::find(succ_begin(SwitchBlock), succ_end(SwitchBlock),
+                  Group.Exit) == succ_end(SwitchBlock)) {
+      Group.Exit->removePredecessor(SwitchBlock);
+    }
+
+    if (Telemetry != nullptr) {
+      ++Telemetry->FinallyCopyCount;
+      Telemetry->FinallyCopySize += Size;
+    }
+  }
+
+  // If only one exit is left sharing the body, it needs no dispatch.
+  if (NumShared == 1) {
+    for (ExitGroup &Group : Groups) {
+      if (!Group.IsCopied) {
+        foldFinallyDispatch(CloneSwitch, Group.Exit, true);
+        break;
+      }
+    }
+  }
 }
 
 bool GenIR::canExecuteHandler(BasicBlock &Handler) {
@@ -803,6 +1066,14 @@ void GenIR::markGCLeaf(CallSite Call) {
 
 void GenIR::readerPostPass(bool IsImportOnly) {
 
+  if (JitContext->Options->EnableOptimization) {
+    packGcAllocas();
+  }
+
+  if (!BlockProfileCounts.empty()) {
+    addProfileBranchWeights();
+  }
+
   SmallVector<Value *, 4> EscapingLocs;
   GcFuncInfo->getEscapingLocations(EscapingLocs);
 
@@ -859,16 +1130,18 @@ void GenIR::readerPostPass(bool IsImportOnly) {
     BoxedTypeMap->clear();
   }
 
-  // Cleanup the memory we've been using.
-  delete DBuilder;
-  delete LLVMBuilder;
-
   // While Jitting a method, SafepointPoll must appear after the function
   // actually being Jitted. EE's DebugInfoManager depends on the fact that
-  // the Jitted function starts at the allocated code block.
-  if (JitContext->Options->DoInsertStatepoints) {
+  // the Jitted function starts at the allocated code block. Callees read
+  // for the inliner share the poll of the method being jitted.
+  if (JitContext->Options->DoInsertStatepoints &&
+      (JitContext->InlineRoot == nullptr)) {
     createSafepointPoll();
   }
+
+  // Cleanup the memory we've been using.
+  delete DBuilder;
+  delete LLVMBuilder;
 }
 
 void GenIR::insertIRToKeepGenericContextAlive() {
@@ -1154,6 +1427,17 @@ void GenIR::createSym(uint32_t Num, bool IsAuto, CorInfoType CorType,
     GcFuncInfo->recordPinned(AllocaInst);
   }
 
+  if (IsAuto) {
+    LocalVars[Num] = AllocaInst;
+    LocalVarCorTypes[Num] = CorType;
+  } else {
+    Arguments[Num] = AllocaInst;
+  }
+
+  if (DBuilder == nullptr) {
+    return;
+  }
+
   DIFile *Unit = DBuilder->createFile(LLILCDebugInfo.TheCU->getFilename(),
                                       LLILCDebugInfo.TheCU->getDirectory());
 
@@ -1164,27 +1448,20 @@ void GenIR::createSym(uint32_t Num, bool IsAuto, CorInfoType CorType,
   std::string Name =
       (UseNumber ? Twine(SymName) + Twine(Number) : Twine(SymName)).str();
 
+  DILocalVariable *DebugVar;
   if (IsAuto) {
-    auto *DebugVar =
+    DebugVar =
         DBuilder->createAutoVariable(LLILCDebugInfo.FunctionScope, Name, Unit,
                                      0, DebugType, AlwaysPreserve, Flags);
-    auto DL = llvm::DebugLoc::get(0, 0, LLILCDebugInfo.FunctionScope);
-    DBuilder->insertDeclare(AllocaInst, DebugVar, DBuilder->createExpression(),
-                            DL, LLVMBuilder->GetInsertBlock());
-
-    LocalVars[Num] = AllocaInst;
-    LocalVarCorTypes[Num] = CorType;
   } else {
     unsigned ArgNo = Num + 1;
-
-    auto *DebugVar = DBuilder->createParameterVariable(
+    DebugVar = DBuilder->createParameterVariable(
         LLILCDebugInfo.FunctionScope, Name, ArgNo, Unit, 0, DebugType,
         AlwaysPreserve, Flags);
-    auto DL = llvm::DebugLoc::get(0, 0, LLILCDebugInfo.FunctionScope);
-    DBuilder->insertDeclare(AllocaInst, DebugVar, DBuilder->createExpression(),
-                            DL, LLVMBuilder->GetInsertBlock());
-    Arguments[Num] = AllocaInst;
   }
+  auto DL = llvm::DebugLoc::get(0, 0, LLILCDebugInfo.FunctionScope);
+  DBuilder->insertDeclare(AllocaInst, DebugVar, DBuilder->createExpression(),
+                          DL, LLVMBuilder->GetInsertBlock());
 }
 
 void GenIR::zeroInit(Value *Var) {
@@ -1192,9 +1469,6 @@ void GenIR::zeroInit(Value *Var) {
   // GC pointers and GC pointer fields on structs. For now we are zero
   // initalizing all fields in structs that have gc fields.
   //
-  // TODO: We should try to lay out GC pointers contiguously on the stack
-  // frame and use memset to initialize them.
-  //
   // TODO: We can avoid zero-initializing some gc pointers if we can
   // ensure that we are not reporting uninitialized GC pointers at gc-safe
   // points.
@@ -1212,14 +1486,32 @@ void GenIR::zeroInit(Value *Var) {
 }
 
 void GenIR::zeroInitLocals() {
-  if (isZeroInitLocals()) {
-    for (const auto &LocalVar : LocalVars) {
-      if (!GcInfo::isGcAllocation(LocalVar)) {
+  if (isZeroInitLocals() && !LocalVars.empty()) {
+    // A local that is written before it is read on every path need not be
+    // zeroed. Finding those takes a pass over the flow graph, so only do it
+    // when optimizing.
+    BitVector ReadBeforeWritten;
+    if (JitContext->Options->EnableOptimization) {
+      ReadBeforeWritten = fgFindLocalsReadBeforeWritten();
+    } else {
+      ReadBeforeWritten.resize(LocalVars.size(), true);
+    }
+    LocalsToZeroInit = ReadBeforeWritten;
+
+    // Zero the locals just after the allocas in the entry block.
+    IRBuilder<>::InsertPoint SavedInsertPoint = LLVMBuilder->saveIP();
+    assert(AllocaInsertionPoint != nullptr);
+    LLVMBuilder->SetInsertPoint(AllocaInsertionPoint->getParent(),
+                                std::next(AllocaInsertionPoint->getIterator()));
+    for (uint32_t I = 0; I < LocalVars.size(); I++) {
+      Value *LocalVar = LocalVars[I];
+      if (!GcInfo::isGcAllocation(LocalVar) && ReadBeforeWritten[I]) {
         // All GC values are zero-initizlied in the post-pass.
         // So, only initialize the remaining ones if necessary.
         zeroInit(LocalVar);
       }
     }
+    LLVMBuilder->restoreIP(SavedInsertPoint);
   }
 
 #ifndef NDEBUG
@@ -1234,7 +1526,78 @@ void GenIR::zeroInitLocals() {
 #endif // !NDEBUG
 }
 
+void GenIR::packGcAllocas() {
+  // Gather the homes of the locals and arguments that hold GC aggregates and
+  // need no special reporting. Only aggregate homes are packed: the fields of
+  // a GC aggregate are reported as object references, whereas a GC pointer
+  // home may hold a byref (e.g. the this of a value type method) and must
+  // stay a separately reported interior slot.
+  const DataLayout &DL = JitContext->CurrentModule->getDataLayout();
+  SmallVector<Value **, 8> Homes;
+  SmallVector<Type *, 8> FieldTypes;
+  auto GatherHomes = [&](std::vector<Value *> &Vars) {
+    for (Value *&Var : Vars) {
+      AllocaInst *Alloca = dyn_cast_or_null<AllocaInst>(Var);
+      if ((Alloca == nullptr) || (Alloca->getParent() != EntryBlock)) {
+        continue;
+      }
+      auto MapElem = GcFuncInfo->AllocaMap.find(Alloca);
+      if (MapElem == GcFuncInfo->AllocaMap.end()) {
+        continue;
+      }
+      const AllocaFlags Flags = MapElem->second.Flags;
+      Type *Ty = Alloca->getAllocatedType();
+      if ((Flags != AllocaFlags::GcAggregate) || !Ty->isStructTy() ||
+          (Alloca->getAlignment() > DL.getABITypeAlignment(Ty))) {
+        continue;
+      }
+      Homes.push_back(&Var);
+      FieldTypes.push_back(Ty);
+    }
+  };
+  GatherHomes(LocalVars);
+  GatherHomes(Arguments);
+
+  if (Homes.size() < 2) {
+    return;
+  }
+
+  // Replace the homes with the fields of one aggregate, so that they are
+  // contiguous in the frame and the post-pass zeroes them all at once.
+  IRBuilder<>::InsertPoint SavedInsertPoint = LLVMBuilder->saveIP();
+  StructType *PackedTy = StructType::get(*JitContext->LLVMContext, FieldTypes);
+  LLVMBuilder->SetInsertPoint(EntryBlock, EntryBlock->getFirstInsertionPt());
+  AllocaInst *Packed = createAlloca(PackedTy, nullptr, "GcSlots");
+
+  for (uint32_t I = 0; I < Homes.size(); I++) {
+    AllocaInst *Alloca = cast<AllocaInst>(*Homes[I]);
+    LLVMBuilder->SetInsertPoint(Alloca);
+    Instruction *Field =
+        cast<Instruction>(LLVMBuilder->CreateStructGEP(PackedTy, Packed, I));
+    Field->takeName(Alloca);
+    GcFuncInfo->AllocaMap.erase(Alloca);
+    Alloca->replaceAllUsesWith(Field);
+    if (AllocaInsertionPoint == Alloca) {
+      AllocaInsertionPoint = Field;
+    }
+    Alloca->eraseFromParent();
+    *Homes[I] = Field;
+  }
+
+  LLVMBuilder->restoreIP(SavedInsertPoint);
+}
+
 void GenIR::zeroInitBlock(Value *Address, uint64_t Size) {
+  // The address is a stack allocation, so its pointee type gives its
+  // alignment.
+  const DataLayout &DL = JitContext->CurrentModule->getDataLayout();
+  Type *ElementTy = Address->getType()->getPointerElementType();
+  uint32_t Align = ElementTy->isSized() ? DL.getABITypeAlignment(ElementTy) : 1;
+  const bool IsVolatile = false;
+  if (moveBlockInline(Address, nullptr, Size, Align, IsVolatile)) {
+    return;
+  }
+
   bool IsSigned = false;
   ConstantInt *BlockSize = ConstantInt::get(
       *JitContext->LLVMContext, APInt(TargetPointerSizeInBits, Size, IsSigned));
@@ -1242,8 +1605,6 @@ void GenIR::zeroInitBlock(Value *Address, uint64_t Size) {
 }
 
 void GenIR::zeroInitBlock(Value *Address, Value *Size) {
-  // TODO: For small structs we may want to generate an integer StoreInst
-  // instead of calling a helper.
   LLVMContext &LLVMContext = *JitContext->LLVMContext;
   const bool MayThrow = false;
   Type *VoidTy = Type::getVoidTy(LLVMContext);
@@ -1255,11 +1616,18 @@ void GenIR::zeroInitBlock(Value *Address, Value *Size) {
 void GenIR::copyStructNoBarrier(Type *StructTy, Value *DestinationAddress,
                                 Value *SourceAddress, bool IsVolatile,
                                 ReaderAlignType Alignment) {
-  // TODO: For small structs we may want to generate an integer StoreInst
-  // instead of calling a helper.
   const DataLayout *DataLayout = &JitContext->CurrentModule->getDataLayout();
   const StructLayout *TheStructLayout =
       DataLayout->getStructLayout(cast<StructType>(StructTy));
+  // GC pointers must not be copied as plain integers, where nothing would
+  // know to report them.
+  if (!GcInfo::isGcType(StructTy)) {
+    uint32_t Align = getBlockAlignment(StructTy, Alignment);
+    if (moveBlockInline(DestinationAddress, SourceAddress,
+                        TheStructLayout->getSizeInBytes(), Align, IsVolatile)) {
+      return;
+    }
+  }
   IRNode *StructSize =
       (IRNode *)ConstantInt::get(Type::getInt32Ty(*JitContext->LLVMContext),
                                  TheStructLayout->getSizeInBytes());
@@ -1280,6 +1648,7 @@ void GenIR::copyStruct(CORINFO_CLASS_HANDLE Class, IRNode *Dst, IRNode *Src,
     const DataLayout *DataLayout = &JitContext->CurrentModule->getDataLayout();
     const StructLayout *TheStructLayout = DataLayout->getStructLayout(StructTy);
     uint64_t StructSizeInBytes = TheStructLayout->getSizeInBytes();
+    uint32_t Align = getBlockAlignment(StructTy, Alignment);
     for (uint64_t CurrentOffset = 0; CurrentOffset < StructSizeInBytes;
          CurrentOffset += PointerSize) {
       uint32_t I = CurrentOffset / PointerSize;
@@ -1288,12 +1657,9 @@ void GenIR::copyStruct(CORINFO_CLASS_HANDLE Class, IRNode *Dst, IRNode *Src,
         // This covers cases when the block is before the first GC pointer or
         // between GC pointers.
         if (CurrentOffset != OffsetAfterLastGCPointer) {
-          IRNode *Size =
-              loadConstantI4(CurrentOffset - OffsetAfterLastGCPointer);
-          IRNode *Offset = loadConstantI4(OffsetAfterLastGCPointer);
-          IRNode *NonGCSrcAddr = binaryOp(ReaderBaseNS::Add, Src, Offset);
-          IRNode *NonGCDstAddr = binaryOp(ReaderBaseNS::Add, Dst, Offset);
-          cpBlk(Size, NonGCSrcAddr, NonGCDstAddr, Alignment, IsVolatile);
+          copyNonGCBlock(Dst, Src, OffsetAfterLastGCPointer,
+                         CurrentOffset - OffsetAfterLastGCPointer, Align,
+                         Alignment, IsVolatile);
         }
 
         // Copy GC pointer with a write barrier.
@@ -1337,19 +1703,125 @@ void GenIR::copyStruct(CORINFO_CLASS_HANDLE Class, IRNode *Dst, IRNode *Src,
     }
     // Check if we need to copy the tail after the last GC pointer.
     if (OffsetAfterLastGCPointer < StructSizeInBytes) {
-      IRNode *Size =
-          loadConstantI4(StructSizeInBytes - OffsetAfterLastGCPointer);
-      IRNode *Offset = loadConstantI4(OffsetAfterLastGCPointer);
-      IRNode *NonGCSrcAddr = binaryOp(ReaderBaseNS::Add, Src, Offset);
-      IRNode *NonGCDstAddr = binaryOp(ReaderBaseNS::Add, Dst, Offset);
-      cpBlk(Size, NonGCSrcAddr, NonGCDstAddr, Alignment, IsVolatile);
+      copyNonGCBlock(Dst, Src, OffsetAfterLastGCPointer,
+                     StructSizeInBytes - OffsetAfterLastGCPointer, Align,
+                     Alignment, IsVolatile);
     }
     free(RuntimeGCInfo);
   } else {
-    // If the class doesn't have a gc layout then use a memcopy
-    IRNode *Size = loadConstantI4(getClassSize(Class));
-    cpBlk(Size, Src, Dst, Alignment, IsVolatile);
+    // If the class doesn't have a gc layout then use a memcopy, or a few
+    // moves if the class is small.
+    uint32_t Align = getBlockAlignment(nullptr, Alignment);
+    const uint32_t Offset = 0;
+    copyNonGCBlock(Dst, Src, Offset, getClassSize(Class), Align, Alignment,
+                   IsVolatile);
+  }
+}
+
+void GenIR::copyNonGCBlock(IRNode *Dst, IRNode *Src, uint32_t Offset,
+                           uint32_t Size, uint32_t Align,
+                           ReaderAlignType Alignment, bool IsVolatile) {
+  IRNode *DstAddr = Dst;
+  IRNode *SrcAddr = Src;
+  if (Offset != 0) {
+    IRNode *OffsetNode = loadConstantI4(Offset);
+    DstAddr = binaryOp(ReaderBaseNS::Add, Dst, OffsetNode);
+    SrcAddr = binaryOp(ReaderBaseNS::Add, Src, OffsetNode);
+  }
+  if (moveBlockInline(DstAddr, SrcAddr, Size, MinAlign(Align, Offset),
+                      IsVolatile)) {
+    return;
   }
+  cpBlk(loadConstantI4(Size), SrcAddr, DstAddr, Alignment, IsVolatile);
+}
+
+uint32_t GenIR::getBlockAlignment(Type *Ty, ReaderAlignType Alignment) {
+  if (Alignment == Reader_AlignUnknown) {
+    return 1;
+  }
+  if (Alignment != Reader_AlignNatural) {
+    return Alignment;
+  }
+  if (Ty == nullptr) {
+    // The natural alignment is not known without the type.
+    return 1;
+  }
+  const DataLayout &DL = JitContext->CurrentModule->getDataLayout();
+  return DL.getABITypeAlignment(Ty);
+}
+
+// Get the type of a pointer to a move of type MoveTy through Address.
+static Type *getMovePointerType(Type *MoveTy, Value *Address) {
+  return PointerType::get(MoveTy, Address->getType()->getPointerAddressSpace());
+}
+
+bool GenIR::moveBlockInline(Value *DestinationAddress, Value *SourceAddress,
+                            uint64_t Size, uint32_t Align, bool IsVolatile) {
+  // Larger blocks are better left to the helpers, which move them with
+  // loops of the widest moves the machine has.
+  const uint64_t MaxInlineBlockSize = 32;
+  if ((Size == 0) || (Size > MaxInlineBlockSize) ||
+      !DestinationAddress->getType()->isPointerTy() ||
+      ((SourceAddress != nullptr) &&
+       !SourceAddress->getType()->isPointerTy())) {
+    return false;
+  }
+
+  LLVMContext &LLVMContext = *JitContext->LLVMContext;
+  Type *DestinationBytePtrTy = Type::getInt8PtrTy(
+      LLVMContext, DestinationAddress->getType()->getPointerAddressSpace());
+  Value *DestinationBytes =
+      LLVMBuilder->CreatePointerCast(DestinationAddress, DestinationBytePtrTy);
+  Value *SourceBytes = nullptr;
+  if (SourceAddress != nullptr) {
+    Type *SourceBytePtrTy = Type::getInt8PtrTy(
+        LLVMContext, SourceAddress->getType()->getPointerAddressSpace());
+    SourceBytes =
+        LLVMBuilder->CreatePointerCast(SourceAddress, SourceBytePtrTy);
+  }
+
+  // Move the block with the widest moves that fit what is left of it: 16
+  // bytes with a vector register, then pointer-sized and smaller integers.
+  uint64_t Offset = 0;
+  while (Offset < Size) {
+    uint64_t Remaining = Size - Offset;
+    Type *MoveTy;
+    uint32_t MoveSize;
+    if (Remaining >= 16) {
+      MoveSize = 16;
+      MoveTy = VectorType::get(Type::getInt64Ty(LLVMContext), 2);
+    } else {
+      MoveSize = TargetPointerSizeInBits / 8;
+      while (MoveSize > Remaining) {
+        MoveSize /= 2;
+      }
+      MoveTy = Type::getIntNTy(LLVMContext, MoveSize * 8);
+    }
+    uint32_t MoveAlign = MinAlign(Align, Offset);
+
+    Value *DestinationMove =
+        LLVMBuilder->CreateConstInBoundsGEP1_64(DestinationBytes, Offset);
+    DestinationMove = LLVMBuilder->CreatePointerCast(
+        DestinationMove, getMovePointerType(MoveTy, DestinationBytes));
+    Value *Moved;
+    if (SourceBytes != nullptr) {
+      Value *SourceMove =
+          LLVMBuilder->CreateConstInBoundsGEP1_64(SourceBytes, Offset);
+      SourceMove = LLVMBuilder->CreatePointerCast(
+          SourceMove, getMovePointerType(MoveTy, SourceBytes));
+      LoadInst *Load = LLVMBuilder->CreateLoad(SourceMove, IsVolatile);
+      Load->setAlignment(MoveAlign);
+      Moved = Load;
+    } else {
+      Moved = Constant::getNullValue(MoveTy);
+    }
+    StoreInst *Store =
+        LLVMBuilder->CreateStore(Moved, DestinationMove, IsVolatile);
+    Store->setAlignment(MoveAlign);
+    Offset += MoveSize;
+  }
+
+  return true;
 }
 
 bool GenIR::doesValueRepresentStruct(Value *TheValue) {
@@ -1442,12 +1914,28 @@ uint32_t GenIR::convertReaderAlignment(ReaderAlignType ReaderAlignment) {
 //
 // This helper is required by the LLVM GC-Statepoint insertion phase.
 // Statepoint lowering inlines the body of @gc.safepoint_poll function
-// at function entry and at loop-back-edges.
+// at function entry and at loop-back-edges. PlaceSafepoints already omits
+// the back-edge polls of loops that contain a call which is itself a
+// safepoint, and of counted loops whose trip count is known to be small.
 //
-// The current strategy is to use an unconditional call to the GCPoll helper.
-// TODO: Inline calls to GCPoll helper when CORJIT_FLG_GCPOLL_INLINE is set.
+// When the EE asks for inline polls (CORJIT_FLG_GCPOLL_INLINE), the flag
+// the EE sets to stop threads for a GC is checked inline, and the GCPoll
+// helper is only called, on a cold path, when it is set:
+//
+// define void @gc.safepoint_poll()
+// {
+// entry:
+//   %Trap = load volatile i32, i32* inttoptr(i64 <TrapReturningThreads>)
+//   %PollGC = icmp ne i32 %Trap, 0
+//   br i1 %PollGC, label %Poll, label %Done, !prof <cold>
+// Poll:
+//   call void inttoptr(i64 <JIT_GCPoll> to void()*)()
+//   br label %Done
+// Done:
+//   ret void
+// }
 //
-// The following code is inserted into the module:
+// Otherwise the GCPoll helper is called unconditionally:
 //
 // define void @gc.safepoint_poll()
 // {
@@ -1478,19 +1966,62 @@ void GenIR::createSafepointPoll() {
   BasicBlock *EntryBlock =
       BasicBlock::Create(*LLVMContext, "entry", SafepointPoll);
 
-  IRNode *Address = getHelperCallAddress(CORINFO_HELP_POLL_GC);
-  Value *Target =
-      LLVMBuilder->CreateIntToPtr(Address, getUnmanagedPointerType(VoidFnType));
+  // The poll is inlined into the method, so it must not carry the method's
+  // debug locations itself.
+  LLVMBuilder->SetInsertPoint(EntryBlock);
+  LLVMBuilder->SetCurrentDebugLocation(DebugLoc());
 
-  CallInst::Create(Target, "", EntryBlock);
-  ReturnInst::Create(*LLVMContext, EntryBlock);
+  BasicBlock *DoneBlock = nullptr;
+  if ((JitContext->Flags & CORJIT_FLG_GCPOLL_INLINE) != 0) {
+    bool IsIndirect;
+    void *TrapAddressHandle = getAddrOfCaptureThreadGlobal(&IsIndirect);
+    const bool IsReadOnly = true;
+    const bool IsRelocatable = true;
+    const bool IsCallTarget = false;
+    Value *RawTrapAddress = handleToIRNode(
+        mdtCaptureThreadGlobal, TrapAddressHandle, TrapAddressHandle,
+        IsIndirect, IsReadOnly, IsRelocatable, IsCallTarget);
+    Type *Int32Ty = Type::getInt32Ty(*LLVMContext);
+    Value *TrapAddress = LLVMBuilder->CreateIntToPtr(
+        RawTrapAddress, getUnmanagedPointerType(Int32Ty));
+    const bool IsVolatile = true;
+    Value *Trap = LLVMBuilder->CreateLoad(TrapAddress, IsVolatile, "Trap");
+    Value *PollGC = LLVMBuilder->CreateIsNotNull(Trap, "PollGC");
+
+    BasicBlock *PollBlock =
+        BasicBlock::Create(*LLVMContext, "Poll", SafepointPoll);
+    DoneBlock = BasicBlock::Create(*LLVMContext, "Done", SafepointPoll);
+    BranchInst *Branch =
+        LLVMBuilder->CreateCondBr(PollGC, PollBlock, DoneBlock);
+
+    // Threads are only rarely asked to stop for a GC.
+    const uint32_t PollWeight = 1;
+    const uint32_t ContinueWeight = 1 << 20;
+    MDBuilder Builder(*LLVMContext);
+    Branch->setMetadata(llvm::LLVMContext::MD_prof,
+                        Builder.createBranchWeights(PollWeight,
+                                                    ContinueWeight));
+    LLVMBuilder->SetInsertPoint(PollBlock);
+  }
+
+  Value *Target = getHelperCallTarget(CORINFO_HELP_POLL_GC, VoidFnType);
+  LLVMBuilder->CreateCall(Target);
+
+  if (DoneBlock != nullptr) {
+    LLVMBuilder->CreateBr(DoneBlock);
+    LLVMBuilder->SetInsertPoint(DoneBlock);
+  }
+  LLVMBuilder->CreateRetVoid();
 }
 
 bool GenIR::doTailCallOpt() { return JitContext->Options->DoTailCallOpt; }
 
 // Set the Debug Location for the current instruction
 void GenIR::setDebugLocation(uint32_t CurrOffset, bool IsCall) {
-  assert(LLILCDebugInfo.FunctionScope != nullptr);
+  if (LLILCDebugInfo.FunctionScope == nullptr) {
+    // The EE did not ask for debug info.
+    return;
+  }
 
   DebugLoc Loc =
       DebugLoc::get(CurrOffset, IsCall, LLILCDebugInfo.FunctionScope);
@@ -1576,9 +2107,9 @@ llvm::DIType *GenIR::convertType(Type *Ty) {
   }
 
   if (Ty->isPointerTy()) {
-    uint64_t Size = JitContext->TM->createDataLayout().getPointerTypeSize(Ty);
-    uint64_t Align =
-        JitContext->TM->createDataLayout().getPrefTypeAlignment(Ty);
+    const DataLayout &DL = JitContext->CurrentModule->getDataLayout();
+    uint64_t Size = DL.getPointerTypeSize(Ty);
+    uint64_t Align = DL.getPrefTypeAlignment(Ty);
     llvm::DIType *DbgTy = DBuilder->createPointerType(
         convertType(Ty->getPointerElementType()), Size, Align);
 
@@ -1623,6 +2154,23 @@ bool GenIR::doSimdIntrinsicOpt() {
   return JitContext->Options->DoSIMDIntrinsic;
 }
 
+bool GenIR::doDevirtualization() {
+  return JitContext->Options->EnableOptimization;
+}
+
+bool GenIR::doNamedIntrinsicExpansion() {
+  // Debuggable code keeps the calls, so that they can be stepped into.
+  return JitContext->Options->EnableOptimization;
+}
+
+bool GenIR::doBoxPeepholes() {
+  return JitContext->Options->EnableOptimization;
+}
+
+bool GenIR::useAtypicalCallSites() {
+  return JitContext->UseAtypicalCallSites;
+}
+
 #pragma endregion
 
 #pragma region DIAGNOSTICS
@@ -2016,8 +2564,9 @@ Type *GenIR::getClassTypeWorker(
   // for arrays with <element type, element handle, array rank> tuple as key.
   if (IsArray) {
     ArrayElementType = getChildType(ClassHandle, &ArrayElementHandle);
-    auto MapElement = ArrayTypeMap->find(std::make_tuple(
-        ArrayElementType, ArrayElementHandle, ArrayRank, IsVector));
+    auto MapElement = ArrayTypeMap->find(
+        LLILCJitPerThreadState::getArrayTypeKey(
+            ArrayElementType, ArrayElementHandle, ArrayRank, IsVector));
     if (MapElement != ArrayTypeMap->end()) {
       ResultTy = MapElement->second;
     }
@@ -2064,8 +2613,9 @@ Type *GenIR::getClassTypeWorker(
     ResultTy =
         IsRefClass ? (Type *)getManagedPointerType(StructTy) : (Type *)StructTy;
     if (IsArray) {
-      (*ArrayTypeMap)[std::make_tuple(ArrayElementType, ArrayElementHandle,
-                                      ArrayRank, IsVector)] = ResultTy;
+      (*ArrayTypeMap)[LLILCJitPerThreadState::getArrayTypeKey(
+          ArrayElementType, ArrayElementHandle, ArrayRank, IsVector)] =
+          ResultTy;
     } else {
       (*ClassTypeMap)[ClassHandle] = ResultTy;
       (*ReverseClassTypeMap)[ResultTy] = ClassHandle;
@@ -2103,10 +2653,11 @@ Type *GenIR::getClassTypeWorker(
   // .Net only allows single inheritance so we know that
   // parent class's layout forms a prefix for this class's layout.
   //
-  // Note getClassNumInstanceFields includes fields from
-  // all ancestor classes. We'll need to subtract those out to figure
-  // out how many fields this class uniquely contributes.
-  const uint32_t NumFields = getClassNumInstanceFields(ClassHandle);
+  // The EE's facts about the layout come from the shared cache, so that
+  // each thread need not ask the EE about each class again.
+  std::shared_ptr<const ClassLayout> Layout =
+      getClassLayout(ClassHandle, IsRefClass);
+  const uint32_t NumFields = Layout->NumInstanceFields;
   std::vector<Type *> Fields;
   uint32_t ByteOffset = 0;
   uint32_t NumParentFields = 0;
@@ -2139,43 +2690,8 @@ Type *GenIR::getClassTypeWorker(
     }
   }
 
-  uint32_t EEClassSize = 0;
-  bool HaveClassSize = false;
-  if (!IsRefClass) {
-    try {
-      EEClassSize = getClassSize(ClassHandle);
-      HaveClassSize = true;
-    } catch (...) {
-      // In ReadyToRun mode a call to getClassSize triggers encoding of special
-      // fixups in the image so that the runtime can verify the assumptions
-      // about value type layouts before native code can be used. The runtime
-      // will fall back to jit if value type layout changed. Currently
-      // encoding of fixups is limited to just the existing assembly references.
-      // If the jit asks about a valuetype from an assembly that's not
-      // referenced from the current assembly, an exception is thrown.
-      // Consider this example:
-      //   Assembly A: public struct SA { SB b; }
-      //   Assembly B : public struct  SB { SC c; }
-      //   Assembly C : public struct  SC {}
-      // If we are compiling a method in A and creating a type for
-      // SA, we'll eventually get to SC. Since C is not referenced from A, the
-      // call to getClassSize will throw.
-      // Catching and swallowing the exception should be safe as long as
-      // we won't use SC directly, only as part of SB or SA. Any change in SC
-      // layout will change the SA and SB layout and the runtime will detect
-      // those changes.
-      // The LLVM type for SC may miss padding at the end. That shouldn't be a
-      // problem since we'll insert the missing padding in the enclosing struct
-      // (SB in this case).
-      // The long-term plan of record is to get framework build-time tooling in
-      // place that marks valuetype layout changes as breaking changes. With
-      // that in place getClassSize won't throw.
-      // TODO: we may want to add validation that the exception is caught only
-      // for types that are embedded into other types.
-      assert(JitContext->Flags & CORJIT_FLG_READYTORUN);
-      HaveClassSize = false;
-    }
-  }
+  const uint32_t EEClassSize = Layout->Size;
+  const bool HaveClassSize = (EEClassSize != 0);
 
   // System.Object is a special case, it has no explicit
   // fields but we need to account for the vtable slot.
@@ -2194,8 +2710,7 @@ Type *GenIR::getClassTypeWorker(
     // If we have a ref class, make sure the parent class
     // field information is filled in first.
     if (IsRefClass) {
-      CORINFO_CLASS_HANDLE ParentClassHandle =
-          JitContext->JitInfo->getParentType(ClassHandle);
+      CORINFO_CLASS_HANDLE ParentClassHandle = Layout->ParentClassHandle;
 
       if (ParentClassHandle != nullptr) {
         // It's always ok to ask for the details of a parent type.
@@ -2214,7 +2729,8 @@ Type *GenIR::getClassTypeWorker(
         }
 
         // Set number of parent fields and cumulative offset into this object.
-        NumParentFields = getClassNumInstanceFields(ParentClassHandle);
+        NumParentFields =
+            getClassLayout(ParentClassHandle, IsRefClass)->NumInstanceFields;
         ByteOffset = DataLayout->getTypeSizeInBits(ParentTy) / 8;
       } else {
         NumParentFields = 0;
@@ -2222,31 +2738,10 @@ Type *GenIR::getClassTypeWorker(
       }
     }
 
-    // Determine how many fields are added at this level of derivation.
+    // The fields (if any) contributed by this class, in increasing order
+    // of offset.
     ASSERT(NumFields >= NumParentFields);
-    const uint32_t NumDerivedFields = NumFields - NumParentFields;
-
-    // Add the fields (if any) contributed by this class.
-    // We need to add them in increasing order of offset, but the EE
-    // gives them to us in somewhat arbitrary order. So we have to sort.
-    std::vector<std::pair<uint32_t, CORINFO_FIELD_HANDLE>> DerivedFields;
-
-    for (uint32_t I = 0; I < NumDerivedFields; I++) {
-      CORINFO_FIELD_HANDLE FieldHandle = getFieldInClass(ClassHandle, I);
-      if (FieldHandle == nullptr) {
-        // Likely a class that derives from System.__ComObject. See
-        // LLILC issue #557. We'll just have to cope with an incomplete
-        // picture of this type.
-        assert(IsRefClass && "need to see all fields of value classes");
-        break;
-      }
-      const uint32_t FieldOffset = getFieldOffset(FieldHandle);
-      DerivedFields.push_back(std::make_pair(FieldOffset, FieldHandle));
-    }
-
-    // Putting offset first in the pair lets us use the
-    // default comparator here.
-    std::sort(DerivedFields.begin(), DerivedFields.end());
+    const std::vector<FieldLayout> &DerivedFields = Layout->Fields;
 
     // If we find overlapping fields, we'll stash them here so we can look
     // at them collectively.
@@ -2254,9 +2749,9 @@ Type *GenIR::getClassTypeWorker(
 
     // Now walk the fields in increasing offset order, adding
     // them and padding to the struct as we go.
-    for (const auto &FieldPair : DerivedFields) {
-      const uint32_t FieldOffset = FieldPair.first;
-      CORINFO_FIELD_HANDLE FieldHandle = FieldPair.second;
+    for (const FieldLayout &Field : DerivedFields) {
+      const uint32_t FieldOffset = Field.Offset;
+      CORINFO_FIELD_HANDLE FieldHandle = Field.Handle;
 
       // Prepare to add this field to the collection.
       //
@@ -2269,8 +2764,8 @@ Type *GenIR::getClassTypeWorker(
       //
       // We need to know the size of A before we can finish B. So we can't
       // ask for B's details while filling out A.
-      CORINFO_CLASS_HANDLE FieldClassHandle;
-      CorInfoType CorInfoType = getFieldType(FieldHandle, &FieldClassHandle);
+      CORINFO_CLASS_HANDLE FieldClassHandle = Field.ClassHandle;
+      CorInfoType CorInfoType = Field.CorType;
 
       const bool GetAggregateFields = ((CorInfoType != CORINFO_TYPE_CLASS) &&
                                        (CorInfoType != CORINFO_TYPE_PTR) &&
@@ -2346,15 +2841,14 @@ Type *GenIR::getClassTypeWorker(
       // The first field of a typed byref is really GC (interior)
       // pointer. It's described in metadata as a pointer-sized integer.
       // Tweak it back...
-      if (IsTypedByref && (FieldHandle == DerivedFields[0].second)) {
+      if (IsTypedByref && (FieldHandle == DerivedFields.front().Handle)) {
         FieldTy = getManagedPointerType(FieldTy);
       }
 
       // The last field of a string is really the start of an array
       // of characters. In LLVM we use a zero-sized array to
       // describe this.
-      if (IsString &&
-          (FieldHandle == DerivedFields[NumDerivedFields - 1].second)) {
+      if (IsString && (FieldHandle == DerivedFields.back().Handle)) {
         FieldTy = ArrayType::get(FieldTy, 0);
       }
 
@@ -2463,6 +2957,99 @@ Type *GenIR::getClassTypeWorker(
   return ResultTy;
 }
 
+std::shared_ptr<const ClassLayout>
+GenIR::getClassLayout(CORINFO_CLASS_HANDLE ClassHandle, bool IsRefClass) {
+  std::shared_ptr<const ClassLayout> Layout =
+      ClassLayouts->lookup(ClassHandle);
+  if (Layout != nullptr) {
+    return Layout;
+  }
+
+  std::unique_ptr<ClassLayout> NewLayout = llvm::make_unique<ClassLayout>();
+
+  // Note getClassNumInstanceFields includes fields from
+  // all ancestor classes. We'll need to subtract those out to figure
+  // out how many fields this class uniquely contributes.
+  const uint32_t NumFields = getClassNumInstanceFields(ClassHandle);
+  NewLayout->NumInstanceFields = NumFields;
+  NewLayout->ParentClassHandle = nullptr;
+  NewLayout->Size = 0;
+
+  uint32_t NumParentFields = 0;
+  if (IsRefClass) {
+    CORINFO_CLASS_HANDLE ParentClassHandle =
+        JitContext->JitInfo->getParentType(ClassHandle);
+    NewLayout->ParentClassHandle = ParentClassHandle;
+    if (ParentClassHandle != nullptr) {
+      NumParentFields =
+          getClassLayout(ParentClassHandle, IsRefClass)->NumInstanceFields;
+    }
+  } else {
+    try {
+      NewLayout->Size = getClassSize(ClassHandle);
+    } catch (...) {
+      // In ReadyToRun mode a call to getClassSize triggers encoding of special
+      // fixups in the image so that the runtime can verify the assumptions
+      // about value type layouts before native code can be used. The runtime
+      // will fall back to jit if value type layout changed. Currently
+      // encoding of fixups is limited to just the existing assembly references.
+      // If the jit asks about a valuetype from an assembly that's not
+      // referenced from the current assembly, an exception is thrown.
+      // Consider this example:
+      //   Assembly A: public struct SA { SB b; }
+      //   Assembly B : public struct  SB { SC c; }
+      //   Assembly C : public struct  SC {}
+      // If we are compiling a method in A and creating a type for
+      // SA, we'll eventually get to SC. Since C is not referenced from A, the
+      // call to getClassSize will throw.
+      // Catching and swallowing the exception should be safe as long as
+      // we won't use SC directly, only as part of SB or SA. Any change in SC
+      // layout will change the SA and SB layout and the runtime will detect
+      // those changes.
+      // The LLVM type for SC may miss padding at the end. That shouldn't be a
+      // problem since we'll insert the missing padding in the enclosing struct
+      // (SB in this case).
+      // The long-term plan of record is to get framework build-time tooling in
+      // place that marks valuetype layout changes as breaking changes. With
+      // that in place getClassSize won't throw.
+      // TODO: we may want to add validation that the exception is caught only
+      // for types that are embedded into other types.
+      assert(JitContext->Flags & CORJIT_FLG_READYTORUN);
+      NewLayout->Size = 0;
+    }
+  }
+
+  // Determine how many fields are added at this level of derivation.
+  ASSERT(NumFields >= NumParentFields);
+  const uint32_t NumDerivedFields = NumFields - NumParentFields;
+
+  for (uint32_t I = 0; I < NumDerivedFields; I++) {
+    CORINFO_FIELD_HANDLE FieldHandle = getFieldInClass(ClassHandle, I);
+    if (FieldHandle == nullptr) {
+      // Likely a class that derives from System.__ComObject. See
+      // LLILC issue #557. We'll just have to cope with an incomplete
+      // picture of this type.
+      assert(IsRefClass && "need to see all fields of value classes");
+      break;
+    }
+    FieldLayout Field;
+    Field.Offset = getFieldOffset(FieldHandle);
+    Field.Handle = FieldHandle;
+    Field.CorType = getFieldType(FieldHandle, &Field.ClassHandle);
+    NewLayout->Fields.push_back(Field);
+  }
+
+  // The fields are needed in increasing order of offset, but the EE
+  // gives them to us in somewhat arbitrary order. So we have to sort.
+  std::sort(NewLayout->Fields.begin(), NewLayout->Fields.end(),
+            [](const FieldLayout &Field1, const FieldLayout &Field2) {
+              return std::make_pair(Field1.Offset, Field1.Handle) <
+                     std::make_pair(Field2.Offset, Field2.Handle);
+            });
+
+  return ClassLayouts->insert(ClassHandle, std::move(NewLayout));
+}
+
 void GenIR::addFieldsRecursively(
     std::vector<std::pair<uint32_t, llvm::Type *>> &Fields, uint32_t Offset,
     llvm::Type *Ty) {
@@ -3679,17 +4266,210 @@ bool fgEdgeIteratorIsEnd(FlowGraphEdgeIterator &FgEdgeIterator) {
   return FgEdgeIterator.isEnd();
 }
 
-// Small helper function that gets the next IDOM. It was pulled out-of-line
-// so that it can be called in a loop in FgNodeGetIDom.
-// TODO (Issue #38): currently we conservatively return single predecessor
-// without
-// computing the immediate dominator.
-FlowGraphNode *getNextIDom(FlowGraphNode *FgNode) {
+// Blocks created while reading the MSIL are not in the dominator tree
+// computed from the flow graph; for those, conservatively fall back to the
+// single predecessor.
+FlowGraphNode *GenIR::fgNodeGetNextIDom(FlowGraphNode *FgNode) {
+  auto MapElem = FlowGraphInfoMap.find(FgNode);
+  if ((MapElem != FlowGraphInfoMap.end()) &&
+      (MapElem->second.IDom != nullptr)) {
+    return MapElem->second.IDom;
+  }
   return (FlowGraphNode *)FgNode->getSinglePredecessor();
 }
 
+void GenIR::fgGetReversePostOrder(
+    std::vector<FlowGraphNode *> &Order,
+    DenseMap<FlowGraphNode *, SmallVector<FlowGraphNode *, 2>> &Predecessors) {
+  FlowGraphNode *Entry = fgGetHeadBlock();
+
+  // Gather the successors of each block, adding an edge from the entry to
+  // the first block of each handler.
+  DenseMap<FlowGraphNode *, SmallVector<FlowGraphNode *, 2>> Successors;
+  for (BasicBlock &Block : *Function) {
+    FlowGraphNode *Node = (FlowGraphNode *)&Block;
+    SmallVector<FlowGraphNode *, 2> &NodeSuccessors = Successors[Node];
+    for (FlowGraphEdgeIterator SuccessorIterator = fgNodeGetSuccessors(Node);
+         !fgEdgeIteratorIsEnd(SuccessorIterator);
+         fgEdgeIteratorMoveNextSuccessor(SuccessorIterator)) {
+      NodeSuccessors.push_back(fgEdgeIteratorGetSink(SuccessorIterator));
+    }
+
+    auto MapElem = FlowGraphInfoMap.find(Node);
+    if (MapElem == FlowGraphInfoMap.end()) {
+      continue;
+    }
+    EHRegion *Region = MapElem->second.Region;
+    if ((Region == nullptr) ||
+        (MapElem->second.StartMSILOffset != rgnGetStartMSILOffset(Region))) {
+      continue;
+    }
+    ReaderBaseNS::RegionKind Kind = rgnGetRegionType(Region);
+    if ((Kind != ReaderBaseNS::RegionKind::RGN_Root) &&
+        (Kind != ReaderBaseNS::RegionKind::RGN_Try)) {
+      Successors[Entry].push_back(Node);
+    }
+  }
+
+  // Order the reachable blocks in reverse postorder.
+  SmallVector<std::pair<FlowGraphNode *, uint32_t>, 16> Stack;
+  DenseSet<FlowGraphNode *> Seen;
+  Stack.push_back(std::make_pair(Entry, 0U));
+  Seen.insert(Entry);
+  while (!Stack.empty()) {
+    FlowGraphNode *Node = Stack.back().first;
+    uint32_t Index = Stack.back().second++;
+    SmallVector<FlowGraphNode *, 2> &NodeSuccessors = Successors[Node];
+    if (Index < NodeSuccessors.size()) {
+      FlowGraphNode *Successor = NodeSuccessors[Index];
+      if (Seen.insert(Successor).second) {
+        Stack.push_back(std::make_pair(Successor, 0U));
+      }
+      continue;
+    }
+    Order.push_back(Node);
+    Stack.pop_back();
+  }
+  std::reverse(Order.begin(), Order.end());
+
+  for (FlowGraphNode *Node : Order) {
+    for (FlowGraphNode *Successor : Successors[Node]) {
+      Predecessors[Successor].push_back(Node);
+    }
+  }
+}
+
+void GenIR::fgComputeDominators() {
+  FlowGraphNode *Entry = fgGetHeadBlock();
+  std::vector<FlowGraphNode *> Order;
+  DenseMap<FlowGraphNode *, SmallVector<FlowGraphNode *, 2>> Predecessors;
+  fgGetReversePostOrder(Order, Predecessors);
+
+  DenseMap<FlowGraphNode *, uint32_t> PostOrderNumber;
+  for (uint32_t I = 0; I < Order.size(); I++) {
+    PostOrderNumber[Order[I]] = Order.size() - 1 - I;
+  }
+
+  // Iterate to a fixed point with the algorithm of Cooper, Harvey and
+  // Kennedy, "A Simple, Fast Dominance Algorithm".
+  DenseMap<FlowGraphNode *, FlowGraphNode *> IDoms;
+  IDoms[Entry] = Entry;
+  auto Intersect = [&](FlowGraphNode *Node1, FlowGraphNode *Node2) {
+    while (Node1 != Node2) {
+      while (PostOrderNumber[Node1] < PostOrderNumber[Node2]) {
+        Node1 = IDoms[Node1];
+      }
+      while (PostOrderNumber[Node2] < PostOrderNumber[Node1]) {
+        Node2 = IDoms[Node2];
+      }
+    }
+    return Node1;
+  };
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (FlowGraphNode *Node : Order) {
+      if (Node == Entry) {
+        continue;
+      }
+      FlowGraphNode *NewIDom = nullptr;
+      for (FlowGraphNode *Predecessor : Predecessors[Node]) {
+        if (IDoms.lookup(Predecessor) == nullptr) {
+          continue;
+        }
+        NewIDom = (NewIDom == nullptr) ? Predecessor
+                                       : Intersect(Predecessor, NewIDom);
+      }
+      if (IDoms[Node] != NewIDom) {
+        IDoms[Node] = NewIDom;
+        Changed = true;
+      }
+    }
+  }
+
+  for (FlowGraphNode *Node : Order) {
+    if (Node != Entry) {
+      FlowGraphInfoMap[Node].IDom = IDoms[Node];
+    }
+  }
+}
+
+BitVector GenIR::fgFindLocalsReadBeforeWritten() {
+  const uint32_t NumLocals = LocalVars.size();
+  FlowGraphNode *Entry = fgGetHeadBlock();
+  std::vector<FlowGraphNode *> Order;
+  DenseMap<FlowGraphNode *, SmallVector<FlowGraphNode *, 2>> Predecessors;
+  fgGetReversePostOrder(Order, Predecessors);
+
+  // Summarize each block by the locals it may read before writing them, and
+  // the locals it writes. Taking a local's address counts as a read.
+  DenseMap<FlowGraphNode *, BitVector> Reads;
+  DenseMap<FlowGraphNode *, BitVector> Writes;
+  for (FlowGraphNode *Node : Order) {
+    BitVector NodeReads(NumLocals);
+    BitVector NodeWrites(NumLocals);
+    auto MapElem = FlowGraphInfoMap.find(Node);
+    if (MapElem != FlowGraphInfoMap.end()) {
+      uint32_t Offset = MapElem->second.StartMSILOffset;
+      const uint32_t EndOffset = MapElem->second.EndMSILOffset;
+      while (Offset < EndOffset) {
+        ReaderBaseNS::OPCODE Opcode;
+        uint8_t *Operand;
+        const bool ReportErrors = false;
+        Offset = getDecodedMSILInstr(Offset, &Opcode, &Operand, ReportErrors);
+        uint32_t LocalNum = 0;
+        MSILLocalAccess Access = getMSILLocalAccess(Opcode, Operand, &LocalNum);
+        if ((Access == MSILLocalAccess::None) || (LocalNum >= NumLocals)) {
+          continue;
+        }
+        if (Access == MSILLocalAccess::Store) {
+          NodeWrites.set(LocalNum);
+        } else if (!NodeWrites.test(LocalNum)) {
+          NodeReads.set(LocalNum);
+        }
+      }
+    }
+    Reads[Node] = NodeReads;
+    Writes[Node] = NodeWrites;
+  }
+
+  // Find the locals written on every path to each block. This starts out
+  // optimistic for all blocks but the entry and shrinks to a fixed point.
+  DenseMap<FlowGraphNode *, BitVector> WrittenOnEntry;
+  for (FlowGraphNode *Node : Order) {
+    WrittenOnEntry[Node] = BitVector(NumLocals, Node != Entry);
+  }
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (FlowGraphNode *Node : Order) {
+      if (Node == Entry) {
+        continue;
+      }
+      BitVector NewWritten(NumLocals, true);
+      for (FlowGraphNode *Predecessor : Predecessors[Node]) {
+        BitVector PredecessorWritten = WrittenOnEntry[Predecessor];
+        PredecessorWritten |= Writes[Predecessor];
+        NewWritten &= PredecessorWritten;
+      }
+      if (NewWritten != WrittenOnEntry[Node]) {
+        WrittenOnEntry[Node] = NewWritten;
+        Changed = true;
+      }
+    }
+  }
+
+  BitVector ReadBeforeWritten(NumLocals);
+  for (FlowGraphNode *Node : Order) {
+    BitVector NodeReads = Reads[Node];
+    NodeReads.reset(WrittenOnEntry[Node]);
+    ReadBeforeWritten |= NodeReads;
+  }
+  return ReadBeforeWritten;
+}
+
 FlowGraphNode *GenIR::fgNodeGetIDom(FlowGraphNode *FgNode) {
-  FlowGraphNode *Idom = getNextIDom(FgNode);
+  FlowGraphNode *Idom = fgNodeGetNextIDom(FgNode);
 
   //  If the dominating block is in an EH region
   //  and the original block is not in the same region, then this
@@ -3698,7 +4478,7 @@ FlowGraphNode *GenIR::fgNodeGetIDom(FlowGraphNode *FgNode) {
   //  block or there are no more blocks.
   while (nullptr != Idom && fgNodeGetRegion(Idom) != EhRegionTree &&
          fgNodeGetRegion(Idom) != fgNodeGetRegion(FgNode)) {
-    Idom = getNextIDom(Idom);
+    Idom = fgNodeGetNextIDom(Idom);
   }
 
   return Idom;
@@ -3825,7 +4605,149 @@ void GenIR::fgAddLabelToBranchList(IRNode *LabelNode, IRNode *BranchNode) {
   return;
 }
 
-void GenIR::insertIBCAnnotations() { return; }
+void GenIR::insertIBCAnnotations() {
+  const bool CollectCounts = (JitContext->Flags & CORJIT_FLG_BBINSTR) != 0;
+  const bool UseCounts = JitContext->Options->EnableOptimization &&
+                         ((JitContext->Flags & CORJIT_FLG_BBOPT) != 0);
+  if (!CollectCounts && !UseCounts) {
+    return;
+  }
+
+  // Gather the blocks that start MSIL ranges, in MSIL order. Handlers are
+  // left out, since they are rarely run, and their blocks must begin with
+  // their EH pads.
+  std::vector<std::pair<uint32_t, FlowGraphNode *>> Blocks;
+  for (BasicBlock &Block : *Function) {
+    auto MapElem = FlowGraphInfoMap.find(&Block);
+    if ((MapElem == FlowGraphInfoMap.end()) ||
+        (MapElem->second.StartMSILOffset >= MapElem->second.EndMSILOffset)) {
+      continue;
+    }
+    bool IsInHandler = false;
+    for (EHRegion *Region = MapElem->second.Region; Region != nullptr;
+         Region = rgnGetEnclosingAncestor(Region)) {
+      IsInHandler |= rgnIsOutsideParent(Region);
+    }
+    if (!IsInHandler) {
+      Blocks.push_back(std::make_pair(MapElem->second.StartMSILOffset, &Block));
+    }
+  }
+  std::sort(Blocks.begin(), Blocks.end());
+  if (Blocks.empty()) {
+    return;
+  }
+
+  // The counts, or the buffer collecting them, are only good for this
+  // process.
+  JitContext->IsCacheable = false;
+
+  if (CollectCounts) {
+    HRESULT Result = JitInfo->allocBBProfileBuffer(Blocks.size(),
+                                                   &BlockProfileBuffer);
+    if (FAILED(Result) || (BlockProfileBuffer == nullptr)) {
+      BlockProfileBuffer = nullptr;
+      return;
+    }
+    for (uint32_t I = 0; I < Blocks.size(); I++) {
+      BlockProfileBuffer[I].ILOffset = Blocks[I].first;
+      BlockProfileBuffer[I].ExecutionCount = 0;
+      insertIBCAnnotation(Blocks[I].second, I, Blocks[I].first);
+    }
+    return;
+  }
+
+  ULONG Count = 0;
+  ULONG NumRuns = 0;
+  ICorJitInfo::ProfileBuffer *Profile = nullptr;
+  HRESULT Result = JitInfo->getBBProfileData(getCurrentMethodHandle(), &Count,
+                                             &Profile, &NumRuns);
+  if (FAILED(Result) || (Profile == nullptr)) {
+    return;
+  }
+
+  std::map<uint32_t, uint32_t> OffsetCounts;
+  for (ULONG I = 0; I < Count; I++) {
+    OffsetCounts[Profile[I].ILOffset] = Profile[I].ExecutionCount;
+  }
+  for (const auto &Block : Blocks) {
+    auto CountElem = OffsetCounts.find(Block.first);
+    if (CountElem != OffsetCounts.end()) {
+      BlockProfileCounts[Block.second] = CountElem->second;
+    }
+  }
+
+  // The block at offset 0 runs once for each call of the method.
+  auto EntryElem = OffsetCounts.find(0);
+  if (EntryElem != OffsetCounts.end()) {
+    Function->setEntryCount(EntryElem->second);
+  }
+}
+
+IRNode *GenIR::insertIBCAnnotation(FlowGraphNode *Node, uint32_t Count,
+                                   uint32_t Offset) {
+  assert(BlockProfileBuffer != nullptr);
+  assert(BlockProfileBuffer[Count].ILOffset == Offset);
+
+  // Bump the count at the start of the block. The increment is not atomic:
+  // counts lost to races do not matter for block layout.
+  IRBuilder<>::InsertPoint SavedInsertPoint = LLVMBuilder->saveIP();
+  Instruction *Terminator = Node->getTerminator();
+  if (Terminator != nullptr) {
+    LLVMBuilder->SetInsertPoint(Terminator);
+  } else {
+    LLVMBuilder->SetInsertPoint(Node);
+  }
+
+  // The count's address is reported to the EE as a relocation, like other
+  // addresses the EE hands out.
+  Type *CountTy = Type::getInt32Ty(*JitContext->LLVMContext);
+  void *CountHandle = &BlockProfileBuffer[Count].ExecutionCount;
+  const bool IsIndirect = false;
+  const bool IsReadOnly = false;
+  const bool IsRelocatable = true;
+  const bool IsCallTarget = false;
+  IRNode *CountAddressValue =
+      handleToIRNode("BlockCount", CountHandle, CountHandle, IsIndirect,
+                     IsReadOnly, IsRelocatable, IsCallTarget);
+  Value *CountAddress = LLVMBuilder->CreateIntToPtr(
+      CountAddressValue, getUnmanagedPointerType(CountTy));
+  Value *OldCount = LLVMBuilder->CreateLoad(CountAddress);
+  Value *NewCount =
+      LLVMBuilder->CreateAdd(OldCount, ConstantInt::get(CountTy, 1));
+  StoreInst *Store = LLVMBuilder->CreateStore(NewCount, CountAddress);
+
+  LLVMBuilder->restoreIP(SavedInsertPoint);
+  return (IRNode *)Store;
+}
+
+void GenIR::addProfileBranchWeights() {
+  MDBuilder Builder(*JitContext->LLVMContext);
+  for (BasicBlock &Block : *Function) {
+    TerminatorInst *Terminator = Block.getTerminator();
+    if ((Terminator == nullptr) || (Terminator->getNumSuccessors() < 2) ||
+        (Terminator->getMetadata(LLVMContext::MD_prof) != nullptr) ||
+        !(isa<BranchInst>(Terminator) || isa<SwitchInst>(Terminator))) {
+      continue;
+    }
+
+    // Weight each edge by the count of its target. A target with other
+    // predecessors overstates the edge, but keeps the hot path hot. The
+    // weights are biased by one so that they are never all zero.
+    SmallVector<uint32_t, 4> Weights;
+    for (BasicBlock *Successor : Terminator->successors()) {
+      auto CountElem = BlockProfileCounts.find(Successor);
+      if (CountElem == BlockProfileCounts.end()) {
+        break;
+      }
+      uint64_t Weight = std::min<uint64_t>(CountElem->second, UINT32_MAX - 1);
+      Weights.push_back(Weight + 1);
+    }
+    if (Weights.size() == Terminator->getNumSuccessors()) {
+      Terminator->setMetadata(LLVMContext::MD_prof,
+                              Builder.createBranchWeights(Weights));
+    }
+  }
+}
 
 IRNode *GenIR::fgNodeFindStartLabel(FlowGraphNode *Block) { return nullptr; }
 
@@ -3887,9 +4809,12 @@ IRNode *GenIR::loadLen(IRNode *Array, bool ArrayMayBeNull) {
   // Length field is at index 1. Get its address.
   Value *LengthFieldAddress = LLVMBuilder->CreateStructGEP(nullptr, Array, 1);
 
-  // Load and return the length.
-  // TODO: this load cannot be aliased.
-  Value *Length = makeLoad(LengthFieldAddress, false, ArrayMayBeNull);
+  // Load and return the length. An array's length never changes, so the
+  // load is invariant; this lets it be hoisted out of loops and shared by
+  // the bounds checks of the accesses to the array.
+  LoadInst *Length = makeLoad(LengthFieldAddress, false, ArrayMayBeNull);
+  Length->setMetadata(LLVMContext::MD_invariant_load,
+                      MDNode::get(*JitContext->LLVMContext, None));
 
   // Result is an unsigned native int.
   IRNode *Result = convertToStackType((IRNode *)Length,
@@ -3922,9 +4847,11 @@ IRNode *GenIR::loadStringLen(IRNode *Address) {
   // Length field is at field index 1. Get its address.
   Value *LengthFieldAddress = LLVMBuilder->CreateStructGEP(nullptr, Address, 1);
 
-  // Load and return the length.
-  // TODO: this load cannot be aliased.
-  Value *Length = makeLoad(LengthFieldAddress, false, !NullCheckBeforeLoad);
+  // Load and return the length. A string's length never changes, so the
+  // load is invariant.
+  LoadInst *Length = makeLoad(LengthFieldAddress, false, !NullCheckBeforeLoad);
+  Length->setMetadata(LLVMContext::MD_invariant_load,
+                      MDNode::get(*JitContext->LLVMContext, None));
   return (IRNode *)Length;
 }
 
@@ -4695,8 +5622,10 @@ IRNode *GenIR::loadField(CORINFO_RESOLVED_TOKEN *ResolvedToken, IRNode *Obj,
   IRNode *Address =
       getFieldAddress(ResolvedToken, &FieldInfo, Obj, NullCheckBeforeLoad);
 
+  MDNode *TBAATag = getFieldTBAATag(ResolvedToken->hField);
   return loadAtAddress(Address, FieldTy, CorInfoType, ResolvedToken,
-                       AlignmentPrefix, IsVolatile, !NullCheckBeforeLoad);
+                       AlignmentPrefix, IsVolatile, !NullCheckBeforeLoad,
+                       TBAATag);
 }
 
 // Generate instructions for loading value of the specified type at the
@@ -4704,7 +5633,7 @@ IRNode *GenIR::loadField(CORINFO_RESOLVED_TOKEN *ResolvedToken, IRNode *Obj,
 IRNode *GenIR::loadAtAddress(IRNode *Address, Type *Ty, CorInfoType CorType,
                              CORINFO_RESOLVED_TOKEN *ResolvedToken,
                              ReaderAlignType AlignmentPrefix, bool IsVolatile,
-                             bool AddressMayBeNull) {
+                             bool AddressMayBeNull, MDNode *TBAATag) {
   if (Ty->isStructTy()) {
     bool IsFieldAccess = ResolvedToken->hField != nullptr;
     return loadObj(ResolvedToken, Address, AlignmentPrefix, IsVolatile,
@@ -4713,6 +5642,9 @@ IRNode *GenIR::loadAtAddress(IRNode *Address, Type *Ty, CorInfoType CorType,
     LoadInst *LoadInst = makeLoad(Address, IsVolatile, AddressMayBeNull);
     uint32_t Align = convertReaderAlignment(AlignmentPrefix);
     LoadInst->setAlignment(Align);
+    if (TBAATag != nullptr) {
+      LoadInst->setMetadata(LLVMContext::MD_tbaa, TBAATag);
+    }
 
     IRNode *Result = convertToStackType((IRNode *)LoadInst, CorType);
 
@@ -4745,7 +5677,8 @@ IRNode *GenIR::loadAtAddress(IRNode *Address, Type *Ty, CorInfoType CorType,
 void GenIR::storeAtAddress(IRNode *Address, IRNode *ValueToStore, Type *Ty,
                            CORINFO_RESOLVED_TOKEN *ResolvedToken,
                            ReaderAlignType Alignment, bool IsVolatile,
-                           bool IsField, bool AddressMayBeNull) {
+                           bool IsField, bool AddressMayBeNull,
+                           MDNode *TBAATag) {
   // We do things differently based on whether the field is a value class.
   if (Ty->isStructTy()) {
     storeObj(ResolvedToken, ValueToStore, Address, Alignment, IsVolatile,
@@ -4755,6 +5688,9 @@ void GenIR::storeAtAddress(IRNode *Address, IRNode *ValueToStore, Type *Ty,
         makeStore(ValueToStore, Address, IsVolatile, AddressMayBeNull);
     uint32_t Align = convertReaderAlignment(Alignment);
     StoreInst->setAlignment(Align);
+    if (TBAATag != nullptr) {
+      StoreInst->setMetadata(LLVMContext::MD_tbaa, TBAATag);
+    }
   }
 }
 
@@ -4833,14 +5769,21 @@ void GenIR::storeField(CORINFO_RESOLVED_TOKEN *FieldToken, IRNode *ValueToStore,
   const bool NeedsWriteBarrier =
       JitContext->JitInfo->isWriteBarrierHelperRequired(FieldHandle);
   if (NeedsWriteBarrier) {
+    // Fields of reference types are always on the heap, so we can use an
+    // unchecked write barrier for them.
+    CORINFO_CLASS_HANDLE OwnerClass = getFieldClass(FieldHandle);
+    const bool IsUnchecked =
+        (getClassAttribs(OwnerClass) & CORINFO_FLG_VALUECLASS) == 0;
     rdrCallWriteBarrierHelper(Address, ValueToStore, Alignment, IsVolatile,
-                              FieldToken, !IsStructTy, false, true, false);
+                              FieldToken, !IsStructTy, false, true,
+                              IsUnchecked);
     return;
   }
 
   bool IsField = true;
+  MDNode *TBAATag = getFieldTBAATag(FieldHandle);
   return storeAtAddress(Address, ValueToStore, FieldTy, FieldToken, Alignment,
-                        IsVolatile, IsField, !NullCheckBeforeStore);
+                        IsVolatile, IsField, !NullCheckBeforeStore, TBAATag);
 }
 
 void GenIR::storePrimitiveType(IRNode *Value, IRNode *Addr,
@@ -4929,6 +5872,12 @@ StoreInst *GenIR::makeStore(Value *ValueToStore, Value *Address,
       // to generate.
     }
   }
+  if (IsVolatile) {
+    // A volatile store has release semantics: no earlier access may move
+    // after it. On x64 this only constrains the optimizer, since stores are
+    // not reordered with earlier accesses.
+    LLVMBuilder->CreateFence(Release);
+  }
   if (ValueToStore->getType()->isVectorTy()) {
     return LLVMBuilder->CreateAlignedStore(ValueToStore, Address, 1,
                                            IsVolatile);
@@ -4948,11 +5897,20 @@ LoadInst *GenIR::makeLoad(Value *Address, bool IsVolatile,
       // to generate.
     }
   }
+  LoadInst *Load;
   if (Address->getType()->isPointerTy() &&
       Address->getType()->getPointerElementType()->isVectorTy()) {
-    return LLVMBuilder->CreateAlignedLoad(Address, 1, IsVolatile);
+    Load = LLVMBuilder->CreateAlignedLoad(Address, 1, IsVolatile);
+  } else {
+    Load = LLVMBuilder->CreateLoad(Address, IsVolatile);
+  }
+  if (IsVolatile) {
+    // A volatile load has acquire semantics: no later access may move before
+    // it. On x64 this only constrains the optimizer, since loads are not
+    // reordered with later accesses.
+    LLVMBuilder->CreateFence(Acquire);
   }
-  return LLVMBuilder->CreateLoad(Address, IsVolatile);
+  return Load;
 }
 
 CallSite GenIR::makeCall(Value *Callee, bool MayThrow, ArrayRef<Value *> Args,
@@ -5080,7 +6038,15 @@ IRNode *GenIR::loadStaticField(CORINFO_RESOLVED_TOKEN *FieldToken,
   CorInfoType FieldCorType = getFieldType(FieldHandle, &FieldClassHandle);
   Type *FieldTy = getType(FieldCorType, FieldClassHandle);
 
-  // TODO: Replace static read-only fields with constant when possible
+  // Once the class of a static read-only field has been initialized, the
+  // field keeps its value: a primitive value can be read now and used as a
+  // constant, and a load of a reference can be treated as invariant.
+  bool IsInitializedReadOnly = isInitializedReadOnlyStaticField(
+      FieldToken, &FieldInfo, IsVolatile);
+  if (IsInitializedReadOnly &&
+      (FieldTy->isIntegerTy() || FieldTy->isFloatingPointTy())) {
+    return readOnlyStaticFieldValue(FieldHandle, FieldTy, FieldCorType);
+  }
 
   // Get static field address. Convert to pointer.
   Value *Address = rdrGetStaticFieldAddress(FieldToken, &FieldInfo);
@@ -5092,8 +6058,74 @@ IRNode *GenIR::loadStaticField(CORINFO_RESOLVED_TOKEN *FieldToken,
     Address = LLVMBuilder->CreatePointerCast(Address, PtrToFieldTy);
   }
 
-  return loadAtAddressNonNull((IRNode *)Address, FieldTy, FieldCorType,
-                              Reader_AlignNatural, IsVolatile);
+  IRNode *Result = loadAtAddressNonNull((IRNode *)Address, FieldTy,
+                                        FieldCorType, Reader_AlignNatural,
+                                        IsVolatile);
+  LoadInst *Load = dyn_cast<LoadInst>(Result);
+  if (IsInitializedReadOnly && (Load != nullptr)) {
+    Load->setMetadata(LLVMContext::MD_invariant_load,
+                      MDNode::get(*JitContext->LLVMContext, None));
+  }
+  return Result;
+}
+
+bool GenIR::isInitializedReadOnlyStaticField(CORINFO_RESOLVED_TOKEN *FieldToken,
+                                             CORINFO_FIELD_INFO *FieldInfo,
+                                             bool IsVolatile) {
+  if (!JitContext->Options->EnableOptimization || IsVolatile) {
+    return false;
+  }
+
+  // Prejitted code runs in other processes, where the class may not have
+  // been initialized yet.
+  if ((JitContext->Flags & (CORJIT_FLG_PREJIT | CORJIT_FLG_READYTORUN)) != 0) {
+    return false;
+  }
+
+  // Only fields at a fixed address whose access needs no checks qualify.
+  const uint32_t ReadOnlyFlags =
+      CORINFO_FLG_FIELD_STATIC | CORINFO_FLG_FIELD_FINAL;
+  if ((FieldInfo->fieldAccessor != CORINFO_FIELD_STATIC_ADDRESS) ||
+      ((FieldInfo->fieldFlags & ReadOnlyFlags) != ReadOnlyFlags) ||
+      ((FieldInfo->fieldFlags & CORINFO_FLG_FIELD_STATIC_IN_HEAP) != 0) ||
+      (FieldInfo->accessAllowed != CORINFO_ACCESS_ALLOWED)) {
+    return false;
+  }
+
+  const bool Speculative = true;
+  CorInfoInitClassResult InitResult =
+      initClass(FieldToken->hField, getCurrentMethodHandle(),
+                getCurrentContext(), Speculative);
+  return (InitResult & CORINFO_INITCLASS_INITIALIZED) != 0;
+}
+
+IRNode *GenIR::readOnlyStaticFieldValue(CORINFO_FIELD_HANDLE FieldHandle,
+                                        Type *FieldTy,
+                                        CorInfoType FieldCorType) {
+  bool IsIndirect;
+  void *Address = ReaderBase::getStaticFieldAddress(FieldHandle, &IsIndirect);
+  if (IsIndirect) {
+    Address = *(void **)Address;
+  }
+
+  // Read the field's bits and reinterpret them as the field's type.
+  const DataLayout *DataLayout = &JitContext->CurrentModule->getDataLayout();
+  uint32_t Size = DataLayout->getTypeStoreSize(FieldTy);
+  ASSERT(Size <= sizeof(uint64_t));
+  uint64_t Bits = 0;
+  memcpy(&Bits, Address, Size);
+
+  LLVMContext &LLVMContext = *JitContext->LLVMContext;
+  Constant *FieldValue =
+      ConstantInt::get(Type::getIntNTy(LLVMContext, Size * 8), Bits);
+  if (FieldTy->isFloatingPointTy()) {
+    FieldValue = ConstantExpr::getBitCast(FieldValue, FieldTy);
+  }
+
+  // The value was read from this process's memory.
+  JitContext->IsCacheable = false;
+
+  return convertToStackType((IRNode *)FieldValue, FieldCorType);
 }
 
 IRNode *GenIR::addressOfValue(IRNode *Leaf) {
@@ -5164,8 +6196,9 @@ IRNode *GenIR::loadElem(ReaderBaseNS::LdElemOpcode Opcode,
 
   IRNode *ElementAddress = genArrayElemAddress(Array, Index, ElementTy);
   bool IsVolatile = false;
+  MDNode *TBAATag = getArrayElementTBAATag(ElementTy);
   return loadAtAddressNonNull(ElementAddress, ElementTy, CorType, ResolvedToken,
-                              Alignment, IsVolatile);
+                              Alignment, IsVolatile, TBAATag);
 }
 
 IRNode *GenIR::loadElemA(CORINFO_RESOLVED_TOKEN *ResolvedToken, IRNode *Index,
@@ -5237,14 +6270,17 @@ void GenIR::storeElem(ReaderBaseNS::StElemOpcode Opcode,
   if (ElementTy->isStructTy()) {
     bool IsNonValueClass = false;
     bool IsValueIsPointer = false;
-    bool IsUnchecked = false;
+    // Array elements are always on the heap.
+    bool IsUnchecked = true;
     // Store with a write barrier if the struct has gc pointers.
     rdrCallWriteBarrierHelper(ElementAddress, ValueToStore, Alignment,
                               IsVolatile, ResolvedToken, IsNonValueClass,
                               IsValueIsPointer, IsField, IsUnchecked);
   } else {
+    MDNode *TBAATag = getArrayElementTBAATag(ElementTy);
     storeAtAddressNonNull(ElementAddress, ValueToStore, ElementTy,
-                          ResolvedToken, Alignment, IsVolatile, IsField);
+                          ResolvedToken, Alignment, IsVolatile, IsField,
+                          TBAATag);
   }
 }
 
@@ -5298,6 +6334,13 @@ IRNode *GenIR::genArrayElemAddress(IRNode *Array, IRNode *Index,
 
   genBoundsCheck(ArrayLength, Index);
 
+  return getArrayElemAddress(Array, Index, ElementTy);
+}
+
+IRNode *GenIR::getArrayElemAddress(IRNode *Array, IRNode *Index,
+                                   Type *ElementTy) {
+  Array = this->ensureIsArray(Array, ElementTy);
+
   PointerType *Ty = cast<PointerType>(Array->getType());
   StructType *ReferentTy = cast<StructType>(Ty->getPointerElementType());
   unsigned int RawArrayStructFieldIndex = ReferentTy->getNumElements() - 1;
@@ -5691,6 +6734,25 @@ bool isNonVolatileWriteHelperCall(CorInfoHelpFunc HelperId) {
   }
 }
 
+// Return true if the helper allocates and returns a new object.
+bool isAllocationHelperCall(CorInfoHelpFunc HelperId) {
+  switch (HelperId) {
+  case CORINFO_HELP_NEWFAST:
+  case CORINFO_HELP_NEWSFAST:
+  case CORINFO_HELP_NEWSFAST_ALIGN8:
+  case CORINFO_HELP_NEWARR_1_DIRECT:
+  case CORINFO_HELP_NEWARR_1_OBJ:
+  case CORINFO_HELP_NEWARR_1_VC:
+  case CORINFO_HELP_NEWARR_1_ALIGN8:
+  case CORINFO_HELP_BOX:
+  case CORINFO_HELP_READYTORUN_NEW:
+  case CORINFO_HELP_READYTORUN_NEWARR_1:
+    return true;
+  default:
+    return false;
+  }
+}
+
 // Generate call to helper
 IRNode *GenIR::callHelper(CorInfoHelpFunc HelperID, bool MayThrow, IRNode *Dst,
                           IRNode *Arg1, IRNode *Arg2, IRNode *Arg3,
@@ -5745,7 +6807,13 @@ CallSite GenIR::callHelperImpl(CorInfoHelpFunc HelperID, bool MayThrow,
   // TODO: We can turn some of these helper calls into intrinsics.
   // When doing so, make sure the intrinsics are not optimized
   // for the volatile operations.
-  IRNode *Address = getHelperCallAddress(HelperID);
+  //
+  // A helper whose entry point the EE knows is called directly, which
+  // callHelperImpl takes a null address to mean.
+  IRNode *Address = nullptr;
+  if (getHelperFunction(HelperID) == nullptr) {
+    Address = getHelperCallAddress(HelperID);
+  }
 
   return callHelperImpl(HelperID, Address, MayThrow, ReturnType, Arg1, Arg2,
                         Arg3, Arg4, Alignment, IsVolatile, NoCtor, CanMoveUp);
@@ -5803,13 +6871,33 @@ CallSite GenIR::callHelperImpl(CorInfoHelpFunc HelperID, IRNode *Address,
   FunctionType *FunctionType =
       FunctionType::get(ReturnType, ArgumentTypes, IsVarArg);
 
-  Value *Target = LLVMBuilder->CreateIntToPtr(
-      Address, getUnmanagedPointerType(FunctionType));
+  Value *Target = (Address == nullptr)
+                      ? getHelperCallTarget(HelperID, FunctionType)
+                      : LLVMBuilder->CreateIntToPtr(
+                            Address, getUnmanagedPointerType(FunctionType));
 
   // This is an intermediate result. Callers must handle
   // transitioning to a valid stack type, if appropriate.
   CallSite Call = makeCall(Target, MayThrow, Arguments);
 
+  // The allocation helpers return a new object, which nothing else can refer
+  // to yet. Telling LLVM so lets it keep the caller's values in registers
+  // across the stores that initialize the object. Statepoint rewriting
+  // replaces the call, so the attributes do not outlive a relocation.
+  if (isAllocationHelperCall(HelperID) && ReturnType->isPointerTy()) {
+    Call.addAttribute(AttributeSet::ReturnIndex, Attribute::NoAlias);
+    Call.addAttribute(AttributeSet::ReturnIndex, Attribute::NonNull);
+  }
+
+  // Tag reference write barriers so that the unneeded ones can be removed.
+  if ((HelperID == CORINFO_HELP_ASSIGN_REF) ||
+      (HelperID == CORINFO_HELP_CHECKED_ASSIGN_REF)) {
+    Instruction *Barrier = Call.getInstruction();
+    LLVMContext &Context = *JitContext->LLVMContext;
+    Barrier->setMetadata(Context.getMDKindID(getWriteBarrierMDName()),
+                         MDNode::get(Context, None));
+  }
+
   if (IsVolatile && isNonVolatileWriteHelperCall(HelperID)) {
     // TODO: this is only needed where CLRConfig::INTERNAL_JitLockWrite is set
     // For now, conservatively we emit barrier regardless.
@@ -5819,21 +6907,67 @@ CallSite GenIR::callHelperImpl(CorInfoHelpFunc HelperID, IRNode *Address,
   return Call;
 }
 
-IRNode *GenIR::getHelperCallAddress(CorInfoHelpFunc HelperId) {
-  bool IsIndirect;
-  void *Descriptor;
+GenIR::JitHelperInfo &GenIR::getHelperInfo(CorInfoHelpFunc HelperId) {
+  auto MapElem = HelperInfoMap.find(HelperId);
+  if (MapElem != HelperInfoMap.end()) {
+    return MapElem->second;
+  }
+
+  // Get the address of the helper's function descriptor.
+  JitHelperInfo Info;
+  Info.Descriptor = getHelperDescr(HelperId, &Info.IsIndirect);
+  Info.Function = nullptr;
 
-  // Get the address of the helper's function descriptor and build
-  // the call target from it.
-  Descriptor = getHelperDescr(HelperId, &IsIndirect);
+  // Remember which helper the descriptor names, so that code referring to it
+  // can be bound to the helper again in another process.
+  JitContext->HelperDescriptorMap[(uint64_t)Info.Descriptor] = HelperId;
+
+  return HelperInfoMap[HelperId] = Info;
+}
 
-  // TODO: direct PC-Rel calls for Jit helpers
+IRNode *GenIR::getHelperCallAddress(CorInfoHelpFunc HelperId) {
+  const JitHelperInfo &Info = getHelperInfo(HelperId);
 
   // TODO: figure out how much of imeta.cpp we need;
   // the token here is really an inlined call to
   // IMetaMakeJitHelperToken(helperId)
-  return handleToIRNode((mdToken)(mdtJitHelper | HelperId), Descriptor, 0,
-                        IsIndirect, IsIndirect, true, false);
+  return handleToIRNode((mdToken)(mdtJitHelper | HelperId), Info.Descriptor, 0,
+                        Info.IsIndirect, Info.IsIndirect, true, false);
+}
+
+Function *GenIR::getHelperFunction(CorInfoHelpFunc HelperId) {
+  JitHelperInfo &Info = getHelperInfo(HelperId);
+  if (Info.IsIndirect) {
+    return nullptr;
+  }
+
+  if (Info.Function == nullptr) {
+    // The helper's real signature is not known, and each call casts the
+    // function to the type of its arguments, so declare it as taking none.
+    FunctionType *Ty =
+        FunctionType::get(Type::getVoidTy(*JitContext->LLVMContext), false);
+    std::string Name =
+        getNameForToken((mdToken)(mdtJitHelper | HelperId),
+                        (CORINFO_GENERIC_HANDLE)Info.Descriptor,
+                        getCurrentContext(), getCurrentModuleHandle());
+    Info.Function = Function::Create(Ty, GlobalValue::ExternalLinkage, Name,
+                                     JitContext->CurrentModule);
+
+    // The object loader binds the call to the helper by name.
+    (*NameToHandleMap)[Info.Function->getName()] = (uint64_t)Info.Descriptor;
+  }
+
+  return Info.Function;
+}
+
+Value *GenIR::getHelperCallTarget(CorInfoHelpFunc HelperId,
+                                  FunctionType *FunctionType) {
+  Type *TargetTy = getUnmanagedPointerType(FunctionType);
+  Function *Helper = getHelperFunction(HelperId);
+  if (Helper != nullptr) {
+    return LLVMBuilder->CreatePointerCast(Helper, TargetTy);
+  }
+  return LLVMBuilder->CreateIntToPtr(getHelperCallAddress(HelperId), TargetTy);
 }
 
 IRNode *
@@ -5843,11 +6977,13 @@ GenIR::getReadyToRunHelperCallAddress(CorInfoHelpFunc HelperId,
   void *Descriptor;
 
   CORINFO_CONST_LOOKUP Lookup;
-  // CORINFO_ACCESS_ATYPICAL_CALLSITE means that we can't guarantee
-  // that we'll be able to generate call [rel32] form of the helper call so
-  // crossgen shouldn't try to disassemble the call instruction.
-  HelperId =
-      (CorInfoHelpFunc)(HelperId | CORINFO_HELP_READYTORUN_ATYPICAL_CALLSITE);
+  // The helper call is lowered to call [rel32] (see
+  // ReadyToRunCallSiteLowering), so crossgen may share its delay-load thunk,
+  // unless an earlier attempt at this method failed to produce that form.
+  if (useAtypicalCallSites()) {
+    HelperId =
+        (CorInfoHelpFunc)(HelperId | CORINFO_HELP_READYTORUN_ATYPICAL_CALLSITE);
+  }
   JitContext->JitInfo->getReadyToRunHelper(ResolvedToken, HelperId, &Lookup);
   Descriptor = Lookup.addr;
   assert(Lookup.accessType != InfoAccessType::IAT_PPVALUE);
@@ -5857,22 +6993,29 @@ GenIR::getReadyToRunHelperCallAddress(CorInfoHelpFunc HelperId,
   // the token here is really an inlined call to
   // IMetaMakeJitHelperToken(helperId)
   bool IsReadOnly = false;
+  const bool IsRelocatable = true;
+  const bool IsCallTarget = true;
   return handleToIRNode((mdToken)(mdtJitHelper | HelperId), Descriptor, 0,
-                        IsIndirect, IsReadOnly, true, false);
+                        IsIndirect, IsReadOnly, IsRelocatable, IsCallTarget);
 }
 
 // Generate special generics helper that might need to insert flow.
 IRNode *GenIR::callRuntimeHandleHelper(CorInfoHelpFunc Helper, IRNode *Arg1,
                                        IRNode *Arg2, IRNode *NullCheckArg) {
 
-  Type *ReturnType =
-      Type::getIntNTy(*JitContext->LLVMContext, TargetPointerSizeInBits);
+  LLVMContext &Context = *JitContext->LLVMContext;
+  Type *ReturnType = Type::getIntNTy(Context, TargetPointerSizeInBits);
+  const unsigned RuntimeLookupKind =
+      Context.getMDKindID(getRuntimeLookupMDName());
 
   // Call the helper unconditionally if NullCheckArg is null.
   if ((NullCheckArg == nullptr) || isConstantNull(NullCheckArg)) {
     const bool MayThrow = true;
-    return (IRNode *)callHelperImpl(Helper, MayThrow, ReturnType, Arg1, Arg2)
-        .getInstruction();
+    Instruction *Call =
+        callHelperImpl(Helper, MayThrow, ReturnType, Arg1, Arg2)
+            .getInstruction();
+    Call->setMetadata(RuntimeLookupKind, MDNode::get(Context, None));
+    return (IRNode *)Call;
   }
 
   BasicBlock *SaveBlock = LLVMBuilder->GetInsertBlock();
@@ -5886,6 +7029,8 @@ IRNode *GenIR::callRuntimeHandleHelper(CorInfoHelpFunc Helper, IRNode *Arg1,
   CallSite HelperCall =
       genConditionalHelperCall(Compare, Helper, MayThrow, ReturnType, Arg1,
                                Arg2, CallReturns, "RuntimeHandleHelperCall");
+  HelperCall.getInstruction()->setMetadata(RuntimeLookupKind,
+                                           MDNode::get(Context, None));
 
   // The result is a PHI of NullCheckArg and the generated call.
   // The generated code is equivalent to
@@ -5986,6 +7131,16 @@ CORINFO_CLASS_HANDLE GenIR::inferThisClass(IRNode *ThisArgument) {
   return nullptr;
 }
 
+CORINFO_CLASS_HANDLE GenIR::getExactClass(IRNode *Object) {
+  Value *Allocation = ((Value *)Object)->stripPointerCasts();
+  auto MapElem = ExactClassMap.find(Allocation);
+  if (MapElem != ExactClassMap.end()) {
+    return MapElem->second;
+  }
+
+  return nullptr;
+}
+
 bool GenIR::canMakeDirectCall(ReaderCallTargetData *CallTargetData) {
   return !CallTargetData->isJmp();
 }
@@ -6167,9 +7322,7 @@ IRNode *GenIR::genNewMDArrayCall(ReaderCallTargetData *CallTargetData,
 
   // Create a call target with the right type.
   // Get the address of the Helper descr.
-  Value *Callee = getHelperCallAddress(CORINFO_HELP_NEW_MDARR);
-  Callee = LLVMBuilder->CreateIntToPtr(Callee,
-                                       getUnmanagedPointerType(FunctionType));
+  Value *Callee = getHelperCallTarget(CORINFO_HELP_NEW_MDARR, FunctionType);
 
   // Replace the old call instruction with the new one.
   const bool MayThrow = true;
@@ -6231,8 +7384,27 @@ IRNode *GenIR::genNewObjThisArg(ReaderCallTargetData *CallTargetData,
     IRNode *ClassHandleNode = CallTargetData->getClassHandleNode();
     CorInfoHelpFunc HelperId = getNewHelper(CallTargetData->getResolvedToken());
     TheCallSite = callHelperImpl(HelperId, MayThrow, ThisType, ClassHandleNode);
+
+    // Objects of classes without finalizers or special allocation needs
+    // may be allocated on the stack if they turn out not to escape.
+    if ((HelperId == CORINFO_HELP_NEWSFAST) &&
+        JitContext->Options->EnableOptimization) {
+      ObjectStackAllocator::markCandidate(TheCallSite.getInstruction(),
+                                          getClassSize(Class));
+    }
+  }
+  Instruction *ThisPointer = TheCallSite.getInstruction();
+  ExactClassMap[ThisPointer] = Class;
+
+  // Objects smaller than the large object threshold start out in
+  // generation 0, so stores into them need no write barrier until a GC
+  // may have promoted them.
+  const uint32_t LargeObjectSize = 85000;
+  if (getClassSize(Class) < LargeObjectSize) {
+    LLVMContext &Context = *JitContext->LLVMContext;
+    ThisPointer->setMetadata(Context.getMDKindID(getSmallAllocationMDName()),
+                             MDNode::get(Context, None));
   }
-  Value *ThisPointer = TheCallSite.getInstruction();
   return (IRNode *)ThisPointer;
 }
 
@@ -6267,6 +7439,35 @@ IRNode *GenIR::genNewObjReturnNode(ReaderCallTargetData *CallTargetData,
   return ThisArg;
 }
 
+// Determine whether the target of a call might be inlined. Only direct
+// calls to a known method whose call site needs nothing from the caller's
+// generic context are candidates; the inliner asks the EE about the rest.
+static bool isInlineCandidate(ReaderCallTargetData *CallTargetInfo) {
+  if (CallTargetInfo->isJmp() || CallTargetInfo->isCallI() ||
+      CallTargetInfo->isIndirect() || CallTargetInfo->isStubDispatch() ||
+      CallTargetInfo->isOptimizedDelegateCtor()) {
+    return false;
+  }
+
+  // Explicit tail calls must not grow the stack, so keep them as calls.
+  if (CallTargetInfo->isTailCall() && !CallTargetInfo->isUnmarkedTailCall()) {
+    return false;
+  }
+
+  if (!CallTargetInfo->isTrueDirect() ||
+      CallTargetInfo->getCallTargetNodeRequiresRuntimeLookup()) {
+    return false;
+  }
+
+  CorInfoIntrinsics IntrinsicID = CallTargetInfo->getCorInstrinsic();
+  if ((0 <= IntrinsicID) && (IntrinsicID < CORINFO_INTRINSIC_Count)) {
+    return false;
+  }
+
+  const uint32_t NoInlineAttribs = CORINFO_FLG_DONT_INLINE | CORINFO_FLG_SYNCH;
+  return (CallTargetInfo->getMethodAttribs() & NoInlineAttribs) == 0;
+}
+
 IRNode *GenIR::genCall(ReaderCallTargetData *CallTargetInfo, bool MayThrow,
                        std::vector<IRNode *> Args, IRNode **CallNode) {
   IRNode *Call = nullptr;
@@ -6346,6 +7547,34 @@ IRNode *GenIR::genCall(ReaderCallTargetData *CallTargetInfo, bool MayThrow,
   }
 
   ABICallSignature ABICallSig(Signature, *this, *JitContext->TheABIInfo);
+
+  // Check tail calls before emitting anything, since a tail call to this
+  // method is not emitted as a call at all.
+  bool CanTailCall = false;
+  if (!IsJmp && CallTargetInfo->isTailCall()) {
+    CanTailCall = tailCallChecks(CallTargetInfo->getMethodHandle(),
+                                 CallTargetInfo->getKnownMethodHandle(),
+                                 CallTargetInfo->isUnmarkedTailCall(),
+                                 ABICallSig.hasIndirectResultOrArg());
+  }
+
+  if (CanTailCall && canConvertTailRecursionToLoop(CallTargetInfo, Arguments)) {
+    genTailRecursionLoop(Arguments);
+    JitContext->JitInfo->reportTailCallDecision(
+        getCurrentMethodHandle(), CallTargetInfo->getKnownMethodHandle(),
+        !CallTargetInfo->isUnmarkedTailCall(), TAILCALL_RECURSIVE, nullptr);
+    *CallNode = nullptr;
+
+    // The ret that follows the call is no longer reachable, but still needs
+    // a value to return.
+    if (ResultType.CorType == CORINFO_TYPE_VOID) {
+      return nullptr;
+    }
+    Type *ResultTy = getType(ResultType.CorType, ResultType.Class);
+    return convertToStackType((IRNode *)UndefValue::get(ResultTy),
+                              ResultType.CorType);
+  }
+
   Value *ResultNode =
       ABICallSig.emitCall(*this, (Value *)TargetNode, MayThrow, Arguments,
                           (Value *)CallTargetInfo->getIndirectionCellNode(),
@@ -6356,23 +7585,42 @@ IRNode *GenIR::genCall(ReaderCallTargetData *CallTargetInfo, bool MayThrow,
     canonVarargsCall(Call, CallTargetInfo);
   }
 
-  // If this call is eligible for tail calls, mark it now.
-  if (!IsJmp) {
-    if (CallTargetInfo->isTailCall()) {
-      if (isa<CallInst>(Call)) {
-        CallInst *C = cast<CallInst>(Call);
-        bool canTailCall =
-            tailCallChecks(CallTargetInfo->getMethodHandle(),
-                           CallTargetInfo->getKnownMethodHandle(),
-                           CallTargetInfo->isUnmarkedTailCall(),
-                           ABICallSig.hasIndirectResultOrArg());
-        C->setTailCall(canTailCall);
-      }
+  // If this call is eligible for tail calls, mark it now. Make explicit tail
+  // calls jumps where LLVM can; otherwise the code generator still decides
+  // whether the call is made as a tail call.
+  bool IsFastTailCall = false;
+  if (CanTailCall && isa<CallInst>(Call)) {
+    CallInst *C = cast<CallInst>(Call);
+    C->setTailCall();
+    if (!CallTargetInfo->isUnmarkedTailCall() &&
+        canMakeFastTailCall(
+            C, ResultNode,
+            (Value *)CallTargetInfo->getIndirectionCellNode())) {
+      C->setTailCallKind(CallInst::TailCallKind::TCK_MustTail);
+      IsFastTailCall = true;
     }
   }
 
+  // Mark calls the inliner may be able to inline.
+  if (JitContext->Options->DoInline && isInlineCandidate(CallTargetInfo)) {
+    LLILCInliner::markCandidate(cast<Instruction>(Call),
+                                CallTargetInfo->getMethodHandle());
+  }
+
   *CallNode = Call;
 
+  if (IsFastTailCall) {
+    // LLVM requires musttail calls to be immediately followed by a ret. The
+    // ret that follows the call in the MSIL is no longer reachable.
+    Value *ReturnValue =
+        Function->getReturnType()->isVoidTy() ? nullptr : (Value *)Call;
+    terminateCurrentBlock(
+        ReturnInst::Create(*JitContext->LLVMContext, ReturnValue));
+    JitContext->JitInfo->reportTailCallDecision(
+        getCurrentMethodHandle(), CallTargetInfo->getKnownMethodHandle(),
+        !CallTargetInfo->isUnmarkedTailCall(), TAILCALL_OPTIMIZED, nullptr);
+  }
+
   if (ResultType.CorType != CORINFO_TYPE_VOID) {
     if (IsJmp) {
       // The IR for jmp is a musttail call immediately followed by a ret.
@@ -6406,11 +7654,13 @@ IRNode *GenIR::convertToBoxHelperArgumentType(IRNode *Opr, uint32_t DestSize) {
   // float32 then also have to do an explict conversion.
   // Otherwise, the boxing helper will grab the wrong bits out of the float64
   // and
-  // destroy the value.
+  // destroy the value. DestSize is in bytes.
   case Type::TypeID::FloatTyID:
   case Type::TypeID::DoubleTyID:
-    if (Ty->getPrimitiveSizeInBits() > DestSize) {
-      Opr = (IRNode *)LLVMBuilder->CreateFPCast(Opr, Ty);
+    if (Ty->getPrimitiveSizeInBits() > DestSize * 8) {
+      assert(DestSize == 4);
+      Opr = (IRNode *)LLVMBuilder->CreateFPCast(
+          Opr, Type::getFloatTy(*JitContext->LLVMContext));
     }
     break;
   default:
@@ -6795,6 +8045,127 @@ bool GenIR::tailCallChecks(CORINFO_METHOD_HANDLE DeclaredMethod,
   return false;
 }
 
+bool GenIR::canConvertTailRecursionToLoop(
+    ReaderCallTargetData *CallTargetInfo, ArrayRef<Value *> CallArguments) {
+  if (CallTargetInfo->getKnownMethodHandle() != getCurrentMethodHandle()) {
+    return false;
+  }
+
+  // Hidden arguments would have to be the ones the method was entered with,
+  // and shared code may be called for another instantiation.
+  if (MethodSignature.hasTypeArg() || MethodSignature.hasSecretParameter() ||
+      MethodSignature.isVarArg() ||
+      ((getCurrentMethodAttribs() & CORINFO_FLG_SHAREDINST) != 0)) {
+    return false;
+  }
+
+  // A localloc would grow the frame on each iteration, and an address taken
+  // in one iteration would see the locals of the next.
+  if (HasLocAlloc || HasAddressTaken) {
+    return false;
+  }
+
+  // Branching back to the first MSIL block may not leave a protected region.
+  if (JitContext->MethodInfo->EHcount != 0) {
+    return false;
+  }
+
+  // Each argument must have a home of its own type to store the new value
+  // to. Aggregate arguments are left alone.
+  if (CallArguments.size() != Arguments.size()) {
+    return false;
+  }
+  for (uint32_t I = 0; I < Arguments.size(); ++I) {
+    if (!doesArgumentHaveHome(ABIMethodSig.getArgumentInfo(I))) {
+      return false;
+    }
+    Type *ArgTy = Arguments[I]->getType()->getPointerElementType();
+    if ((CallArguments[I]->getType() != ArgTy) || ArgTy->isStructTy() ||
+        ArgTy->isVectorTy()) {
+      return false;
+    }
+  }
+
+  // The ret that follows the call needs a value to return, which is simple
+  // to make up only for a scalar.
+  const CallArgType &ResultType = MethodSignature.getResultType();
+  if (ResultType.CorType != CORINFO_TYPE_VOID) {
+    Type *ResultTy = getType(ResultType.CorType, ResultType.Class);
+    if (ResultTy->isStructTy() || ResultTy->isVectorTy()) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void GenIR::genTailRecursionLoop(ArrayRef<Value *> CallArguments) {
+  // The arguments were all computed before any of them is stored.
+  for (uint32_t I = 0; I < Arguments.size(); ++I) {
+    Value *ArgAddress = Arguments[I];
+    Type *ArgTy = ArgAddress->getType()->getPointerElementType();
+    const bool IsVolatile = false;
+    storeAtAddressNoBarrierNonNull((IRNode *)ArgAddress,
+                                   (IRNode *)CallArguments[I], ArgTy,
+                                   IsVolatile);
+  }
+
+  // Each iteration must see the locals as the prolog left them. A local that
+  // is not read before it is written on any path from the first MSIL block
+  // need not be zeroed here either.
+  for (uint32_t I = 0; I < LocalsToZeroInit.size(); ++I) {
+    if (LocalsToZeroInit[I]) {
+      zeroInit(LocalVars[I]);
+    }
+  }
+
+  terminateCurrentBlock(BranchInst::Create(FirstMSILBlock));
+}
+
+bool GenIR::canMakeFastTailCall(CallInst *Call, Value *Result,
+                                Value *IndirectionCell) {
+  if ((Call->getFunctionType() != Function->getFunctionType()) ||
+      (Call->getCallingConv() != Function->getCallingConv())) {
+    return false;
+  }
+
+  // ReadyToRun calls through indirection cells must stay calls.
+  if (JitContext->Flags & CORJIT_FLG_READYTORUN) {
+    if (IndirectionCell != nullptr) {
+      return false;
+    }
+    Value *Target = Call->getCalledValue()->stripPointerCasts();
+    while (isa<IntToPtrInst>(Target) || isa<BitCastInst>(Target)) {
+      Target = cast<Instruction>(Target)->getOperand(0);
+    }
+    if (LoadInst *Load = dyn_cast<LoadInst>(Target)) {
+      Value *Cell = Load->getPointerOperand();
+      if (ConstantExpr *Expr = dyn_cast<ConstantExpr>(Cell)) {
+        if (Expr->getOpcode() == Instruction::IntToPtr) {
+          Cell = Expr->getOperand(0);
+        }
+      }
+      if (ConstantExpr *Expr = dyn_cast<ConstantExpr>(Cell)) {
+        if (Expr->getOpcode() == Instruction::PtrToInt) {
+          Cell = Expr->getOperand(0);
+        }
+      }
+      if (isa<GlobalVariable>(Cell->stripPointerCasts())) {
+        return false;
+      }
+    }
+  }
+
+  // The result must be returned just as the callee returns it.
+  if (!Function->getReturnType()->isVoidTy() && (Result != Call)) {
+    return false;
+  }
+
+  BasicBlock::iterator InsertPoint = LLVMBuilder->GetInsertPoint();
+  return (Call->getParent() == LLVMBuilder->GetInsertBlock()) &&
+         (std::next(Call->getIterator()) == InsertPoint);
+}
+
 void GenIR::returnOpcode(IRNode *Opr, bool IsSynchronizedMethod) {
   const ABIArgInfo &ResultInfo = ABIMethodSig.getResultInfo();
   const CallArgType &ResultArgType = MethodSignature.getResultType();
@@ -6863,6 +8234,8 @@ void GenIR::returnOpcode(IRNode *Opr, bool IsSynchronizedMethod) {
 
 bool GenIR::needSequencePoints() { return false; }
 
+bool GenIR::generateDebugInfo() { return JitContext->Options->DoDebugInfo; }
+
 void GenIR::setEHInfo(EHRegion *EhRegionTree, EHRegionList *EhRegionList) {
   // TODO: anything we need here?
 }
@@ -6993,6 +8366,8 @@ bool GenIR::interlockedCmpXchg(IRNode *Destination, IRNode *Exchange,
     Destination = (IRNode *)LLVMBuilder->CreatePointerCast(Destination, CastTy);
   }
 
+  // As for the other interlocked operations, lock cmpxchg is a full fence on
+  // x64, so sequential consistency needs no extra fence.
   Value *Pair = LLVMBuilder->CreateAtomicCmpXchg(
       Destination, Comparand, Exchange, llvm::SequentiallyConsistent,
       llvm::SequentiallyConsistent);
@@ -7021,6 +8396,12 @@ bool GenIR::interlockedIntrinsicBinOp(IRNode *Arg1, IRNode *Arg2,
     break;
   }
 
+  // Exchanging object references needs a write barrier, so leave that to
+  // the helper.
+  if (!Arg2->getType()->isIntegerTy()) {
+    Op = AtomicRMWInst::BinOp::BAD_BINOP;
+  }
+
   if (Op != AtomicRMWInst::BinOp::BAD_BINOP) {
     assert(Arg1->getType()->isPointerTy());
     Type *CastTy = GcInfo::isGcPointer(Arg1->getType())
@@ -7028,6 +8409,8 @@ bool GenIR::interlockedIntrinsicBinOp(IRNode *Arg1, IRNode *Arg2,
                        : getUnmanagedPointerType(Arg2->getType());
     Arg1 = (IRNode *)LLVMBuilder->CreatePointerCast(Arg1, CastTy);
 
+    // Interlocked operations are full fences. On x64 the locked instruction
+    // already is one, so sequential consistency costs no extra fence.
     Value *Result = LLVMBuilder->CreateAtomicRMW(
         Op, Arg1, Arg2, AtomicOrdering::SequentiallyConsistent);
     *RetVal = (IRNode *)Result;
@@ -7039,12 +8422,35 @@ bool GenIR::interlockedIntrinsicBinOp(IRNode *Arg1, IRNode *Arg2,
 }
 
 bool GenIR::memoryBarrier() {
-  // TODO: Here we emit mfence which is stronger than sfence
-  // that CLR needs.
-  // We could improve this further by using
-  // lock or byte ptr [rsp], 0
-  // which is faster than sfence.
-  LLVMBuilder->CreateFence(SequentiallyConsistent);
+  // Thread.MemoryBarrier is a full fence, which LLVM lowers to mfence on
+  // x86. A locked no-op on the top of the stack orders memory the same way
+  // and is faster, so use that instead. The asm clobbers memory, which also
+  // keeps the optimizer from moving accesses across it.
+  Triple TargetTriple(JitContext->CurrentModule->getTargetTriple());
+  const char *LockedNop = nullptr;
+  if (TargetTriple.getArch() == Triple::x86_64) {
+    LockedNop = "lock or dword ptr [rsp], 0";
+  } else if (TargetTriple.getArch() == Triple::x86) {
+    LockedNop = "lock or dword ptr [esp], 0";
+  }
+
+  if (LockedNop == nullptr) {
+    LLVMBuilder->CreateFence(SequentiallyConsistent);
+    return true;
+  }
+
+  bool IsVariadic = false;
+  FunctionType *FTy = FunctionType::get(
+      Type::getVoidTy(*JitContext->LLVMContext), IsVariadic);
+  const bool HasSideEffects = true;
+  const bool IsAlignStack = false;
+  InlineAsm *AsmCode =
+      InlineAsm::get(FTy, LockedNop, "~{memory},~{flags}", HasSideEffects,
+                     IsAlignStack, InlineAsm::AD_Intel);
+  const bool MayThrow = false;
+  ArrayRef<Value *> Args;
+  CallSite Call = makeCall(AsmCode, MayThrow, Args);
+  markGCLeaf(Call);
   return true;
 }
 
@@ -7096,8 +8502,10 @@ void GenIR::throwOpcode(IRNode *Arg1) {
   const bool MayThrow = true;
   CallSite ThrowCall = callHelperImpl(CORINFO_HELP_THROW, MayThrow, Void, Arg1);
 
-  // Annotate the helper
+  // Annotate the helper. Marking the call cold lets branch probability
+  // analysis treat the paths leading to it as rarely run.
   ThrowCall.setDoesNotReturn();
+  ThrowCall.addAttribute(AttributeSet::FunctionIndex, Attribute::Cold);
 }
 
 void GenIR::rethrow() {
@@ -7107,6 +8515,7 @@ void GenIR::rethrow() {
 
   // Annotate the helper
   ThrowCall.setDoesNotReturn();
+  ThrowCall.addAttribute(AttributeSet::FunctionIndex, Attribute::Cold);
 }
 
 void GenIR::endFilter(IRNode *Arg1) {
@@ -7127,6 +8536,7 @@ CallSite GenIR::genConditionalHelperCall(
 
   if (!CallReturns) {
     HelperCall.setDoesNotReturn();
+    HelperCall.addAttribute(AttributeSet::FunctionIndex, Attribute::Cold);
     LLVMBuilder->CreateUnreachable();
   }
   LLVMBuilder->restoreIP(SavedInsertPoint);
@@ -7141,12 +8551,32 @@ CallSite GenIR::genConditionalHelperCall(
 // Generate a call to the throw helper if the condition is met.
 void GenIR::genConditionalThrow(Value *Condition, CorInfoHelpFunc HelperId,
                                 const Twine &ThrowBlockName) {
+  // In optimized code, let all the checks of a region that throw with the
+  // same helper share a throw block. The shared block is reported at the IL
+  // offset of the first of those checks. Block placement moves it out of
+  // line along with the other cold blocks.
+  BasicBlock **SharedBlock = nullptr;
+  if (JitContext->Options->EnableOptimization && DoneBuildingFlowGraph) {
+    SharedBlock = &SharedThrowBlocks[std::make_pair(HelperId, CurrentRegion)];
+    if (*SharedBlock != nullptr) {
+      const bool Rejoin = false;
+      insertConditionalPointBlock(Condition, *SharedBlock, Rejoin);
+      return;
+    }
+  }
+
   IRNode *Arg1 = nullptr, *Arg2 = nullptr;
   Type *ReturnType = Type::getVoidTy(*JitContext->LLVMContext);
   const bool MayThrow = true;
   const bool CallReturns = false;
-  genConditionalHelperCall(Condition, HelperId, MayThrow, ReturnType, Arg1,
-                           Arg2, CallReturns, ThrowBlockName);
+  CallSite ThrowCall =
+      genConditionalHelperCall(Condition, HelperId, MayThrow, ReturnType, Arg1,
+                               Arg2, CallReturns, ThrowBlockName);
+
+  if (SharedBlock != nullptr) {
+    // The call is at the start of the throw block, since the block is new.
+    *SharedBlock = ThrowCall.getInstruction()->getParent();
+  }
 }
 
 IRNode *GenIR::genNullCheck(IRNode *Node) {
@@ -7157,9 +8587,86 @@ IRNode *GenIR::genNullCheck(IRNode *Node) {
   CorInfoHelpFunc HelperId = CORINFO_HELP_THROWNULLREF;
   genConditionalThrow(Compare, HelperId, "ThrowNullRef");
 
+  // Mark the check so that codegen can fold it into the first access
+  // through the pointer, if that access is close enough to the start of
+  // the object to fault on null. Otherwise the check stays explicit.
+  Instruction *CompareInst = dyn_cast<Instruction>(Compare);
+  if ((CompareInst != nullptr) && canUseImplicitNullCheck()) {
+    TerminatorInst *Branch = CompareInst->getParent()->getTerminator();
+    Branch->setMetadata(LLVMContext::MD_make_implicit,
+                        MDNode::get(*JitContext->LLVMContext, None));
+  }
+
   return Node;
 }
 
+bool GenIR::canUseImplicitNullCheck() {
+  if (!JitContext->Options->DoImplicitNullChecks) {
+    return false;
+  }
+
+  // Exceptions in a protected region must unwind to its handler.
+  if ((CurrentRegion != nullptr) && (CurrentRegion->HandlerEHPad != nullptr)) {
+    return false;
+  }
+
+  // Handlers are funclets, whose faults the EE would attribute to them.
+  for (EHRegion *Region = CurrentRegion; Region != nullptr;
+       Region = rgnGetEnclosingAncestor(Region)) {
+    if (rgnIsOutsideParent(Region)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+MDNode *GenIR::getManagedHeapTBAATag(StringRef Group, StringRef Name) {
+  // Metadata nodes are uniqued by the context, so building the same path
+  // again yields the same nodes, including for inlined callees.
+  MDBuilder Builder(*JitContext->LLVMContext);
+  MDNode *Root = Builder.createTBAARoot("LLILC managed heap");
+  MDNode *GroupNode = Builder.createTBAAScalarTypeNode(Group, Root);
+  MDNode *TypeNode = Builder.createTBAAScalarTypeNode(Name, GroupNode);
+  return Builder.createTBAAStructTagNode(TypeNode, TypeNode, 0);
+}
+
+MDNode *GenIR::getFieldTBAATag(CORINFO_FIELD_HANDLE Field) {
+  // A value type's fields may be embedded in objects, arrays or locals of
+  // other types, possibly at overlapping offsets, so only the fields of
+  // reference types can be told apart by their declaring type.
+  CORINFO_CLASS_HANDLE Class = getFieldClass(Field);
+  if ((getClassAttribs(Class) & CORINFO_FLG_VALUECLASS) != 0) {
+    return nullptr;
+  }
+
+  // Drop any instantiation from the name, so that shared and unshared
+  // instantiations of a generic type get the same tag. Types whose names
+  // collide only share a tag, which is conservative.
+  StringRef ClassName = getClassName(Class);
+  ClassName = ClassName.substr(0, ClassName.find_first_of("[<"));
+  return getManagedHeapTBAATag("instance fields", ClassName);
+}
+
+MDNode *GenIR::getArrayElementTBAATag(Type *ElementTy) {
+  if (ElementTy->isPointerTy()) {
+    // Arrays of references are covariant.
+    return getManagedHeapTBAATag("array elements", "object reference");
+  }
+
+  if (!ElementTy->isIntegerTy() && !ElementTy->isFloatingPointTy()) {
+    return nullptr;
+  }
+
+  // Integer arrays of the same element size can be cast to one another, as
+  // can enum arrays and arrays of their underlying type. Those all share an
+  // LLVM element type.
+  std::string TypeName;
+  raw_string_ostream OS(TypeName);
+  ElementTy->print(OS);
+  return getManagedHeapTBAATag("array elements", OS.str());
+}
+
 void GenIR::genBoundsCheck(Value *ArrayLength, Value *Index) {
   CorInfoHelpFunc HelperId = CORINFO_HELP_RNGCHKFAIL;
 
@@ -7174,6 +8681,11 @@ void GenIR::genBoundsCheck(Value *ArrayLength, Value *Index) {
       LLVMBuilder->CreateIntCast(Index, ArrayLengthType, IsSigned);
   Value *UpperBoundCompare =
       LLVMBuilder->CreateICmpUGE(ConvertedIndex, ArrayLength, "BoundsCheck");
+  if (Instruction *Compare = dyn_cast<Instruction>(UpperBoundCompare)) {
+    LLVMContext &Context = *JitContext->LLVMContext;
+    Compare->setMetadata(Context.getMDKindID(getBoundsCheckMDName()),
+                         MDNode::get(Context, None));
+  }
   genConditionalThrow(UpperBoundCompare, HelperId, "ThrowIndexOutOfRange");
 }
 
@@ -7471,18 +8983,34 @@ IRNode *GenIR::handleToIRNode(const std::string &HandleName, void *EmbHandle,
     GlobalVariable *GlobalVar = getGlobalVariable(
         LookupHandle, ValueHandle, HandleTy, HandleName, IsReadOnly);
     HandleValue = LLVMBuilder->CreatePtrToInt(GlobalVar, HandleTy);
+    // The EE takes calls through ReadyToRun cells to be call [rel32],
+    // unless told they are atypical; the object loader checks that they are.
+    if (IsIndirect && IsCallTarget && !useAtypicalCallSites() &&
+        (JitContext->Flags & CORJIT_FLG_READYTORUN)) {
+      JitContext->ReadyToRunCallCells.insert(GlobalVar->getName());
+    }
   } else {
     uint32_t NumBits = TargetPointerSizeInBits;
     bool IsSigned = false;
 
     HandleValue = ConstantInt::get(
         LLVMContext, APInt(NumBits, (uint64_t)EmbHandle, IsSigned));
+
+    // The raw handle value is only meaningful in this process.
+    JitContext->IsCacheable = false;
   }
 
   if (IsIndirect) {
     Type *HandlePtrTy = getUnmanagedPointerType(HandleTy);
     Value *HandlePtr = LLVMBuilder->CreateIntToPtr(HandleValue, HandlePtrTy);
-    HandleValue = LLVMBuilder->CreateLoad(HandlePtr);
+    LoadInst *HandleLoad = LLVMBuilder->CreateLoad(HandlePtr);
+    // The EE fills in read-only indirection cells before the code that
+    // uses them can run, so loads from them can be hoisted and shared.
+    if (IsReadOnly) {
+      HandleLoad->setMetadata(LLVMContext::MD_invariant_load,
+                              MDNode::get(LLVMContext, None));
+    }
+    HandleValue = HandleLoad;
   }
 
   return (IRNode *)HandleValue;
@@ -7709,7 +9237,17 @@ BasicBlock *GenIR::insertConditionalPointBlock(Value *Condition,
   BranchInst *Branch = BranchInst::Create(PointBlock, ContinueBlock, Condition);
   replaceInstruction(Goto, Branch);
 
-  if (Rejoin) {
+  if (!Rejoin) {
+    // The point block throws. Weight the branch so that block placement
+    // lays the throw out of line, after the method's hot code, and the
+    // common path falls through.
+    const uint32_t ThrowWeight = 1;
+    const uint32_t ContinueWeight = 1 << 20;
+    MDBuilder Builder(*JitContext->LLVMContext);
+    Branch->setMetadata(LLVMContext::MD_prof,
+                        Builder.createBranchWeights(ThrowWeight,
+                                                    ContinueWeight));
+  } else {
     BasicBlock *RejoinFromBlock = PointBlock;
     // Allow that the point block may have been split to insert invoke
     // instructions.
@@ -7771,6 +9309,12 @@ BasicBlock *GenIR::splitCurrentBlock(TerminatorInst **Goto) {
   return NewBlock;
 }
 
+void GenIR::terminateCurrentBlock(TerminatorInst *Terminator) {
+  TerminatorInst *Goto;
+  splitCurrentBlock(&Goto);
+  replaceInstruction(Goto, Terminator);
+}
+
 void GenIR::replaceInstruction(Instruction *OldInstruction,
                                Instruction *NewInstruction) {
   // Record where we were
@@ -8356,25 +9900,33 @@ IRNode *GenIR::castOp(CORINFO_RESOLVED_TOKEN *ResolvedToken, IRNode *ObjRefNode,
 
   IRNode *ClassHandleNode = genericTokenToNode(
       ResolvedToken, EmbedParent, MustRestoreHandle, &HandleType, nullptr);
-  bool Optimize = false;
+  CORINFO_CLASS_HANDLE CastClass = (CORINFO_CLASS_HANDLE)HandleType;
+
+  // An object is an instance of a class if its method table is the class'
+  // handle. Check for that inline, and call the helper only for objects of
+  // other types. If the class is sealed, no other type can pass the cast.
+  bool CheckExactType = false;
+  bool IsSealed = false;
   if (!disableCastClassOptimization()) {
     switch (HelperId) {
     case CORINFO_HELP_CHKCASTCLASS:
-      // TODO: It's not clear why calling this helper is safe. It assumes
-      // that trivial checks are inlined. Check this again if we decide to
-      // enable cast class optimization.
+      // The special helper skips the trivial checks we make inline.
       HelperId = CORINFO_HELP_CHKCASTCLASS_SPECIAL;
 
     //
     // FALL-THROUGH
     //
 
-    case CORINFO_HELP_ISINSTANCEOFCLASS: {
-      uint32_t Flags = getClassAttribs((CORINFO_CLASS_HANDLE)HandleType);
-      if ((Flags & CORINFO_FLG_FINAL) &&
+    case CORINFO_HELP_ISINSTANCEOFCLASS:
+    case CORINFO_HELP_CHKCASTANY:
+    case CORINFO_HELP_ISINSTANCEOFANY: {
+      uint32_t Flags = getClassAttribs(CastClass);
+      if (canInlineTypeCheckWithObjectVTable(CastClass) &&
           !(Flags & (CORINFO_FLG_MARSHAL_BYREF | CORINFO_FLG_CONTEXTFUL |
                      CORINFO_FLG_SHAREDINST))) {
-        Optimize = true;
+        CheckExactType = true;
+        IsSealed = ((Flags & CORINFO_FLG_FINAL) != 0) &&
+                   ((Flags & CORINFO_FLG_VALUECLASS) == 0);
       }
     } break;
 
@@ -8385,21 +9937,83 @@ IRNode *GenIR::castOp(CORINFO_RESOLVED_TOKEN *ResolvedToken, IRNode *ObjRefNode,
 
   // Generate the helper call or intrinsic
   const bool IsVolatile = false;
-  const bool DoesNotInvokeStaticCtor = Optimize;
-  return (IRNode *)callHelperImpl(HelperId, MayThrow, ResultType,
-                                  ClassHandleNode, ObjRefNode, nullptr, nullptr,
-                                  Reader_AlignUnknown, IsVolatile,
-                                  DoesNotInvokeStaticCtor)
-      .getInstruction();
+  const bool DoesNotInvokeStaticCtor = CheckExactType;
+  if (!CheckExactType) {
+    return (IRNode *)callHelperImpl(HelperId, MayThrow, ResultType,
+                                    ClassHandleNode, ObjRefNode, nullptr,
+                                    nullptr, Reader_AlignUnknown, IsVolatile,
+                                    DoesNotInvokeStaticCtor)
+        .getInstruction();
+  }
+
+  // Load the method table of a non-null object. A null object gets a zero
+  // method table, which matches no class.
+  Value *IsNotNull = LLVMBuilder->CreateIsNotNull(ObjRefNode, "CastNotNull");
+  BasicBlock *NullTestBlock = LLVMBuilder->GetInsertBlock();
+  BasicBlock *LoadBlock = createPointBlock("CastLoadMT");
+  IRBuilder<>::InsertPoint SavedInsertPoint = LLVMBuilder->saveIP();
+  LLVMBuilder->SetInsertPoint(LoadBlock);
+  const bool DstIsGCPtr = false;
+  const bool IsConst = true;
+  Value *LoadedMT = derefAddressNonNull(ObjRefNode, DstIsGCPtr, IsConst);
+  LLVMBuilder->restoreIP(SavedInsertPoint);
+  BasicBlock *MTBlock = insertConditionalPointBlock(IsNotNull, LoadBlock, true);
+  PHINode *MethodTable =
+      mergeConditionalResults(MTBlock, ConstantInt::get(LoadedMT->getType(), 0),
+                              NullTestBlock, LoadedMT, LoadBlock, "CastMT");
+
+  Value *Object = LLVMBuilder->CreatePointerCast(ObjRefNode, ResultType);
+  Value *IsExactType =
+      LLVMBuilder->CreateICmpEQ(MethodTable, ClassHandleNode, "CastExact");
+  Value *IsNull = LLVMBuilder->CreateNot(IsNotNull);
+  Value *Passes = LLVMBuilder->CreateOr(IsNull, IsExactType);
+
+  bool IsCastClass = (HelperId == CORINFO_HELP_CHKCASTCLASS_SPECIAL) ||
+                     (HelperId == CORINFO_HELP_CHKCASTANY);
+  if (IsSealed && !IsCastClass) {
+    // No other type is an instance of a sealed class.
+    Value *Null = Constant::getNullValue(ResultType);
+    return (IRNode *)LLVMBuilder->CreateSelect(Passes, Object, Null);
+  }
+
+  // Call the helper for objects of other types. For a sealed class, that
+  // only happens for castclass, which then throws.
+  Value *NeedsHelper = LLVMBuilder->CreateNot(Passes, "CastNeedsHelper");
+  BasicBlock *TestBlock = LLVMBuilder->GetInsertBlock();
+  BasicBlock *HelperBlock = createPointBlock("CastHelper");
+  SavedInsertPoint = LLVMBuilder->saveIP();
+  LLVMBuilder->SetInsertPoint(HelperBlock);
+  Value *HelperResult =
+      callHelperImpl(HelperId, MayThrow, ResultType, ClassHandleNode,
+                     ObjRefNode, nullptr, nullptr, Reader_AlignUnknown,
+                     IsVolatile, DoesNotInvokeStaticCtor)
+          .getInstruction();
+  // The helper call may have been an invoke, which ends the block.
+  BasicBlock *HelperExitBlock = LLVMBuilder->GetInsertBlock();
+  LLVMBuilder->restoreIP(SavedInsertPoint);
+  BasicBlock *JoinBlock =
+      insertConditionalPointBlock(NeedsHelper, HelperBlock, true);
+
+  if (IsSealed) {
+    BranchInst *Branch = cast<BranchInst>(TestBlock->getTerminator());
+    const uint32_t ThrowWeight = 1;
+    const uint32_t ContinueWeight = 1 << 20;
+    MDBuilder Builder(*JitContext->LLVMContext);
+    Branch->setMetadata(LLVMContext::MD_prof,
+                        Builder.createBranchWeights(ThrowWeight,
+                                                    ContinueWeight));
+  }
+
+  return (IRNode *)mergeConditionalResults(JoinBlock, Object, TestBlock,
+                                           HelperResult, HelperExitBlock,
+                                           "CastResult");
 }
 
 // Override the cast class optimization
 bool GenIR::disableCastClassOptimization() {
-  // TODO: We may want to enable cast class optimization unless it's disabled
-  // by some flags or we are generating debug code or it's causing problems
-  // downstream.
-
-  return true;
+  // Debuggable and tier 0 code call the helpers, which keeps them small.
+  return !JitContext->Options->EnableOptimization ||
+         (JitContext->Options->OptLevel == ::OptLevel::TIER0_CODE);
 }
 
 /// Optionally generate inline code for the \p abs opcode
@@ -8441,6 +10055,58 @@ bool GenIR::sqrt(IRNode *Argument, IRNode **Result) {
   return false;
 }
 
+bool GenIR::round(IRNode *Argument, IRNode **Result) {
+  Type *Ty = Argument->getType();
+
+  // System.Math.Round(double) rounds ties to even, as nearbyint does in the
+  // default rounding mode, without raising the inexact exception.
+  if (Ty->isFloatingPointTy()) {
+    Type *Types[] = {Ty};
+    Value *NearbyInt = Intrinsic::getDeclaration(JitContext->CurrentModule,
+                                                 Intrinsic::nearbyint, Types);
+    bool MayThrow = false;
+    Value *Round = makeCall(NearbyInt, MayThrow, Argument).getInstruction();
+    *Result = (IRNode *)Round;
+    return true;
+  }
+
+  return false;
+}
+
+bool GenIR::minMax(bool IsMax, bool IsUnsigned, IRNode *Arg1, IRNode *Arg2,
+                   IRNode **Result) {
+  Type *Ty = Arg1->getType();
+  if (Arg2->getType() != Ty) {
+    return false;
+  }
+
+  Value *Condition;
+  if (Ty->isIntegerTy()) {
+    CmpInst::Predicate Predicate;
+    if (IsMax) {
+      Predicate = IsUnsigned ? CmpInst::ICMP_UGT : CmpInst::ICMP_SGT;
+    } else {
+      Predicate = IsUnsigned ? CmpInst::ICMP_ULT : CmpInst::ICMP_SLT;
+    }
+    Condition = LLVMBuilder->CreateICmp(Predicate, Arg1, Arg2);
+  } else if (Ty->isFloatingPointTy()) {
+    // Match the managed implementation, which returns the first argument if
+    // it compares greater (or less), or if it is a NaN, and the second
+    // argument otherwise.
+    Value *Ordered = IsMax ? LLVMBuilder->CreateFCmpOGT(Arg1, Arg2)
+                           : LLVMBuilder->CreateFCmpOLT(Arg1, Arg2);
+    Value *IsNaN = LLVMBuilder->CreateFCmpUNO(Arg1, Arg1);
+    Condition = LLVMBuilder->CreateOr(Ordered, IsNaN);
+  } else {
+    // System.Math.Max(decimal, decimal) and the like.
+    return false;
+  }
+
+  *Result = (IRNode *)LLVMBuilder->CreateSelect(Condition, Arg1, Arg2,
+                                                IsMax ? "max" : "min");
+  return true;
+}
+
 IRNode *GenIR::localAlloc(IRNode *Arg, bool ZeroInit) {
   // We should have noticed this during the first pass.
   assert(HasLocAlloc && "need to detect localloc early");
@@ -9583,4 +11249,271 @@ IRNode *GenIR::vectorGetItem(IRNode *VectorPointer, IRNode *Index,
   return convertToStackType(Result, ResType);
 }
 
+IRNode *GenIR::vectorHorizontalAdd(IRNode *Vector) {
+  LLVMContext &Context = *JitContext->LLVMContext;
+  VectorType *Ty = cast<VectorType>(Vector->getType());
+  bool IsFloat = Ty->getElementType()->isFloatingPointTy();
+  unsigned Count = Ty->getNumElements();
+  Value *Sum = Vector;
+
+  // Fold the upper half onto the lower half while the count is even, so the
+  // reduction is log2(Count) vector adds rather than Count - 1 scalar ones.
+  while ((Count > 1) && ((Count % 2) == 0)) {
+    unsigned Half = Count / 2;
+    SmallVector<uint32_t, 16> LowMask;
+    SmallVector<uint32_t, 16> HighMask;
+    for (unsigned Counter = 0; Counter < Half; ++Counter) {
+      LowMask.push_back(Counter);
+      HighMask.push_back(Counter + Half);
+    }
+    Value *Undef = UndefValue::get(Sum->getType());
+    Value *Low = LLVMBuilder->CreateShuffleVector(
+        Sum, Undef, ConstantDataVector::get(Context, LowMask));
+    Value *High = LLVMBuilder->CreateShuffleVector(
+        Sum, Undef, ConstantDataVector::get(Context, HighMask));
+    Sum = IsFloat ? LLVMBuilder->CreateFAdd(Low, High)
+                  : LLVMBuilder->CreateAdd(Low, High);
+    Count = Half;
+  }
+
+  Value *Result = LLVMBuilder->CreateExtractElement(Sum, (uint64_t)0);
+  for (unsigned Counter = 1; Counter < Count; ++Counter) {
+    Value *Element = LLVMBuilder->CreateExtractElement(Sum, Counter);
+    Result = IsFloat ? LLVMBuilder->CreateFAdd(Result, Element)
+                     : LLVMBuilder->CreateAdd(Result, Element);
+  }
+  return (IRNode *)Result;
+}
+
+IRNode *GenIR::vectorNorm(IRNode *Vector, bool IsSquared,
+                          CorInfoType ResType) {
+  Type *ElementTy = Vector->getType()->getVectorElementType();
+  if (!ElementTy->isFloatingPointTy()) {
+    return 0;
+  }
+  IRNode *Result = vectorHorizontalAdd(vectorMul(Vector, Vector));
+  if (!IsSquared) {
+    Function *Sqrt = Intrinsic::getDeclaration(JitContext->CurrentModule,
+                                               Intrinsic::sqrt, ElementTy);
+    Result = (IRNode *)LLVMBuilder->CreateCall(Sqrt, Result);
+  }
+  return convertToStackType(Result, ResType);
+}
+
+IRNode *GenIR::vectorDot(IRNode *Vector1, IRNode *Vector2,
+                         CorInfoType ResType) {
+  if (Vector1->getType() != Vector2->getType()) {
+    return 0;
+  }
+  IRNode *Product = vectorMul(Vector1, Vector2);
+  if (!Product) {
+    return 0;
+  }
+  return convertToStackType(vectorHorizontalAdd(Product), ResType);
+}
+
+IRNode *GenIR::vectorDistance(IRNode *Vector1, IRNode *Vector2,
+                              bool IsSquared, CorInfoType ResType) {
+  if (Vector1->getType() != Vector2->getType()) {
+    return 0;
+  }
+  IRNode *Difference = vectorSub(Vector1, Vector2);
+  if (!Difference) {
+    return 0;
+  }
+  return vectorNorm(Difference, IsSquared, ResType);
+}
+
+IRNode *GenIR::vectorLength(IRNode *VectorPointer, bool IsSquared,
+                            CorInfoType ResType) {
+  Type *PointerTy = VectorPointer->getType();
+  if (!PointerTy->isPointerTy() ||
+      !PointerTy->getPointerElementType()->isVectorTy()) {
+    return 0; // For example Quaternion.Length.
+  }
+  IRNode *Vector = (IRNode *)LLVMBuilder->CreateLoad(VectorPointer);
+  return vectorNorm(Vector, IsSquared, ResType);
+}
+
+IRNode *GenIR::vectorConditionalSelect(IRNode *Mask, IRNode *Vector1,
+                                       IRNode *Vector2) {
+  Type *ResultType = Vector1->getType();
+  if ((Vector2->getType() != ResultType) ||
+      (Mask->getType()->getPrimitiveSizeInBits() !=
+       ResultType->getPrimitiveSizeInBits())) {
+    return 0;
+  }
+
+  // The float and double overloads take an integer mask, so do the select
+  // on the bits.
+  Type *VectorIntType = VectorType::getInteger(cast<VectorType>(ResultType));
+  Value *IntMask = LLVMBuilder->CreateBitCast(Mask, VectorIntType);
+  Value *Int1 = LLVMBuilder->CreateBitCast(Vector1, VectorIntType);
+  Value *Int2 = LLVMBuilder->CreateBitCast(Vector2, VectorIntType);
+  Value *Selected1 = LLVMBuilder->CreateAnd(IntMask, Int1);
+  Value *Selected2 =
+      LLVMBuilder->CreateAnd(LLVMBuilder->CreateNot(IntMask), Int2);
+  Value *Result = LLVMBuilder->CreateOr(Selected1, Selected2);
+  return (IRNode *)LLVMBuilder->CreateBitCast(Result, ResultType);
+}
+
+IRNode *GenIR::vectorConvert(IRNode *Vector, CORINFO_CLASS_HANDLE ResultClass,
+                             bool IsSigned) {
+  int VectorSize = 0;
+  bool IsGeneric = false;
+  bool IsResultSigned = false;
+  Type *ElementType = getBaseTypeAndSizeOfSIMDType(ResultClass, VectorSize,
+                                                   IsGeneric, IsResultSigned);
+  VectorType *SourceType = cast<VectorType>(Vector->getType());
+  if (!ElementType || ((int)SourceType->getNumElements() != VectorSize)) {
+    return 0;
+  }
+  Type *ResultType = VectorType::get(ElementType, VectorSize);
+  bool IsSourceFloat = SourceType->getElementType()->isFloatingPointTy();
+
+  if (!IsSourceFloat && ElementType->isFloatingPointTy()) {
+    if (IsSigned) {
+      return (IRNode *)LLVMBuilder->CreateSIToFP(Vector, ResultType);
+    }
+    return (IRNode *)LLVMBuilder->CreateUIToFP(Vector, ResultType);
+  }
+  if (IsSourceFloat && ElementType->isIntegerTy()) {
+    if (IsResultSigned) {
+      return (IRNode *)LLVMBuilder->CreateFPToSI(Vector, ResultType);
+    }
+    return (IRNode *)LLVMBuilder->CreateFPToUI(Vector, ResultType);
+  }
+  return 0;
+}
+
+IRNode *GenIR::vectorNarrow(IRNode *Vector1, IRNode *Vector2) {
+  LLVMContext &Context = *JitContext->LLVMContext;
+  VectorType *SourceType = cast<VectorType>(Vector1->getType());
+  if (Vector2->getType() != SourceType) {
+    return 0;
+  }
+  Type *ElementType = SourceType->getElementType();
+  unsigned Count = SourceType->getNumElements() * 2;
+  Type *NarrowType = nullptr;
+  if (ElementType->isDoubleTy()) {
+    NarrowType = Type::getFloatTy(Context);
+  } else if (ElementType->isIntegerTy() &&
+             (ElementType->getIntegerBitWidth() >= 16)) {
+    NarrowType =
+        Type::getIntNTy(Context, ElementType->getIntegerBitWidth() / 2);
+  } else {
+    return 0;
+  }
+
+  SmallVector<uint32_t, 32> Mask;
+  for (unsigned Counter = 0; Counter < Count; ++Counter) {
+    Mask.push_back(Counter);
+  }
+  Value *Both = LLVMBuilder->CreateShuffleVector(
+      Vector1, Vector2, ConstantDataVector::get(Context, Mask));
+  Type *ResultType = VectorType::get(NarrowType, Count);
+  if (NarrowType->isFloatingPointTy()) {
+    return (IRNode *)LLVMBuilder->CreateFPTrunc(Both, ResultType);
+  }
+  return (IRNode *)LLVMBuilder->CreateTrunc(Both, ResultType);
+}
+
+IRNode *GenIR::vectorWiden(IRNode *Vector, IRNode *LowPointer,
+                           IRNode *HighPointer, bool IsSigned) {
+  LLVMContext &Context = *JitContext->LLVMContext;
+  if (!LowPointer->getType()->isPointerTy() ||
+      !HighPointer->getType()->isPointerTy()) {
+    return 0;
+  }
+  VectorType *SourceType = cast<VectorType>(Vector->getType());
+  Type *ElementType = SourceType->getElementType();
+  unsigned Half = SourceType->getNumElements() / 2;
+  Type *WideType = nullptr;
+  if (ElementType->isFloatTy()) {
+    WideType = Type::getDoubleTy(Context);
+  } else if (ElementType->isIntegerTy() &&
+             (ElementType->getIntegerBitWidth() <= 32)) {
+    WideType = Type::getIntNTy(Context, ElementType->getIntegerBitWidth() * 2);
+  } else {
+    return 0;
+  }
+  Type *ResultType = VectorType::get(WideType, Half);
+  unsigned Alignment = WideType->getPrimitiveSizeInBits() / 8;
+
+  IRNode *Store = 0;
+  IRNode *Pointers[] = {LowPointer, HighPointer};
+  for (unsigned Part = 0; Part < 2; ++Part) {
+    SmallVector<uint32_t, 16> Mask;
+    for (unsigned Counter = 0; Counter < Half; ++Counter) {
+      Mask.push_back(Part * Half + Counter);
+    }
+    Value *Elements = LLVMBuilder->CreateShuffleVector(
+        Vector, UndefValue::get(SourceType),
+        ConstantDataVector::get(Context, Mask));
+    Value *Result;
+    if (WideType->isFloatingPointTy()) {
+      Result = LLVMBuilder->CreateFPExt(Elements, ResultType);
+    } else if (IsSigned) {
+      Result = LLVMBuilder->CreateSExt(Elements, ResultType);
+    } else {
+      Result = LLVMBuilder->CreateZExt(Elements, ResultType);
+    }
+
+    // The out arguments may be fields of heap objects, which only have the
+    // alignment of their elements.
+    IRNode *Pointer = Pointers[Part];
+    unsigned AddressSpace = Pointer->getType()->getPointerAddressSpace();
+    Value *Address = LLVMBuilder->CreatePointerCast(
+        Pointer, PointerType::get(ResultType, AddressSpace));
+    Store = (IRNode *)LLVMBuilder->CreateAlignedStore(Result, Address,
+                                                      Alignment);
+  }
+  return Store;
+}
+
+IRNode *GenIR::vectorCopyTo(IRNode *VectorPointer, IRNode *Array,
+                            IRNode *Index) {
+  Type *PointerTy = VectorPointer->getType();
+  if (!PointerTy->isPointerTy() ||
+      !PointerTy->getPointerElementType()->isVectorTy() ||
+      !Array->getType()->isPointerTy()) {
+    return 0;
+  }
+  VectorType *Ty = cast<VectorType>(PointerTy->getPointerElementType());
+  Type *ElementType = Ty->getElementType();
+  IRNode *Vector = (IRNode *)LLVMBuilder->CreateLoad(VectorPointer);
+  if (!Index) {
+    LLVMContext &Context = *JitContext->LLVMContext;
+    Index = (IRNode *)ConstantInt::get(Type::getInt32Ty(Context), 0);
+  }
+
+  // Check the whole destination before storing anything, so that a copy
+  // that does not fit leaves the array unchanged, and then store the whole
+  // vector at once. Loading the length throws NullReferenceException for a
+  // null array, as CopyTo does too. The EE has no helpers that throw the
+  // ArgumentException types the managed CopyTo uses, so a bad index or a
+  // copy that does not fit throws IndexOutOfRangeException, as an element
+  // by element copy would.
+  IRNode *ArrayLength = loadLen(Array);
+  Type *LengthTy = ArrayLength->getType();
+  const bool IsSigned = false;
+  Value *StartIndex = LLVMBuilder->CreateIntCast(Index, LengthTy, IsSigned);
+  // The unsigned compare also catches negative indices.
+  Value *IsOutOfRange =
+      LLVMBuilder->CreateICmpUGE(StartIndex, ArrayLength, "CopyToRange");
+  genConditionalThrow(IsOutOfRange, CORINFO_HELP_RNGCHKFAIL,
+                      "ThrowIndexOutOfRange");
+  Value *Room = LLVMBuilder->CreateSub(ArrayLength, StartIndex);
+  Value *DoesNotFit = LLVMBuilder->CreateICmpULT(
+      Room, ConstantInt::get(LengthTy, Ty->getNumElements()), "CopyToFit");
+  genConditionalThrow(DoesNotFit, CORINFO_HELP_RNGCHKFAIL,
+                      "ThrowIndexOutOfRange");
+  IRNode *Address = getArrayElemAddress(Array, Index, ElementType);
+  unsigned AddressSpace = Address->getType()->getPointerAddressSpace();
+  Value *VectorAddress = LLVMBuilder->CreatePointerCast(
+      Address, PointerType::get(Ty, AddressSpace));
+  return (IRNode *)LLVMBuilder->CreateAlignedStore(
+      Vector, VectorAddress, ElementType->getPrimitiveSizeInBits() / 8);
+}
+
 #pragma endregion
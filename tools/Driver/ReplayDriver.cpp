@@ -0,0 +1,380 @@
+//===---- tools/Driver/ReplayDriver.cpp -------------------------*- C++ -*-===//
+//
+// LLILC
+//
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license.
+// See LICENSE file in the project root for full license information.
+//
+//===----------------------------------------------------------------------===//
+///
+/// \file
+/// \brief Offline compile throughput benchmark for LLILC.
+///
+/// llilc-replay loads a build of the jit, and compiles the methods in one or
+/// more files of replay records (see COMPlus_AltJitReplayRecord) with it,
+/// without a runtime in the process. It reports the methods compiled per
+/// second, the time spent in each compile phase and the peak of the heap,
+/// for each of the thread counts it is asked to use.
+///
+/// Because the records fix the input, running the tool with two builds of
+/// the jit on the same records is a reproducible measure of a change's
+/// effect on compile time.
+///
+//===----------------------------------------------------------------------===//
+
+#include "CompileReplay.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace llvm;
+
+static cl::list<std::string> RecordFiles(cl::Positional, cl::OneOrMore,
+                                         cl::desc("<replay record files>"));
+
+static cl::opt<std::string>
+    JitPath("jit", cl::Required,
+            cl::desc("Path of the LLILC jit library to replay with"),
+            cl::value_desc("path"));
+
+static cl::list<unsigned>
+    ThreadCounts("threads", cl::CommaSeparated,
+                 cl::desc("Numbers of threads to replay with, in turn "
+                          "(default 1)"),
+                 cl::value_desc("n,..."));
+
+static cl::opt<unsigned>
+    Iterations("iterations", cl::init(1),
+               cl::desc("Times to compile each method per measurement"),
+               cl::value_desc("n"));
+
+static cl::opt<unsigned> WarmupIterations(
+    "warmup", cl::init(1),
+    cl::desc("Times to compile each method before measuring, so that the "
+             "jit's per-thread caches are filled"),
+    cl::value_desc("n"));
+
+namespace {
+
+/// A record in one of the loaded files.
+struct ReplayRecord {
+  const char *Data; ///< Start of the record.
+  size_t Size;      ///< Bytes of the record.
+};
+
+/// The totals of one measurement.
+struct ReplayTotals {
+  uint64_t NumCompiled = 0; ///< Methods compiled.
+  uint64_t NumFailed = 0;   ///< Methods that could not be compiled.
+  uint64_t ObjectBytes = 0; ///< Bytes of object files emitted.
+  uint32_t NumPhases = 0;   ///< Phases the jit reported.
+  const char *PhaseNames[LLILCReplayMaxPhases] = {}; ///< Their names.
+  uint64_t PhaseMicroseconds[LLILCReplayMaxPhases] = {}; ///< Their times.
+
+  /// Add the outcome of one compile.
+  void add(bool IsCompiled, const LLILCReplayResult &Result) {
+    if (!IsCompiled) {
+      ++NumFailed;
+      return;
+    }
+    ++NumCompiled;
+    ObjectBytes += Result.ObjectSize;
+    NumPhases = std::min(Result.NumPhases, LLILCReplayMaxPhases);
+    for (uint32_t I = 0; I < NumPhases; ++I) {
+      PhaseNames[I] = Result.PhaseNames[I];
+      PhaseMicroseconds[I] += Result.PhaseMicroseconds[I];
+    }
+  }
+
+  /// Add the totals of another thread.
+  void add(const ReplayTotals &Other) {
+    NumCompiled += Other.NumCompiled;
+    NumFailed += Other.NumFailed;
+    ObjectBytes += Other.ObjectBytes;
+    if (Other.NumPhases != 0) {
+      NumPhases = Other.NumPhases;
+      for (uint32_t I = 0; I < NumPhases; ++I) {
+        PhaseNames[I] = Other.PhaseNames[I];
+        PhaseMicroseconds[I] += Other.PhaseMicroseconds[I];
+      }
+    }
+  }
+};
+
+/// The outcome of a measurement.
+struct ReplayMeasurement {
+  ReplayTotals Totals;   ///< What was compiled, and the phase times.
+  double Seconds = 0;    ///< Wall time of the measured compiles.
+  uint64_t PeakHeap = 0; ///< Largest heap size seen, in bytes.
+};
+
+/// \brief Samples the size of the heap while a measurement runs.
+///
+/// The jit frees most of what it allocates for a method when the method is
+/// done, so the peak is sampled from a thread of its own rather than read
+/// between methods.
+class HeapSampler {
+public:
+  HeapSampler() : Peak(sys::Process::GetMallocUsage()), IsDone(false) {
+    Sampler = std::thread([this]() {
+      std::unique_lock<std::mutex> Guard(Lock);
+      while (!IsDone) {
+        Peak = std::max(Peak, (uint64_t)sys::Process::GetMallocUsage());
+        Done.wait_for(Guard, std::chrono::milliseconds(1));
+      }
+    });
+  }
+
+  /// Stop sampling.
+  /// \returns The largest heap size seen, in bytes.
+  uint64_t finish() {
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
+      IsDone = true;
+    }
+    Done.notify_one();
+    Sampler.join();
+    return std::max(Peak, (uint64_t)sys::Process::GetMallocUsage());
+  }
+
+private:
+  uint64_t Peak;
+  bool IsDone;
+  std::mutex Lock;
+  std::condition_variable Done;
+  std::thread Sampler;
+};
+
+} // end anonymous namespace
+
+/// \brief Split a replay file into its records.
+///
+/// \param Path    Name of the file, for diagnostics.
+/// \param Buffer  Contents of the file.
+/// \param Records Where to add the records.
+/// \returns true if the file is a well formed replay file.
+static bool splitRecords(StringRef Path, const MemoryBuffer &Buffer,
+                         std::vector<ReplayRecord> &Records) {
+  const size_t FileHeaderSize =
+      sizeof(LLILCReplayMagic) + sizeof(LLILCReplayVersion);
+  StringRef Contents = Buffer.getBuffer();
+  uint32_t Version;
+  if ((Contents.size() < FileHeaderSize) ||
+      (memcmp(Contents.data(), LLILCReplayMagic, sizeof(LLILCReplayMagic)) !=
+       0)) {
+    errs() << Path << ": not a replay record file\n";
+    return false;
+  }
+  memcpy(&Version, Contents.data() + sizeof(LLILCReplayMagic),
+         sizeof(Version));
+  if (Version != LLILCReplayVersion) {
+    errs() << Path << ": replay record version " << Version
+           << " is not supported\n";
+    return false;
+  }
+
+  size_t Offset = FileHeaderSize;
+  while (Offset < Contents.size()) {
+    LLILCReplayRecordHeader Header;
+    if (Contents.size() - Offset < sizeof(Header)) {
+      errs() << Path << ": truncated record at offset " << Offset << '\n';
+      return false;
+    }
+    memcpy(&Header, Contents.data() + Offset, sizeof(Header));
+    if ((Header.RecordSize < sizeof(Header)) ||
+        (Header.RecordSize > Contents.size() - Offset)) {
+      errs() << Path << ": bad record size at offset " << Offset << '\n';
+      return false;
+    }
+    Records.push_back({Contents.data() + Offset, Header.RecordSize});
+    Offset += Header.RecordSize;
+  }
+  return true;
+}
+
+/// \brief Compile every record on \p NumThreads threads, first
+/// \p NumWarmups times without measuring and then \p NumIterations times
+/// measured.
+///
+/// The same threads warm up and are measured, since the jit's caches are per
+/// thread. The threads take the next compile from a shared counter, so a
+/// slow method does not hold up the others.
+static ReplayMeasurement replay(LLILCReplayMethodFn ReplayMethod,
+                                const std::vector<ReplayRecord> &Records,
+                                unsigned NumThreads, unsigned NumWarmups,
+                                unsigned NumIterations) {
+  const uint64_t NumWarmupCompiles = (uint64_t)Records.size() * NumWarmups;
+  const uint64_t NumCompiles = (uint64_t)Records.size() * NumIterations;
+  std::atomic<uint64_t> NextWarmupCompile(0);
+  std::atomic<uint64_t> NextCompile(0);
+  std::mutex Lock;
+  std::condition_variable Changed;
+  unsigned NumReady = 0;
+  bool IsStarted = false;
+
+  std::vector<ReplayTotals> ThreadTotals(NumThreads);
+  std::vector<std::thread> Threads;
+  for (unsigned T = 0; T < NumThreads; ++T) {
+    Threads.emplace_back([&, T]() {
+      LLILCReplayResult Result;
+      for (uint64_t I = NextWarmupCompile++; I < NumWarmupCompiles;
+           I = NextWarmupCompile++) {
+        const ReplayRecord &Record = Records[I % Records.size()];
+        ReplayMethod(Record.Data, Record.Size, &Result);
+      }
+
+      // Wait for the other threads to finish warming up.
+      {
+        std::unique_lock<std::mutex> Guard(Lock);
+        ++NumReady;
+        Changed.notify_all();
+        Changed.wait(Guard, [&]() { return IsStarted; });
+      }
+
+      for (uint64_t I = NextCompile++; I < NumCompiles; I = NextCompile++) {
+        const ReplayRecord &Record = Records[I % Records.size()];
+        bool IsCompiled =
+            ReplayMethod(Record.Data, Record.Size, &Result) != 0;
+        ThreadTotals[T].add(IsCompiled, Result);
+      }
+    });
+  }
+
+  {
+    std::unique_lock<std::mutex> Guard(Lock);
+    Changed.wait(Guard, [&]() { return NumReady == NumThreads; });
+  }
+
+  ReplayMeasurement Measurement;
+  HeapSampler Sampler;
+  auto Start = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+    IsStarted = true;
+  }
+  Changed.notify_all();
+  for (unsigned T = 0; T < NumThreads; ++T) {
+    Threads[T].join();
+    Measurement.Totals.add(ThreadTotals[T]);
+  }
+  Measurement.Seconds = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - Start)
+                            .count();
+  Measurement.PeakHeap = Sampler.finish();
+  return Measurement;
+}
+
+/// Print the outcome of a measurement.
+static void printReport(raw_ostream &OS, unsigned NumThreads,
+                        const ReplayTotals &Totals, double Seconds,
+                        uint64_t PeakHeapBytes, double BaseRate) {
+  double Rate = (Seconds > 0) ? Totals.NumCompiled / Seconds : 0;
+  OS << "threads: " << NumThreads << '\n';
+  OS << "  methods compiled:  " << Totals.NumCompiled << " ("
+     << Totals.NumFailed << " failed)\n";
+  OS << "  wall time:         " << format("%.3f s", Seconds) << '\n';
+  OS << "  methods/sec:       " << format("%.1f", Rate);
+  if (BaseRate > 0) {
+    OS << format(" (%.2fx)", Rate / BaseRate);
+  }
+  OS << '\n';
+  OS << "  object bytes:      " << Totals.ObjectBytes << '\n';
+  OS << "  peak heap:         "
+     << format("%.1f MB", PeakHeapBytes / (1024.0 * 1024.0)) << '\n';
+
+  uint64_t TotalMicroseconds = 0;
+  for (uint32_t I = 0; I < Totals.NumPhases; ++I) {
+    TotalMicroseconds += Totals.PhaseMicroseconds[I];
+  }
+  OS << "  compile time by phase (summed over threads):\n";
+  for (uint32_t I = 0; I < Totals.NumPhases; ++I) {
+    uint64_t Microseconds = Totals.PhaseMicroseconds[I];
+    double Percent = (TotalMicroseconds != 0)
+                         ? 100.0 * Microseconds / TotalMicroseconds
+                         : 0.0;
+    OS << format("    %-16s %12.3f ms %6.2f%%\n", Totals.PhaseNames[I],
+                 Microseconds / 1000.0, Percent);
+  }
+  OS << format("    %-16s %12.3f ms\n", (const char *)"total",
+               TotalMicroseconds / 1000.0);
+}
+
+int main(int argc, char **argv) {
+  cl::ParseCommandLineOptions(argc, argv, "LLILC compile replay benchmark\n");
+
+  std::vector<std::unique_ptr<MemoryBuffer>> Buffers;
+  std::vector<ReplayRecord> Records;
+  for (const std::string &Path : RecordFiles) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer =
+        MemoryBuffer::getFile(Path, -1, /*RequiresNullTerminator=*/false);
+    if (!Buffer) {
+      errs() << Path << ": " << Buffer.getError().message() << '\n';
+      return 1;
+    }
+    if (!splitRecords(Path, **Buffer, Records)) {
+      return 1;
+    }
+    Buffers.push_back(std::move(*Buffer));
+  }
+  if (Records.empty()) {
+    errs() << "no records to replay\n";
+    return 1;
+  }
+
+  std::string Error;
+  sys::DynamicLibrary Jit =
+      sys::DynamicLibrary::getPermanentLibrary(JitPath.c_str(), &Error);
+  if (!Jit.isValid()) {
+    errs() << JitPath << ": " << Error << '\n';
+    return 1;
+  }
+  typedef void *(*GetJitFn)();
+  GetJitFn GetJit = (GetJitFn)Jit.getAddressOfSymbol("getJit");
+  LLILCReplayMethodFn ReplayMethod =
+      (LLILCReplayMethodFn)Jit.getAddressOfSymbol("replayMethod");
+  if ((GetJit == nullptr) || (ReplayMethod == nullptr)) {
+    errs() << JitPath << ": not a jit that can replay records\n";
+    return 1;
+  }
+  // The jit expects to be set up before it is used on several threads.
+  GetJit();
+
+  if (ThreadCounts.empty()) {
+    ThreadCounts.push_back(1);
+  }
+
+  outs() << "records: " << Records.size() << ", iterations: " << Iterations
+         << '\n';
+  bool HasFailures = false;
+  double BaseRate = 0;
+  for (unsigned NumThreads : ThreadCounts) {
+    NumThreads = std::max(NumThreads, 1u);
+
+    ReplayMeasurement Measurement = replay(
+        ReplayMethod, Records, NumThreads, WarmupIterations, Iterations);
+    const ReplayTotals &Totals = Measurement.Totals;
+    printReport(outs(), NumThreads, Totals, Measurement.Seconds,
+                Measurement.PeakHeap, BaseRate);
+    if ((BaseRate == 0) && (Measurement.Seconds > 0)) {
+      BaseRate = Totals.NumCompiled / Measurement.Seconds;
+    }
+    HasFailures |= (Totals.NumFailed != 0);
+  }
+
+  return HasFailures ? 1 : 0;
+}